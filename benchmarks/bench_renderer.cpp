@@ -0,0 +1,298 @@
+// Renderer benchmark: renders the synthetic corpus at every quality preset,
+// as thumbnails, as tiles and banded into PNG, and prints throughput,
+// latency percentiles and the per-phase split as JSON.
+//
+//   pdfeditor_bench [--iterations N] [--warmup N] [--warm] [--output FILE]
+//
+// By default the display list cache is off so every render interprets the
+// page; --warm keeps it, measuring replay only.
+
+#include "pdfeditor/core.h"
+#include "pdfeditor/document.h"
+#include "pdfeditor/renderer.h"
+#include "synthetic_corpus.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace pdfeditor;
+
+namespace {
+    struct Settings {
+        int iterations = 10;
+        int warmup = 1;
+        bool warm = false;
+        std::string output;
+    };
+    
+    // One benchmark case: a list of operations, each timed as one sample
+    struct CaseResult {
+        std::string name;
+        std::string variant;
+        float dpi = 0;
+        std::vector<double> samples_ms;
+        Renderer::RenderTimings phases;
+        int failures = 0;
+    };
+    
+    using Operation = std::function<bool()>;
+    
+    // Nearest-rank percentile of sorted samples
+    double percentile(const std::vector<double>& sorted, double p) {
+        if (sorted.empty()) return 0;
+        size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+        return sorted[std::max<size_t>(rank, 1) - 1];
+    }
+    
+    CaseResult run(
+        Renderer& renderer,
+        const Settings& settings,
+        const std::string& name,
+        const std::string& variant,
+        float dpi,
+        const std::vector<Operation>& operations
+    ) {
+        CaseResult result;
+        result.name = name;
+        result.variant = variant;
+        result.dpi = dpi;
+        
+        for (int i = 0; i < settings.warmup; ++i) {
+            for (const Operation& op : operations) {
+                op();
+            }
+        }
+        
+        renderer.reset_render_timings();
+        for (int i = 0; i < settings.iterations; ++i) {
+            for (const Operation& op : operations) {
+                auto start = std::chrono::steady_clock::now();
+                bool ok = op();
+                std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+                
+                result.samples_ms.push_back(elapsed.count());
+                if (!ok) {
+                    ++result.failures;
+                }
+            }
+        }
+        result.phases = renderer.get_render_timings();
+        
+        std::cerr << name << (variant.empty() ? "" : " " + variant) << ": "
+                  << result.samples_ms.size() << " samples\n";
+        return result;
+    }
+    
+    std::string json_string(const std::string& text) {
+        std::string out = "\"";
+        for (char c : text) {
+            if (c == '"' || c == '\\') out += '\\';
+            out += c;
+        }
+        return out + "\"";
+    }
+    
+    std::string json_number(double value) {
+        char text[32];
+        std::snprintf(text, sizeof(text), "%.4f", value);
+        return text;
+    }
+    
+    std::string to_json(
+        const Settings& settings,
+        const bench::SyntheticCorpus& corpus,
+        const std::vector<CaseResult>& results
+    ) {
+        std::ostringstream out;
+        out << "{\n"
+            << "  \"library_version\": " << json_string(Library::get_version()) << ",\n"
+            << "  \"iterations\": " << settings.iterations << ",\n"
+            << "  \"warmup\": " << settings.warmup << ",\n"
+            << "  \"display_list_cache\": " << (settings.warm ? "true" : "false") << ",\n"
+            << "  \"corpus\": [\n";
+        
+        for (size_t i = 0; i < corpus.pages.size(); ++i) {
+            out << "    {\"name\": " << json_string(corpus.pages[i].name)
+                << ", \"description\": " << json_string(corpus.pages[i].description) << "}"
+                << (i + 1 < corpus.pages.size() ? "," : "") << "\n";
+        }
+        out << "  ],\n  \"results\": [\n";
+        
+        for (size_t i = 0; i < results.size(); ++i) {
+            const CaseResult& r = results[i];
+            std::vector<double> sorted = r.samples_ms;
+            std::sort(sorted.begin(), sorted.end());
+            
+            double total = 0;
+            for (double ms : sorted) total += ms;
+            const double count = std::max<double>(sorted.size(), 1);
+            
+            out << "    {\n"
+                << "      \"name\": " << json_string(r.name) << ",\n"
+                << "      \"variant\": " << json_string(r.variant) << ",\n"
+                << "      \"dpi\": " << json_number(r.dpi) << ",\n"
+                << "      \"samples\": " << sorted.size() << ",\n"
+                << "      \"failures\": " << r.failures << ",\n"
+                << "      \"ops_per_sec\": " << json_number(total > 0 ? sorted.size() * 1000.0 / total : 0) << ",\n"
+                << "      \"latency_ms\": {"
+                << "\"mean\": " << json_number(total / count)
+                << ", \"min\": " << json_number(sorted.empty() ? 0 : sorted.front())
+                << ", \"p50\": " << json_number(percentile(sorted, 50))
+                << ", \"p99\": " << json_number(percentile(sorted, 99))
+                << ", \"max\": " << json_number(sorted.empty() ? 0 : sorted.back()) << "},\n"
+                << "      \"phase_ms\": {"
+                << "\"interpret\": " << json_number(r.phases.interpret_ms / count)
+                << ", \"rasterize\": " << json_number(r.phases.rasterize_ms / count)
+                << ", \"copy\": " << json_number(r.phases.copy_ms / count)
+                << ", \"encode\": " << json_number(r.phases.encode_ms / count) << "}\n"
+                << "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+        return out.str();
+    }
+    
+    bool parse_args(int argc, char* argv[], Settings& settings) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            bool has_value = i + 1 < argc;
+            
+            if (arg == "--iterations" && has_value) {
+                settings.iterations = std::max(1, std::atoi(argv[++i]));
+            } else if (arg == "--warmup" && has_value) {
+                settings.warmup = std::max(0, std::atoi(argv[++i]));
+            } else if (arg == "--warm") {
+                settings.warm = true;
+            } else if (arg == "--output" && has_value) {
+                settings.output = argv[++i];
+            } else {
+                std::cerr << "Usage: pdfeditor_bench [--iterations N] [--warmup N] [--warm] [--output FILE]\n";
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Settings settings;
+    if (!parse_args(argc, argv, settings)) {
+        return 2;
+    }
+    
+    if (!Library::initialize()) {
+        std::cerr << "Failed to initialize library: " << Library::get_last_error() << "\n";
+        return 1;
+    }
+    
+    // The document reads from the corpus bytes, so they must outlive it
+    const bench::SyntheticCorpus corpus = bench::build_synthetic_corpus();
+    auto opened = Document::open_from_memory(corpus.pdf.data(), corpus.pdf.size());
+    if (!opened.is_ok()) {
+        std::cerr << "Failed to open corpus: " << opened.error_message() << "\n";
+        return 1;
+    }
+    std::unique_ptr<Document> doc = std::move(opened.value());
+    std::vector<Page*> pages = doc->get_pages();
+    
+    // Measure rendering, not the render caches
+    Renderer renderer;
+    renderer.set_cache_enabled(false);
+    renderer.set_thread_count(1);
+    if (!settings.warm) {
+        renderer.set_display_list_cache_size(0);
+    }
+    
+    std::vector<CaseResult> results;
+    
+    const std::pair<RenderQuality, const char*> qualities[] = {
+        { RenderQuality::Draft, "Draft" },
+        { RenderQuality::Low, "Low" },
+        { RenderQuality::Medium, "Medium" },
+        { RenderQuality::High, "High" },
+        { RenderQuality::VeryHigh, "VeryHigh" },
+    };
+    
+    for (const auto& quality : qualities) {
+        RenderOptions options;
+        options.dpi = static_cast<float>(quality.first);
+        
+        std::vector<Operation> ops;
+        for (Page* page : pages) {
+            ops.push_back([&renderer, page, options] {
+                return renderer.render_page(page, options).is_ok();
+            });
+        }
+        results.push_back(run(renderer, settings, "render_page", quality.second, options.dpi, ops));
+    }
+    
+    {
+        std::vector<Operation> ops;
+        for (Page* page : pages) {
+            ops.push_back([&renderer, page] {
+                return renderer.render_thumbnail(page, 160, 160).is_ok();
+            });
+        }
+        results.push_back(run(renderer, settings, "render_thumbnail", "160x160", 0, ops));
+    }
+    
+    {
+        // Every 256x256 tile of every page at print resolution
+        RenderOptions options;
+        options.dpi = static_cast<float>(RenderQuality::High);
+        
+        std::vector<Operation> ops;
+        for (Page* page : pages) {
+            for (const Renderer::TileInfo& tile : renderer.calculate_tiles(page, 256, 256, options)) {
+                ops.push_back([&renderer, page, tile, options] {
+                    return renderer.render_tile(page, tile, options).is_ok();
+                });
+            }
+        }
+        results.push_back(run(renderer, settings, "render_tile", "256x256", options.dpi, ops));
+    }
+    
+    {
+        // Banded into a PNG file: the only case with an encode phase
+        RenderOptions options;
+        options.dpi = static_cast<float>(RenderQuality::Medium);
+        const std::string path =
+            (std::filesystem::temp_directory_path() / "pdfeditor_bench.png").string();
+        
+        std::vector<Operation> ops;
+        for (Page* page : pages) {
+            ops.push_back([&renderer, page, options, path] {
+                PngSink sink(path);
+                return renderer.render_page_banded(page, sink, options);
+            });
+        }
+        results.push_back(run(renderer, settings, "render_page_banded", "png", options.dpi, ops));
+        
+        std::error_code ignored;
+        std::filesystem::remove(path, ignored);
+    }
+    
+    const std::string json = to_json(settings, corpus, results);
+    if (settings.output.empty()) {
+        std::cout << json;
+    } else {
+        std::ofstream file(settings.output);
+        file << json;
+        if (!file) {
+            std::cerr << "Failed to write " << settings.output << "\n";
+            return 1;
+        }
+    }
+    
+    doc.reset();
+    Library::shutdown();
+    return 0;
+}
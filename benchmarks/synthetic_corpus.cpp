@@ -0,0 +1,276 @@
+#include "synthetic_corpus.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace pdfeditor {
+namespace bench {
+
+namespace {
+    constexpr double PAGE_WIDTH = 612;
+    constexpr double PAGE_HEIGHT = 792;
+    constexpr int IMAGE_SIZE = 1024;
+    
+    // Small LCG: the corpus must not depend on the standard library's
+    // random engines, whose output may differ between implementations
+    class Random {
+    public:
+        explicit Random(uint32_t seed) : state_(seed ? seed : 1) {}
+        
+        uint32_t next() {
+            state_ = state_ * 1664525u + 1013904223u;
+            return state_ >> 8;
+        }
+        
+        // Uniform in [lo, hi)
+        double uniform(double lo, double hi) {
+            return lo + (hi - lo) * (next() / 16777216.0);
+        }
+        
+        int below(int n) {
+            return static_cast<int>(next() % static_cast<uint32_t>(n));
+        }
+    
+    private:
+        uint32_t state_;
+    };
+    
+    std::string num(double value) {
+        char text[32];
+        std::snprintf(text, sizeof(text), "%.2f", value);
+        return text;
+    }
+    
+    std::string color(Random& random) {
+        return num(random.uniform(0, 1)) + " " + num(random.uniform(0, 1)) + " " +
+               num(random.uniform(0, 1));
+    }
+    
+    // Writes numbered objects and the cross-reference table
+    class PdfBuilder {
+    public:
+        int reserve() {
+            objects_.emplace_back();
+            return static_cast<int>(objects_.size());
+        }
+        
+        void set(int id, const std::string& body) {
+            objects_[id - 1] = body;
+        }
+        
+        void set_stream(int id, const std::string& dict, const std::string& data) {
+            objects_[id - 1] = "<< " + dict + " /Length " + std::to_string(data.size()) +
+                               " >>\nstream\n" + data + "\nendstream";
+        }
+        
+        std::vector<uint8_t> finish(int root) const {
+            std::string out = "%PDF-1.7\n%\xE2\xE3\xCF\xD3\n";
+            std::vector<size_t> offsets;
+            
+            for (size_t i = 0; i < objects_.size(); ++i) {
+                offsets.push_back(out.size());
+                out += std::to_string(i + 1) + " 0 obj\n" + objects_[i] + "\nendobj\n";
+            }
+            
+            const size_t xref = out.size();
+            out += "xref\n0 " + std::to_string(objects_.size() + 1) + "\n";
+            out += "0000000000 65535 f \n";
+            for (size_t offset : offsets) {
+                char entry[24];
+                std::snprintf(entry, sizeof(entry), "%010zu 00000 n \n", offset);
+                out += entry;
+            }
+            out += "trailer\n<< /Size " + std::to_string(objects_.size() + 1) +
+                   " /Root " + std::to_string(root) + " 0 R >>\n";
+            out += "startxref\n" + std::to_string(xref) + "\n%%EOF\n";
+            
+            return std::vector<uint8_t>(out.begin(), out.end());
+        }
+    
+    private:
+        std::vector<std::string> objects_;
+    };
+    
+    std::string word(Random& random) {
+        std::string text;
+        const int length = 2 + random.below(9);
+        for (int i = 0; i < length; ++i) {
+            text += static_cast<char>('a' + random.below(26));
+        }
+        return text;
+    }
+    
+    // Lines of text in one column, switching font now and then
+    std::string text_block(Random& random, double x, double top, double width, int lines, double size) {
+        static const char* const fonts[] = { "/F1", "/F2", "/F3" };
+        const double leading = size * 1.2;
+        const int chars_per_line = static_cast<int>(width / (size * 0.5));
+        
+        std::string ops = "BT\n" + std::string(fonts[0]) + " " + num(size) + " Tf\n" +
+                          num(leading) + " TL\n" + num(x) + " " + num(top) + " Td\n";
+        for (int line = 0; line < lines; ++line) {
+            if (random.below(8) == 0) {
+                ops += std::string(fonts[random.below(3)]) + " " + num(size) + " Tf\n";
+            }
+            
+            std::string text;
+            while (static_cast<int>(text.size()) < chars_per_line - 10) {
+                text += word(random) + " ";
+            }
+            ops += "(" + text + ") Tj T*\n";
+        }
+        return ops + "ET\n";
+    }
+    
+    // Rectangles, curves and strokes, a fifth of them semi-transparent
+    std::string shapes(Random& random, int count, double x0, double y0, double x1, double y1) {
+        std::string ops;
+        for (int i = 0; i < count; ++i) {
+            ops += "q\n";
+            if (i % 5 == 0) {
+                ops += "/GS1 gs\n";
+            }
+            
+            const double x = random.uniform(x0, x1);
+            const double y = random.uniform(y0, y1);
+            const double w = random.uniform(4, 80);
+            const double h = random.uniform(4, 80);
+            
+            switch (random.below(3)) {
+                case 0:
+                    ops += color(random) + " rg\n" + num(x) + " " + num(y) + " " +
+                           num(w) + " " + num(h) + " re f\n";
+                    break;
+                case 1:
+                    ops += color(random) + " rg\n" + color(random) + " RG\n" +
+                           num(random.uniform(0.5, 3)) + " w\n" +
+                           num(x) + " " + num(y) + " m\n" +
+                           num(x + w) + " " + num(y + h) + " " +
+                           num(x - w) + " " + num(y + 2 * h) + " " +
+                           num(x + w / 2) + " " + num(y - h) + " c\n" +
+                           num(x + 2 * w) + " " + num(y) + " " +
+                           num(x) + " " + num(y - h) + " " +
+                           num(x) + " " + num(y) + " c\nb\n";
+                    break;
+                default:
+                    ops += color(random) + " RG\n" + num(random.uniform(0.2, 6)) + " w\n" +
+                           "1 J\n" + num(x) + " " + num(y) + " m\n";
+                    for (int j = 0; j < 6; ++j) {
+                        ops += num(random.uniform(x0, x1)) + " " + num(random.uniform(y0, y1)) + " l\n";
+                    }
+                    ops += "S\n";
+                    break;
+            }
+            ops += "Q\n";
+        }
+        return ops;
+    }
+    
+    // Smooth gradients with noise and rings: hard to compress and shows up
+    // resampling artifacts
+    std::string image_samples(Random& random) {
+        std::string data(static_cast<size_t>(IMAGE_SIZE) * IMAGE_SIZE * 3, '\0');
+        const double center = IMAGE_SIZE / 2.0;
+        
+        for (int y = 0; y < IMAGE_SIZE; ++y) {
+            for (int x = 0; x < IMAGE_SIZE; ++x) {
+                const double r = std::hypot(x - center, y - center);
+                const int ring = (static_cast<int>(r) / 16) % 2 ? 40 : 0;
+                const int noise = random.below(24);
+                
+                char* pixel = &data[(static_cast<size_t>(y) * IMAGE_SIZE + x) * 3];
+                pixel[0] = static_cast<char>(std::min(255, x * 255 / IMAGE_SIZE / 2 + ring + noise));
+                pixel[1] = static_cast<char>(std::min(255, y * 255 / IMAGE_SIZE / 2 + ring + noise));
+                pixel[2] = static_cast<char>(std::min(255, 128 + ring + noise));
+            }
+        }
+        return data;
+    }
+    
+    // An image drawn at rect, rotated by angle degrees about its center
+    std::string place_image(double x, double y, double w, double h, double angle) {
+        const double a = angle * 3.14159265358979 / 180;
+        const double c = std::cos(a);
+        const double s = std::sin(a);
+        return "q\n1 0 0 1 " + num(x + w / 2) + " " + num(y + h / 2) + " cm\n" +
+               num(c) + " " + num(s) + " " + num(-s) + " " + num(c) + " 0 0 cm\n" +
+               num(w) + " 0 0 " + num(h) + " " + num(-w / 2) + " " + num(-h / 2) + " cm\n" +
+               "/Im1 Do\nQ\n";
+    }
+}
+
+SyntheticCorpus build_synthetic_corpus(uint32_t seed) {
+    Random random(seed);
+    PdfBuilder pdf;
+    SyntheticCorpus corpus;
+    
+    const int catalog = pdf.reserve();
+    const int pages = pdf.reserve();
+    const int helvetica = pdf.reserve();
+    const int times = pdf.reserve();
+    const int courier = pdf.reserve();
+    const int alpha = pdf.reserve();
+    const int image = pdf.reserve();
+    const int shading = pdf.reserve();
+    
+    pdf.set(catalog, "<< /Type /Catalog /Pages " + std::to_string(pages) + " 0 R >>");
+    pdf.set(helvetica, "<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica >>");
+    pdf.set(times, "<< /Type /Font /Subtype /Type1 /BaseFont /Times-Roman >>");
+    pdf.set(courier, "<< /Type /Font /Subtype /Type1 /BaseFont /Courier >>");
+    pdf.set(alpha, "<< /Type /ExtGState /ca 0.5 /CA 0.5 >>");
+    pdf.set_stream(image,
+        "/Type /XObject /Subtype /Image /Width " + std::to_string(IMAGE_SIZE) +
+        " /Height " + std::to_string(IMAGE_SIZE) +
+        " /ColorSpace /DeviceRGB /BitsPerComponent 8",
+        image_samples(random));
+    pdf.set(shading,
+        "<< /ShadingType 2 /ColorSpace /DeviceRGB /Coords [0 0 " + num(PAGE_WIDTH) + " " +
+        num(PAGE_HEIGHT) + "] /Extend [true true] /Function << /FunctionType 2 /Domain [0 1] "
+        "/C0 [0.95 0.9 0.8] /C1 [0.6 0.75 0.95] /N 1 >> >>");
+    
+    const std::string resources =
+        "<< /Font << /F1 " + std::to_string(helvetica) + " 0 R /F2 " + std::to_string(times) +
+        " 0 R /F3 " + std::to_string(courier) + " 0 R >> /ExtGState << /GS1 " +
+        std::to_string(alpha) + " 0 R >> /XObject << /Im1 " + std::to_string(image) +
+        " 0 R >> /Shading << /Sh1 " + std::to_string(shading) + " 0 R >> >>";
+    
+    std::vector<std::string> contents;
+    
+    corpus.pages.push_back({"text", "Dense text in three base-14 fonts"});
+    contents.push_back(text_block(random, 36, PAGE_HEIGHT - 48, PAGE_WIDTH - 72, 70, 9.5));
+    
+    corpus.pages.push_back({"vector", "Fills, curves and strokes, partly transparent"});
+    contents.push_back(shapes(random, 1500, 0, 0, PAGE_WIDTH, PAGE_HEIGHT));
+    
+    corpus.pages.push_back({"image", "A 1024x1024 RGB image drawn three times"});
+    contents.push_back(place_image(36, 180, PAGE_WIDTH - 72, PAGE_WIDTH - 72, 0) +
+                       place_image(60, 40, 160, 120, 15) +
+                       place_image(380, 40, 160, 120, -30));
+    
+    corpus.pages.push_back({"mixed", "Shaded background, two text columns, shapes and an image"});
+    contents.push_back("q\n0 0 " + num(PAGE_WIDTH) + " " + num(PAGE_HEIGHT) + " re W n\n/Sh1 sh\nQ\n" +
+                       text_block(random, 36, PAGE_HEIGHT - 48, 255, 40, 8) +
+                       text_block(random, 321, PAGE_HEIGHT - 48, 255, 40, 8) +
+                       shapes(random, 200, 36, 36, PAGE_WIDTH - 36, 320) +
+                       place_image(396, 340, 180, 80, 0));
+    
+    std::string kids;
+    for (const std::string& content : contents) {
+        const int page = pdf.reserve();
+        const int stream = pdf.reserve();
+        pdf.set(page,
+            "<< /Type /Page /Parent " + std::to_string(pages) + " 0 R /MediaBox [0 0 " +
+            num(PAGE_WIDTH) + " " + num(PAGE_HEIGHT) + "] /Resources " + resources +
+            " /Contents " + std::to_string(stream) + " 0 R >>");
+        pdf.set_stream(stream, "", content);
+        kids += std::to_string(page) + " 0 R ";
+    }
+    pdf.set(pages, "<< /Type /Pages /Kids [" + kids + "] /Count " +
+                   std::to_string(contents.size()) + " >>");
+    
+    corpus.pdf = pdf.finish(catalog);
+    return corpus;
+}
+
+} // namespace bench
+} // namespace pdfeditor
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace pdfeditor {
+namespace bench {
+
+// One page of the synthetic corpus. Each stresses a different part of the
+// render pipeline so that a regression can be traced to it.
+struct CorpusPage {
+    std::string name;
+    std::string description;
+};
+
+// Deterministic PDF generated in memory, so the benchmark needs no test
+// files and gives the same content on every machine.
+struct SyntheticCorpus {
+    std::vector<CorpusPage> pages;
+    std::vector<uint8_t> pdf;
+};
+
+// Build the corpus: dense text, vector art, a large image and a mixed page,
+// all US Letter. The same seed always gives the same bytes.
+SyntheticCorpus build_synthetic_corpus(uint32_t seed = 1);
+
+} // namespace bench
+} // namespace pdfeditor
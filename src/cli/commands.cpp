@@ -294,6 +294,102 @@ namespace commands {
         return EXIT_SUCCESS;
     }
     
+    // Catalog probe command: one line (or JSON object) per file, without
+    // opening the documents
+    int cmd_probe(const Arguments& args) {
+        if (args.positional.empty()) {
+            utils::print_error("No input file or directory specified");
+            return EXIT_FAILURE;
+        }
+        
+        const int threads = std::stoi(args.get_option("threads", "0"));
+        std::vector<DocumentProbe> probes;
+        std::vector<std::string> files;
+        for (const std::string& input : args.positional) {
+            if (fs::is_directory(input)) {
+                auto found = Document::probe_directory(input, threads);
+                probes.insert(probes.end(), found.begin(), found.end());
+            } else {
+                files.push_back(input);
+            }
+        }
+        auto listed = Document::probe_all(files, threads);
+        probes.insert(probes.end(), listed.begin(), listed.end());
+        
+        auto version_name = [](PDFVersion version) {
+            if (version == PDFVersion::PDF_2_0) return std::string("2.0");
+            return "1." + std::to_string(static_cast<int>(version));
+        };
+        auto quoted = [](const std::string& text) {
+            std::ostringstream out;
+            out << '"';
+            for (char c : text) {
+                if (c == '"' || c == '\\') {
+                    out << '\\' << c;
+                } else if (static_cast<unsigned char>(c) < 0x20) {
+                    out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+                        << static_cast<int>(c) << std::dec;
+                } else {
+                    out << c;
+                }
+            }
+            out << '"';
+            return out.str();
+        };
+        
+        const bool json_output = args.get_flag("json");
+        int failed = 0;
+        if (json_output) {
+            std::cout << "[" << std::endl;
+        }
+        for (size_t i = 0; i < probes.size(); ++i) {
+            const DocumentProbe& probe = probes[i];
+            if (probe.info.is_error()) {
+                ++failed;
+            }
+            
+            if (!json_output) {
+                if (probe.info.is_error()) {
+                    std::cout << probe.path << "\terror\t" << probe.info.error_message() << std::endl;
+                    continue;
+                }
+                const DocumentInfo& info = probe.info.value();
+                std::cout << probe.path << "\t" << info.page_count << " pages\tPDF "
+                          << version_name(info.version) << "\t" << info.file_size << " bytes"
+                          << (info.is_encrypted ? "\tencrypted" : "")
+                          << (info.is_linearized ? "\tlinearized" : "")
+                          << (info.title.empty() ? "" : "\t" + info.title) << std::endl;
+                continue;
+            }
+            
+            std::cout << "  {\"path\": " << quoted(probe.path);
+            if (probe.info.is_error()) {
+                std::cout << ", \"error\": " << quoted(probe.info.error_message());
+            } else {
+                const DocumentInfo& info = probe.info.value();
+                std::cout << ", \"pages\": " << info.page_count
+                          << ", \"version\": " << quoted(version_name(info.version))
+                          << ", \"size\": " << info.file_size
+                          << ", \"encrypted\": " << (info.is_encrypted ? "true" : "false")
+                          << ", \"linearized\": " << (info.is_linearized ? "true" : "false")
+                          << ", \"title\": " << quoted(info.title)
+                          << ", \"author\": " << quoted(info.author)
+                          << ", \"subject\": " << quoted(info.subject)
+                          << ", \"keywords\": " << quoted(info.keywords)
+                          << ", \"creator\": " << quoted(info.creator)
+                          << ", \"producer\": " << quoted(info.producer)
+                          << ", \"created\": " << quoted(info.creation_date)
+                          << ", \"modified\": " << quoted(info.modification_date);
+            }
+            std::cout << "}" << (i + 1 < probes.size() ? "," : "") << std::endl;
+        }
+        if (json_output) {
+            std::cout << "]" << std::endl;
+        }
+        
+        return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    
     // Bookmarks list command
     int cmd_bookmarks_list(const Arguments& args) {
         if (args.positional.empty()) {
@@ -377,6 +473,87 @@ namespace commands {
         return EXIT_SUCCESS;
     }
     
+    // Deep-zoom tiles command
+    int cmd_tiles(const Arguments& args) {
+        if (args.positional.size() < 2) {
+            utils::print_error("Usage: tiles <file> <output-dir>");
+            return EXIT_FAILURE;
+        }
+        
+        std::string input_file = args.positional[0];
+        std::string output_dir = args.positional[1];
+        
+        auto result = Document::open(input_file);
+        if (!result.is_ok()) {
+            utils::print_error("Failed to open PDF: " + result.error_message());
+            return EXIT_FAILURE;
+        }
+        
+        auto doc = std::move(result.value());
+        
+        TilePyramidOptions pyramid;
+        std::string layout = args.get_option("layout", "dzi");
+        std::string format = args.get_option("format", "png");
+        if (layout == "xyz") {
+            pyramid.layout = TilePyramidOptions::Layout::XYZ;
+        } else if (layout != "dzi") {
+            utils::print_error("Unknown layout: " + layout + " (expected dzi or xyz)");
+            return EXIT_FAILURE;
+        }
+        if (format == "jpg" || format == "jpeg") {
+            pyramid.format = TilePyramidOptions::Format::JPEG;
+        } else if (format != "png") {
+            utils::print_error("Unknown format: " + format + " (expected png or jpg)");
+            return EXIT_FAILURE;
+        }
+        pyramid.tile_size = std::stoi(args.get_option("tile-size", "256"));
+        pyramid.jpeg_quality = std::stoi(args.get_option("quality", "85"));
+        pyramid.overwrite = args.get_flag("overwrite");
+        
+        RenderOptions options;
+        options.dpi = std::stof(args.get_option("dpi", "150"));
+        
+        // All pages, or a 1-based list such as 1,3-5
+        std::vector<int> pages;
+        std::stringstream list(args.get_option("pages"));
+        std::string item;
+        while (std::getline(list, item, ',')) {
+            size_t dash = item.find('-');
+            int first = std::stoi(item.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+            for (int page = first; page <= last; ++page) {
+                pages.push_back(page - 1);
+            }
+        }
+        if (pages.empty()) {
+            for (int page = 0; page < doc->page_count(); ++page) {
+                pages.push_back(page);
+            }
+        }
+        
+        Renderer renderer;
+        utils::ProgressBar progress(static_cast<int>(pages.size()), "Tiling");
+        auto exported = renderer.export_tile_pyramid(doc.get(), pages, output_dir, pyramid, options,
+            [&progress](int current, int, const std::string&) {
+                progress.update(current);
+                return true;
+            });
+        progress.finish();
+        
+        if (!exported.is_ok()) {
+            utils::print_error("Failed to export tiles: " + exported.error_message());
+            return EXIT_FAILURE;
+        }
+        
+        const TilePyramidStats& stats = exported.value();
+        utils::print_success("Wrote " + std::to_string(stats.pages) + " page(s) to " + output_dir + ": " +
+                             std::to_string(stats.tiles_rendered) + " tiles rendered, " +
+                             std::to_string(stats.tiles_derived) + " reduced, " +
+                             std::to_string(stats.tiles_copied) + " copied from identical pages, " +
+                             std::to_string(stats.tiles_skipped) + " already present");
+        return EXIT_SUCCESS;
+    }
+    
     // More command implementations will follow in Part 2...
     
 } // namespace commands
@@ -393,6 +570,13 @@ void register_all_commands() {
         commands::cmd_info
     );
     
+    registry.register_command(
+        "probe",
+        "Read page count, version and Info of many files without opening them",
+        "pdfeditor-cli probe <file|directory>... [--threads N] [--json]",
+        commands::cmd_probe
+    );
+    
     // Bookmarks
     registry.register_command(
         "bookmarks",
@@ -409,6 +593,15 @@ void register_all_commands() {
         commands::cmd_metadata_show
     );
     
+    // Rendering
+    registry.register_command(
+        "tiles",
+        "Export pages as deep-zoom tile pyramids",
+        "pdfeditor-cli tiles <file> <output-dir> [--dpi 150] [--tile-size 256] "
+        "[--layout dzi|xyz] [--format png|jpg] [--quality 85] [--pages 1,3-5] [--overwrite]",
+        commands::cmd_tiles
+    );
+    
     // More commands will be registered here...
 }
 
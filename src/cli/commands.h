@@ -105,6 +105,7 @@ namespace utils {
 namespace commands {
     // Document info
     int cmd_info(const Arguments& args);
+    int cmd_probe(const Arguments& args);
     
     // Bookmarks
     int cmd_bookmarks_list(const Arguments& args);
@@ -132,6 +133,7 @@ namespace commands {
     // Rendering
     int cmd_render(const Arguments& args);
     int cmd_thumbnail(const Arguments& args);
+    int cmd_tiles(const Arguments& args);
     
     // Annotations
     int cmd_annotations_list(const Arguments& args);
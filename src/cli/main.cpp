@@ -17,6 +17,7 @@ void print_usage() {
     std::cout << std::endl;
     std::cout << "Commands:" << std::endl;
     std::cout << "  info              Show PDF document information" << std::endl;
+    std::cout << "  probe             Catalog many PDFs quickly (page count, version, Info)" << std::endl;
     std::cout << "  bookmarks         Manage PDF bookmarks/outline" << std::endl;
     std::cout << "  metadata          Manage PDF metadata" << std::endl;
     std::cout << "  pages             Manage PDF pages" << std::endl;
@@ -5,6 +5,7 @@
 #include <cstdint>
 #include <vector>
 #include <functional>
+#include <utility>
 
 // Platform-specific export/import macros
 #ifdef _WIN32
@@ -158,6 +159,7 @@ template<typename T>
 class Result {
 public:
     Result(const T& value) : value_(value), error_(ErrorCode::Success) {}
+    Result(T&& value) : value_(std::move(value)), error_(ErrorCode::Success) {}
     Result(ErrorCode error) : error_(error) {}
     Result(ErrorCode error, const std::string& message) 
         : error_(error), error_message_(message) {}
@@ -200,7 +202,14 @@ public:
     // Get version components
     static void get_version(int& major, int& minor, int& patch);
     
-    // Set global cache size (in MB)
+    // Set global cache size (in MB): the MuPDF resource store of fonts,
+    // glyphs and decoded images that every document and renderer shares;
+    // 0 means unlimited. The store's size is fixed when it is created, so
+    // call this before initialize() and before opening or rendering
+    // anything (which initializes on demand). Called later, it does not
+    // change the running store: the size applies after shutdown() and
+    // initialize(), and a warning goes to get_last_error() and the log
+    // callback.
     static void set_cache_size(size_t size_mb);
     
     // Get last error message
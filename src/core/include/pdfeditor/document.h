@@ -5,6 +5,7 @@
 #include <vector>
 #include <memory>
 #include <map>
+#include <mutex>
 
 namespace pdfeditor {
 
@@ -22,37 +23,119 @@ struct DocumentInfo {
     std::string producer;
     std::string creation_date;
     std::string modification_date;
-    bool is_encrypted;
-    bool is_linearized;
-    PDFVersion version;
-    size_t file_size;
-    int page_count;
+    bool is_encrypted = false;
+    bool is_linearized = false;
+    PDFVersion version = PDFVersion::PDF_1_7;
+    size_t file_size = 0;
+    int page_count = 0;
+};
+
+// One file's result from Document::probe_all
+struct DocumentProbe {
+    std::string path;
+    Result<DocumentInfo> info{ErrorCode::UnknownError};
+};
+
+// How an opened file will be read, passed on to the kernel for the
+// memory-mapped file (Document::open)
+enum class FileAccess {
+    Default,
+    Sequential,     // Front to back, e.g. converting every page
+    Random          // Jumping between pages, e.g. viewing a large file
+};
+
+// A page's boxes as stored in the file, in PDF units from the bottom-left
+// corner, and its rotation
+struct PageGeometry {
+    Rect mediabox;
+    Rect cropbox;                               // Within the mediabox
+    PageRotation rotation = PageRotation::None;
+    float user_unit = 1.0f;                     // Points per unit
+    
+    // Displayed size in points: the cropbox turned by rotation and
+    // scaled by user_unit, as Page::width() and height() report it
+    float width() const {
+        return (turned() ? cropbox.height() : cropbox.width()) * user_unit;
+    }
+    
+    float height() const {
+        return (turned() ? cropbox.width() : cropbox.height()) * user_unit;
+    }
+    
+    bool turned() const {
+        return rotation == PageRotation::Clockwise90 || rotation == PageRotation::Clockwise270;
+    }
 };
 
 // Document class
 class PDFEDITOR_API Document {
 public:
-    // Open document from file
+    // Open document from file. The file is memory-mapped where possible
+    // and read in place, so it must not be truncated while open; files
+    // that cannot be mapped are read through ordinary file I/O.
     static Result<std::unique_ptr<Document>> open(
         const std::string& path, 
-        const std::string& password = ""
+        const std::string& password = "",
+        FileAccess access = FileAccess::Default
     );
     
     // Create new empty document
     static std::unique_ptr<Document> create();
     
-    // Open from memory buffer
+    // Open from memory buffer. The bytes are read in place and must stay
+    // valid and unchanged for the lifetime of the document.
     static Result<std::unique_ptr<Document>> open_from_memory(
         const uint8_t* data,
         size_t size,
         const std::string& password = ""
     );
     
+    // Open from a buffer the document takes over; no copy is made
+    static Result<std::unique_ptr<Document>> open_from_memory(
+        std::vector<uint8_t>&& data,
+        const std::string& password = ""
+    );
+    
+    // Open from size bytes at data, held for as long as the document
+    // lives. Any owner can be shared through the aliasing constructor,
+    // e.g. std::shared_ptr<const uint8_t>(buffer, buffer->data()).
+    static Result<std::unique_ptr<Document>> open_from_memory(
+        std::shared_ptr<const uint8_t> data,
+        size_t size,
+        const std::string& password = ""
+    );
+    
+    // Catalog facts (page count, version, Info strings, encryption,
+    // linearization) read from the header, trailer and the few objects
+    // they point to, without opening the document or touching the page
+    // tree. Info is left empty for encrypted files.
+    static Result<DocumentInfo> probe(const std::string& path);
+    
+    // probe for many files at once, on threads threads (0 for one per
+    // core). Results are in the order of paths.
+    static std::vector<DocumentProbe> probe_all(const std::vector<std::string>& paths, int threads = 0);
+    
+    // probe_all for every .pdf file under directory, sorted by path
+    static std::vector<DocumentProbe> probe_directory(const std::string& directory, int threads = 0);
+    
     virtual ~Document();
     
-    // Save operations
+    // Save operations. save rewrites the whole file; saving over the
+    // file the document was opened from replaces it once written.
     bool save(const std::string& path);
+    
+    // Append only the changed objects and a new xref section after the
+    // original bytes, which stay as they were, so existing signatures
+    // remain valid. Saving to the opened file appends to it; any other
+    // path gets a copy of the original plus the update. Once save() has
+    // rewritten the opened file, saving to it is a full save, since the
+    // update would refer to bytes the file no longer holds. False if the
+    // document cannot be updated this way (e.g. it had to be repaired on
+    // open); save() still works then.
     bool save_incremental(const std::string& path);
+    
+    // Full save into buffer, replacing its contents. Written to a MuPDF
+    // buffer first, then copied once.
     bool save_to_memory(std::vector<uint8_t>& buffer);
     
     // Document properties
@@ -60,12 +143,29 @@ public:
     DocumentInfo get_info() const;
     PDFVersion get_version() const;
     
-    // Page access
+    // Page access. A Page stays valid, at the same address, for as long
+    // as the document. The parsed page behind it is loaded on first use
+    // and dropped again once more than page_cache_size() others have been
+    // used since; it is reloaded transparently the next time it is needed.
     Page* get_page(int index);
     const Page* get_page(int index) const;
     std::vector<Page*> get_pages();
     
-    // Page manipulation
+    // Most parsed pages held at once (default 64, at least 1)
+    void set_page_cache_size(size_t pages);
+    size_t page_cache_size() const;
+    size_t loaded_page_count() const;
+    
+    // Geometry of a page without loading it. The whole table is read in
+    // one pass over the page tree on first use and kept up to date by the
+    // page manipulation calls below; Page::width(), height(), boxes and
+    // rotation come from it. False if index is out of range, or the
+    // document has no PDF page tree to read it from.
+    bool get_page_geometry(int index, PageGeometry& geometry) const;
+    
+    // Page manipulation. Page objects follow their page as others are
+    // inserted or deleted before it; a deleted page's Page stays valid
+    // but is detached, with index -1 and no contents.
     bool insert_page(int index, float width, float height);
     bool delete_page(int index);
     bool move_page(int from_index, int to_index);
@@ -149,7 +249,13 @@ public:
     // Internal handle (for advanced use)
     void* get_handle() const;
     
+    // Internal: the lock on the document's MuPDF context, the one
+    // Page::interpret_mutex() returns for each of its pages. Held by any
+    // direct use of get_handle(), such as reading the file stream.
+    std::recursive_mutex& interpret_mutex() const;
+    
 private:
+    friend class Page;
     Document();
     
     class Impl;
@@ -220,9 +326,58 @@ public:
     bool insert_text(const std::string& text, const Point& position);
     bool insert_image(const std::string& image_path, const Rect& rect);
     
-    // Internal handle
+    // Change tracking. Edits record the area they touch and bump the
+    // revision: rotation and page tree edits do so themselves, and code
+    // that changes a page's objects directly calls add_damage(). Renderers
+    // compare revisions to spot stale renders and redraw only the damaged
+    // areas.
+    // add_damage() takes PDF units from the bottom-left corner, like the
+    // edits themselves; get_damage_since() returns page space, points
+    // from the top-left corner of the turned cropbox like
+    // RenderOptions::clip_rect.
+    // Edits confined to annotations and form fields leave the content
+    // revision alone, so renders of the page contents stay valid.
+    enum class Layer {
+        Content,        // Content streams and page geometry
+        Annotations     // Annotations and widgets drawn over the contents
+    };
+    
+    uint64_t revision() const;
+    uint64_t content_revision() const;
+    void add_damage(const Rect& area, Layer layer = Layer::Content);
+    void add_damage(Layer layer = Layer::Content);     // The whole page
+    
+    // Areas changed after the given revision. False if the record does
+    // not reach back that far (a whole-page change, or too many edits
+    // since): everything must be redrawn.
+    bool get_damage_since(uint64_t revision, std::vector<Rect>& areas) const;
+    
+    // Hash of what the page draws: its content stream bytes, the object
+    // ids of the resources and annotations it uses, and its geometry.
+    // Pages with equal non-zero fingerprints render the same, which lets
+    // caches and batch renders share one raster between them. 0 when
+    // unknown (no page loaded, or not a PDF page). Computed on first use
+    // and again after an edit.
+    uint64_t content_fingerprint() const;
+    
+    // Unique among all pages created by this process and never reused,
+    // unlike the Page's address once its document is closed. Caches of
+    // per-page data key on it.
+    uint64_t id() const;
+    
+    // Internal handle: the parsed fz_page, loaded if need be. It carries
+    // a reference of its own that the caller releases with fz_drop_page,
+    // so it stays valid while other pages are loaded and evicted. Null if
+    // the page cannot be loaded.
     void* get_handle() const;
     
+    // Internal: the lock on the document's MuPDF context. A MuPDF document
+    // takes one thread at a time, so every use of it holds this lock, the
+    // Document and Page calls as well as renderers interpreting pages. It
+    // is recursive: get_handle() and the other calls can be made with it
+    // held.
+    std::recursive_mutex& interpret_mutex() const;
+    
 private:
     friend class Document;
     Page();
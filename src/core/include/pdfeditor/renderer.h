@@ -39,7 +39,21 @@ enum class ImageFormat {
     BGR24,      // 24-bit BGR (Windows bitmap order)
     BGRA32,     // 32-bit BGRA
     Gray8,      // 8-bit grayscale
-    Mono1       // 1-bit monochrome
+    Mono1       // 1-bit monochrome, MSB first, 1 = black
+};
+
+// How grays are reduced to black and white for Mono1 output or
+// ColorMode::Monochrome
+enum class Dithering {
+    Ordered,        // 8x8 Bayer matrix; stable across tiles and bands
+    ErrorDiffusion  // Floyd-Steinberg; smoother, but restarts per tile/band
+};
+
+// Filter for resizing rendered images
+enum class ResampleFilter {
+    Box,        // Area average; fastest, fine for large reductions
+    Bilinear,   // Triangle filter
+    Lanczos     // 3-lobe Lanczos; sharpest
 };
 
 // Render options
@@ -48,13 +62,25 @@ struct RenderOptions {
     AntiAliasing anti_aliasing = AntiAliasing::All;
     ColorMode color_mode = ColorMode::RGB;
     ImageFormat image_format = ImageFormat::RGB24;
+    // Annotations and form widgets are interpreted and cached apart from
+    // the page contents, so toggling these or editing an annotation or
+    // field does not rasterize the contents again
     bool render_annotations = true;
     bool render_forms = true;
     bool render_xfa_forms = false;
-    bool render_transparent = false;
+    bool render_transparent = false;    // Only the 32-bit formats keep alpha
+    bool premultiplied_alpha = false;   // Color scaled by alpha (GPU upload)
     Color background_color = Color::white();
+    Dithering dithering = Dithering::Ordered;
+    ResampleFilter resample_filter = ResampleFilter::Lanczos;  // render_page_scaled/_to_size
     
-    // Clipping rectangle (in page coordinates)
+    // Fast preview while scrolling: images are drawn as gray boxes without
+    // being decoded, and shadings, soft masks and transparency groups are
+    // skipped. Re-render without it once the view settles.
+    bool draft = false;
+    
+    // Clipping rectangle (in page coordinates, points from the top-left
+    // corner). Only the clipped area is rasterized and returned.
     Rect clip_rect;
     bool use_clip_rect = false;
     
@@ -63,6 +89,56 @@ struct RenderOptions {
     bool override_rotation = false;
 };
 
+// TIFF output layout
+struct TiffOptions {
+    enum class Layout {
+        Strips,
+        Tiles       // Better for huge images viewed a region at a time
+    };
+    
+    enum class Compression {
+        None,
+        Deflate     // Falls back to None without zlib
+    };
+    
+    Layout layout = Layout::Strips;
+    Compression compression = Compression::Deflate;
+    int rows_per_strip = 64;
+    int tile_size = 256;        // Rounded up to a multiple of 16
+};
+
+// Tile pyramid export (Renderer::export_tile_pyramid)
+struct TilePyramidOptions {
+    enum class Layout {
+        DeepZoom,   // page_<n>.dzi and page_<n>_files/<level>/<column>_<row>.<ext>
+        XYZ         // page_<n>/<z>/<x>/<y>.<ext>, edge tiles padded to full size
+    };
+    
+    enum class Format {
+        PNG,
+        JPEG        // Needs libjpeg(-turbo); no alpha
+    };
+    
+    Layout layout = Layout::DeepZoom;
+    Format format = Format::PNG;
+    int tile_size = 256;
+    int jpeg_quality = 85;
+    
+    // Tiles already on disk are kept, so an interrupted export resumes
+    // where it stopped and a re-run only fills in what is missing. Set
+    // this to render everything again, e.g. after the document changed.
+    bool overwrite = false;
+};
+
+// What Renderer::export_tile_pyramid did
+struct TilePyramidStats {
+    int pages = 0;              // Pages finished
+    int tiles_rendered = 0;     // Rasterized from the page and written
+    int tiles_derived = 0;      // Reduced from the level above and written
+    int tiles_skipped = 0;      // Already on disk
+    int tiles_copied = 0;       // From an identical page exported earlier
+};
+
 // Rendered image buffer
 class PDFEDITOR_API ImageBuffer {
 public:
@@ -77,26 +153,165 @@ public:
     // Image format
     ImageFormat format() const;
     int bytes_per_pixel() const;
+    bool is_premultiplied() const;
+    
+    // Copy in another format. Alpha is dropped, not composited, when the
+    // target has none; gray is Rec. 601 luma.
+    std::unique_ptr<ImageBuffer> convert(
+        ImageFormat format,
+        bool premultiplied = false,
+        Dithering dithering = Dithering::Ordered
+    ) const;
+    
+    // Copy resized to width x height; the axes scale independently.
+    // Returns nullptr for an empty size.
+    std::unique_ptr<ImageBuffer> scaled(
+        int width,
+        int height,
+        ResampleFilter filter = ResampleFilter::Lanczos
+    ) const;
     
     // Raw pixel data
     const uint8_t* data() const;
     uint8_t* data();
     size_t size() const;
     
-    // Save to file
+    // Save to file. Rows are converted and written a strip at a time;
+    // PNG and deflated TIFF compress strips on all cores. JPEG needs
+    // libjpeg(-turbo) and drops alpha.
     bool save_png(const std::string& path) const;
     bool save_jpeg(const std::string& path, int quality = 85) const;
     bool save_bmp(const std::string& path) const;
-    bool save_tiff(const std::string& path) const;
+    bool save_tiff(const std::string& path, const TiffOptions& options = TiffOptions()) const;
     
     // Copy to buffer
     std::vector<uint8_t> to_vector() const;
     
+private:
+    friend class Renderer;
+    
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// Writes a multi-page TIFF one page at a time, so a whole document can be
+// exported without holding every rendered page in memory
+class PDFEDITOR_API TiffWriter {
+public:
+    TiffWriter();
+    ~TiffWriter();
+    
+    bool open(const std::string& path, const TiffOptions& options = TiffOptions());
+    bool add_page(const ImageBuffer& image, float dpi = 72.0f);
+    
+    // Write a page from rows that arrive a band at a time: begin_page(),
+    // add_rows() top to bottom until every row is in, then end_page().
+    // Only the rows of an unfinished strip or tile row are held.
+    bool begin_page(
+        int width,
+        int height,
+        ImageFormat format,
+        bool premultiplied = false,
+        float dpi = 72.0f
+    );
+    bool add_rows(const uint8_t* data, int stride, int rows);
+    bool end_page();
+    
+    // Finishes the file; false if any page failed to write
+    bool close();
+    bool is_open() const;
+    int page_count() const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// Receives a page from Renderer::render_page_banded() a band of rows at a
+// time, top to bottom. Returning false from any call stops the render.
+class PDFEDITOR_API RenderSink {
+public:
+    virtual ~RenderSink() = default;
+    
+    // Called once, before the first band, with the size of the whole page
+    virtual bool begin(int width, int height, ImageFormat format, bool premultiplied, float dpi) = 0;
+    
+    // Rows y to y + rows - 1, `stride` bytes apart. The memory is reused
+    // for the next band once this returns.
+    virtual bool write_rows(const uint8_t* data, int stride, int y, int rows) = 0;
+    
+    // Called after the last band
+    virtual bool finish() = 0;
+    
+    // Called instead of finish() when the render stops early
+    virtual void abort() {}
+};
+
+// Streams a banded render into a PNG file
+class PDFEDITOR_API PngSink : public RenderSink {
+public:
+    explicit PngSink(const std::string& path);
+    ~PngSink() override;
+    
+    bool begin(int width, int height, ImageFormat format, bool premultiplied, float dpi) override;
+    bool write_rows(const uint8_t* data, int stride, int y, int rows) override;
+    bool finish() override;
+    void abort() override;      // Removes the partial file
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// Streams a banded render into a JPEG file (needs libjpeg; alpha is dropped)
+class PDFEDITOR_API JpegSink : public RenderSink {
+public:
+    explicit JpegSink(const std::string& path, int quality = 85);
+    ~JpegSink() override;
+    
+    bool begin(int width, int height, ImageFormat format, bool premultiplied, float dpi) override;
+    bool write_rows(const uint8_t* data, int stride, int y, int rows) override;
+    bool finish() override;
+    void abort() override;      // Removes the partial file
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// Streams a banded render into a single-page TIFF file, or as the next
+// page of an open TiffWriter
+class PDFEDITOR_API TiffSink : public RenderSink {
+public:
+    explicit TiffSink(const std::string& path, const TiffOptions& options = TiffOptions());
+    explicit TiffSink(TiffWriter& writer);
+    ~TiffSink() override;
+    
+    bool begin(int width, int height, ImageFormat format, bool premultiplied, float dpi) override;
+    bool write_rows(const uint8_t* data, int stride, int y, int rows) override;
+    bool finish() override;
+    void abort() override;
+
 private:
     class Impl;
     std::unique_ptr<Impl> impl_;
 };
 
+// Hands each band to a callback, e.g. to feed a printer or a network stream
+class PDFEDITOR_API CallbackSink : public RenderSink {
+public:
+    using RowsCallback = std::function<bool(const uint8_t* data, int stride, int y, int rows)>;
+    
+    explicit CallbackSink(RowsCallback callback);
+    
+    bool begin(int width, int height, ImageFormat format, bool premultiplied, float dpi) override;
+    bool write_rows(const uint8_t* data, int stride, int y, int rows) override;
+    bool finish() override;
+
+private:
+    RowsCallback callback_;
+};
+
 // PDF Renderer
 class PDFEDITOR_API Renderer {
 public:
@@ -119,7 +334,20 @@ public:
         const RenderOptions& options = RenderOptions()
     );
     
-    // Render page at specific scale
+    // Render page straight into caller memory, e.g. a shared-memory frame or
+    // QImage::bits(), without an intermediate copy. Rows are `stride` bytes
+    // apart (0 = tightly packed); size the buffer with calculate_dimensions().
+    bool render_page_to_buffer(
+        Page* page,
+        uint8_t* buffer,
+        size_t buffer_size,
+        int stride,
+        const RenderOptions& options = RenderOptions()
+    );
+    
+    // Render page at specific scale. Unequal scales are rendered at the
+    // larger one and resampled with options.resample_filter; so is any
+    // size a cached render at up to 4x the resolution can be reduced from.
     Result<std::unique_ptr<ImageBuffer>> render_page_scaled(
         Page* page,
         float scale_x,
@@ -127,7 +355,8 @@ public:
         const RenderOptions& options = RenderOptions()
     );
     
-    // Render page to specific dimensions
+    // Render page (or options.clip_rect) to exactly width x height,
+    // stretching it if the aspect ratios differ
     Result<std::unique_ptr<ImageBuffer>> render_page_to_size(
         Page* page,
         int width,
@@ -135,9 +364,27 @@ public:
         const RenderOptions& options = RenderOptions()
     );
     
+    // ===== Banded Rendering =====
+    
+    // Render page in horizontal bands of band_height rows and pass each to
+    // the sink as soon as it is drawn. Only one band is held at a time, so
+    // peak memory is set by the band height and page width rather than the
+    // page size; use this for large formats at print resolution. The
+    // callback is told the rows done after each band and may stop the
+    // render by returning false.
+    bool render_page_banded(
+        Page* page,
+        RenderSink& sink,
+        const RenderOptions& options = RenderOptions(),
+        int band_height = 256,
+        ProgressCallback callback = nullptr
+    );
+    
     // ===== Batch Rendering =====
     
-    // Render multiple pages
+    // Render multiple pages. Pages with equal content fingerprints (see
+    // Page::content_fingerprint), such as a repeated index or identical
+    // blank pages, are rendered once and share one buffer.
     std::vector<Result<std::unique_ptr<ImageBuffer>>> render_pages(
         Document* doc,
         const std::vector<int>& page_indices,
@@ -154,6 +401,10 @@ public:
     
     // ===== Thumbnail Generation =====
     
+    // Thumbnails come from the page's embedded /Thumb image when it is
+    // large enough, and are otherwise rendered from the page contents only
+    // (no annotations or form fields) at thumbnail size.
+    
     // Generate thumbnail of page
     Result<std::unique_ptr<ImageBuffer>> render_thumbnail(
         Page* page,
@@ -162,7 +413,9 @@ public:
         bool maintain_aspect = true
     );
     
-    // Generate thumbnails for all pages
+    // Generate thumbnails for all pages, in parallel (see set_thread_count).
+    // Uses the on-disk thumbnail cache if one is set. Identical pages are
+    // rendered once, as in render_pages.
     std::vector<Result<std::unique_ptr<ImageBuffer>>> render_all_thumbnails(
         Document* doc,
         int max_width,
@@ -170,17 +423,27 @@ public:
         ProgressCallback callback = nullptr
     );
     
+    // Directory for thumbnails kept across sessions, keyed by a hash of
+    // the document file, page and size. Empty (the default) disables it.
+    void set_thumbnail_cache_dir(const std::string& directory);
+    std::string get_thumbnail_cache_dir() const;
+    
     // ===== Tile Rendering (for large pages) =====
     
+    // Tiles cut the full-page raster at a given DPI into a pixel grid. Only
+    // the tile's own pixels are rasterized, so very large pages can be
+    // viewed at high zoom without a whole-page pixmap.
     struct TileInfo {
-        int tile_x;
-        int tile_y;
-        int tile_width;
+        int tile_x;       // Column in the tile grid
+        int tile_y;       // Row in the tile grid
+        int pixel_x;      // Left edge in the full-page raster
+        int pixel_y;      // Top edge in the full-page raster
+        int tile_width;   // Pixel size (edge tiles may be smaller)
         int tile_height;
-        Rect page_rect;  // Area of page this tile covers
+        Rect page_rect;   // Area of page this tile covers (points, top-left origin)
     };
     
-    // Calculate tile layout for page
+    // Calculate tile layout for page (tile sizes in pixels at options.dpi)
     std::vector<TileInfo> calculate_tiles(
         Page* page,
         int tile_width,
@@ -195,21 +458,69 @@ public:
         const RenderOptions& options = RenderOptions()
     );
     
+    // Render several tiles of one page in parallel (see set_thread_count).
+    // Results are in the order of the given tiles.
+    std::vector<Result<std::unique_ptr<ImageBuffer>>> render_tiles(
+        Page* page,
+        const std::vector<TileInfo>& tiles,
+        const RenderOptions& options = RenderOptions()
+    );
+    
+    // ===== Tile Pyramids =====
+    
+    // Deep-zoom export for web viewers: every zoom level of a page cut into
+    // square tiles, from the page at options.dpi down to a single pixel.
+    // Each level is reduced 2:1 from the one above it rather than rendered,
+    // so a page's display list is rasterized once; monochrome output, which
+    // does not survive filtering, is rendered level by level instead.
+    
+    // Write the pyramids of the given pages (0-based) under directory.
+    // A page is built depth first, a few levels of a subtree at a time,
+    // so only a handful of tiles per level are held however large the
+    // page; they bypass the tile cache. Tiles are rendered, reduced and
+    // encoded in parallel (see set_thread_count), and each is written
+    // under a temporary name and renamed into place, so a tile file is
+    // never partial. The callback is told before each page and may stop
+    // the export by returning false.
+    // A page identical to one exported earlier in the call gets copies of
+    // that page's tile files. Fails with RenderError if a page cannot be
+    // drawn and IOError if a tile or descriptor cannot be written.
+    Result<TilePyramidStats> export_tile_pyramid(
+        Document* doc,
+        const std::vector<int>& page_indices,
+        const std::string& directory,
+        const TilePyramidOptions& pyramid = TilePyramidOptions(),
+        const RenderOptions& options = RenderOptions(),
+        ProgressCallback callback = nullptr
+    );
+    
     // ===== Progressive Rendering =====
     
-    // Start progressive render (for large pages)
+    // Start progressive render (for large pages). The page is rendered on
+    // a background thread: a coarse preview first, then the full image in
+    // bands. Renderers interpreting the same document take turns with it,
+    // but the document must not otherwise be used from other threads
+    // until the render finishes or is cancelled. Starting a new render
+    // cancels the previous one.
     bool start_progressive_render(
         Page* page,
         const RenderOptions& options = RenderOptions()
     );
     
-    // Continue progressive render (returns true if more work needed)
+    // Continue progressive render (returns true if more work needed).
+    // Blocks for at most one frame (~16 ms), returning early as soon as
+    // there is something new to show.
     bool continue_progressive_render();
     
-    // Get current progressive render state
+    // Progress of the current progressive render, 0-100
+    int get_progressive_progress() const;
+    
+    // Get current progressive render state: finished bands at full
+    // resolution, the rest upscaled from the preview. Fails until the
+    // preview is ready, or if the render failed or was cancelled.
     Result<std::unique_ptr<ImageBuffer>> get_progressive_buffer();
     
-    // Cancel progressive render
+    // Cancel progressive render. Returns once the render has stopped.
     void cancel_progressive_render();
     
     // ===== Caching =====
@@ -218,14 +529,59 @@ public:
     void set_cache_enabled(bool enabled);
     bool is_cache_enabled() const;
     
-    // Set cache size (in MB)
+    // Set cache size (in MB). Least recently used renders are evicted
+    // once their pixel data exceeds this budget.
     void set_cache_size(size_t size_mb);
     size_t get_cache_size() const;
     
+    // Set tile cache size (in MB). Tiles are cached by page, zoom and
+    // position, separately from whole-page renders.
+    void set_tile_cache_size(size_t size_mb);
+    size_t get_tile_cache_size() const;
+    
+    // Render cache statistics
+    struct CacheStats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        size_t entries = 0;
+        size_t bytes = 0;
+    };
+    
+    CacheStats get_cache_stats() const;
+    void reset_cache_stats();
+    
+    // Set memory budget for interpreted pages (in MB). Each page is
+    // interpreted once into a display list that all later renders of the
+    // page replay, whatever their scale; 0 disables the cache.
+    void set_display_list_cache_size(size_t size_mb);
+    size_t get_display_list_cache_size() const;
+    
+    // Pixel buffer pool, shared by every renderer in the process. Image
+    // buffers and scratch rasters are recycled through it instead of being
+    // freed; idle buffers are kept up to this budget (in MB).
+    static void set_buffer_pool_size(size_t size_mb);
+    static size_t get_buffer_pool_size();
+    
+    struct BufferPoolStats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        size_t idle_buffers = 0;
+        size_t idle_bytes = 0;
+        size_t in_use_bytes = 0;
+    };
+    
+    static BufferPoolStats get_buffer_pool_stats();
+    
+    // Free all idle pooled buffers
+    static void trim_buffer_pool();
+    
     // Clear render cache
     void clear_cache();
     
-    // Invalidate cache for specific page
+    // Invalidate cache for specific page. Edits made through Page, Editor,
+    // Annotations or Forms are tracked by Page::revision() and need no call;
+    // render_page() then redraws only their damaged areas when it can.
     void invalidate_page(Page* page);
     
     // ===== Utility Functions =====
@@ -261,7 +617,10 @@ public:
     
     // ===== Performance Settings =====
     
-    // Set number of threads for rendering (0 = auto)
+    // Set number of threads for batch rendering (0 = auto). Each worker
+    // renders with its own MuPDF context cloned from the library's base
+    // context, so glyph and image caches are shared between workers and
+    // with the documents.
     void set_thread_count(int count);
     int get_thread_count() const;
     
@@ -269,7 +628,26 @@ public:
     void set_gpu_acceleration(bool enabled);
     bool is_gpu_acceleration_enabled() const;
     
+    // ===== Instrumentation =====
+    
+    // Time spent in each phase, summed over every render by this renderer
+    // since the last reset. Interpretation is building display lists (none
+    // when the page's list is cached), rasterization the drawing itself,
+    // copy the conversion to the output format and copies out of the
+    // cache, and encode the sink writes of banded renders.
+    struct RenderTimings {
+        double interpret_ms = 0;
+        double rasterize_ms = 0;
+        double copy_ms = 0;
+        double encode_ms = 0;
+    };
+    
+    RenderTimings get_render_timings() const;
+    void reset_render_timings();
+
 private:
+    friend class AsyncRenderer;
+    
     class Impl;
     std::unique_ptr<Impl> impl_;
 };
@@ -295,37 +673,57 @@ public:
     // Wait for completion
     bool wait(int timeout_ms = -1);
     
-    // Cancel job
+    // Cancel job. A render shared with other jobs keeps running for them;
+    // otherwise it is dropped from the queue or aborted mid-render.
     void cancel();
     
     // Get result (blocks until complete)
     Result<std::unique_ptr<ImageBuffer>> get_result();
     
 private:
+    friend class AsyncRenderer;
+    
     class Impl;
     std::unique_ptr<Impl> impl_;
 };
 
 // Async renderer (for background rendering)
+//
+// Jobs run on a fixed pool of worker threads, highest priority first.
+// Queuing the same page with the same options as a queued or running job
+// shares that render instead of starting another. A document's pages are
+// interpreted one at a time, since a document may only be used by one
+// thread at once; renders of other documents, and rasterizing, run in
+// parallel. Renderers interpreting the same document, such as two
+// AsyncRenderers or a progressive render, take turns rather than race.
 class PDFEDITOR_API AsyncRenderer {
 public:
-    AsyncRenderer();
+    enum class Priority {
+        Prefetch,   // Pages that may be needed soon
+        Normal,
+        Visible     // Pages on screen now
+    };
+    
+    // thread_count 0 uses one worker per hardware thread
+    explicit AsyncRenderer(int thread_count = 0);
     ~AsyncRenderer();
     
     // Queue render job
     std::shared_ptr<RenderJob> queue_render(
         Page* page,
-        const RenderOptions& options = RenderOptions()
+        const RenderOptions& options = RenderOptions(),
+        Priority priority = Priority::Normal
     );
     
     // Queue multiple pages
     std::vector<std::shared_ptr<RenderJob>> queue_batch(
         Document* doc,
         const std::vector<int>& page_indices,
-        const RenderOptions& options = RenderOptions()
+        const RenderOptions& options = RenderOptions(),
+        Priority priority = Priority::Normal
     );
     
-    // Get number of pending jobs
+    // Get number of renders queued or running
     int pending_count() const;
     
     // Cancel all jobs
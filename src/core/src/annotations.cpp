@@ -1,5 +1,6 @@
 #include "pdfeditor/annotations.h"
 #include "pdfeditor/core.h"
+#include "context_manager.h"
 #include <algorithm>
 #include <sstream>
 
@@ -23,15 +24,14 @@ std::vector<std::shared_ptr<Annotation>> Annotations::get_annotations(Page* page
     if (!page) return annotations;
     
 #ifdef USE_MUPDF
-    void* handle = page->get_handle();
-    if (!handle) return annotations;
-    
-    fz_page* fz_pg = static_cast<fz_page*>(handle);
     // TODO: Get context from page
     fz_context* ctx = nullptr;
     
     if (!ctx) return annotations;
     
+    fz_page* fz_pg = static_cast<fz_page*>(page->get_handle());
+    if (!fz_pg) return annotations;
+    
     fz_try(ctx) {
         pdf_page* pdf_pg = pdf_page_from_fz_page(ctx, fz_pg);
         if (pdf_pg) {
@@ -41,8 +41,9 @@ std::vector<std::shared_ptr<Annotation>> Annotations::get_annotations(Page* page
                 annotation->id = generate_annotation_id();
                 annotation->type = AnnotationType::Text; // TODO: Get actual type
                 
-                // Get rect
-                fz_rect rect = pdf_bound_annot(ctx, annot);
+                // Get rect, in PDF units like the rects annotations are
+                // made with rather than MuPDF's page space
+                fz_rect rect = pdf_dict_get_rect(ctx, pdf_annot_obj(ctx, annot), PDF_NAME(Rect));
                 annotation->rect = Rect(rect.x0, rect.y0, rect.x1, rect.y1);
                 
                 // Get contents
@@ -56,6 +57,9 @@ std::vector<std::shared_ptr<Annotation>> Annotations::get_annotations(Page* page
             }
         }
     }
+    fz_always(ctx) {
+        fz_drop_page(ctx, fz_pg);
+    }
     fz_catch(ctx) {
         // Error loading annotations
     }
@@ -135,13 +139,14 @@ Result<std::string> Annotations::add_text(
     std::string id = generate_annotation_id();
     
 #ifdef USE_MUPDF
-    void* handle = page->get_handle();
+    fz_page* handle = static_cast<fz_page*>(page->get_handle());
     if (!handle) {
         return Result<std::string>(ErrorCode::InvalidArgument, "Invalid page handle");
     }
     
     // TODO: Implement actual annotation creation with MuPDF
     // This is a stub that would need full MuPDF annotation API integration
+    fz_drop_page(detail::ContextManager::thread_context(), handle);
 #endif
     
     return Result<std::string>(id);
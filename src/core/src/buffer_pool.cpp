@@ -0,0 +1,138 @@
+#include "buffer_pool.h"
+#include <algorithm>
+
+namespace pdfeditor {
+namespace detail {
+
+namespace {
+    // Below this the general-purpose allocator is fast enough
+    const size_t kMinPooledSize = 64 * 1024;
+
+    const size_t kDefaultBudget = 128 * 1024 * 1024;
+}
+
+BufferPool& BufferPool::instance() {
+    static BufferPool* pool = new BufferPool(kDefaultBudget);
+    return *pool;
+}
+
+BufferPool::BufferPool(size_t budget) : budget_(budget) {
+    stats_.budget = budget;
+}
+
+// Eight classes per power of two, so a buffer is at most 12.5% larger
+// than asked for and pages of equal size always share a class
+size_t BufferPool::size_class(size_t size) {
+    size_t power = 1;
+    while (power <= size / 2) {
+        power *= 2;
+    }
+    const size_t step = std::max<size_t>(power / 8, 1);
+    return (size + step - 1) / step * step;
+}
+
+std::shared_ptr<uint8_t[]> BufferPool::acquire(size_t size) {
+    if (size < kMinPooledSize) {
+        return std::shared_ptr<uint8_t[]>(new uint8_t[std::max<size_t>(size, 1)]);
+    }
+
+    const size_t capacity = size_class(size);
+    uint8_t* data = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = classes_.find(capacity);
+        if (it != classes_.end() && !it->second.empty()) {
+            auto entry = it->second.back();
+            it->second.pop_back();
+            data = entry->data;
+            idle_.erase(entry);
+            stats_.idle_bytes -= capacity;
+            --stats_.idle_buffers;
+            ++stats_.hits;
+        } else {
+            ++stats_.misses;
+        }
+        stats_.in_use_bytes += capacity;
+    }
+
+    if (!data) {
+        try {
+            data = new uint8_t[capacity];
+        } catch (...) {
+            // Give the idle memory back and try once more
+            trim();
+            try {
+                data = new uint8_t[capacity];
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stats_.in_use_bytes -= capacity;
+                throw;
+            }
+        }
+    }
+
+    return std::shared_ptr<uint8_t[]>(data, [this, capacity](uint8_t* p) {
+        release(p, capacity);
+    });
+}
+
+void BufferPool::release(uint8_t* data, size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.in_use_bytes -= capacity;
+
+    if (capacity > budget_) {
+        delete[] data;
+        return;
+    }
+
+    evict_locked(budget_ - capacity);
+    idle_.push_back(Idle{capacity, data});
+    classes_[capacity].push_back(std::prev(idle_.end()));
+    stats_.idle_bytes += capacity;
+    ++stats_.idle_buffers;
+}
+
+// Free the longest-idle buffers until at most budget bytes are idle
+void BufferPool::evict_locked(size_t budget) {
+    while (stats_.idle_bytes > budget && !idle_.empty()) {
+        const Idle oldest = idle_.front();
+
+        // The oldest of its class sits at the front of the class list
+        auto& list = classes_[oldest.capacity];
+        list.erase(list.begin());
+        if (list.empty()) {
+            classes_.erase(oldest.capacity);
+        }
+
+        idle_.pop_front();
+        delete[] oldest.data;
+        stats_.idle_bytes -= oldest.capacity;
+        --stats_.idle_buffers;
+    }
+}
+
+void BufferPool::set_budget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    budget_ = bytes;
+    stats_.budget = bytes;
+    evict_locked(bytes);
+}
+
+size_t BufferPool::budget() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return budget_;
+}
+
+void BufferPool::trim() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    evict_locked(0);
+}
+
+BufferPool::Stats BufferPool::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+} // namespace detail
+} // namespace pdfeditor
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace pdfeditor {
+namespace detail {
+
+// Process-wide pool of pixel buffers, binned by size class. Every render
+// needs a page-sized buffer, and batch jobs and viewers keep asking for
+// the same few sizes; handing back a buffer that is already mapped and
+// faulted in skips the allocator and the page faults. Idle buffers are
+// kept up to a byte budget, the longest idle freed first.
+class BufferPool {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        size_t idle_buffers = 0;
+        size_t idle_bytes = 0;
+        size_t in_use_bytes = 0;    // Handed out and not yet returned
+        size_t budget = 0;
+    };
+
+    // Never destroyed, so buffers may be released during static teardown
+    static BufferPool& instance();
+
+    // Uninitialized memory of at least size bytes. It returns to the pool
+    // when the last reference is dropped. Small requests bypass the pool.
+    std::shared_ptr<uint8_t[]> acquire(size_t size);
+
+    void set_budget(size_t bytes);
+    size_t budget() const;
+
+    // Free every idle buffer
+    void trim();
+
+    Stats stats() const;
+
+private:
+    explicit BufferPool(size_t budget);
+
+    struct Idle {
+        size_t capacity;
+        uint8_t* data;
+    };
+
+    static size_t size_class(size_t size);
+    void release(uint8_t* data, size_t capacity);
+    void evict_locked(size_t budget);
+
+    mutable std::mutex mutex_;
+    size_t budget_;
+    Stats stats_;
+
+    // Idle buffers oldest first, and per size class newest last
+    std::list<Idle> idle_;
+    std::unordered_map<size_t, std::vector<std::list<Idle>::iterator>> classes_;
+};
+
+} // namespace detail
+} // namespace pdfeditor
@@ -0,0 +1,157 @@
+#include "context_manager.h"
+
+#ifdef USE_MUPDF
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+namespace pdfeditor {
+namespace detail {
+
+namespace {
+    // Lock table handed to MuPDF so that contexts cloned from one base
+    // context can share its resource store from several threads.
+    struct ContextLocks {
+        std::mutex mutexes[FZ_LOCK_MAX];
+        
+        static void lock(void* user, int lock) {
+            static_cast<ContextLocks*>(user)->mutexes[lock].lock();
+        }
+        
+        static void unlock(void* user, int lock) {
+            static_cast<ContextLocks*>(user)->mutexes[lock].unlock();
+        }
+    };
+    
+    struct State {
+        std::mutex mutex;
+        ContextLocks locks;
+        fz_context* base = nullptr;
+        size_t store_bytes = FZ_STORE_DEFAULT;
+        std::atomic<uint64_t> generation{0};   // Bumped each time a base is created
+    };
+    
+    // Never destroyed: clones may outlive static teardown (thread exit
+    // handlers, leaked documents) and still need the locks
+    State& state() {
+        static State* s = new State;
+        return *s;
+    }
+    
+    bool initialize_locked(State& s) {
+        if (s.base) {
+            return true;
+        }
+        
+        fz_locks_context locks;
+        locks.user = &s.locks;
+        locks.lock = ContextLocks::lock;
+        locks.unlock = ContextLocks::unlock;
+        
+        s.base = fz_new_context(nullptr, &locks, s.store_bytes);
+        if (!s.base) {
+            return false;
+        }
+        
+        fz_try(s.base) {
+            fz_register_document_handlers(s.base);
+        }
+        fz_catch(s.base) {
+            fz_drop_context(s.base);
+            s.base = nullptr;
+            return false;
+        }
+        
+        ++s.generation;
+        return true;
+    }
+    
+    // A thread's clone, dropped by the thread-exit destructor
+    struct ThreadContext {
+        fz_context* ctx = nullptr;
+        uint64_t generation = 0;
+        
+        ~ThreadContext() {
+            if (ctx) {
+                fz_drop_context(ctx);
+            }
+        }
+    };
+}
+
+bool ContextManager::initialize(size_t store_bytes) {
+    State& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (!s.base) {
+        s.store_bytes = store_bytes;
+    }
+    return initialize_locked(s);
+}
+
+void ContextManager::shutdown() {
+    State& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (s.base) {
+        fz_drop_context(s.base);
+        s.base = nullptr;
+    }
+}
+
+bool ContextManager::is_initialized() {
+    State& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.base != nullptr;
+}
+
+bool ContextManager::set_store_size(size_t store_bytes) {
+    State& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.store_bytes = store_bytes;
+    return s.base == nullptr;
+}
+
+size_t ContextManager::store_size() {
+    State& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.store_bytes;
+}
+
+fz_context* ContextManager::thread_context() {
+    static thread_local ThreadContext current;
+    
+    // Fast path: this thread already has a clone of the current base
+    State& s = state();
+    if (current.ctx && current.generation == s.generation.load()) {
+        return current.ctx;
+    }
+    
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (!initialize_locked(s)) {
+        return nullptr;
+    }
+    
+    // A clone of a base from before a shutdown would not share the
+    // current store
+    if (current.ctx && current.generation != s.generation) {
+        fz_drop_context(current.ctx);
+        current.ctx = nullptr;
+    }
+    if (!current.ctx) {
+        current.ctx = fz_clone_context(s.base);
+        current.generation = s.generation;
+    }
+    return current.ctx;
+}
+
+fz_context* ContextManager::clone() {
+    State& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (!initialize_locked(s)) {
+        return nullptr;
+    }
+    return fz_clone_context(s.base);
+}
+
+} // namespace detail
+} // namespace pdfeditor
+#endif
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+
+#ifdef USE_MUPDF
+#include <mupdf/fitz.h>
+
+namespace pdfeditor {
+namespace detail {
+
+// Library-wide MuPDF contexts. One base context owns the resource store
+// (fonts, glyphs, decoded images) and the locks that let it be shared;
+// every thread and document works through a clone of it, so they all
+// share one store, and objects loaded through one clone may be used with
+// any other.
+class ContextManager {
+public:
+    // Create the base context with a store of store_bytes (0 = unlimited).
+    // Called from Library::initialize(); thread_context() and clone()
+    // initialize with the current store size if it was not.
+    static bool initialize(size_t store_bytes);
+    
+    // Drop the base context. Clones still in use stay valid until they are
+    // dropped themselves.
+    static void shutdown();
+    
+    static bool is_initialized();
+    
+    // Store size used by the next initialize(). MuPDF fixes a store's
+    // limit when it is created, so this returns false if the base context
+    // already exists and keeps its current store.
+    static bool set_store_size(size_t store_bytes);
+    static size_t store_size();
+    
+    // This thread's context, cloned on first use and dropped when the
+    // thread exits. Null if MuPDF could not be initialized.
+    static fz_context* thread_context();
+    
+    // A new clone for a worker thread or a long-lived owner such as a
+    // document; the caller drops it. Null on failure.
+    static fz_context* clone();
+};
+
+} // namespace detail
+} // namespace pdfeditor
+#endif
@@ -0,0 +1,103 @@
+#include "pdfeditor/core.h"
+#include "context_manager.h"
+#include <mutex>
+
+namespace pdfeditor {
+
+namespace {
+    struct LibraryState {
+        std::mutex mutex;
+        bool initialized = false;
+        std::string last_error;
+        Library::LogCallback log;
+    };
+    
+    LibraryState& library_state() {
+        static LibraryState state;
+        return state;
+    }
+}
+
+bool Library::initialize() {
+    LibraryState& state = library_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (state.initialized) {
+        return true;
+    }
+    
+#ifdef USE_MUPDF
+    if (!detail::ContextManager::initialize(detail::ContextManager::store_size())) {
+        state.last_error = "Failed to create MuPDF context";
+        if (state.log) {
+            state.log(state.last_error);
+        }
+        return false;
+    }
+#endif
+    
+    state.initialized = true;
+    return true;
+}
+
+void Library::shutdown() {
+    LibraryState& state = library_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (!state.initialized) {
+        return;
+    }
+    
+#ifdef USE_MUPDF
+    detail::ContextManager::shutdown();
+#endif
+    state.initialized = false;
+}
+
+bool Library::is_initialized() {
+    LibraryState& state = library_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    return state.initialized;
+}
+
+std::string Library::get_version() {
+    return std::to_string(VERSION_MAJOR) + "." +
+           std::to_string(VERSION_MINOR) + "." +
+           std::to_string(VERSION_PATCH);
+}
+
+void Library::get_version(int& major, int& minor, int& patch) {
+    major = VERSION_MAJOR;
+    minor = VERSION_MINOR;
+    patch = VERSION_PATCH;
+}
+
+// The store is sized when the base context is created, so this applies
+// from the next initialize()
+void Library::set_cache_size(size_t size_mb) {
+#ifdef USE_MUPDF
+    if (!detail::ContextManager::set_store_size(size_mb * 1024 * 1024)) {
+        LibraryState& state = library_state();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.last_error = "Cache size takes effect after shutdown() and initialize(); "
+                           "the current store keeps its size";
+        if (state.log) {
+            state.log(state.last_error);
+        }
+    }
+#else
+    (void)size_mb;
+#endif
+}
+
+std::string Library::get_last_error() {
+    LibraryState& state = library_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    return state.last_error;
+}
+
+void Library::set_log_callback(LogCallback callback) {
+    LibraryState& state = library_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.log = std::move(callback);
+}
+
+} // namespace pdfeditor
@@ -1,8 +1,17 @@
 #include "pdfeditor/document.h"
 #include "pdfeditor/core.h"
+#include "context_manager.h"
+#include "memory_stream.h"
+#include <algorithm>
+#include <atomic>
 #include <stdexcept>
 #include <fstream>
+#include <cstdio>
 #include <cstring>
+#include <deque>
+#include <filesystem>
+#include <list>
+#include <mutex>
 
 #ifdef USE_MUPDF
 #include <mupdf/fitz.h>
@@ -15,16 +24,21 @@ class Document::Impl {
 public:
     Impl() : ctx_(nullptr), doc_(nullptr) {
 #ifdef USE_MUPDF
-        ctx_ = fz_new_context(nullptr, nullptr, FZ_STORE_DEFAULT);
+        // A clone of the library's base context, so the document's
+        // resources live in the shared store and its pages can be drawn
+        // from any thread's context
+        ctx_ = detail::ContextManager::clone();
         if (!ctx_) {
             throw Exception(ErrorCode::OutOfMemory, "Failed to create MuPDF context");
         }
-        fz_register_document_handlers(ctx_);
 #endif
     }
     
     ~Impl() {
 #ifdef USE_MUPDF
+        // Pages hold references into the document
+        loaded_.clear();
+        pages_.clear();
         if (doc_) {
             fz_drop_document(ctx_, doc_);
         }
@@ -34,47 +48,89 @@ public:
 #endif
     }
     
-    bool open_file(const std::string& path, const std::string& password) {
+    bool open_file(const std::string& path, const std::string& password, FileAccess access) {
 #ifdef USE_MUPDF
+        // Mapped and read in place; stdio reads for what cannot be mapped
+        static const detail::MappedFile::Advice advice[] = {
+            detail::MappedFile::Advice::Normal,
+            detail::MappedFile::Advice::Sequential,
+            detail::MappedFile::Advice::Random
+        };
+        path_ = path;
+        if (auto mapped = detail::MappedFile::open(path, advice[static_cast<int>(access)])) {
+            const uint8_t* data = mapped->data();
+            const size_t size = mapped->size();
+            return open_shared(std::move(mapped), data, size, path.c_str(), password);
+        }
+        
         fz_try(ctx_) {
             doc_ = fz_open_document(ctx_, path.c_str());
-            if (!password.empty() && fz_needs_password(ctx_, doc_)) {
-                if (!fz_authenticate_password(ctx_, doc_, password.c_str())) {
-                    fz_drop_document(ctx_, doc_);
-                    doc_ = nullptr;
-                    return false;
-                }
-            }
         }
         fz_catch(ctx_) {
             return false;
         }
-        return doc_ != nullptr;
+        return authenticate(password);
 #else
         // TODO: Implement with alternative backend
         return false;
 #endif
     }
     
-    bool open_from_memory(const uint8_t* data, size_t size, const std::string& password) {
+    // Read size bytes at data in place, holding owner (if any) for as
+    // long as the document. magic names the format, as a file name or
+    // MIME type.
+    bool open_shared(
+        std::shared_ptr<const void> owner,
+        const uint8_t* data,
+        size_t size,
+        const char* magic,
+        const std::string& password
+    ) {
 #ifdef USE_MUPDF
+        fz_stream* stream = nullptr;
+        fz_var(stream);
+        
         fz_try(ctx_) {
-            fz_stream* stream = fz_open_memory(ctx_, data, size);
-            doc_ = fz_open_document_with_stream(ctx_, "pdf", stream);
+            if (owner) {
+                stream = detail::open_shared_memory(ctx_, std::move(owner), data, size);
+            } else {
+                stream = fz_open_memory(ctx_, data, size);
+            }
+            doc_ = fz_open_document_with_stream(ctx_, magic, stream);
+        }
+        fz_always(ctx_) {
+            // The document keeps its own reference
             fz_drop_stream(ctx_, stream);
-            
+        }
+        fz_catch(ctx_) {
+            return false;
+        }
+        return authenticate(password);
+#else
+        return false;
+#endif
+    }
+    
+    // With a password given, a document that needs one must accept it
+    bool authenticate(const std::string& password) {
+#ifdef USE_MUPDF
+        if (!doc_) return false;
+        
+        bool accepted = true;
+        fz_try(ctx_) {
             if (!password.empty() && fz_needs_password(ctx_, doc_)) {
-                if (!fz_authenticate_password(ctx_, doc_, password.c_str())) {
-                    fz_drop_document(ctx_, doc_);
-                    doc_ = nullptr;
-                    return false;
-                }
+                accepted = fz_authenticate_password(ctx_, doc_, password.c_str()) != 0;
             }
         }
         fz_catch(ctx_) {
-            return false;
+            accepted = false;
         }
-        return doc_ != nullptr;
+        
+        if (!accepted) {
+            fz_drop_document(ctx_, doc_);
+            doc_ = nullptr;
+        }
+        return accepted;
 #else
         return false;
 #endif
@@ -83,31 +139,169 @@ public:
     int page_count() const {
 #ifdef USE_MUPDF
         if (!doc_) return 0;
+        std::lock_guard<std::recursive_mutex> context(context_mutex_);
         return fz_count_pages(ctx_, doc_);
 #else
         return 0;
 #endif
     }
     
+    // True if path names the file the document was opened from
+    bool is_source(const std::string& path) const {
+        std::error_code ec;
+        return !path_.empty() && std::filesystem::equivalent(path, path_, ec);
+    }
+    
     bool save(const std::string& path) {
 #ifdef USE_MUPDF
         if (!doc_) return false;
         
+        std::lock_guard<std::recursive_mutex> context(context_mutex_);
+        
+        // The source file is still being read (and may be mapped), so it
+        // is replaced by a new file rather than rewritten in place
+        const std::string target = is_source(path) ? path + ".part" : path;
+        
         fz_try(ctx_) {
             pdf_document* pdf = pdf_specifics(ctx_, doc_);
             if (pdf) {
-                pdf_save_document(ctx_, pdf, path.c_str(), nullptr);
+                pdf_save_document(ctx_, pdf, target.c_str(), nullptr);
             }
         }
         fz_catch(ctx_) {
             return false;
         }
+        
+        if (target != path) {
+            std::error_code ec;
+            std::filesystem::rename(target, path, ec);
+            if (ec) {
+                std::filesystem::remove(target, ec);
+                return false;
+            }
+            // The document still reads the old bytes, which the file no
+            // longer holds
+            source_replaced_ = true;
+        }
         return true;
 #else
         return false;
 #endif
     }
     
+    bool save_incremental(const std::string& path) {
+#ifdef USE_MUPDF
+        if (!doc_) return false;
+        
+        std::lock_guard<std::recursive_mutex> context(context_mutex_);
+        pdf_document* pdf = pdf_specifics(ctx_, doc_);
+        if (!pdf) return false;
+        
+        // An update appended to a file that was since rewritten would
+        // point into bytes that are no longer there; write it whole
+        if (source_replaced_ && is_source(path)) {
+            return save(path);
+        }
+        
+        pdf_write_options options = pdf_default_write_options;
+        options.do_incremental = 1;
+        
+        fz_output* out = nullptr;
+        fz_var(out);
+        
+        bool saved = true;
+        fz_try(ctx_) {
+            if (!pdf_can_be_saved_incrementally(ctx_, pdf)) {
+                fz_throw(ctx_, FZ_ERROR_GENERIC, "Document cannot be updated incrementally");
+            }
+            
+            if (is_source(path)) {
+                // Appends to the file
+                pdf_save_document(ctx_, pdf, path.c_str(), &options);
+            } else {
+                // The original bytes, then the update; the offsets in the
+                // new xref section count from the start of the output
+                out = fz_new_output_with_path(ctx_, path.c_str(), 0);
+                copy_source(out);
+                pdf_write_document(ctx_, pdf, out, &options);
+                fz_close_output(ctx_, out);
+            }
+        }
+        fz_always(ctx_) {
+            fz_drop_output(ctx_, out);
+        }
+        fz_catch(ctx_) {
+            saved = false;
+        }
+        return saved;
+#else
+        return false;
+#endif
+    }
+    
+    bool save_to_memory(std::vector<uint8_t>& buffer) {
+#ifdef USE_MUPDF
+        buffer.clear();
+        if (!doc_) return false;
+        
+        std::lock_guard<std::recursive_mutex> context(context_mutex_);
+        pdf_document* pdf = pdf_specifics(ctx_, doc_);
+        if (!pdf) return false;
+        
+        fz_buffer* written = nullptr;
+        fz_output* out = nullptr;
+        fz_var(written);
+        fz_var(out);
+        
+        // Sized for about the file it was read from, to spare regrowing
+        bool saved = true;
+        fz_try(ctx_) {
+            written = fz_new_buffer(ctx_, pdf->file_size > 0 ? static_cast<size_t>(pdf->file_size) : 1024);
+            out = fz_new_output_with_buffer(ctx_, written);
+            pdf_write_document(ctx_, pdf, out, nullptr);
+            fz_close_output(ctx_, out);
+        }
+        fz_always(ctx_) {
+            fz_drop_output(ctx_, out);
+        }
+        fz_catch(ctx_) {
+            saved = false;
+        }
+        
+        // A vector cannot take over the buffer's storage, so the bytes
+        // are copied once
+        if (saved) {
+            unsigned char* data = nullptr;
+            const size_t size = fz_buffer_storage(ctx_, written, &data);
+            try {
+                buffer.assign(data, data + size);
+            } catch (const std::bad_alloc&) {
+                buffer.clear();
+                saved = false;
+            }
+        }
+        fz_drop_buffer(ctx_, written);
+        return saved;
+#else
+        return false;
+#endif
+    }
+    
+#ifdef USE_MUPDF
+    // Write the bytes the document was opened from to out
+    void copy_source(fz_output* out) {
+        pdf_document* pdf = pdf_specifics(ctx_, doc_);
+        unsigned char chunk[16384];
+        
+        fz_seek(ctx_, pdf->file, 0, SEEK_SET);
+        for (;;) {
+            const size_t n = fz_read(ctx_, pdf->file, chunk, sizeof(chunk));
+            if (n == 0) break;
+            fz_write_data(ctx_, out, chunk, n);
+        }
+    }
+#endif
+    
 #ifdef USE_MUPDF
     fz_context* ctx_;
     fz_document* doc_;
@@ -115,10 +309,537 @@ public:
     void* ctx_;
     void* doc_;
 #endif
+    std::string path_;      // File opened from, if any
+    bool source_replaced_ = false;  // save() has rewritten that file
+    
+    // Locks, always taken in this order:
+    //   context_mutex_   every use of ctx_ and doc_ once the document is
+    //                    open, from MuPDF's document-level calls to
+    //                    interpreting pages. Recursive, as larger
+    //                    operations holding it count and load pages.
+    //                    Page::interpret_mutex() is this lock.
+    //   pages_mutex_     pages_, loaded_, detached_ and max_loaded_
+    //   geometry_mutex_  geometry_ and geometry_state_
+    //   Page::Impl::damage_mutex_, with nothing taken under it
+    // Opening runs before the document is shared and takes none.
+    mutable std::recursive_mutex context_mutex_;
+    
+    // Load the page's fz_page if it is not, and mark it most recently
+    // used. The page is returned with a reference of its own, taken
+    // before trim_pages() can drop the list's one. Null if it cannot be
+    // loaded.
+    void* load_page(Page::Impl& page);
+    
+    // Drop least recently used pages beyond max_loaded_; call with
+    // context_mutex_ and pages_mutex_ held
+    void trim_pages();
+    
+    // Geometry of one page from the table, filling it first if need be
+    bool page_geometry(int index, PageGeometry& geometry);
+    
+    // Page tree edits, keeping the page objects and geometry in step
+    bool insert_page(int index, float width, float height);
+    bool delete_page(int index);
+    bool rotate_page(int index, PageRotation rotation);
     
+    // Page geometry as parallel arrays, one element per page, so that
+    // laying out a long document runs through a few compact arrays
+    struct GeometryTable {
+        std::vector<Rect> mediabox;
+        std::vector<Rect> cropbox;
+        std::vector<uint16_t> rotation;     // Degrees
+        std::vector<float> user_unit;
+        
+        size_t size() const { return rotation.size(); }
+        
+        void reserve(size_t pages) {
+            mediabox.reserve(pages);
+            cropbox.reserve(pages);
+            rotation.reserve(pages);
+            user_unit.reserve(pages);
+        }
+        
+        void insert(size_t at, const PageGeometry& page) {
+            mediabox.insert(mediabox.begin() + at, page.mediabox);
+            cropbox.insert(cropbox.begin() + at, page.cropbox);
+            rotation.insert(rotation.begin() + at, static_cast<uint16_t>(page.rotation));
+            user_unit.insert(user_unit.begin() + at, page.user_unit);
+        }
+        
+        void erase(size_t at) {
+            mediabox.erase(mediabox.begin() + at);
+            cropbox.erase(cropbox.begin() + at);
+            rotation.erase(rotation.begin() + at);
+            user_unit.erase(user_unit.begin() + at);
+        }
+        
+        PageGeometry get(size_t at) const {
+            PageGeometry page;
+            page.mediabox = mediabox[at];
+            page.cropbox = cropbox[at];
+            page.rotation = static_cast<PageRotation>(rotation[at]);
+            page.user_unit = user_unit[at];
+            return page;
+        }
+    };
+    
+    // Read every page's geometry from the page tree into table, without
+    // loading any page. False if there is no PDF page tree or it does not
+    // match the page count.
+    bool read_geometry(GeometryTable& table);
+    
+#ifdef USE_MUPDF
+    // The boxes and rotation MuPDF lays a page out with, given the
+    // MediaBox, CropBox and Rotate in force for it, inherited or its own
+    PageGeometry geometry_of(pdf_obj* page, pdf_obj* mediabox, pdf_obj* cropbox, pdf_obj* rotate);
+#endif
+    
+    enum class GeometryState { Unread, Ready, Unavailable };
+    
+    static constexpr size_t kDefaultLoadedPages = 64;
+    
+    // Page objects are created on first use and kept, so that a Page*
+    // stays valid; only max_loaded_ of them hold a parsed page at a time
+    mutable std::mutex pages_mutex_;
     std::vector<std::unique_ptr<Page>> pages_;
+    std::list<Page::Impl*> loaded_;     // Most recently used first
+    size_t max_loaded_ = kDefaultLoadedPages;
+    
+    // Page objects of deleted pages, kept so that their Page* stays valid
+    std::vector<std::unique_ptr<Page>> detached_;
+    
+    mutable std::mutex geometry_mutex_;
+    GeometryTable geometry_;
+    GeometryState geometry_state_ = GeometryState::Unread;
 };
 
+// Page implementation
+class Page::Impl {
+public:
+    Impl() : ctx_(nullptr), page_(nullptr), page_index_(0) {}
+    
+    ~Impl() {
+        unload();
+    }
+    
+    // The parsed page, loaded through the owning document if need be,
+    // with a reference the caller drops. Null if it cannot be loaded.
+    void* handle() {
+        if (owner_) {
+            return owner_->load_page(*this);
+        }
+#ifdef USE_MUPDF
+        return page_ ? fz_keep_page(ctx_, page_) : nullptr;
+#else
+        return page_;
+#endif
+    }
+    
+    void unload() {
+#ifdef USE_MUPDF
+        if (page_) {
+            fz_drop_page(ctx_, page_);
+            page_ = nullptr;
+        }
+#endif
+    }
+    
+#ifdef USE_MUPDF
+    fz_context* ctx_;
+    fz_page* page_;
+#else
+    void* ctx_;
+    void* page_;
+#endif
+    int page_index_;
+    
+    // Page::id()
+    const uint64_t id_ = next_id();
+    
+    static uint64_t next_id() {
+        static std::atomic<uint64_t> counter(0);
+        return ++counter;
+    }
+    
+    // Document that loads page_ on demand, and the page's place in its
+    // list of loaded pages while page_ is set
+    Document::Impl* owner_ = nullptr;
+    std::list<Page::Impl*>::iterator loaded_at_;
+    
+    // Damage record: (revision, area) of recent edits, oldest first. It
+    // covers every change after damage_base_; older ones were whole-page
+    // or have been dropped.
+    static constexpr size_t kMaxDamage = 64;
+    
+    mutable std::mutex damage_mutex_;
+    uint64_t revision_ = 0;
+    uint64_t content_revision_ = 0;
+    uint64_t damage_base_ = 0;
+    std::deque<std::pair<uint64_t, Rect>> damage_;
+    
+    // content_fingerprint() as of fingerprint_revision_
+    uint64_t fingerprint_ = 0;
+    uint64_t fingerprint_revision_ = UINT64_MAX;
+    
+    uint64_t compute_fingerprint();
+};
+
+void* Document::Impl::load_page(Page::Impl& page) {
+    std::lock_guard<std::recursive_mutex> context(context_mutex_);
+    std::lock_guard<std::mutex> lock(pages_mutex_);
+    if (page.page_) {
+        loaded_.splice(loaded_.begin(), loaded_, page.loaded_at_);
+#ifdef USE_MUPDF
+        return fz_keep_page(ctx_, page.page_);
+#else
+        return page.page_;
+#endif
+    }
+    
+#ifdef USE_MUPDF
+    if (!doc_) return nullptr;
+    
+    fz_page* loaded = nullptr;
+    fz_try(ctx_) {
+        loaded = fz_load_page(ctx_, doc_, page.page_index_);
+    }
+    fz_catch(ctx_) {
+        return nullptr;
+    }
+    
+    page.ctx_ = ctx_;
+    page.page_ = loaded;
+    page.loaded_at_ = loaded_.insert(loaded_.begin(), &page);
+    trim_pages();
+    return fz_keep_page(ctx_, loaded);
+#else
+    return nullptr;
+#endif
+}
+
+void Document::Impl::trim_pages() {
+    // Handles given out hold references of their own, so a page dropped
+    // here stays alive until its last handle is released
+    while (loaded_.size() > max_loaded_) {
+        Page::Impl* page = loaded_.back();
+        loaded_.pop_back();
+        page->unload();
+    }
+}
+
+bool Document::Impl::page_geometry(int index, PageGeometry& geometry) {
+    std::unique_lock<std::mutex> lock(geometry_mutex_);
+    if (geometry_state_ == GeometryState::Unread) {
+        // Reading walks the page tree through the document context,
+        // which is locked before geometry_mutex_
+        lock.unlock();
+        std::lock_guard<std::recursive_mutex> context(context_mutex_);
+        lock.lock();
+        if (geometry_state_ == GeometryState::Unread) {
+            geometry_state_ = read_geometry(geometry_) ? GeometryState::Ready : GeometryState::Unavailable;
+        }
+    }
+    if (geometry_state_ != GeometryState::Ready || index < 0 || static_cast<size_t>(index) >= geometry_.size()) {
+        return false;
+    }
+    
+    geometry = geometry_.get(static_cast<size_t>(index));
+    return true;
+}
+
+bool Document::Impl::read_geometry(GeometryTable& table) {
+#ifdef USE_MUPDF
+    pdf_document* pdf = doc_ ? pdf_specifics(ctx_, doc_) : nullptr;
+    if (!pdf) return false;
+    
+    static constexpr size_t kMaxTreeDepth = 64;
+    
+    // A page tree node with the inheritable attributes in force below it
+    struct Level {
+        pdf_obj* node;
+        int next_kid;
+        pdf_obj* mediabox;
+        pdf_obj* cropbox;
+        pdf_obj* rotate;
+    };
+    
+    auto enter = [this](pdf_obj* node, const Level* parent) {
+        pdf_obj* mediabox = pdf_dict_get(ctx_, node, PDF_NAME(MediaBox));
+        pdf_obj* cropbox = pdf_dict_get(ctx_, node, PDF_NAME(CropBox));
+        pdf_obj* rotate = pdf_dict_get(ctx_, node, PDF_NAME(Rotate));
+        return Level{
+            node,
+            0,
+            mediabox || !parent ? mediabox : parent->mediabox,
+            cropbox || !parent ? cropbox : parent->cropbox,
+            rotate || !parent ? rotate : parent->rotate
+        };
+    };
+    
+    const size_t count = static_cast<size_t>(std::max(page_count(), 0));
+    
+    // Depth first, with the path kept marked so that a cycle in a broken
+    // tree ends the walk instead of looping. Everything is allocated up
+    // front: no C++ exception may unwind through MuPDF.
+    std::vector<Level> path;
+    path.reserve(kMaxTreeDepth);
+    table.reserve(count);
+    
+    bool read = true;
+    fz_var(read);
+    
+    fz_try(ctx_) {
+        pdf_obj* root = pdf_dict_get(ctx_, pdf_dict_get(ctx_, pdf_trailer(ctx_, pdf), PDF_NAME(Root)), PDF_NAME(Pages));
+        if (!pdf_is_dict(ctx_, root)) {
+            fz_throw(ctx_, FZ_ERROR_GENERIC, "No page tree");
+        }
+        pdf_mark_obj(ctx_, root);
+        path.push_back(enter(root, nullptr));
+        
+        while (!path.empty()) {
+            Level& level = path.back();
+            pdf_obj* kids = pdf_dict_get(ctx_, level.node, PDF_NAME(Kids));
+            if (level.next_kid >= pdf_array_len(ctx_, kids)) {
+                pdf_unmark_obj(ctx_, level.node);
+                path.pop_back();
+                continue;
+            }
+            
+            pdf_obj* kid = pdf_array_get(ctx_, kids, level.next_kid++);
+            const Level child = enter(kid, &level);
+            const bool leaf = pdf_name_eq(ctx_, pdf_dict_get(ctx_, kid, PDF_NAME(Type)), PDF_NAME(Page)) ||
+                              !pdf_is_array(ctx_, pdf_dict_get(ctx_, kid, PDF_NAME(Kids)));
+            if (leaf) {
+                if (table.size() >= count) {
+                    fz_throw(ctx_, FZ_ERROR_GENERIC, "More pages than counted");
+                }
+                table.insert(table.size(), geometry_of(child.node, child.mediabox, child.cropbox, child.rotate));
+            } else {
+                if (path.size() >= kMaxTreeDepth || pdf_mark_obj(ctx_, kid)) {
+                    fz_throw(ctx_, FZ_ERROR_GENERIC, "Page tree too deep or cyclic");
+                }
+                path.push_back(child);
+            }
+        }
+    }
+    fz_always(ctx_) {
+        for (const Level& level : path) {
+            pdf_unmark_obj(ctx_, level.node);
+        }
+    }
+    fz_catch(ctx_) {
+        read = false;
+    }
+    
+    // MuPDF repairs some broken trees when counting; go by its pages then
+    if (!read || table.size() != count) {
+        table = GeometryTable();
+        return false;
+    }
+    return true;
+#else
+    (void)table;
+    return false;
+#endif
+}
+
+#ifdef USE_MUPDF
+PageGeometry Document::Impl::geometry_of(pdf_obj* page, pdf_obj* mediabox_obj, pdf_obj* cropbox_obj, pdf_obj* rotate_obj) {
+    fz_rect mediabox = pdf_to_rect(ctx_, mediabox_obj);
+    if (mediabox.x1 <= mediabox.x0 || mediabox.y1 <= mediabox.y0) {
+        mediabox = fz_make_rect(0, 0, 612, 792);
+    }
+    fz_rect cropbox = mediabox;
+    if (cropbox_obj) {
+        cropbox = fz_intersect_rect(pdf_to_rect(ctx_, cropbox_obj), mediabox);
+        if (cropbox.x1 <= cropbox.x0 || cropbox.y1 <= cropbox.y0) {
+            cropbox = mediabox;
+        }
+    }
+    
+    int rotate = pdf_to_int(ctx_, rotate_obj) % 360;
+    if (rotate < 0) rotate += 360;
+    rotate = (rotate + 45) / 90 * 90 % 360;
+    
+    const float user_unit = pdf_to_real(ctx_, pdf_dict_get(ctx_, page, PDF_NAME(UserUnit)));
+    
+    PageGeometry geometry;
+    geometry.mediabox = Rect(mediabox.x0, mediabox.y0, mediabox.x1, mediabox.y1);
+    geometry.cropbox = Rect(cropbox.x0, cropbox.y0, cropbox.x1, cropbox.y1);
+    geometry.rotation = static_cast<PageRotation>(rotate);
+    geometry.user_unit = user_unit > 0 ? user_unit : 1.0f;
+    return geometry;
+}
+#endif
+
+bool Document::Impl::insert_page(int index, float width, float height) {
+#ifdef USE_MUPDF
+    std::lock_guard<std::recursive_mutex> context(context_mutex_);
+    pdf_document* pdf = doc_ ? pdf_specifics(ctx_, doc_) : nullptr;
+    if (!pdf || width <= 0 || height <= 0) return false;
+    
+    std::lock_guard<std::mutex> pages_lock(pages_mutex_);
+    std::lock_guard<std::mutex> geometry_lock(geometry_mutex_);
+    if (index < 0 || index > page_count()) return false;
+    
+    pdf_obj* resources = nullptr;
+    fz_buffer* contents = nullptr;
+    pdf_obj* page = nullptr;
+    fz_var(resources);
+    fz_var(contents);
+    fz_var(page);
+    
+    // Read back once in the tree, so a CropBox or Rotate the page
+    // inherits from it counts
+    PageGeometry geometry;
+    bool inserted = true;
+    fz_try(ctx_) {
+        resources = pdf_new_dict(ctx_, pdf, 1);
+        contents = fz_new_buffer(ctx_, 0);
+        page = pdf_add_page(ctx_, pdf, fz_make_rect(0, 0, width, height), 0, resources, contents);
+        pdf_insert_page(ctx_, pdf, index, page);
+        geometry = geometry_of(page,
+                               pdf_dict_get_inheritable(ctx_, page, PDF_NAME(MediaBox)),
+                               pdf_dict_get_inheritable(ctx_, page, PDF_NAME(CropBox)),
+                               pdf_dict_get_inheritable(ctx_, page, PDF_NAME(Rotate)));
+    }
+    fz_always(ctx_) {
+        pdf_drop_obj(ctx_, page);
+        pdf_drop_obj(ctx_, resources);
+        fz_drop_buffer(ctx_, contents);
+    }
+    fz_catch(ctx_) {
+        inserted = false;
+    }
+    
+    if (!inserted) {
+        // The tree may have changed part way; read it again when needed
+        geometry_state_ = GeometryState::Unread;
+        geometry_ = GeometryTable();
+        return false;
+    }
+    
+    if (geometry_state_ == GeometryState::Ready) {
+        geometry_.insert(static_cast<size_t>(index), geometry);
+    }
+    
+    // Pages after the new one move up a number. MuPDF finds loaded pages
+    // by number, so theirs are dropped and loaded again under the new one.
+    if (static_cast<size_t>(index) < pages_.size()) {
+        pages_.insert(pages_.begin() + index, nullptr);
+        for (size_t i = static_cast<size_t>(index) + 1; i < pages_.size(); ++i) {
+            if (!pages_[i]) continue;
+            Page::Impl& shell = *pages_[i]->impl_;
+            if (shell.page_) {
+                loaded_.erase(shell.loaded_at_);
+                shell.unload();
+            }
+            shell.page_index_ = static_cast<int>(i);
+        }
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool Document::Impl::delete_page(int index) {
+#ifdef USE_MUPDF
+    std::lock_guard<std::recursive_mutex> context(context_mutex_);
+    pdf_document* pdf = doc_ ? pdf_specifics(ctx_, doc_) : nullptr;
+    if (!pdf) return false;
+    
+    std::lock_guard<std::mutex> pages_lock(pages_mutex_);
+    std::lock_guard<std::mutex> geometry_lock(geometry_mutex_);
+    if (index < 0 || index >= page_count()) return false;
+    
+    // Loaded pages from here on are renumbered or gone
+    for (size_t i = static_cast<size_t>(index); i < pages_.size(); ++i) {
+        if (pages_[i] && pages_[i]->impl_->page_) {
+            loaded_.erase(pages_[i]->impl_->loaded_at_);
+            pages_[i]->impl_->unload();
+        }
+    }
+    
+    bool deleted = true;
+    fz_try(ctx_) {
+        pdf_delete_page(ctx_, pdf, index);
+    }
+    fz_catch(ctx_) {
+        deleted = false;
+    }
+    
+    if (!deleted) {
+        geometry_state_ = GeometryState::Unread;
+        geometry_ = GeometryTable();
+        return false;
+    }
+    
+    if (geometry_state_ == GeometryState::Ready) {
+        geometry_.erase(static_cast<size_t>(index));
+    }
+    
+    if (static_cast<size_t>(index) < pages_.size()) {
+        if (pages_[index]) {
+            Page::Impl& shell = *pages_[index]->impl_;
+            shell.owner_ = nullptr;
+            shell.page_index_ = -1;
+            detached_.push_back(std::move(pages_[index]));
+            detached_.back()->add_damage();
+        }
+        pages_.erase(pages_.begin() + index);
+        for (size_t i = static_cast<size_t>(index); i < pages_.size(); ++i) {
+            if (pages_[i]) {
+                pages_[i]->impl_->page_index_ = static_cast<int>(i);
+            }
+        }
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool Document::Impl::rotate_page(int index, PageRotation rotation) {
+#ifdef USE_MUPDF
+    std::lock_guard<std::recursive_mutex> context(context_mutex_);
+    pdf_document* pdf = doc_ ? pdf_specifics(ctx_, doc_) : nullptr;
+    if (!pdf || index < 0 || index >= page_count()) return false;
+    
+    bool rotated = true;
+    fz_try(ctx_) {
+        pdf_obj* page = pdf_lookup_page_obj(ctx_, pdf, index);
+        pdf_dict_put_int(ctx_, page, PDF_NAME(Rotate), static_cast<int>(rotation));
+    }
+    fz_catch(ctx_) {
+        rotated = false;
+    }
+    if (!rotated) return false;
+    
+    {
+        std::lock_guard<std::mutex> lock(geometry_mutex_);
+        if (geometry_state_ == GeometryState::Ready) {
+            geometry_.rotation[static_cast<size_t>(index)] = static_cast<uint16_t>(rotation);
+        }
+    }
+    
+    // The page keeps its loaded page; MuPDF reads Rotate as it draws
+    Page* page = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(pages_mutex_);
+        if (static_cast<size_t>(index) < pages_.size()) {
+            page = pages_[index].get();
+        }
+    }
+    if (page) {
+        page->add_damage();
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
 // Document implementation
 Document::Document() : impl_(std::make_unique<Impl>()) {}
 
@@ -126,11 +847,12 @@ Document::~Document() = default;
 
 Result<std::unique_ptr<Document>> Document::open(
     const std::string& path,
-    const std::string& password
+    const std::string& password,
+    FileAccess access
 ) {
     auto doc = std::unique_ptr<Document>(new Document());
     
-    if (!doc->impl_->open_file(path, password)) {
+    if (!doc->impl_->open_file(path, password, access)) {
         return Result<std::unique_ptr<Document>>(
             ErrorCode::InvalidPDF,
             "Failed to open PDF document"
@@ -152,7 +874,36 @@ Result<std::unique_ptr<Document>> Document::open_from_memory(
 ) {
     auto doc = std::unique_ptr<Document>(new Document());
     
-    if (!doc->impl_->open_from_memory(data, size, password)) {
+    if (!doc->impl_->open_shared(nullptr, data, size, "pdf", password)) {
+        return Result<std::unique_ptr<Document>>(
+            ErrorCode::InvalidPDF,
+            "Failed to open PDF from memory"
+        );
+    }
+    
+    return Result<std::unique_ptr<Document>>(std::move(doc));
+}
+
+Result<std::unique_ptr<Document>> Document::open_from_memory(
+    std::vector<uint8_t>&& data,
+    const std::string& password
+) {
+    // Moving the vector into the owner keeps its storage where it is
+    auto owned = std::make_shared<std::vector<uint8_t>>(std::move(data));
+    const uint8_t* bytes = owned->data();
+    const size_t size = owned->size();
+    return open_from_memory(std::shared_ptr<const uint8_t>(std::move(owned), bytes), size, password);
+}
+
+Result<std::unique_ptr<Document>> Document::open_from_memory(
+    std::shared_ptr<const uint8_t> data,
+    size_t size,
+    const std::string& password
+) {
+    auto doc = std::unique_ptr<Document>(new Document());
+    
+    const uint8_t* bytes = data.get();
+    if (!bytes || !doc->impl_->open_shared(std::move(data), bytes, size, "pdf", password)) {
         return Result<std::unique_ptr<Document>>(
             ErrorCode::InvalidPDF,
             "Failed to open PDF from memory"
@@ -167,13 +918,11 @@ bool Document::save(const std::string& path) {
 }
 
 bool Document::save_incremental(const std::string& path) {
-    // TODO: Implement incremental save
-    return save(path);
+    return impl_->save_incremental(path);
 }
 
 bool Document::save_to_memory(std::vector<uint8_t>& buffer) {
-    // TODO: Implement save to memory
-    return false;
+    return impl_->save_to_memory(buffer);
 }
 
 int Document::page_count() const {
@@ -188,28 +937,45 @@ DocumentInfo Document::get_info() const {
     info.subject = get_subject();
     info.is_encrypted = is_encrypted();
     info.is_linearized = is_linearized();
+    info.version = get_version();
     // TODO: Fill in other fields
     return info;
 }
 
 PDFVersion Document::get_version() const {
-    // TODO: Implement version detection
+#ifdef USE_MUPDF
+    std::lock_guard<std::recursive_mutex> context(impl_->context_mutex_);
+    pdf_document* pdf = impl_->doc_ ? pdf_specifics(impl_->ctx_, impl_->doc_) : nullptr;
+    if (pdf) {
+        // MuPDF keeps the header version as major * 10 + minor
+        if (pdf->version >= 20) return PDFVersion::PDF_2_0;
+        if (pdf->version >= 10 && pdf->version <= 17) {
+            return static_cast<PDFVersion>(pdf->version - 10);
+        }
+    }
+#endif
     return PDFVersion::PDF_1_7;
 }
 
 Page* Document::get_page(int index) {
-    if (index < 0 || index >= page_count()) {
+    // Held across the count, so the page cannot go away under us
+    std::lock_guard<std::recursive_mutex> context(impl_->context_mutex_);
+    const int count = page_count();
+    if (index < 0 || index >= count) {
         return nullptr;
     }
     
-    // Ensure page is loaded
+    std::lock_guard<std::mutex> lock(impl_->pages_mutex_);
     if (index >= static_cast<int>(impl_->pages_.size())) {
-        impl_->pages_.resize(page_count());
+        impl_->pages_.resize(count);
     }
     
+    // The page itself is only parsed when something needs its handle
     if (!impl_->pages_[index]) {
-        impl_->pages_[index] = std::unique_ptr<Page>(new Page());
-        // TODO: Initialize page with MuPDF page handle
+        auto page = std::unique_ptr<Page>(new Page());
+        page->impl_->owner_ = impl_.get();
+        page->impl_->page_index_ = index;
+        impl_->pages_[index] = std::move(page);
     }
     
     return impl_->pages_[index].get();
@@ -227,14 +993,33 @@ std::vector<Page*> Document::get_pages() {
     return pages;
 }
 
+void Document::set_page_cache_size(size_t pages) {
+    std::lock_guard<std::recursive_mutex> context(impl_->context_mutex_);
+    std::lock_guard<std::mutex> lock(impl_->pages_mutex_);
+    impl_->max_loaded_ = std::max<size_t>(pages, 1);
+    impl_->trim_pages();
+}
+
+size_t Document::page_cache_size() const {
+    std::lock_guard<std::mutex> lock(impl_->pages_mutex_);
+    return impl_->max_loaded_;
+}
+
+size_t Document::loaded_page_count() const {
+    std::lock_guard<std::mutex> lock(impl_->pages_mutex_);
+    return impl_->loaded_.size();
+}
+
+bool Document::get_page_geometry(int index, PageGeometry& geometry) const {
+    return impl_->page_geometry(index, geometry);
+}
+
 bool Document::insert_page(int index, float width, float height) {
-    // TODO: Implement page insertion
-    return false;
+    return impl_->insert_page(index, width, height);
 }
 
 bool Document::delete_page(int index) {
-    // TODO: Implement page deletion
-    return false;
+    return impl_->delete_page(index);
 }
 
 bool Document::move_page(int from_index, int to_index) {
@@ -243,8 +1028,7 @@ bool Document::move_page(int from_index, int to_index) {
 }
 
 bool Document::rotate_page(int index, PageRotation rotation) {
-    // TODO: Implement page rotation
-    return false;
+    return impl_->rotate_page(index, rotation);
 }
 
 std::unique_ptr<Document> Document::extract_pages(const std::vector<int>& page_indices) {
@@ -314,6 +1098,7 @@ void Document::set_producer(const std::string& producer) {
 bool Document::is_encrypted() const {
 #ifdef USE_MUPDF
     if (!impl_->doc_) return false;
+    std::lock_guard<std::recursive_mutex> context(impl_->context_mutex_);
     return fz_needs_password(impl_->ctx_, impl_->doc_);
 #else
     return false;
@@ -348,8 +1133,13 @@ bool Document::remove_password() {
 }
 
 bool Document::is_linearized() const {
-    // TODO: Check if document is linearized
+#ifdef USE_MUPDF
+    std::lock_guard<std::recursive_mutex> context(impl_->context_mutex_);
+    pdf_document* pdf = impl_->doc_ ? pdf_specifics(impl_->ctx_, impl_->doc_) : nullptr;
+    return pdf && pdf_doc_was_linearized(impl_->ctx_, pdf);
+#else
     return false;
+#endif
 }
 
 bool Document::linearize() {
@@ -440,37 +1230,127 @@ void* Document::get_handle() const {
     return impl_->doc_;
 }
 
-// Page implementation
-class Page::Impl {
-public:
-    Impl() : ctx_(nullptr), page_(nullptr), page_index_(0) {}
-    
-    ~Impl() {
+std::recursive_mutex& Document::interpret_mutex() const {
+    return impl_->context_mutex_;
+}
+
 #ifdef USE_MUPDF
-        if (page_) {
-            fz_drop_page(ctx_, page_);
+namespace {
+    uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ULL;
         }
-#endif
+        return hash;
+    }
+    
+    // Tight serialization of obj. Indirect references print as "n g R",
+    // so what they point at counts by object id, not by content.
+    uint64_t hash_object(fz_context* ctx, uint64_t hash, pdf_obj* obj) {
+        size_t length = 0;
+        char* text = pdf_sprint_obj(ctx, nullptr, 0, &length, obj, 1, 0);
+        hash = fnv1a(hash, text, length);
+        fz_free(ctx, text);
+        return hash;
     }
     
+    uint64_t hash_stream(fz_context* ctx, uint64_t hash, pdf_obj* stream) {
+        if (!pdf_is_stream(ctx, stream)) {
+            return hash;
+        }
+        
+        // Raw bytes: equal encoded streams decode the same
+        hash = hash_object(ctx, hash, pdf_dict_get(ctx, stream, PDF_NAME(Filter)));
+        hash = hash_object(ctx, hash, pdf_dict_get(ctx, stream, PDF_NAME(DecodeParms)));
+        
+        fz_buffer* buffer = pdf_load_raw_stream(ctx, stream);
+        unsigned char* data = nullptr;
+        const size_t size = fz_buffer_storage(ctx, buffer, &data);
+        hash = fnv1a(hash, data, size);
+        fz_drop_buffer(ctx, buffer);
+        return hash;
+    }
+}
+#endif
+
+uint64_t Page::Impl::compute_fingerprint() {
 #ifdef USE_MUPDF
-    fz_context* ctx_;
-    fz_page* page_;
+    fz_page* fz_pg = static_cast<fz_page*>(handle());
+    if (!fz_pg) return 0;
+    
+    pdf_page* pdf_pg = pdf_page_from_fz_page(ctx_, fz_pg);
+    if (!pdf_pg) {
+        fz_drop_page(ctx_, fz_pg);
+        return 0;
+    }
+    
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    
+    fz_var(hash);
+    
+    fz_try(ctx_) {
+        pdf_obj* page = pdf_pg->obj;
+        
+        pdf_obj* contents = pdf_dict_get(ctx_, page, PDF_NAME(Contents));
+        if (pdf_is_array(ctx_, contents)) {
+            const int n = pdf_array_len(ctx_, contents);
+            for (int i = 0; i < n; ++i) {
+                hash = hash_stream(ctx_, hash, pdf_array_get(ctx_, contents, i));
+            }
+        } else {
+            hash = hash_stream(ctx_, hash, contents);
+        }
+        
+        // Everything else that changes the drawing, including inherited
+        // attributes
+        hash = hash_object(ctx_, hash, pdf_resolve_indirect(ctx_,
+            pdf_dict_get_inheritable(ctx_, page, PDF_NAME(Resources))));
+        hash = hash_object(ctx_, hash, pdf_dict_get_inheritable(ctx_, page, PDF_NAME(MediaBox)));
+        hash = hash_object(ctx_, hash, pdf_dict_get_inheritable(ctx_, page, PDF_NAME(CropBox)));
+        hash = hash_object(ctx_, hash, pdf_dict_get_inheritable(ctx_, page, PDF_NAME(Rotate)));
+        hash = hash_object(ctx_, hash, pdf_dict_get(ctx_, page, PDF_NAME(UserUnit)));
+        hash = hash_object(ctx_, hash, pdf_dict_get(ctx_, page, PDF_NAME(Group)));
+        hash = hash_object(ctx_, hash, pdf_dict_get(ctx_, page, PDF_NAME(Annots)));
+    }
+    fz_always(ctx_) {
+        fz_drop_page(ctx_, fz_pg);
+    }
+    fz_catch(ctx_) {
+        return 0;
+    }
+    
+    // 0 is reserved for unknown
+    return hash ? hash : 1;
 #else
-    void* ctx_;
-    void* page_;
+    return 0;
 #endif
-    int page_index_;
-};
+}
 
 Page::Page() : impl_(std::make_unique<Impl>()) {}
 
 Page::~Page() = default;
 
 float Page::width() const {
+    PageGeometry geometry;
+    if (impl_->owner_ && impl_->owner_->page_geometry(impl_->page_index_, geometry)) {
+        return geometry.width();
+    }
+    
 #ifdef USE_MUPDF
-    if (!impl_->page_) return 0.0f;
-    fz_rect bounds = fz_bound_page(impl_->ctx_, impl_->page_);
+    std::lock_guard<std::recursive_mutex> context(interpret_mutex());
+    fz_page* page = static_cast<fz_page*>(impl_->handle());
+    if (!page) return 0.0f;
+    fz_rect bounds = fz_empty_rect;
+    fz_try(impl_->ctx_) {
+        bounds = fz_bound_page(impl_->ctx_, page);
+    }
+    fz_always(impl_->ctx_) {
+        fz_drop_page(impl_->ctx_, page);
+    }
+    fz_catch(impl_->ctx_) {
+        return 0.0f;
+    }
     return bounds.x1 - bounds.x0;
 #else
     return 595.0f; // A4 default
@@ -478,9 +1358,25 @@ float Page::width() const {
 }
 
 float Page::height() const {
+    PageGeometry geometry;
+    if (impl_->owner_ && impl_->owner_->page_geometry(impl_->page_index_, geometry)) {
+        return geometry.height();
+    }
+    
 #ifdef USE_MUPDF
-    if (!impl_->page_) return 0.0f;
-    fz_rect bounds = fz_bound_page(impl_->ctx_, impl_->page_);
+    std::lock_guard<std::recursive_mutex> context(interpret_mutex());
+    fz_page* page = static_cast<fz_page*>(impl_->handle());
+    if (!page) return 0.0f;
+    fz_rect bounds = fz_empty_rect;
+    fz_try(impl_->ctx_) {
+        bounds = fz_bound_page(impl_->ctx_, page);
+    }
+    fz_always(impl_->ctx_) {
+        fz_drop_page(impl_->ctx_, page);
+    }
+    fz_catch(impl_->ctx_) {
+        return 0.0f;
+    }
     return bounds.y1 - bounds.y0;
 #else
     return 842.0f; // A4 default
@@ -488,10 +1384,18 @@ float Page::height() const {
 }
 
 Rect Page::get_mediabox() const {
+    PageGeometry geometry;
+    if (impl_->owner_ && impl_->owner_->page_geometry(impl_->page_index_, geometry)) {
+        return geometry.mediabox;
+    }
     return Rect(0, 0, width(), height());
 }
 
 Rect Page::get_cropbox() const {
+    PageGeometry geometry;
+    if (impl_->owner_ && impl_->owner_->page_geometry(impl_->page_index_, geometry)) {
+        return geometry.cropbox;
+    }
     return get_mediabox();
 }
 
@@ -512,12 +1416,18 @@ int Page::index() const {
 }
 
 PageRotation Page::rotation() const {
-    // TODO: Implement
+    PageGeometry geometry;
+    if (impl_->owner_ && impl_->owner_->page_geometry(impl_->page_index_, geometry)) {
+        return geometry.rotation;
+    }
     return PageRotation::None;
 }
 
 void Page::set_rotation(PageRotation rotation) {
-    // TODO: Implement
+    // Damages the page when it succeeds
+    if (impl_->owner_) {
+        impl_->owner_->rotate_page(impl_->page_index_, rotation);
+    }
 }
 
 std::string Page::get_text() const {
@@ -560,8 +1470,126 @@ bool Page::insert_image(const std::string& image_path, const Rect& rect) {
     return false;
 }
 
+uint64_t Page::revision() const {
+    std::lock_guard<std::mutex> lock(impl_->damage_mutex_);
+    return impl_->revision_;
+}
+
+uint64_t Page::content_revision() const {
+    std::lock_guard<std::mutex> lock(impl_->damage_mutex_);
+    return impl_->content_revision_;
+}
+
+namespace {
+    // area, in PDF units, in the page space MuPDF draws in: turned
+    // clockwise by the rotation, y down, scaled by UserUnit, and with the
+    // top-left corner of the turned cropbox as origin
+    Rect to_page_space(const PageGeometry& page, const Rect& area) {
+        const float u = page.user_unit;
+        auto turn = [&page, u](float x, float y) {
+            switch (page.rotation) {
+                case PageRotation::Clockwise90:  return Point(u * y, u * x);
+                case PageRotation::Clockwise180: return Point(-u * x, u * y);
+                case PageRotation::Clockwise270: return Point(-u * y, -u * x);
+                default:                         return Point(u * x, -u * y);
+            }
+        };
+        // Quarter turns keep rects upright, so two corners are enough
+        auto bounds = [&turn](const Rect& r) {
+            const Point a = turn(r.x0, r.y0);
+            const Point b = turn(r.x1, r.y1);
+            return Rect(std::min(a.x, b.x), std::min(a.y, b.y), std::max(a.x, b.x), std::max(a.y, b.y));
+        };
+        
+        const Rect origin = bounds(page.cropbox);
+        const Rect turned = bounds(area);
+        return Rect(turned.x0 - origin.x0, turned.y0 - origin.y0,
+                    turned.x1 - origin.x0, turned.y1 - origin.y0);
+    }
+}
+
+void Page::add_damage(const Rect& area, Layer layer) {
+    // An area that cannot be placed on the page damages all of it
+    PageGeometry geometry;
+    if (!impl_->owner_ || !impl_->owner_->page_geometry(impl_->page_index_, geometry)) {
+        add_damage(layer);
+        return;
+    }
+    const Rect damaged = to_page_space(geometry, area);
+    
+    std::lock_guard<std::mutex> lock(impl_->damage_mutex_);
+    ++impl_->revision_;
+    if (layer == Layer::Content) {
+        impl_->content_revision_ = impl_->revision_;
+    }
+    impl_->damage_.emplace_back(impl_->revision_, damaged);
+    
+    if (impl_->damage_.size() > Impl::kMaxDamage) {
+        impl_->damage_base_ = impl_->damage_.front().first;
+        impl_->damage_.pop_front();
+    }
+}
+
+void Page::add_damage(Layer layer) {
+    std::lock_guard<std::mutex> lock(impl_->damage_mutex_);
+    ++impl_->revision_;
+    if (layer == Layer::Content) {
+        impl_->content_revision_ = impl_->revision_;
+    }
+    impl_->damage_base_ = impl_->revision_;
+    impl_->damage_.clear();
+}
+
+bool Page::get_damage_since(uint64_t revision, std::vector<Rect>& areas) const {
+    areas.clear();
+    
+    std::lock_guard<std::mutex> lock(impl_->damage_mutex_);
+    if (revision < impl_->damage_base_) {
+        return false;
+    }
+    
+    for (const auto& [changed, area] : impl_->damage_) {
+        if (changed > revision) {
+            areas.push_back(area);
+        }
+    }
+    return true;
+}
+
+uint64_t Page::content_fingerprint() const {
+    const uint64_t current = revision();
+    {
+        std::lock_guard<std::mutex> lock(impl_->damage_mutex_);
+        if (impl_->fingerprint_revision_ == current) {
+            return impl_->fingerprint_;
+        }
+    }
+    
+    // Hashing reads the page's streams through the document context
+    uint64_t fingerprint;
+    {
+        std::lock_guard<std::recursive_mutex> context(interpret_mutex());
+        fingerprint = impl_->compute_fingerprint();
+    }
+    
+    std::lock_guard<std::mutex> lock(impl_->damage_mutex_);
+    impl_->fingerprint_ = fingerprint;
+    impl_->fingerprint_revision_ = current;
+    return fingerprint;
+}
+
 void* Page::get_handle() const {
-    return impl_->page_;
+    return impl_->handle();
+}
+
+uint64_t Page::id() const {
+    return impl_->id_;
+}
+
+std::recursive_mutex& Page::interpret_mutex() const {
+    // A deleted page has nothing left to interpret
+    static std::recursive_mutex detached;
+    return impl_->owner_ ? impl_->owner_->context_mutex_ : detached;
 }
 
 // Outline implementation
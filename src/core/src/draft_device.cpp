@@ -0,0 +1,207 @@
+#include "draft_device.h"
+
+#ifdef USE_MUPDF
+#include <vector>
+
+namespace pdfeditor {
+namespace detail {
+
+namespace {
+    struct DraftDevice {
+        fz_device super;
+        fz_device* target;
+        std::vector<bool>* clips;   // Whether each open clip was passed to target
+        int skipping;               // Depth of soft mask definitions being dropped
+    };
+    
+    DraftDevice* draft(fz_device* dev) {
+        return reinterpret_cast<DraftDevice*>(dev);
+    }
+    
+    bool forwarding(fz_device* dev) {
+        return draft(dev)->skipping == 0;
+    }
+    
+    void push_clip(fz_device* dev, bool forwarded) {
+        draft(dev)->clips->push_back(forwarded);
+    }
+    
+    // The unit square an image is drawn into, under ctm
+    fz_path* image_outline(fz_context* ctx) {
+        fz_path* path = fz_new_path(ctx);
+        fz_try(ctx) {
+            fz_rectto(ctx, path, 0, 0, 1, 1);
+        }
+        fz_catch(ctx) {
+            fz_drop_path(ctx, path);
+            fz_rethrow(ctx);
+        }
+        return path;
+    }
+    
+    void fill_placeholder(fz_context* ctx, fz_device* dev, fz_matrix ctm, float alpha, fz_color_params params) {
+        static const float gray = 0.85f;
+        fz_path* path = image_outline(ctx);
+        fz_try(ctx) {
+            fz_fill_path(ctx, draft(dev)->target, path, 0, ctm, fz_device_gray(ctx), &gray, alpha, params);
+        }
+        fz_always(ctx) {
+            fz_drop_path(ctx, path);
+        }
+        fz_catch(ctx) {
+            fz_rethrow(ctx);
+        }
+    }
+    
+    void fill_path(fz_context* ctx, fz_device* dev, const fz_path* path, int even_odd, fz_matrix ctm,
+                   fz_colorspace* cs, const float* color, float alpha, fz_color_params params) {
+        if (forwarding(dev)) {
+            fz_fill_path(ctx, draft(dev)->target, path, even_odd, ctm, cs, color, alpha, params);
+        }
+    }
+    
+    void stroke_path(fz_context* ctx, fz_device* dev, const fz_path* path, const fz_stroke_state* stroke,
+                     fz_matrix ctm, fz_colorspace* cs, const float* color, float alpha, fz_color_params params) {
+        if (forwarding(dev)) {
+            fz_stroke_path(ctx, draft(dev)->target, path, stroke, ctm, cs, color, alpha, params);
+        }
+    }
+    
+    void clip_path(fz_context* ctx, fz_device* dev, const fz_path* path, int even_odd, fz_matrix ctm, fz_rect scissor) {
+        if (forwarding(dev)) {
+            fz_clip_path(ctx, draft(dev)->target, path, even_odd, ctm, scissor);
+        }
+        push_clip(dev, forwarding(dev));
+    }
+    
+    void clip_stroke_path(fz_context* ctx, fz_device* dev, const fz_path* path, const fz_stroke_state* stroke,
+                          fz_matrix ctm, fz_rect scissor) {
+        if (forwarding(dev)) {
+            fz_clip_stroke_path(ctx, draft(dev)->target, path, stroke, ctm, scissor);
+        }
+        push_clip(dev, forwarding(dev));
+    }
+    
+    void fill_text(fz_context* ctx, fz_device* dev, const fz_text* text, fz_matrix ctm,
+                   fz_colorspace* cs, const float* color, float alpha, fz_color_params params) {
+        if (forwarding(dev)) {
+            fz_fill_text(ctx, draft(dev)->target, text, ctm, cs, color, alpha, params);
+        }
+    }
+    
+    void stroke_text(fz_context* ctx, fz_device* dev, const fz_text* text, const fz_stroke_state* stroke,
+                     fz_matrix ctm, fz_colorspace* cs, const float* color, float alpha, fz_color_params params) {
+        if (forwarding(dev)) {
+            fz_stroke_text(ctx, draft(dev)->target, text, stroke, ctm, cs, color, alpha, params);
+        }
+    }
+    
+    void clip_text(fz_context* ctx, fz_device* dev, const fz_text* text, fz_matrix ctm, fz_rect scissor) {
+        if (forwarding(dev)) {
+            fz_clip_text(ctx, draft(dev)->target, text, ctm, scissor);
+        }
+        push_clip(dev, forwarding(dev));
+    }
+    
+    void clip_stroke_text(fz_context* ctx, fz_device* dev, const fz_text* text, const fz_stroke_state* stroke,
+                          fz_matrix ctm, fz_rect scissor) {
+        if (forwarding(dev)) {
+            fz_clip_stroke_text(ctx, draft(dev)->target, text, stroke, ctm, scissor);
+        }
+        push_clip(dev, forwarding(dev));
+    }
+    
+    void fill_image(fz_context* ctx, fz_device* dev, fz_image*, fz_matrix ctm, float alpha, fz_color_params params) {
+        if (forwarding(dev)) {
+            fill_placeholder(ctx, dev, ctm, alpha, params);
+        }
+    }
+    
+    void fill_image_mask(fz_context* ctx, fz_device* dev, fz_image*, fz_matrix ctm,
+                         fz_colorspace*, const float*, float alpha, fz_color_params params) {
+        if (forwarding(dev)) {
+            fill_placeholder(ctx, dev, ctm, alpha, params);
+        }
+    }
+    
+    // Clip to the image's bounds rather than its decoded mask
+    void clip_image_mask(fz_context* ctx, fz_device* dev, fz_image*, fz_matrix ctm, fz_rect scissor) {
+        if (forwarding(dev)) {
+            fz_path* path = image_outline(ctx);
+            fz_try(ctx) {
+                fz_clip_path(ctx, draft(dev)->target, path, 0, ctm, scissor);
+            }
+            fz_always(ctx) {
+                fz_drop_path(ctx, path);
+            }
+            fz_catch(ctx) {
+                fz_rethrow(ctx);
+            }
+        }
+        push_clip(dev, forwarding(dev));
+    }
+    
+    void pop_clip(fz_context* ctx, fz_device* dev) {
+        std::vector<bool>& clips = *draft(dev)->clips;
+        if (clips.empty()) {
+            return;
+        }
+        
+        const bool forwarded = clips.back();
+        clips.pop_back();
+        if (forwarded) {
+            fz_pop_clip(ctx, draft(dev)->target);
+        }
+    }
+    
+    // A soft mask is defined between begin_mask and end_mask and then
+    // applies like a clip until the matching pop_clip. Drop the
+    // definition, and record the clip so that pop is dropped too.
+    void begin_mask(fz_context*, fz_device* dev, fz_rect, int, fz_colorspace*, const float*, fz_color_params) {
+        ++draft(dev)->skipping;
+    }
+    
+    void end_mask(fz_context*, fz_device* dev, fz_function*) {
+        if (draft(dev)->skipping > 0) {
+            --draft(dev)->skipping;
+        }
+        push_clip(dev, false);
+    }
+    
+    void drop_device(fz_context*, fz_device* dev) {
+        delete draft(dev)->clips;
+    }
+}
+
+fz_device* new_draft_device(fz_context* ctx, fz_device* target) {
+    DraftDevice* dev = fz_new_derived_device(ctx, DraftDevice);
+    
+    dev->target = target;
+    dev->clips = new std::vector<bool>();
+    dev->skipping = 0;
+    
+    // Shadings, transparency groups and tiles are left unset, which MuPDF
+    // treats as a device that ignores them; the group and tile contents
+    // still arrive as ordinary drawing calls.
+    dev->super.drop_device = drop_device;
+    dev->super.fill_path = fill_path;
+    dev->super.stroke_path = stroke_path;
+    dev->super.clip_path = clip_path;
+    dev->super.clip_stroke_path = clip_stroke_path;
+    dev->super.fill_text = fill_text;
+    dev->super.stroke_text = stroke_text;
+    dev->super.clip_text = clip_text;
+    dev->super.clip_stroke_text = clip_stroke_text;
+    dev->super.fill_image = fill_image;
+    dev->super.fill_image_mask = fill_image_mask;
+    dev->super.clip_image_mask = clip_image_mask;
+    dev->super.pop_clip = pop_clip;
+    dev->super.begin_mask = begin_mask;
+    dev->super.end_mask = end_mask;
+    
+    return &dev->super;
+}
+
+} // namespace detail
+} // namespace pdfeditor
+#endif
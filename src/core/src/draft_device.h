@@ -0,0 +1,19 @@
+#pragma once
+
+#ifdef USE_MUPDF
+#include <mupdf/fitz.h>
+
+namespace pdfeditor {
+namespace detail {
+
+// Device that forwards to target everything cheap to draw and drops the
+// rest, for RenderOptions::draft: images and image masks become flat
+// placeholder boxes without being decoded, shadings and soft masks are
+// skipped, and transparency groups are drawn straight onto the page
+// instead of being composited. Tiling patterns are drawn as a single
+// cell. The caller closes and drops both devices.
+fz_device* new_draft_device(fz_context* ctx, fz_device* target);
+
+} // namespace detail
+} // namespace pdfeditor
+#endif
@@ -1,5 +1,6 @@
 #include "pdfeditor/editor.h"
 #include "pdfeditor/core.h"
+#include "context_manager.h"
 #include <fstream>
 #include <algorithm>
 
@@ -19,11 +20,12 @@ bool Editor::insert_text(
     if (!page || text.empty()) return false;
     
 #ifdef USE_MUPDF
-    void* handle = page->get_handle();
+    fz_page* handle = static_cast<fz_page*>(page->get_handle());
     if (!handle) return false;
     
     // TODO: Implement text insertion with MuPDF
     // This requires creating a new content stream with text operators
+    fz_drop_page(detail::ContextManager::thread_context(), handle);
 #endif
     
     return true;
@@ -109,13 +111,14 @@ bool Editor::insert_image_data(
     if (!page || !data || size == 0) return false;
     
 #ifdef USE_MUPDF
-    void* handle = page->get_handle();
+    fz_page* handle = static_cast<fz_page*>(page->get_handle());
     if (!handle) return false;
     
     // TODO: Insert image with MuPDF
     // 1. Load image from data
     // 2. Add to page resources
     // 3. Insert Do operator in content stream
+    fz_drop_page(detail::ContextManager::thread_context(), handle);
 #endif
     
     return true;
@@ -0,0 +1,1428 @@
+#include "image_writer.h"
+#include "pixel_convert.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef USE_LIBJPEG
+#include <csetjmp>
+#include <jpeglib.h>
+#endif
+
+namespace pdfeditor {
+
+namespace {
+    // Uncompressed bytes per independently compressed block. Large enough
+    // that restarting the deflate window costs little ratio, small enough
+    // to keep every core busy on a single page.
+    const size_t kBlockBytes = 256 * 1024;
+    
+    // Rows handed to libjpeg / written to a BMP per call
+    const int kStripRows = 64;
+    
+    void put16le(std::vector<uint8_t>& out, uint32_t v) {
+        out.push_back(static_cast<uint8_t>(v));
+        out.push_back(static_cast<uint8_t>(v >> 8));
+    }
+    
+    void put32le(std::vector<uint8_t>& out, uint32_t v) {
+        put16le(out, v & 0xFFFF);
+        put16le(out, v >> 16);
+    }
+    
+    void put32be(uint8_t* out, uint32_t v) {
+        out[0] = static_cast<uint8_t>(v >> 24);
+        out[1] = static_cast<uint8_t>(v >> 16);
+        out[2] = static_cast<uint8_t>(v >> 8);
+        out[3] = static_cast<uint8_t>(v);
+    }
+    
+    bool write_bytes(std::ostream& out, const void* data, size_t size) {
+        out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        return static_cast<bool>(out);
+    }
+    
+    bool write_bytes(std::ostream& out, const std::vector<uint8_t>& data) {
+        return write_bytes(out, data.data(), data.size());
+    }
+    
+    uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t size) {
+        static const std::array<uint32_t, 256> table = [] {
+            std::array<uint32_t, 256> t;
+            for (uint32_t n = 0; n < 256; ++n) {
+                uint32_t c = n;
+                for (int k = 0; k < 8; ++k) {
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                }
+                t[n] = c;
+            }
+            return t;
+        }();
+        
+        crc = ~crc;
+        for (size_t i = 0; i < size; ++i) {
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+    
+    const uint32_t kAdlerBase = 65521;
+    
+    uint32_t adler32_update(uint32_t adler, const uint8_t* data, size_t size) {
+        uint32_t a = adler & 0xFFFF;
+        uint32_t b = adler >> 16;
+        while (size > 0) {
+            // Largest run that cannot overflow b before the modulo
+            size_t n = std::min<size_t>(size, 5552);
+            size -= n;
+            while (n--) {
+                a += *data++;
+                b += a;
+            }
+            a %= kAdlerBase;
+            b %= kAdlerBase;
+        }
+        return (b << 16) | a;
+    }
+    
+    // Checksum of two concatenated runs from the checksums of each,
+    // len2 being the length of the second
+    uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, uint64_t len2) {
+        const uint64_t rem = len2 % kAdlerBase;
+        uint64_t a = adler1 & 0xFFFF;
+        uint64_t b = (rem * a) % kAdlerBase;
+        a += (adler2 & 0xFFFF) + kAdlerBase - 1;
+        b += (adler1 >> 16) + (adler2 >> 16) + kAdlerBase - rem;
+        a %= kAdlerBase;
+        b %= kAdlerBase;
+        return static_cast<uint32_t>((b << 16) | a);
+    }
+    
+    struct EncodedBlock {
+        std::vector<uint8_t> raw;       // Scratch for the uncompressed bytes
+        std::vector<uint8_t> data;      // What goes into the file
+        size_t raw_size = 0;
+        uint32_t adler = 1;
+        uint32_t crc = 0;
+        bool ok = true;
+    };
+    
+    // Encode count blocks on all cores and hand them to write() in order
+    // as each becomes ready, so writing overlaps compression. Only a few
+    // blocks per thread are in flight, which bounds memory however large
+    // the image is.
+    bool encode_blocks(
+        size_t count,
+        const std::function<void(size_t, EncodedBlock&)>& encode,
+        const std::function<bool(size_t, const EncodedBlock&)>& write
+    ) {
+        const size_t threads = std::min<size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+        
+        if (threads <= 1) {
+            EncodedBlock block;
+            for (size_t i = 0; i < count; ++i) {
+                encode(i, block);
+                if (!block.ok || !write(i, block)) return false;
+            }
+            return true;
+        }
+        
+        const size_t window = threads * 2;
+        std::vector<EncodedBlock> slots(window);
+        std::vector<char> ready(window, 0);
+        std::mutex mutex;
+        std::condition_variable cv;
+        size_t next = 0;
+        size_t written = 0;
+        bool failed = false;
+        
+        auto worker = [&]() {
+            std::unique_lock<std::mutex> lock(mutex);
+            for (;;) {
+                // A slot is reused once the block it held has been written
+                cv.wait(lock, [&] { return failed || next >= count || next < written + window; });
+                if (failed || next >= count) return;
+                
+                const size_t i = next++;
+                lock.unlock();
+                bool ok = true;
+                try {
+                    encode(i, slots[i % window]);
+                } catch (...) {
+                    ok = false;
+                }
+                lock.lock();
+                
+                if (!ok || !slots[i % window].ok) {
+                    failed = true;
+                }
+                ready[i % window] = 1;
+                cv.notify_all();
+            }
+        };
+        
+        std::vector<std::thread> pool;
+        for (size_t t = 0; t < threads; ++t) {
+            pool.emplace_back(worker);
+        }
+        
+        for (size_t i = 0; i < count; ++i) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return failed || ready[i % window]; });
+                if (failed) break;
+            }
+            
+            const bool ok = write(i, slots[i % window]);
+            
+            std::lock_guard<std::mutex> lock(mutex);
+            ready[i % window] = 0;
+            ++written;
+            if (!ok) failed = true;
+            cv.notify_all();
+            if (failed) break;
+        }
+        
+        for (auto& t : pool) {
+            t.join();
+        }
+        return !failed;
+    }
+    
+#ifdef USE_ZLIB
+    // Raw deflate of one block. Non-final blocks end with a sync flush on
+    // a byte boundary, so separately compressed blocks concatenate into
+    // one valid stream.
+    bool deflate_block(const uint8_t* data, size_t size, bool last, std::vector<uint8_t>& out) {
+        z_stream zs;
+        std::memset(&zs, 0, sizeof(zs));
+        if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return false;
+        }
+        
+        out.resize(deflateBound(&zs, static_cast<uLong>(size)) + 16);
+        zs.next_in = const_cast<Bytef*>(data);
+        zs.avail_in = static_cast<uInt>(size);
+        zs.next_out = out.data();
+        zs.avail_out = static_cast<uInt>(out.size());
+        
+        const int rc = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+        const bool ok = last ? rc == Z_STREAM_END : (rc == Z_OK && zs.avail_in == 0);
+        out.resize(zs.total_out);
+        deflateEnd(&zs);
+        return ok;
+    }
+#else
+    // Stored (uncompressed) deflate blocks, for builds without zlib
+    void store_block(const uint8_t* data, size_t size, bool last, std::vector<uint8_t>& out) {
+        out.clear();
+        do {
+            const size_t n = std::min<size_t>(size, 65535);
+            out.push_back(last && n == size ? 1 : 0);
+            put16le(out, static_cast<uint32_t>(n));
+            put16le(out, static_cast<uint32_t>(~n & 0xFFFF));
+            out.insert(out.end(), data, data + n);
+            data += n;
+            size -= n;
+        } while (size > 0);
+    }
+#endif
+    
+    // ===== PNG =====
+    
+    struct PngLayout {
+        ImageFormat row_format;     // What rows are converted to
+        uint8_t color_type;
+        uint8_t bit_depth;
+        bool invert;                // PNG gray has 0 = black, Mono1 1 = black
+    };
+    
+    PngLayout png_layout(ImageFormat format) {
+        switch (format) {
+            case ImageFormat::RGBA32:
+            case ImageFormat::BGRA32:
+                return { ImageFormat::RGBA32, 6, 8, false };
+            case ImageFormat::Gray8:
+                return { ImageFormat::Gray8, 0, 8, false };
+            case ImageFormat::Mono1:
+                return { ImageFormat::Mono1, 0, 1, true };
+            case ImageFormat::RGB24:
+            case ImageFormat::BGR24:
+            default:
+                return { ImageFormat::RGB24, 2, 8, false };
+        }
+    }
+    
+    inline int paeth(int a, int b, int c) {
+        const int p = a + b - c;
+        const int pa = std::abs(p - a);
+        const int pb = std::abs(p - b);
+        const int pc = std::abs(p - c);
+        if (pa <= pb && pa <= pc) return a;
+        return pb <= pc ? b : c;
+    }
+    
+    // Filter one row with whichever of the five PNG filters gives the
+    // smallest sum of absolute residuals (the libpng heuristic). bpp is
+    // the distance in bytes to the pixel on the left. Writes the filter
+    // type byte followed by the row.
+    void filter_row(const uint8_t* row, const uint8_t* prev, size_t n, size_t bpp, uint8_t* out) {
+        uint32_t cost[5] = {0, 0, 0, 0, 0};
+        for (size_t i = 0; i < n; ++i) {
+            const int x = row[i];
+            const int a = i >= bpp ? row[i - bpp] : 0;
+            const int b = prev[i];
+            const int c = i >= bpp ? prev[i - bpp] : 0;
+            cost[0] += std::abs(static_cast<int8_t>(x));
+            cost[1] += std::abs(static_cast<int8_t>(x - a));
+            cost[2] += std::abs(static_cast<int8_t>(x - b));
+            cost[3] += std::abs(static_cast<int8_t>(x - ((a + b) >> 1)));
+            cost[4] += std::abs(static_cast<int8_t>(x - paeth(a, b, c)));
+        }
+        
+        const int type = static_cast<int>(std::min_element(cost, cost + 5) - cost);
+        out[0] = static_cast<uint8_t>(type);
+        uint8_t* dst = out + 1;
+        
+        for (size_t i = 0; i < n; ++i) {
+            const int x = row[i];
+            const int a = i >= bpp ? row[i - bpp] : 0;
+            const int b = prev[i];
+            const int c = i >= bpp ? prev[i - bpp] : 0;
+            int predicted = 0;
+            switch (type) {
+                case 1: predicted = a; break;
+                case 2: predicted = b; break;
+                case 3: predicted = (a + b) >> 1; break;
+                case 4: predicted = paeth(a, b, c); break;
+                default: break;
+            }
+            dst[i] = static_cast<uint8_t>(x - predicted);
+        }
+    }
+    
+    uint32_t chunk_crc(const char* type, const uint8_t* data, size_t size) {
+        uint32_t crc = crc32_update(0, reinterpret_cast<const uint8_t*>(type), 4);
+        return crc32_update(crc, data, size);
+    }
+    
+    bool write_chunk(std::ostream& out, const char* type, const uint8_t* data, size_t size, uint32_t crc) {
+        uint8_t length[4];
+        uint8_t check[4];
+        put32be(length, static_cast<uint32_t>(size));
+        put32be(check, crc);
+        return write_bytes(out, length, 4) &&
+               write_bytes(out, type, 4) &&
+               (size == 0 || write_bytes(out, data, size)) &&
+               write_bytes(out, check, 4);
+    }
+    
+    bool write_chunk(std::ostream& out, const char* type, const uint8_t* data, size_t size) {
+        return write_chunk(out, type, data, size, chunk_crc(type, data, size));
+    }
+    
+    // ===== TIFF =====
+    
+    enum TiffType : uint16_t {
+        kTiffShort = 3,
+        kTiffLong = 4,
+        kTiffRational = 5
+    };
+    
+    struct TiffEntry {
+        uint16_t tag;
+        uint16_t type;
+        uint32_t count;
+        std::vector<uint8_t> value;
+    };
+    
+    TiffEntry tiff_shorts(uint16_t tag, std::initializer_list<uint32_t> values) {
+        TiffEntry entry{tag, kTiffShort, static_cast<uint32_t>(values.size()), {}};
+        for (uint32_t v : values) put16le(entry.value, v);
+        return entry;
+    }
+    
+    TiffEntry tiff_longs(uint16_t tag, const std::vector<uint32_t>& values) {
+        TiffEntry entry{tag, kTiffLong, static_cast<uint32_t>(values.size()), {}};
+        for (uint32_t v : values) put32le(entry.value, v);
+        return entry;
+    }
+    
+    TiffEntry tiff_rational(uint16_t tag, uint32_t numerator, uint32_t denominator) {
+        TiffEntry entry{tag, kTiffRational, 1, {}};
+        put32le(entry.value, numerator);
+        put32le(entry.value, denominator);
+        return entry;
+    }
+}
+
+// PngSink implementation
+class PngSink::Impl {
+public:
+    std::string path;
+    std::ofstream file;
+    int width = 0;
+    int height = 0;
+    ImageFormat format = ImageFormat::RGB24;
+    bool premultiplied = false;
+    PngLayout layout = png_layout(ImageFormat::RGB24);
+    size_t row_bytes = 0;
+    size_t bpp = 1;
+    int rows_per_block = 1;
+    int next_row = 0;
+    std::vector<uint8_t> previous;      // Last row written, converted
+    uint32_t adler = 1;
+    bool ok = false;
+    
+    void load_row(detail::RowConverter& converter, const uint8_t* src, int y, uint8_t* row) const {
+        converter.convert(src, row, y);
+        if (layout.invert) {
+            for (size_t i = 0; i < row_bytes; ++i) row[i] = static_cast<uint8_t>(~row[i]);
+        }
+    }
+};
+
+PngSink::PngSink(const std::string& path) : impl_(std::make_unique<Impl>()) {
+    impl_->path = path;
+}
+
+PngSink::~PngSink() {
+    if (impl_->file.is_open()) {
+        abort();
+    }
+}
+
+bool PngSink::begin(int width, int height, ImageFormat format, bool premultiplied, float dpi) {
+    Impl& d = *impl_;
+    if (width <= 0 || height <= 0 || d.file.is_open()) {
+        return false;
+    }
+    
+    d.width = width;
+    d.height = height;
+    d.format = format;
+    d.premultiplied = premultiplied;
+    d.layout = png_layout(format);
+    d.row_bytes = static_cast<size_t>(detail::format_row_bytes(d.layout.row_format, width));
+    d.bpp = std::max<size_t>(1, d.row_bytes / static_cast<size_t>(width));
+    d.rows_per_block = static_cast<int>(std::max<size_t>(1, kBlockBytes / (d.row_bytes + 1)));
+    d.next_row = 0;
+    d.previous.assign(d.row_bytes, 0);
+    d.adler = 1;
+    
+    d.file.clear();
+    d.file.open(d.path, std::ios::binary | std::ios::trunc);
+    if (!d.file) {
+        return false;
+    }
+    
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    uint8_t header[13];
+    put32be(header, static_cast<uint32_t>(width));
+    put32be(header + 4, static_cast<uint32_t>(height));
+    header[8] = d.layout.bit_depth;
+    header[9] = d.layout.color_type;
+    header[10] = 0;     // Deflate
+    header[11] = 0;     // Adaptive filtering
+    header[12] = 0;     // No interlace
+    
+#ifdef USE_ZLIB
+    const uint8_t zlib_header[2] = {0x78, 0x9C};
+#else
+    const uint8_t zlib_header[2] = {0x78, 0x01};
+#endif
+    
+    d.ok = write_bytes(d.file, signature, sizeof(signature)) &&
+           write_chunk(d.file, "IHDR", header, sizeof(header));
+    
+    if (d.ok && dpi > 0.0f) {
+        // Physical pixel size, in pixels per meter
+        uint8_t physical[9];
+        const uint32_t ppm = static_cast<uint32_t>(std::lround(dpi / 0.0254f));
+        put32be(physical, ppm);
+        put32be(physical + 4, ppm);
+        physical[8] = 1;
+        d.ok = write_chunk(d.file, "pHYs", physical, sizeof(physical));
+    }
+    
+    d.ok = d.ok && write_chunk(d.file, "IDAT", zlib_header, sizeof(zlib_header));
+    return d.ok;
+}
+
+bool PngSink::write_rows(const uint8_t* data, int stride, int y, int rows) {
+    Impl& d = *impl_;
+    if (!d.ok || !data || rows <= 0 || y != d.next_row || rows > d.height - y) {
+        return d.ok = false;
+    }
+    
+    const size_t block_count = static_cast<size_t>((rows + d.rows_per_block - 1) / d.rows_per_block);
+    
+    // Each block filters its rows (reconverting the row above its first
+    // one, or taking the last row of the previous band) and compresses
+    // them on its own
+    auto encode = [&](size_t index, EncodedBlock& block) {
+        const int y0 = static_cast<int>(index) * d.rows_per_block;
+        const int y1 = std::min(rows, y0 + d.rows_per_block);
+        
+        detail::RowConverter converter(d.format, d.premultiplied, d.layout.row_format, false,
+                               static_cast<size_t>(d.width));
+        std::vector<uint8_t> current(d.row_bytes);
+        std::vector<uint8_t> previous(d.row_bytes);
+        
+        if (y0 > 0) {
+            d.load_row(converter, data + static_cast<size_t>(y0 - 1) * stride, y + y0 - 1, previous.data());
+        } else {
+            previous = d.previous;
+        }
+        
+        block.raw.resize(static_cast<size_t>(y1 - y0) * (d.row_bytes + 1));
+        for (int r = y0; r < y1; ++r) {
+            d.load_row(converter, data + static_cast<size_t>(r) * stride, y + r, current.data());
+            filter_row(current.data(), previous.data(), d.row_bytes, d.bpp,
+                       block.raw.data() + static_cast<size_t>(r - y0) * (d.row_bytes + 1));
+            current.swap(previous);
+        }
+        
+        // The stream is ended by an empty final block in finish()
+        block.raw_size = block.raw.size();
+        block.adler = adler32_update(1, block.raw.data(), block.raw.size());
+#ifdef USE_ZLIB
+        block.ok = deflate_block(block.raw.data(), block.raw.size(), false, block.data);
+#else
+        store_block(block.raw.data(), block.raw.size(), false, block.data);
+        block.ok = true;
+#endif
+        block.crc = chunk_crc("IDAT", block.data.data(), block.data.size());
+    };
+    
+    auto write = [&](size_t, const EncodedBlock& block) {
+        d.adler = adler32_combine(d.adler, block.adler, block.raw_size);
+        return write_chunk(d.file, "IDAT", block.data.data(), block.data.size(), block.crc);
+    };
+    
+    d.ok = encode_blocks(block_count, encode, write);
+    if (d.ok) {
+        // The next band filters its first row against this band's last
+        detail::RowConverter converter(d.format, d.premultiplied, d.layout.row_format, false,
+                               static_cast<size_t>(d.width));
+        d.load_row(converter, data + static_cast<size_t>(rows - 1) * stride, y + rows - 1, d.previous.data());
+        d.next_row = y + rows;
+    }
+    return d.ok;
+}
+
+bool PngSink::finish() {
+    Impl& d = *impl_;
+    if (!d.file.is_open()) {
+        return false;
+    }
+    if (!d.ok || d.next_row != d.height) {
+        abort();
+        return false;
+    }
+    
+    // Final empty deflate block, then the checksum of the whole stream
+    std::vector<uint8_t> tail;
+#ifdef USE_ZLIB
+    d.ok = deflate_block(nullptr, 0, true, tail);
+#else
+    store_block(nullptr, 0, true, tail);
+#endif
+    uint8_t adler[4];
+    put32be(adler, d.adler);
+    tail.insert(tail.end(), adler, adler + 4);
+    
+    d.ok = d.ok &&
+           write_chunk(d.file, "IDAT", tail.data(), tail.size()) &&
+           write_chunk(d.file, "IEND", nullptr, 0);
+    d.file.close();
+    d.ok = d.ok && !d.file.fail();
+    if (!d.ok) {
+        std::remove(d.path.c_str());
+    }
+    return d.ok;
+}
+
+void PngSink::abort() {
+    Impl& d = *impl_;
+    d.ok = false;
+    if (d.file.is_open()) {
+        d.file.close();
+        std::remove(d.path.c_str());
+    }
+}
+
+#ifdef USE_LIBJPEG
+namespace {
+    struct JpegError {
+        jpeg_error_mgr manager;
+        std::jmp_buf jump;
+    };
+    
+    void jpeg_error_exit(j_common_ptr cinfo) {
+        std::longjmp(reinterpret_cast<JpegError*>(cinfo->err)->jump, 1);
+    }
+    
+    struct JpegJob {
+        jpeg_compress_struct cinfo;
+        JpegError error;
+        FILE* file;
+        int width;
+        int height;
+        float dpi;
+        J_COLOR_SPACE color_space;
+        int components;
+        int quality;
+        detail::RowConverter* converter;    // Null when libjpeg reads rows as they are
+        uint8_t* strip;
+        size_t row_bytes;
+        JSAMPROW* rows;
+        
+        // The band being written
+        const uint8_t* band;
+        int band_stride;
+        int band_rows;
+    };
+    
+    void jpeg_begin(JpegJob& job) {
+        jpeg_compress_struct& cinfo = job.cinfo;
+        jpeg_create_compress(&cinfo);
+        jpeg_stdio_dest(&cinfo, job.file);
+        
+        cinfo.image_width = static_cast<JDIMENSION>(job.width);
+        cinfo.image_height = static_cast<JDIMENSION>(job.height);
+        cinfo.input_components = job.components;
+        cinfo.in_color_space = job.color_space;
+        jpeg_set_defaults(&cinfo);
+        jpeg_set_quality(&cinfo, std::clamp(job.quality, 1, 100), TRUE);
+        if (job.dpi > 0.0f) {
+            cinfo.density_unit = 1;     // Dots per inch
+            cinfo.X_density = static_cast<UINT16>(std::clamp(std::lround(job.dpi), 1L, 65535L));
+            cinfo.Y_density = cinfo.X_density;
+        }
+        jpeg_start_compress(&cinfo, TRUE);
+    }
+    
+    void jpeg_write_band(JpegJob& job) {
+        for (int r0 = 0; r0 < job.band_rows; r0 += kStripRows) {
+            const int count = std::min(kStripRows, job.band_rows - r0);
+            const int y0 = static_cast<int>(job.cinfo.next_scanline);
+            
+            for (int i = 0; i < count; ++i) {
+                const uint8_t* src = job.band + static_cast<size_t>(r0 + i) * job.band_stride;
+                if (job.converter) {
+                    uint8_t* dst = job.strip + static_cast<size_t>(i) * job.row_bytes;
+                    job.converter->convert(src, dst, y0 + i);
+                    job.rows[i] = dst;
+                } else {
+                    job.rows[i] = const_cast<JSAMPROW>(src);
+                }
+            }
+            jpeg_write_scanlines(&job.cinfo, job.rows, static_cast<JDIMENSION>(count));
+        }
+    }
+    
+    void jpeg_end(JpegJob& job) {
+        jpeg_finish_compress(&job.cinfo);
+    }
+    
+    // libjpeg reports errors through error_exit, which must not return.
+    // Only plain C state lives between here and the jump, so it skips no
+    // destructors.
+    bool run_jpeg(JpegJob& job, void (*step)(JpegJob&)) {
+        if (setjmp(job.error.jump)) {
+            return false;
+        }
+        step(job);
+        return true;
+    }
+}
+#endif
+
+// JpegSink implementation
+class JpegSink::Impl {
+public:
+    std::string path;
+    int quality = 85;
+    int height = 0;
+    int next_row = 0;
+    bool ok = false;
+    
+#ifdef USE_LIBJPEG
+    JpegJob job;
+    FILE* file = nullptr;
+    std::unique_ptr<detail::RowConverter> converter;
+    std::vector<uint8_t> strip;
+    std::vector<JSAMPROW> rows;
+    
+    // Release libjpeg and the file; removes the file unless it is complete
+    bool close(bool keep) {
+        jpeg_destroy_compress(&job.cinfo);
+        bool good = keep && !std::ferror(file);
+        good = std::fclose(file) == 0 && good;
+        file = nullptr;
+        if (!good) {
+            std::remove(path.c_str());
+        }
+        return good;
+    }
+#endif
+};
+
+JpegSink::JpegSink(const std::string& path, int quality) : impl_(std::make_unique<Impl>()) {
+    impl_->path = path;
+    impl_->quality = quality;
+}
+
+JpegSink::~JpegSink() {
+    abort();
+}
+
+bool JpegSink::begin(int width, int height, ImageFormat format, bool premultiplied, float dpi) {
+#ifdef USE_LIBJPEG
+    Impl& d = *impl_;
+    if (width <= 0 || height <= 0 || d.file) {
+        return false;
+    }
+    
+    // Hand libjpeg the rows as they are where it can read the layout
+    // (libjpeg-turbo reads BGR and 4-byte pixels natively); convert the
+    // rest a strip at a time
+    ImageFormat row_format = ImageFormat::RGB24;
+    J_COLOR_SPACE color_space = JCS_RGB;
+    int components = 3;
+    bool direct = false;
+    
+    switch (format) {
+        case ImageFormat::Gray8:
+            row_format = ImageFormat::Gray8;
+            color_space = JCS_GRAYSCALE;
+            components = 1;
+            direct = true;
+            break;
+        case ImageFormat::Mono1:
+            row_format = ImageFormat::Gray8;
+            color_space = JCS_GRAYSCALE;
+            components = 1;
+            break;
+        case ImageFormat::RGB24:
+            direct = true;
+            break;
+#ifdef JCS_EXTENSIONS
+        case ImageFormat::BGR24:
+            color_space = JCS_EXT_BGR;
+            direct = true;
+            break;
+        case ImageFormat::RGBA32:
+        case ImageFormat::BGRA32:
+            // Premultiplied color would come out dark without its alpha
+            if (!premultiplied) {
+                color_space = format == ImageFormat::RGBA32 ? JCS_EXT_RGBX : JCS_EXT_BGRX;
+                components = 4;
+                direct = true;
+            }
+            break;
+#endif
+        default:
+            break;
+    }
+    
+    d.converter.reset();
+    if (!direct) {
+        d.converter = std::make_unique<detail::RowConverter>(format, premultiplied, row_format, false,
+                                                     static_cast<size_t>(width));
+    }
+    const size_t row_bytes = static_cast<size_t>(detail::format_row_bytes(row_format, width));
+    d.strip.assign(direct ? 0 : row_bytes * kStripRows, 0);
+    d.rows.assign(kStripRows, nullptr);
+    
+    d.file = std::fopen(d.path.c_str(), "wb");
+    if (!d.file) {
+        return d.ok = false;
+    }
+    
+    JpegJob& job = d.job;
+    std::memset(&job.cinfo, 0, sizeof(job.cinfo));
+    job.cinfo.err = jpeg_std_error(&job.error.manager);
+    job.error.manager.error_exit = jpeg_error_exit;
+    job.file = d.file;
+    job.width = width;
+    job.height = height;
+    job.dpi = dpi;
+    job.color_space = color_space;
+    job.components = components;
+    job.quality = d.quality;
+    job.converter = d.converter.get();
+    job.strip = d.strip.data();
+    job.row_bytes = row_bytes;
+    job.rows = d.rows.data();
+    
+    d.height = height;
+    d.next_row = 0;
+    d.ok = run_jpeg(job, jpeg_begin);
+    if (!d.ok) {
+        d.close(false);
+    }
+    return d.ok;
+#else
+    (void)width;
+    (void)height;
+    (void)format;
+    (void)premultiplied;
+    (void)dpi;
+    return false;
+#endif
+}
+
+bool JpegSink::write_rows(const uint8_t* data, int stride, int y, int rows) {
+#ifdef USE_LIBJPEG
+    Impl& d = *impl_;
+    if (!d.ok || !data || rows <= 0 || y != d.next_row || rows > d.height - y) {
+        return d.ok = false;
+    }
+    
+    d.job.band = data;
+    d.job.band_stride = stride;
+    d.job.band_rows = rows;
+    d.ok = run_jpeg(d.job, jpeg_write_band);
+    d.next_row = y + rows;
+    return d.ok;
+#else
+    (void)data;
+    (void)stride;
+    (void)y;
+    (void)rows;
+    return false;
+#endif
+}
+
+bool JpegSink::finish() {
+#ifdef USE_LIBJPEG
+    Impl& d = *impl_;
+    if (!d.file) {
+        return false;
+    }
+    
+    d.ok = d.ok && d.next_row == d.height && run_jpeg(d.job, jpeg_end);
+    d.ok = d.close(d.ok);
+    return d.ok;
+#else
+    return false;
+#endif
+}
+
+void JpegSink::abort() {
+    impl_->ok = false;
+#ifdef USE_LIBJPEG
+    if (impl_->file) {
+        impl_->close(false);
+    }
+#endif
+}
+
+namespace detail {
+
+bool write_png(const ImageBuffer& image, const std::string& path) {
+    if (!image.data()) {
+        return false;
+    }
+    
+    PngSink sink(path);
+    return sink.begin(image.width(), image.height(), image.format(), image.is_premultiplied(), 0.0f) &&
+           sink.write_rows(image.data(), image.stride(), 0, image.height()) &&
+           sink.finish();
+}
+
+bool write_jpeg(const ImageBuffer& image, const std::string& path, int quality) {
+    if (!image.data()) {
+        return false;
+    }
+    
+    JpegSink sink(path, quality);
+    return sink.begin(image.width(), image.height(), image.format(), image.is_premultiplied(), 0.0f) &&
+           sink.write_rows(image.data(), image.stride(), 0, image.height()) &&
+           sink.finish();
+}
+
+bool write_bmp(const ImageBuffer& image, const std::string& path) {
+    const int width = image.width();
+    const int height = image.height();
+    if (width <= 0 || height <= 0 || !image.data()) {
+        return false;
+    }
+    
+    // 24-bit BGR, 32-bit BGRA with a V4 header carrying the alpha mask,
+    // or a gray / black-and-white palette
+    ImageFormat row_format = ImageFormat::BGR24;
+    uint16_t bits = 24;
+    uint32_t palette = 0;
+    switch (image.format()) {
+        case ImageFormat::RGBA32:
+        case ImageFormat::BGRA32:
+            row_format = ImageFormat::BGRA32;
+            bits = 32;
+            break;
+        case ImageFormat::Gray8:
+            row_format = ImageFormat::Gray8;
+            bits = 8;
+            palette = 256;
+            break;
+        case ImageFormat::Mono1:
+            row_format = ImageFormat::Mono1;
+            bits = 1;
+            palette = 2;
+            break;
+        default:
+            break;
+    }
+    
+    const bool alpha = bits == 32;
+    const size_t row_bytes = static_cast<size_t>(format_row_bytes(row_format, width));
+    const size_t padded = (row_bytes + 3) & ~static_cast<size_t>(3);
+    const uint32_t info_size = alpha ? 108 : 40;
+    const uint64_t offset = 14 + info_size + palette * 4;
+    const uint64_t file_size = offset + static_cast<uint64_t>(padded) * height;
+    if (file_size > 0xFFFFFFFFu) {
+        return false;
+    }
+    
+    std::vector<uint8_t> header;
+    header.push_back('B');
+    header.push_back('M');
+    put32le(header, static_cast<uint32_t>(file_size));
+    put32le(header, 0);
+    put32le(header, static_cast<uint32_t>(offset));
+    
+    put32le(header, info_size);
+    put32le(header, static_cast<uint32_t>(width));
+    put32le(header, static_cast<uint32_t>(height));    // Positive: bottom-up
+    put16le(header, 1);
+    put16le(header, bits);
+    put32le(header, alpha ? 3 : 0);                     // BI_BITFIELDS / BI_RGB
+    put32le(header, static_cast<uint32_t>(padded * height));
+    put32le(header, 2835);                              // 72 DPI in pixels per meter
+    put32le(header, 2835);
+    put32le(header, palette);
+    put32le(header, 0);
+    
+    if (alpha) {
+        put32le(header, 0x00FF0000);
+        put32le(header, 0x0000FF00);
+        put32le(header, 0x000000FF);
+        put32le(header, 0xFF000000);
+        put32le(header, 0x73524742);                    // 'sRGB'
+        header.resize(header.size() + 36 + 12, 0);      // Endpoints, gamma
+    }
+    
+    if (palette == 256) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            put32le(header, (i << 16) | (i << 8) | i);
+        }
+    } else if (palette == 2) {
+        // Mono1 bits index the palette directly: 0 white, 1 black
+        put32le(header, 0x00FFFFFF);
+        put32le(header, 0);
+    }
+    
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file || !write_bytes(file, header)) {
+        return false;
+    }
+    
+    RowConverter converter(image.format(), image.is_premultiplied(), row_format, false,
+                           static_cast<size_t>(width));
+    std::vector<uint8_t> strip(padded * kStripRows, 0);
+    
+    // Bottom row first
+    for (int y1 = height; y1 > 0; y1 -= kStripRows) {
+        const int y0 = std::max(0, y1 - kStripRows);
+        for (int y = y1 - 1; y >= y0; --y) {
+            converter.convert(image.data() + static_cast<size_t>(y) * image.stride(),
+                              strip.data() + static_cast<size_t>(y1 - 1 - y) * padded,
+                              y);
+        }
+        if (!write_bytes(file, strip.data(), padded * static_cast<size_t>(y1 - y0))) {
+            return false;
+        }
+    }
+    
+    file.close();
+    return !file.fail();
+}
+
+} // namespace detail
+
+// TiffWriter implementation
+class TiffWriter::Impl {
+public:
+    std::ofstream file;
+    TiffOptions options;
+    uint64_t next_link = 0;     // Where the last IFD's next-IFD offset lives
+    int pages = 0;
+    bool ok = false;
+    
+    // The page being written
+    struct Page {
+        int width = 0;
+        int height = 0;
+        ImageFormat source = ImageFormat::RGB24;
+        bool premultiplied = false;
+        float dpi = 72.0f;
+        uint32_t samples = 3;
+        uint32_t bits = 8;
+        uint32_t photometric = 2;
+        bool swap = false;
+        bool tiled = false;
+        bool deflate = false;
+        int tile = 0;
+        int block_rows = 0;         // Rows per strip, or per row of tiles
+        int across = 1;             // Blocks per block row
+        size_t row_bytes = 0;
+        int next_row = 0;
+        
+        // Rows of an unfinished strip or tile row, kept from earlier bands
+        std::vector<uint8_t> pending;
+        int pending_rows = 0;
+        
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> byte_counts;
+    };
+    std::unique_ptr<Page> page;
+    
+    bool begin_page(int width, int height, ImageFormat format, bool premultiplied, float dpi);
+    bool add_rows(const uint8_t* data, int stride, int rows);
+    bool end_page();
+    
+    // Current end of file, or false if it no longer fits 32-bit offsets
+    bool position(uint64_t& pos) {
+        const std::streamoff p = file.tellp();
+        if (p < 0 || static_cast<uint64_t>(p) > 0xFFFFFFFFu) return false;
+        pos = static_cast<uint64_t>(p);
+        return true;
+    }
+};
+
+bool TiffWriter::Impl::begin_page(int width, int height, ImageFormat format, bool premultiplied, float dpi) {
+    if (width <= 0 || height <= 0) {
+        return false;
+    }
+    
+    auto p = std::make_unique<Page>();
+    p->width = width;
+    p->height = height;
+    p->source = format;
+    p->premultiplied = premultiplied;
+    p->dpi = dpi;
+    
+    // Every ImageFormat maps onto a baseline TIFF layout; only BGR order
+    // needs converting. Mono1 is WhiteIsZero as is.
+    switch (format) {
+        case ImageFormat::BGR24:
+            p->swap = true;
+            break;
+        case ImageFormat::BGRA32:
+            p->swap = true;
+            p->samples = 4;
+            break;
+        case ImageFormat::RGBA32:
+            p->samples = 4;
+            break;
+        case ImageFormat::Gray8:
+            p->samples = 1;
+            p->photometric = 1;
+            break;
+        case ImageFormat::Mono1:
+            p->samples = 1;
+            p->bits = 1;
+            p->photometric = 0;
+            break;
+        default:
+            break;
+    }
+    
+    p->tiled = options.layout == TiffOptions::Layout::Tiles;
+    p->tile = std::max(16, (options.tile_size + 15) / 16 * 16);
+    p->block_rows = p->tiled ? p->tile : std::clamp(options.rows_per_strip, 1, height);
+    p->across = p->tiled ? (width + p->tile - 1) / p->tile : 1;
+    p->row_bytes = static_cast<size_t>(detail::format_row_bytes(format, width));
+#ifdef USE_ZLIB
+    p->deflate = options.compression == TiffOptions::Compression::Deflate;
+#endif
+    
+    page = std::move(p);
+    return true;
+}
+
+bool TiffWriter::Impl::add_rows(const uint8_t* data, int stride, int rows) {
+    Page& p = *page;
+    if (!data || rows <= 0 || rows > p.height - p.next_row) {
+        return false;
+    }
+    
+    // Rows from first on are held in pending, then in the new band
+    const int first = p.next_row - p.pending_rows;
+    auto row = [&](int y) -> const uint8_t* {
+        if (y < p.next_row) {
+            return p.pending.data() + static_cast<size_t>(y - first) * p.row_bytes;
+        }
+        return data + static_cast<size_t>(y - p.next_row) * stride;
+    };
+    
+    // Encode every strip or tile row that is now complete
+    const int end = p.next_row + rows;
+    const int complete = end == p.height ? (end - first + p.block_rows - 1) / p.block_rows
+                                         : (end - first) / p.block_rows;
+    const size_t block_count = static_cast<size_t>(complete) * p.across;
+    
+    const detail::PixelKernels& k = detail::pixel_kernels();
+    const int pixel_bytes = p.bits == 1 ? 0 : static_cast<int>(p.samples);
+    
+    // Copy count pixels of row y starting at x, swapping to RGB if needed
+    auto copy_span = [&](int y, int x, int count, uint8_t* dst) {
+        const uint8_t* src = row(y);
+        if (p.bits == 1) {
+            std::memcpy(dst, src + x / 8, static_cast<size_t>((count + 7) / 8));
+        } else if (p.swap && p.samples == 3) {
+            k.swap_rb24(src + x * 3, dst, static_cast<size_t>(count));
+        } else if (p.swap) {
+            k.swap_rb32(src + x * 4, dst, static_cast<size_t>(count));
+        } else {
+            std::memcpy(dst, src + x * pixel_bytes, static_cast<size_t>(count) * pixel_bytes);
+        }
+    };
+    
+    auto encode = [&](size_t index, EncodedBlock& block) {
+        const int y0 = first + static_cast<int>(index / p.across) * p.block_rows;
+        if (p.tiled) {
+            // Tiles are always full size; the parts past the image are zero
+            const int tx = static_cast<int>(index % p.across) * p.tile;
+            const size_t tile_row = static_cast<size_t>(detail::format_row_bytes(
+                p.bits == 1 ? ImageFormat::Mono1 : p.source, p.tile));
+            block.raw.assign(tile_row * p.tile, 0);
+            
+            const int count = std::min(p.tile, p.width - tx);
+            for (int r = 0; r < p.tile && y0 + r < p.height; ++r) {
+                copy_span(y0 + r, tx, count, block.raw.data() + r * tile_row);
+            }
+        } else {
+            const int y1 = std::min(p.height, y0 + p.block_rows);
+            block.raw.resize(p.row_bytes * (y1 - y0));
+            for (int y = y0; y < y1; ++y) {
+                copy_span(y, 0, p.width, block.raw.data() + (y - y0) * p.row_bytes);
+            }
+        }
+        
+        block.raw_size = block.raw.size();
+#ifdef USE_ZLIB
+        if (p.deflate) {
+            uLongf size = compressBound(static_cast<uLong>(block.raw.size()));
+            block.data.resize(size);
+            block.ok = compress2(block.data.data(), &size, block.raw.data(),
+                                 static_cast<uLong>(block.raw.size()), Z_DEFAULT_COMPRESSION) == Z_OK;
+            block.data.resize(size);
+            return;
+        }
+#endif
+        block.data.swap(block.raw);
+        block.ok = true;
+    };
+    
+    auto write = [&](size_t, const EncodedBlock& block) {
+        uint64_t pos = 0;
+        if (!position(pos) || pos + block.data.size() > 0xFFFFFFFFu) return false;
+        p.offsets.push_back(static_cast<uint32_t>(pos));
+        p.byte_counts.push_back(static_cast<uint32_t>(block.data.size()));
+        return write_bytes(file, block.data);
+    };
+    
+    if (!encode_blocks(block_count, encode, write)) {
+        return false;
+    }
+    
+    // Keep the rows of the unfinished strip or tile row for the next band
+    const int kept_from = std::min(end, first + complete * p.block_rows);
+    std::vector<uint8_t> pending;
+    pending.reserve(p.row_bytes * static_cast<size_t>(end - kept_from));
+    for (int y = kept_from; y < end; ++y) {
+        const uint8_t* src = row(y);
+        pending.insert(pending.end(), src, src + p.row_bytes);
+    }
+    p.pending.swap(pending);
+    p.pending_rows = end - kept_from;
+    p.next_row = end;
+    return true;
+}
+
+bool TiffWriter::Impl::end_page() {
+    std::unique_ptr<Page> done = std::move(page);
+    const Page& p = *done;
+    if (p.next_row != p.height) {
+        return false;
+    }
+    
+    // Directory entries, sorted by tag as TIFF requires
+    const uint32_t resolution = static_cast<uint32_t>(std::lround(std::max(p.dpi, 1.0f) * 100.0f));
+    std::vector<TiffEntry> entries;
+    entries.push_back(tiff_longs(256, {static_cast<uint32_t>(p.width)}));
+    entries.push_back(tiff_longs(257, {static_cast<uint32_t>(p.height)}));
+    entries.push_back(p.samples == 1 ? tiff_shorts(258, {p.bits})
+                    : p.samples == 3 ? tiff_shorts(258, {8, 8, 8})
+                                     : tiff_shorts(258, {8, 8, 8, 8}));
+    entries.push_back(tiff_shorts(259, {p.deflate ? 8u : 1u}));
+    entries.push_back(tiff_shorts(262, {p.photometric}));
+    if (!p.tiled) {
+        entries.push_back(tiff_longs(273, p.offsets));
+    }
+    entries.push_back(tiff_shorts(277, {p.samples}));
+    if (!p.tiled) {
+        entries.push_back(tiff_longs(278, {static_cast<uint32_t>(p.block_rows)}));
+        entries.push_back(tiff_longs(279, p.byte_counts));
+    }
+    entries.push_back(tiff_rational(282, resolution, 100));
+    entries.push_back(tiff_rational(283, resolution, 100));
+    entries.push_back(tiff_shorts(284, {1}));
+    entries.push_back(tiff_shorts(296, {2}));
+    entries.push_back(tiff_shorts(297, {static_cast<uint32_t>(pages), 0}));    // Total unknown
+    if (p.tiled) {
+        entries.push_back(tiff_longs(322, {static_cast<uint32_t>(p.tile)}));
+        entries.push_back(tiff_longs(323, {static_cast<uint32_t>(p.tile)}));
+        entries.push_back(tiff_longs(324, p.offsets));
+        entries.push_back(tiff_longs(325, p.byte_counts));
+    }
+    if (p.samples == 4) {
+        // Associated (premultiplied) or unassociated alpha
+        entries.push_back(tiff_shorts(338, {p.premultiplied ? 1u : 2u}));
+    }
+    
+    uint64_t ifd = 0;
+    if (!position(ifd)) return false;
+    if (ifd & 1) {
+        const uint8_t pad = 0;
+        if (!write_bytes(file, &pad, 1)) return false;
+        ++ifd;
+    }
+    
+    // Values over four bytes go after the directory
+    const uint64_t next_field = ifd + 2 + 12 * entries.size();
+    uint64_t external = next_field + 4;
+    std::vector<uint8_t> directory;
+    std::vector<uint8_t> values;
+    put16le(directory, static_cast<uint32_t>(entries.size()));
+    for (const TiffEntry& entry : entries) {
+        put16le(directory, entry.tag);
+        put16le(directory, entry.type);
+        put32le(directory, entry.count);
+        if (entry.value.size() <= 4) {
+            std::vector<uint8_t> inline_value = entry.value;
+            inline_value.resize(4, 0);
+            directory.insert(directory.end(), inline_value.begin(), inline_value.end());
+        } else {
+            put32le(directory, static_cast<uint32_t>(external + values.size()));
+            values.insert(values.end(), entry.value.begin(), entry.value.end());
+        }
+    }
+    put32le(directory, 0);
+    
+    if (external + values.size() > 0xFFFFFFFFu ||
+        !write_bytes(file, directory) || !write_bytes(file, values)) {
+        return false;
+    }
+    
+    // Link the previous directory (or the header) to this one
+    std::vector<uint8_t> link;
+    put32le(link, static_cast<uint32_t>(ifd));
+    file.seekp(static_cast<std::streamoff>(next_link));
+    if (!write_bytes(file, link)) return false;
+    file.seekp(0, std::ios::end);
+    
+    next_link = next_field;
+    ++pages;
+    return static_cast<bool>(file);
+}
+
+TiffWriter::TiffWriter() : impl_(std::make_unique<Impl>()) {}
+
+TiffWriter::~TiffWriter() {
+    if (is_open()) {
+        close();
+    }
+}
+
+bool TiffWriter::open(const std::string& path, const TiffOptions& options) {
+    if (is_open()) {
+        close();
+    }
+    
+    impl_->file.clear();
+    impl_->file.open(path, std::ios::binary | std::ios::trunc);
+    if (!impl_->file) {
+        return false;
+    }
+    
+    // Little-endian header; the first directory offset is patched in later
+    std::vector<uint8_t> header = {'I', 'I'};
+    put16le(header, 42);
+    put32le(header, 0);
+    
+    impl_->options = options;
+    impl_->next_link = 4;
+    impl_->pages = 0;
+    impl_->page.reset();
+    impl_->ok = write_bytes(impl_->file, header);
+    return impl_->ok;
+}
+
+bool TiffWriter::add_page(const ImageBuffer& image, float dpi) {
+    if (!image.data()) {
+        return false;
+    }
+    return begin_page(image.width(), image.height(), image.format(), image.is_premultiplied(), dpi) &&
+           add_rows(image.data(), image.stride(), image.height()) &&
+           end_page();
+}
+
+bool TiffWriter::begin_page(int width, int height, ImageFormat format, bool premultiplied, float dpi) {
+    if (!is_open() || !impl_->ok || impl_->page) {
+        return false;
+    }
+    return impl_->begin_page(width, height, format, premultiplied, dpi);
+}
+
+// A page that fails part way cannot be taken back out of the file, so
+// any failure from here on fails the whole file
+bool TiffWriter::add_rows(const uint8_t* data, int stride, int rows) {
+    if (!is_open() || !impl_->ok || !impl_->page) {
+        return false;
+    }
+    impl_->ok = impl_->add_rows(data, stride, rows);
+    return impl_->ok;
+}
+
+bool TiffWriter::end_page() {
+    if (!is_open() || !impl_->ok || !impl_->page) {
+        return false;
+    }
+    impl_->ok = impl_->end_page();
+    return impl_->ok;
+}
+
+bool TiffWriter::close() {
+    if (!is_open()) {
+        return false;
+    }
+    
+    // A TIFF needs at least one directory; an unfinished page is dropped
+    const bool ok = impl_->ok && impl_->pages > 0 && !impl_->page;
+    impl_->page.reset();
+    impl_->file.close();
+    return ok && !impl_->file.fail();
+}
+
+bool TiffWriter::is_open() const {
+    return impl_->file.is_open();
+}
+
+int TiffWriter::page_count() const {
+    return impl_->pages;
+}
+
+// TiffSink implementation
+class TiffSink::Impl {
+public:
+    TiffWriter own;             // Used when the sink writes its own file
+    TiffWriter* writer = nullptr;
+    std::string path;
+    TiffOptions options;
+    int next_row = 0;
+    bool started = false;
+    
+    bool owns() const { return writer == &own; }
+};
+
+TiffSink::TiffSink(const std::string& path, const TiffOptions& options) : impl_(std::make_unique<Impl>()) {
+    impl_->writer = &impl_->own;
+    impl_->path = path;
+    impl_->options = options;
+}
+
+TiffSink::TiffSink(TiffWriter& writer) : impl_(std::make_unique<Impl>()) {
+    impl_->writer = &writer;
+}
+
+TiffSink::~TiffSink() {
+    if (impl_->started) {
+        abort();
+    }
+}
+
+bool TiffSink::begin(int width, int height, ImageFormat format, bool premultiplied, float dpi) {
+    Impl& d = *impl_;
+    if (d.started || (d.owns() && !d.own.open(d.path, d.options))) {
+        return false;
+    }
+    d.started = d.writer->begin_page(width, height, format, premultiplied, dpi);
+    d.next_row = 0;
+    if (!d.started && d.owns()) {
+        d.own.close();
+        std::remove(d.path.c_str());
+    }
+    return d.started;
+}
+
+bool TiffSink::write_rows(const uint8_t* data, int stride, int y, int rows) {
+    Impl& d = *impl_;
+    if (!d.started || y != d.next_row) {
+        return false;
+    }
+    d.next_row = y + rows;
+    return d.writer->add_rows(data, stride, rows);
+}
+
+bool TiffSink::finish() {
+    Impl& d = *impl_;
+    if (!d.started) {
+        return false;
+    }
+    d.started = false;
+    
+    bool ok = d.writer->end_page();
+    if (d.owns()) {
+        ok = d.own.close() && ok;
+        if (!ok) {
+            std::remove(d.path.c_str());
+        }
+    }
+    return ok;
+}
+
+void TiffSink::abort() {
+    Impl& d = *impl_;
+    if (!d.started) {
+        return;
+    }
+    d.started = false;
+    
+    if (d.owns()) {
+        d.own.close();
+        std::remove(d.path.c_str());
+    } else {
+        // The rows already written cannot be taken back out, so this
+        // fails the shared writer
+        d.writer->end_page();
+    }
+}
+
+} // namespace pdfeditor
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "pdfeditor/renderer.h"
+#include <string>
+
+namespace pdfeditor {
+namespace detail {
+
+// Encoders behind ImageBuffer::save_*. Each one converts and writes the
+// image a strip of rows at a time rather than building the file in
+// memory. PNG and JPEG go through PngSink and JpegSink, which take the
+// rows in bands; TIFF output lives in TiffWriter.
+bool write_png(const ImageBuffer& image, const std::string& path);
+bool write_jpeg(const ImageBuffer& image, const std::string& path, int quality);
+bool write_bmp(const ImageBuffer& image, const std::string& path);
+
+} // namespace detail
+} // namespace pdfeditor
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace pdfeditor {
+namespace detail {
+
+// Key grouping for caches that need none: every key in group 0
+template <typename Key>
+struct SingleGroup {
+    uint64_t operator()(const Key&) const { return 0; }
+};
+
+// Thread-safe least-recently-used cache bounded by a byte budget.
+//
+// Values are shared so a hit stays valid after the entry is evicted.
+// Renders run without the cache lock held, so a render may finish after
+// the page it read was invalidated. To keep such stale results out,
+// callers take a generation() token before rendering and pass it to
+// insert(); the insert is dropped if anything was invalidated meanwhile.
+//
+// GroupOf maps each key to a group, such as the page it renders, and an
+// index of each group's keys lets for_each_in() and erase_if_in() visit
+// one group without walking the whole cache.
+template <typename Key, typename Value, typename Hash = std::hash<Key>,
+          typename GroupOf = SingleGroup<Key>>
+class LruCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        size_t entries = 0;
+        size_t bytes = 0;
+    };
+    
+    explicit LruCache(size_t budget) : budget_(budget) {}
+    
+    std::shared_ptr<const Value> find(const Key& key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key);
+        if (it == entries_.end()) {
+            ++stats_.misses;
+            return nullptr;
+        }
+        ++stats_.hits;
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+        return it->second.value;
+    }
+    
+    // Look up without touching recency or statistics
+    std::shared_ptr<const Value> peek(const Key& key) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key);
+        return it == entries_.end() ? nullptr : it->second.value;
+    }
+    
+    uint64_t generation() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return generation_;
+    }
+    
+    bool insert(const Key& key, std::shared_ptr<const Value> value, size_t cost, uint64_t generation) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (generation != generation_ || cost > budget_) {
+            return false;
+        }
+        
+        auto it = entries_.find(key);
+        if (it != entries_.end()) {
+            erase_locked(it);
+        }
+        
+        auto& group = groups_[GroupOf()(key)];
+        group.push_front(key);
+        lru_.push_front(key);
+        entries_.emplace(key, Entry{std::move(value), cost, lru_.begin(), group.begin()});
+        bytes_ += cost;
+        evict_locked();
+        return true;
+    }
+    
+    // Remove every entry whose key matches the predicate
+    template <typename Predicate>
+    void erase_if(Predicate predicate) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++generation_;
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            if (predicate(it->first)) {
+                it = erase_locked(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    
+    // As erase_if(), over one group's entries only
+    template <typename Predicate>
+    void erase_if_in(uint64_t group, Predicate predicate) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++generation_;
+        auto members = groups_.find(group);
+        if (members == groups_.end()) return;
+        
+        // Erasing the last key drops the group's list
+        std::vector<Key> doomed;
+        for (const Key& key : members->second) {
+            if (predicate(key)) {
+                doomed.push_back(key);
+            }
+        }
+        for (const Key& key : doomed) {
+            erase_locked(entries_.find(key));
+        }
+    }
+    
+    // Visit one group's entries, newest first, until the visitor returns
+    // false
+    template <typename Visitor>
+    void for_each_in(uint64_t group, Visitor visitor) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto members = groups_.find(group);
+        if (members == groups_.end()) return;
+        for (const Key& key : members->second) {
+            if (!visitor(key, entries_.find(key)->second.value)) break;
+        }
+    }
+    
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++generation_;
+        entries_.clear();
+        lru_.clear();
+        groups_.clear();
+        bytes_ = 0;
+    }
+    
+    void set_budget(size_t budget) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        budget_ = budget;
+        evict_locked();
+    }
+    
+    size_t budget() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return budget_;
+    }
+    
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Stats stats = stats_;
+        stats.entries = entries_.size();
+        stats.bytes = bytes_;
+        return stats;
+    }
+    
+    void reset_stats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_ = Stats();
+    }
+
+private:
+    struct Entry {
+        std::shared_ptr<const Value> value;
+        size_t cost;
+        typename std::list<Key>::iterator lru;
+        typename std::list<Key>::iterator group;    // In groups_
+    };
+    
+    using Map = std::unordered_map<Key, Entry, Hash>;
+    
+    typename Map::iterator erase_locked(typename Map::iterator it) {
+        bytes_ -= it->second.cost;
+        lru_.erase(it->second.lru);
+        auto members = groups_.find(GroupOf()(it->first));
+        members->second.erase(it->second.group);
+        if (members->second.empty()) {
+            groups_.erase(members);
+        }
+        return entries_.erase(it);
+    }
+    
+    void evict_locked() {
+        while (bytes_ > budget_ && !lru_.empty()) {
+            erase_locked(entries_.find(lru_.back()));
+            ++stats_.evictions;
+        }
+    }
+    
+    mutable std::mutex mutex_;
+    Map entries_;
+    std::list<Key> lru_;
+    std::unordered_map<uint64_t, std::list<Key>> groups_;
+    size_t bytes_ = 0;
+    size_t budget_;
+    uint64_t generation_ = 0;
+    Stats stats_;
+};
+
+} // namespace detail
+} // namespace pdfeditor
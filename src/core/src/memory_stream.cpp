@@ -0,0 +1,94 @@
+#include "memory_stream.h"
+#include <cstdio>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define PDFEDITOR_HAVE_MMAP 1
+#endif
+
+namespace pdfeditor {
+namespace detail {
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string& path, Advice advice) {
+#ifdef PDFEDITOR_HAVE_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return nullptr;
+    
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+    
+    const size_t size = static_cast<size_t>(info.st_size);
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file referenced on its own
+    close(fd);
+    if (data == MAP_FAILED) return nullptr;
+    
+    if (advice == Advice::Sequential) {
+        madvise(data, size, MADV_SEQUENTIAL);
+    } else if (advice == Advice::Random) {
+        madvise(data, size, MADV_RANDOM);
+    }
+    
+    return std::shared_ptr<MappedFile>(new MappedFile(static_cast<const uint8_t*>(data), size));
+#else
+    (void)path;
+    (void)advice;
+    return nullptr;
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifdef PDFEDITOR_HAVE_MMAP
+    munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+}
+
+#ifdef USE_MUPDF
+namespace {
+    struct SharedMemory {
+        std::shared_ptr<const void> owner;
+    };
+    
+    // The whole buffer is available from the start: there is never more
+    int next_shared(fz_context*, fz_stream*, size_t) {
+        return EOF;
+    }
+    
+    // As MuPDF's own memory streams: pos stays at the end of the buffer
+    // and only rp moves
+    void seek_shared(fz_context*, fz_stream* stm, int64_t offset, int whence) {
+        const int64_t pos = stm->pos - (stm->wp - stm->rp);
+        if (whence == SEEK_CUR) {
+            offset += pos;
+        } else if (whence == SEEK_END) {
+            offset += stm->pos;
+        }
+        if (offset < 0) offset = 0;
+        if (offset > stm->pos) offset = stm->pos;
+        stm->rp += offset - pos;
+    }
+    
+    void drop_shared(fz_context*, void* state) {
+        delete static_cast<SharedMemory*>(state);
+    }
+}
+
+fz_stream* open_shared_memory(fz_context* ctx, std::shared_ptr<const void> owner, const uint8_t* data, size_t size) {
+    // fz_new_stream drops the state itself if it throws
+    fz_stream* stm = fz_new_stream(ctx, new SharedMemory{std::move(owner)}, next_shared, drop_shared);
+    stm->seek = seek_shared;
+    stm->rp = const_cast<unsigned char*>(data);
+    stm->wp = stm->rp + size;
+    stm->pos = static_cast<int64_t>(size);
+    return stm;
+}
+#endif
+
+} // namespace detail
+} // namespace pdfeditor
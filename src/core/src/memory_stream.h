@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#ifdef USE_MUPDF
+#include <mupdf/fitz.h>
+#endif
+
+namespace pdfeditor {
+namespace detail {
+
+// Read-only memory map of a whole file. Pages are faulted in from the
+// page cache as they are read, so opening costs no read() and no copy.
+// The mapping is released with the last reference.
+class MappedFile {
+public:
+    // Kernel read-ahead hint for the mapping
+    enum class Advice {
+        Normal,
+        Sequential,     // Read ahead aggressively, drop pages behind
+        Random          // Read only what is touched
+    };
+    
+    // Null if the file cannot be mapped: missing, empty, not a regular
+    // file, or no mmap on this platform. The file must not be truncated
+    // while mapped.
+    static std::shared_ptr<MappedFile> open(const std::string& path, Advice advice = Advice::Normal);
+    
+    ~MappedFile();
+    
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    MappedFile(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+    
+    const uint8_t* data_;
+    size_t size_;
+};
+
+#ifdef USE_MUPDF
+// Seekable stream over size bytes at data, read in place. owner is held
+// until MuPDF drops the stream, so whatever keeps data alive (a mapping,
+// a vector) lives exactly as long as the document reading it.
+fz_stream* open_shared_memory(fz_context* ctx, std::shared_ptr<const void> owner, const uint8_t* data, size_t size);
+#endif
+
+} // namespace detail
+} // namespace pdfeditor
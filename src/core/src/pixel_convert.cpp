@@ -0,0 +1,1153 @@
+#include "pixel_convert.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define PDFEDITOR_PIXEL_X86 1
+    #include <immintrin.h>
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    #define PDFEDITOR_PIXEL_NEON 1
+    #include <arm_neon.h>
+#endif
+
+// GCC and Clang need vector code marked with the ISA it uses when the
+// file is built for the baseline; MSVC accepts the intrinsics anywhere.
+#if defined(__GNUC__) || defined(__clang__)
+    #define PDFEDITOR_TARGET(isa) __attribute__((target(isa)))
+#else
+    #define PDFEDITOR_TARGET(isa)
+#endif
+
+namespace pdfeditor {
+namespace detail {
+
+namespace {
+    const uint8_t kBayer8[8][8] = {
+        { 0, 32,  8, 40,  2, 34, 10, 42},
+        {48, 16, 56, 24, 50, 18, 58, 26},
+        {12, 44,  4, 36, 14, 46,  6, 38},
+        {60, 28, 52, 20, 62, 30, 54, 22},
+        { 3, 35, 11, 43,  1, 33,  9, 41},
+        {51, 19, 59, 27, 49, 17, 57, 25},
+        {15, 47,  7, 39, 13, 45,  5, 37},
+        {63, 31, 55, 23, 61, 29, 53, 21}
+    };
+    
+    // Thresholds spread evenly over 2..254, so 0 is always black and 255
+    // always white
+    inline uint8_t bayer_threshold(int x, int y) {
+        return static_cast<uint8_t>(kBayer8[y & 7][x & 7] * 4 + 2);
+    }
+    
+    // Thresholds for 16 consecutive pixels starting at x0; the pattern
+    // repeats every 8, so it holds for every 16-pixel step
+    void bayer_row(uint8_t* out, size_t n, int x0, int y) {
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = bayer_threshold(x0 + static_cast<int>(i), y);
+        }
+    }
+    
+    // x / 255 rounded to nearest, for x = c * a
+    inline uint8_t div255(unsigned x) {
+        x += 128;
+        return static_cast<uint8_t>((x + (x >> 8)) >> 8);
+    }
+    
+    inline uint8_t luma(unsigned r, unsigned g, unsigned b) {
+        return static_cast<uint8_t>((77 * r + 150 * g + 29 * b + 128) >> 8);
+    }
+    
+    // ===== Portable kernels =====
+    
+    void swap_rb24_scalar(const uint8_t* src, uint8_t* dst, size_t count) {
+        for (size_t i = 0; i < count; ++i, src += 3, dst += 3) {
+            uint8_t r = src[0];
+            uint8_t g = src[1];
+            uint8_t b = src[2];
+            dst[0] = b;
+            dst[1] = g;
+            dst[2] = r;
+        }
+    }
+    
+    void swap_rb32_scalar(const uint8_t* src, uint8_t* dst, size_t count) {
+        for (size_t i = 0; i < count; ++i, src += 4, dst += 4) {
+            uint8_t r = src[0];
+            uint8_t g = src[1];
+            uint8_t b = src[2];
+            uint8_t a = src[3];
+            dst[0] = b;
+            dst[1] = g;
+            dst[2] = r;
+            dst[3] = a;
+        }
+    }
+    
+    void add_alpha_scalar(const uint8_t* src, uint8_t* dst, size_t count) {
+        for (size_t i = 0; i < count; ++i, src += 3, dst += 4) {
+            dst[0] = src[0];
+            dst[1] = src[1];
+            dst[2] = src[2];
+            dst[3] = 255;
+        }
+    }
+    
+    void drop_alpha_scalar(const uint8_t* src, uint8_t* dst, size_t count) {
+        for (size_t i = 0; i < count; ++i, src += 4, dst += 3) {
+            uint8_t c0 = src[0];
+            uint8_t c1 = src[1];
+            uint8_t c2 = src[2];
+            dst[0] = c0;
+            dst[1] = c1;
+            dst[2] = c2;
+        }
+    }
+    
+    void premultiply_scalar(uint8_t* p, size_t count) {
+        for (size_t i = 0; i < count; ++i, p += 4) {
+            unsigned a = p[3];
+            p[0] = div255(p[0] * a);
+            p[1] = div255(p[1] * a);
+            p[2] = div255(p[2] * a);
+        }
+    }
+    
+    void unpremultiply_scalar(uint8_t* p, size_t count) {
+        for (size_t i = 0; i < count; ++i, p += 4) {
+            unsigned a = p[3];
+            if (a == 0) {
+                p[0] = p[1] = p[2] = 0;
+                continue;
+            }
+            for (int c = 0; c < 3; ++c) {
+                unsigned v = (p[c] * 255u + a / 2) / a;
+                p[c] = static_cast<uint8_t>(std::min(v, 255u));
+            }
+        }
+    }
+    
+    void gray_from24_scalar(const uint8_t* src, uint8_t* dst, size_t count, bool bgr) {
+        const int r = bgr ? 2 : 0;
+        const int b = bgr ? 0 : 2;
+        for (size_t i = 0; i < count; ++i, src += 3) {
+            dst[i] = luma(src[r], src[1], src[b]);
+        }
+    }
+    
+    void gray_from32_scalar(const uint8_t* src, uint8_t* dst, size_t count, bool bgr) {
+        const int r = bgr ? 2 : 0;
+        const int b = bgr ? 0 : 2;
+        for (size_t i = 0; i < count; ++i, src += 4) {
+            dst[i] = luma(src[r], src[1], src[b]);
+        }
+    }
+    
+    void gray_to24_scalar(const uint8_t* src, uint8_t* dst, size_t count) {
+        for (size_t i = 0; i < count; ++i, dst += 3) {
+            dst[0] = dst[1] = dst[2] = src[i];
+        }
+    }
+    
+    void gray_to32_scalar(const uint8_t* src, uint8_t* dst, size_t count) {
+        for (size_t i = 0; i < count; ++i, dst += 4) {
+            dst[0] = dst[1] = dst[2] = src[i];
+            dst[3] = 255;
+        }
+    }
+    
+    void dither_ordered_scalar(const uint8_t* gray, uint8_t* bits, size_t count, int x0, int y) {
+        uint8_t acc = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (gray[i] < bayer_threshold(x0 + static_cast<int>(i), y)) {
+                acc |= static_cast<uint8_t>(0x80 >> (i & 7));
+            }
+            if ((i & 7) == 7) {
+                bits[i >> 3] = acc;
+                acc = 0;
+            }
+        }
+        if (count & 7) {
+            bits[count >> 3] = acc;
+        }
+    }
+    
+    uint8_t clamp_resampled(int32_t acc) {
+        return static_cast<uint8_t>(std::clamp(acc >> kResampleShift, 0, 255));
+    }
+    
+    // Bytes begin..end of resample_rows, shared with the vector tails
+    void resample_rows_from(const uint8_t* const* rows, const int16_t* weights, int taps,
+                            uint8_t* dst, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            int32_t acc = 1 << (kResampleShift - 1);
+            for (int k = 0; k < taps; ++k) {
+                acc += weights[k] * rows[k][i];
+            }
+            dst[i] = clamp_resampled(acc);
+        }
+    }
+    
+    void resample_rows_scalar(const uint8_t* const* rows, const int16_t* weights, int taps, uint8_t* dst, size_t bytes) {
+        resample_rows_from(rows, weights, taps, dst, 0, bytes);
+    }
+    
+    void resample_row4_scalar(const uint8_t* src, uint8_t* dst, size_t count,
+                              const ResampleTaps* taps, const int16_t* weights) {
+        for (size_t x = 0; x < count; ++x, dst += 4) {
+            const uint8_t* p = src + static_cast<size_t>(taps[x].first) * 4;
+            const int16_t* w = weights + taps[x].offset;
+            int32_t acc[4] = { 1 << (kResampleShift - 1), 1 << (kResampleShift - 1),
+                               1 << (kResampleShift - 1), 1 << (kResampleShift - 1) };
+            for (int k = 0; k < taps[x].count; ++k, p += 4) {
+                for (int c = 0; c < 4; ++c) {
+                    acc[c] += w[k] * p[c];
+                }
+            }
+            for (int c = 0; c < 4; ++c) {
+                dst[c] = clamp_resampled(acc[c]);
+            }
+        }
+    }
+    
+#ifdef PDFEDITOR_PIXEL_X86
+    // ===== SSSE3 kernels (four pixels per 16-byte vector) =====
+    
+    PDFEDITOR_TARGET("ssse3")
+    void swap_rb24_ssse3(const uint8_t* src, uint8_t* dst, size_t count) {
+        // Bytes 12-15 (the next pixels) are written back unchanged, which
+        // keeps in-place use safe
+        const __m128i mask = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 12, 13, 14, 15);
+        size_t i = 0;
+        for (; i + 6 <= count; i += 4) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 3), _mm_shuffle_epi8(v, mask));
+        }
+        swap_rb24_scalar(src + i * 3, dst + i * 3, count - i);
+    }
+    
+    PDFEDITOR_TARGET("ssse3")
+    void swap_rb32_ssse3(const uint8_t* src, uint8_t* dst, size_t count) {
+        const __m128i mask = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), _mm_shuffle_epi8(v, mask));
+        }
+        swap_rb32_scalar(src + i * 4, dst + i * 4, count - i);
+    }
+    
+    PDFEDITOR_TARGET("ssse3")
+    void add_alpha_ssse3(const uint8_t* src, uint8_t* dst, size_t count) {
+        const __m128i mask = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+        size_t i = 0;
+        for (; i + 6 <= count; i += 4) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4),
+                             _mm_or_si128(_mm_shuffle_epi8(v, mask), alpha));
+        }
+        add_alpha_scalar(src + i * 3, dst + i * 4, count - i);
+    }
+    
+    PDFEDITOR_TARGET("ssse3")
+    void drop_alpha_ssse3(const uint8_t* src, uint8_t* dst, size_t count) {
+        // Each store spills four bytes past its 12, never reaching source
+        // bytes not yet read, so in-place use stays safe
+        const __m128i mask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        size_t i = 0;
+        for (; i + 6 <= count; i += 4) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 3), _mm_shuffle_epi8(v, mask));
+        }
+        drop_alpha_scalar(src + i * 4, dst + i * 3, count - i);
+    }
+    
+    // Premultiply four pixels held in v
+    PDFEDITOR_TARGET("ssse3")
+    inline __m128i premultiply4(__m128i v) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i round = _mm_set1_epi16(128);
+        const __m128i alpha_lo = _mm_setr_epi8(3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1);
+        const __m128i alpha_hi = _mm_setr_epi8(11, -1, 11, -1, 11, -1, 11, -1, 15, -1, 15, -1, 15, -1, 15, -1);
+        const __m128i alpha_mask = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+        
+        __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), _mm_shuffle_epi8(v, alpha_lo));
+        __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), _mm_shuffle_epi8(v, alpha_hi));
+        lo = _mm_add_epi16(lo, round);
+        hi = _mm_add_epi16(hi, round);
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+        
+        __m128i color = _mm_andnot_si128(alpha_mask, _mm_packus_epi16(lo, hi));
+        return _mm_or_si128(color, _mm_and_si128(v, alpha_mask));
+    }
+    
+    PDFEDITOR_TARGET("ssse3")
+    void premultiply_ssse3(uint8_t* p, size_t count) {
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            __m128i* at = reinterpret_cast<__m128i*>(p + i * 4);
+            _mm_storeu_si128(at, premultiply4(_mm_loadu_si128(at)));
+        }
+        premultiply_scalar(p + i * 4, count - i);
+    }
+    
+    // Unpremultiply four pixels held in v. Float division is exact here:
+    // the quotient of two integers below 2^16 never rounds across an
+    // integer in single precision.
+    inline __m128i unpremultiply4(__m128i v) {
+        const __m128i byte = _mm_set1_epi32(0xFF);
+        const __m128 scale = _mm_set1_ps(255.0f);
+        const __m128 max = _mm_set1_ps(255.0f);
+        
+        __m128i a = _mm_srli_epi32(v, 24);
+        __m128 af = _mm_cvtepi32_ps(a);
+        __m128 half = _mm_cvtepi32_ps(_mm_srli_epi32(a, 1));
+        __m128 nonzero = _mm_cmpneq_ps(af, _mm_setzero_ps());
+        
+        __m128i out = _mm_slli_epi32(a, 24);
+        for (int c = 0; c < 3; ++c) {
+            __m128i ci = _mm_and_si128(_mm_srli_epi32(v, 8 * c), byte);
+            __m128 num = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(ci), scale), half);
+            __m128 q = _mm_min_ps(_mm_div_ps(num, af), max);
+            q = _mm_and_ps(q, nonzero);
+            out = _mm_or_si128(out, _mm_slli_epi32(_mm_cvttps_epi32(q), 8 * c));
+        }
+        return out;
+    }
+    
+    PDFEDITOR_TARGET("ssse3")
+    void unpremultiply_ssse3(uint8_t* p, size_t count) {
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            __m128i* at = reinterpret_cast<__m128i*>(p + i * 4);
+            _mm_storeu_si128(at, unpremultiply4(_mm_loadu_si128(at)));
+        }
+        unpremultiply_scalar(p + i * 4, count - i);
+    }
+    
+    // Luma of four 4-byte pixels as 32-bit lanes
+    inline __m128i luma4(__m128i v, bool bgr) {
+        const __m128i rb_mask = _mm_set1_epi32(0x00FF00FF);
+        const __m128i g_mask = _mm_set1_epi32(0xFF);
+        const __m128i w_rb = bgr ? _mm_set1_epi32((77 << 16) | 29) : _mm_set1_epi32((29 << 16) | 77);
+        const __m128i w_g = _mm_set1_epi32(150);
+        const __m128i round = _mm_set1_epi32(128);
+        
+        __m128i rb = _mm_madd_epi16(_mm_and_si128(v, rb_mask), w_rb);
+        __m128i g = _mm_madd_epi16(_mm_and_si128(_mm_srli_epi32(v, 8), g_mask), w_g);
+        return _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(rb, g), round), 8);
+    }
+    
+    PDFEDITOR_TARGET("ssse3")
+    void gray_from32_ssse3(const uint8_t* src, uint8_t* dst, size_t count, bool bgr) {
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            const __m128i* in = reinterpret_cast<const __m128i*>(src + i * 4);
+            __m128i l0 = luma4(_mm_loadu_si128(in + 0), bgr);
+            __m128i l1 = luma4(_mm_loadu_si128(in + 1), bgr);
+            __m128i l2 = luma4(_mm_loadu_si128(in + 2), bgr);
+            __m128i l3 = luma4(_mm_loadu_si128(in + 3), bgr);
+            __m128i packed = _mm_packus_epi16(_mm_packs_epi32(l0, l1), _mm_packs_epi32(l2, l3));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), packed);
+        }
+        gray_from32_scalar(src + i * 4, dst + i, count - i, bgr);
+    }
+    
+    PDFEDITOR_TARGET("ssse3")
+    void gray_from24_ssse3(const uint8_t* src, uint8_t* dst, size_t count, bool bgr) {
+        const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        size_t i = 0;
+        // The last load reads four bytes past its pixels
+        for (; i + 18 <= count; i += 16) {
+            const uint8_t* in = src + i * 3;
+            __m128i l0 = luma4(_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 0)), spread), bgr);
+            __m128i l1 = luma4(_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 12)), spread), bgr);
+            __m128i l2 = luma4(_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 24)), spread), bgr);
+            __m128i l3 = luma4(_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 36)), spread), bgr);
+            __m128i packed = _mm_packus_epi16(_mm_packs_epi32(l0, l1), _mm_packs_epi32(l2, l3));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), packed);
+        }
+        gray_from24_scalar(src + i * 3, dst + i, count - i, bgr);
+    }
+    
+    PDFEDITOR_TARGET("ssse3")
+    void gray_to24_ssse3(const uint8_t* src, uint8_t* dst, size_t count) {
+        const __m128i m0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+        const __m128i m1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+        const __m128i m2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            __m128i* out = reinterpret_cast<__m128i*>(dst + i * 3);
+            _mm_storeu_si128(out + 0, _mm_shuffle_epi8(g, m0));
+            _mm_storeu_si128(out + 1, _mm_shuffle_epi8(g, m1));
+            _mm_storeu_si128(out + 2, _mm_shuffle_epi8(g, m2));
+        }
+        gray_to24_scalar(src + i, dst + i * 3, count - i);
+    }
+    
+    PDFEDITOR_TARGET("ssse3")
+    void gray_to32_ssse3(const uint8_t* src, uint8_t* dst, size_t count) {
+        const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            __m128i* out = reinterpret_cast<__m128i*>(dst + i * 4);
+            for (int k = 0; k < 4; ++k) {
+                const char b = static_cast<char>(4 * k);
+                __m128i mask = _mm_setr_epi8(b, b, b, -1, b + 1, b + 1, b + 1, -1,
+                                             b + 2, b + 2, b + 2, -1, b + 3, b + 3, b + 3, -1);
+                _mm_storeu_si128(out + k, _mm_or_si128(_mm_shuffle_epi8(g, mask), alpha));
+            }
+        }
+        gray_to32_scalar(src + i, dst + i * 4, count - i);
+    }
+    
+    PDFEDITOR_TARGET("ssse3")
+    void dither_ordered_ssse3(const uint8_t* gray, uint8_t* bits, size_t count, int x0, int y) {
+        // Reversing each group of eight before movemask puts the first
+        // pixel in the most significant bit
+        const __m128i reverse = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+        const __m128i zero = _mm_setzero_si128();
+        
+        alignas(16) uint8_t thresholds[16];
+        bayer_row(thresholds, 16, x0, y);
+        const __m128i t = _mm_load_si128(reinterpret_cast<const __m128i*>(thresholds));
+        
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(gray + i));
+            // t - g saturates to zero exactly where the pixel is white
+            __m128i white = _mm_cmpeq_epi8(_mm_subs_epu8(t, g), zero);
+            unsigned m = ~static_cast<unsigned>(_mm_movemask_epi8(_mm_shuffle_epi8(white, reverse)));
+            bits[i >> 3] = static_cast<uint8_t>(m);
+            bits[(i >> 3) + 1] = static_cast<uint8_t>(m >> 8);
+        }
+        dither_ordered_scalar(gray + i, bits + (i >> 3), count - i, x0 + static_cast<int>(i), y);
+    }
+    
+    // ===== AVX2 kernels (eight pixels per 32-byte vector) =====
+    
+    PDFEDITOR_TARGET("avx2")
+    void swap_rb32_avx2(const uint8_t* src, uint8_t* dst, size_t count) {
+        const __m256i mask = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                              2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 4));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), _mm256_shuffle_epi8(v, mask));
+        }
+        swap_rb32_ssse3(src + i * 4, dst + i * 4, count - i);
+    }
+    
+    PDFEDITOR_TARGET("avx2")
+    void premultiply_avx2(uint8_t* p, size_t count) {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i round = _mm256_set1_epi16(128);
+        const __m256i alpha_lo = _mm256_setr_epi8(3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1,
+                                                  3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1);
+        const __m256i alpha_hi = _mm256_setr_epi8(11, -1, 11, -1, 11, -1, 11, -1, 15, -1, 15, -1, 15, -1, 15, -1,
+                                                  11, -1, 11, -1, 11, -1, 11, -1, 15, -1, 15, -1, 15, -1, 15, -1);
+        const __m256i alpha_mask = _mm256_set1_epi32(static_cast<int>(0xFF000000u));
+        
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256i* at = reinterpret_cast<__m256i*>(p + i * 4);
+            __m256i v = _mm256_loadu_si256(at);
+            __m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(v, zero), _mm256_shuffle_epi8(v, alpha_lo));
+            __m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(v, zero), _mm256_shuffle_epi8(v, alpha_hi));
+            lo = _mm256_add_epi16(lo, round);
+            hi = _mm256_add_epi16(hi, round);
+            lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+            hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+            __m256i color = _mm256_andnot_si256(alpha_mask, _mm256_packus_epi16(lo, hi));
+            _mm256_storeu_si256(at, _mm256_or_si256(color, _mm256_and_si256(v, alpha_mask)));
+        }
+        premultiply_ssse3(p + i * 4, count - i);
+    }
+    
+    PDFEDITOR_TARGET("avx2")
+    void unpremultiply_avx2(uint8_t* p, size_t count) {
+        const __m256i byte = _mm256_set1_epi32(0xFF);
+        const __m256 scale = _mm256_set1_ps(255.0f);
+        const __m256 max = _mm256_set1_ps(255.0f);
+        
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256i* at = reinterpret_cast<__m256i*>(p + i * 4);
+            __m256i v = _mm256_loadu_si256(at);
+            __m256i a = _mm256_srli_epi32(v, 24);
+            __m256 af = _mm256_cvtepi32_ps(a);
+            __m256 half = _mm256_cvtepi32_ps(_mm256_srli_epi32(a, 1));
+            __m256 nonzero = _mm256_cmp_ps(af, _mm256_setzero_ps(), _CMP_NEQ_OQ);
+            
+            __m256i out = _mm256_slli_epi32(a, 24);
+            for (int c = 0; c < 3; ++c) {
+                __m256i ci = _mm256_and_si256(_mm256_srli_epi32(v, 8 * c), byte);
+                __m256 num = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(ci), scale), half);
+                __m256 q = _mm256_min_ps(_mm256_div_ps(num, af), max);
+                q = _mm256_and_ps(q, nonzero);
+                out = _mm256_or_si256(out, _mm256_slli_epi32(_mm256_cvttps_epi32(q), 8 * c));
+            }
+            _mm256_storeu_si256(at, out);
+        }
+        unpremultiply_ssse3(p + i * 4, count - i);
+    }
+    
+    PDFEDITOR_TARGET("avx2")
+    inline __m256i luma8(__m256i v, bool bgr) {
+        const __m256i rb_mask = _mm256_set1_epi32(0x00FF00FF);
+        const __m256i g_mask = _mm256_set1_epi32(0xFF);
+        const __m256i w_rb = bgr ? _mm256_set1_epi32((77 << 16) | 29) : _mm256_set1_epi32((29 << 16) | 77);
+        const __m256i w_g = _mm256_set1_epi32(150);
+        const __m256i round = _mm256_set1_epi32(128);
+        
+        __m256i rb = _mm256_madd_epi16(_mm256_and_si256(v, rb_mask), w_rb);
+        __m256i g = _mm256_madd_epi16(_mm256_and_si256(_mm256_srli_epi32(v, 8), g_mask), w_g);
+        return _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(rb, g), round), 8);
+    }
+    
+    PDFEDITOR_TARGET("avx2")
+    void gray_from32_avx2(const uint8_t* src, uint8_t* dst, size_t count, bool bgr) {
+        // Packing works per 128-bit lane; this restores pixel order
+        const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+        
+        size_t i = 0;
+        for (; i + 32 <= count; i += 32) {
+            const __m256i* in = reinterpret_cast<const __m256i*>(src + i * 4);
+            __m256i l0 = luma8(_mm256_loadu_si256(in + 0), bgr);
+            __m256i l1 = luma8(_mm256_loadu_si256(in + 1), bgr);
+            __m256i l2 = luma8(_mm256_loadu_si256(in + 2), bgr);
+            __m256i l3 = luma8(_mm256_loadu_si256(in + 3), bgr);
+            __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(l0, l1), _mm256_packs_epi32(l2, l3));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_permutevar8x32_epi32(packed, order));
+        }
+        gray_from32_ssse3(src + i * 4, dst + i, count - i, bgr);
+    }
+    
+    PDFEDITOR_TARGET("avx2")
+    void dither_ordered_avx2(const uint8_t* gray, uint8_t* bits, size_t count, int x0, int y) {
+        const __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                                 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+        const __m256i zero = _mm256_setzero_si256();
+        
+        alignas(32) uint8_t thresholds[32];
+        bayer_row(thresholds, 32, x0, y);
+        const __m256i t = _mm256_load_si256(reinterpret_cast<const __m256i*>(thresholds));
+        
+        size_t i = 0;
+        for (; i + 32 <= count; i += 32) {
+            __m256i g = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(gray + i));
+            __m256i white = _mm256_cmpeq_epi8(_mm256_subs_epu8(t, g), zero);
+            uint32_t m = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_shuffle_epi8(white, reverse)));
+            for (int k = 0; k < 4; ++k) {
+                bits[(i >> 3) + k] = static_cast<uint8_t>(m >> (8 * k));
+            }
+        }
+        dither_ordered_ssse3(gray + i, bits + (i >> 3), count - i, x0 + static_cast<int>(i), y);
+    }
+    
+    // Two weights side by side, for _mm_madd_epi16 on interleaved samples
+    inline int32_t weight_pair(int16_t a, int16_t b) {
+        return static_cast<int32_t>(static_cast<uint16_t>(a) | (static_cast<uint32_t>(static_cast<uint16_t>(b)) << 16));
+    }
+    
+    PDFEDITOR_TARGET("ssse3")
+    void resample_rows_ssse3(const uint8_t* const* rows, const int16_t* weights, int taps, uint8_t* dst, size_t bytes) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i round = _mm_set1_epi32(1 << (kResampleShift - 1));
+        
+        size_t i = 0;
+        for (; i + 16 <= bytes; i += 16) {
+            __m128i acc[4] = { round, round, round, round };
+            
+            // Rows in pairs: interleave their samples and multiply-add
+            // both weights at once
+            for (int k = 0; k < taps; k += 2) {
+                const bool pair = k + 1 < taps;
+                const __m128i w = _mm_set1_epi32(weight_pair(weights[k], pair ? weights[k + 1] : 0));
+                __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k] + i));
+                __m128i b = pair ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k + 1] + i)) : zero;
+                
+                __m128i alo = _mm_unpacklo_epi8(a, zero);
+                __m128i ahi = _mm_unpackhi_epi8(a, zero);
+                __m128i blo = _mm_unpacklo_epi8(b, zero);
+                __m128i bhi = _mm_unpackhi_epi8(b, zero);
+                acc[0] = _mm_add_epi32(acc[0], _mm_madd_epi16(_mm_unpacklo_epi16(alo, blo), w));
+                acc[1] = _mm_add_epi32(acc[1], _mm_madd_epi16(_mm_unpackhi_epi16(alo, blo), w));
+                acc[2] = _mm_add_epi32(acc[2], _mm_madd_epi16(_mm_unpacklo_epi16(ahi, bhi), w));
+                acc[3] = _mm_add_epi32(acc[3], _mm_madd_epi16(_mm_unpackhi_epi16(ahi, bhi), w));
+            }
+            
+            for (__m128i& a : acc) {
+                a = _mm_srai_epi32(a, kResampleShift);
+            }
+            __m128i lo = _mm_packs_epi32(acc[0], acc[1]);
+            __m128i hi = _mm_packs_epi32(acc[2], acc[3]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+        }
+        resample_rows_from(rows, weights, taps, dst, i, bytes);
+    }
+    
+    PDFEDITOR_TARGET("ssse3")
+    void resample_row4_ssse3(const uint8_t* src, uint8_t* dst, size_t count,
+                             const ResampleTaps* taps, const int16_t* weights) {
+        // Two neighbouring pixels' channels interleaved as 16-bit pairs
+        const __m128i interleave = _mm_setr_epi8(0, -1, 4, -1, 1, -1, 5, -1, 2, -1, 6, -1, 3, -1, 7, -1);
+        const __m128i round = _mm_set1_epi32(1 << (kResampleShift - 1));
+        
+        for (size_t x = 0; x < count; ++x, dst += 4) {
+            const uint8_t* p = src + static_cast<size_t>(taps[x].first) * 4;
+            const int16_t* w = weights + taps[x].offset;
+            const int n = taps[x].count;
+            __m128i acc = round;
+            
+            int k = 0;
+            for (; k + 2 <= n; k += 2, p += 8) {
+                __m128i px = _mm_shuffle_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), interleave);
+                acc = _mm_add_epi32(acc, _mm_madd_epi16(px, _mm_set1_epi32(weight_pair(w[k], w[k + 1]))));
+            }
+            if (k < n) {
+                int32_t last;
+                std::memcpy(&last, p, 4);
+                __m128i px = _mm_shuffle_epi8(_mm_cvtsi32_si128(last), interleave);
+                acc = _mm_add_epi32(acc, _mm_madd_epi16(px, _mm_set1_epi32(weight_pair(w[k], 0))));
+            }
+            
+            acc = _mm_srai_epi32(acc, kResampleShift);
+            acc = _mm_packus_epi16(_mm_packs_epi32(acc, acc), acc);
+            const int32_t out = _mm_cvtsi128_si32(acc);
+            std::memcpy(dst, &out, 4);
+        }
+    }
+    
+    PDFEDITOR_TARGET("avx2")
+    void resample_rows_avx2(const uint8_t* const* rows, const int16_t* weights, int taps, uint8_t* dst, size_t bytes) {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i round = _mm256_set1_epi32(1 << (kResampleShift - 1));
+        
+        // The unpacks work within 128-bit lanes and the packs at the end
+        // undo them the same way, so bytes come out in order
+        size_t i = 0;
+        for (; i + 32 <= bytes; i += 32) {
+            __m256i acc[4] = { round, round, round, round };
+            
+            for (int k = 0; k < taps; k += 2) {
+                const bool pair = k + 1 < taps;
+                const __m256i w = _mm256_set1_epi32(weight_pair(weights[k], pair ? weights[k + 1] : 0));
+                __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows[k] + i));
+                __m256i b = pair ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows[k + 1] + i)) : zero;
+                
+                __m256i alo = _mm256_unpacklo_epi8(a, zero);
+                __m256i ahi = _mm256_unpackhi_epi8(a, zero);
+                __m256i blo = _mm256_unpacklo_epi8(b, zero);
+                __m256i bhi = _mm256_unpackhi_epi8(b, zero);
+                acc[0] = _mm256_add_epi32(acc[0], _mm256_madd_epi16(_mm256_unpacklo_epi16(alo, blo), w));
+                acc[1] = _mm256_add_epi32(acc[1], _mm256_madd_epi16(_mm256_unpackhi_epi16(alo, blo), w));
+                acc[2] = _mm256_add_epi32(acc[2], _mm256_madd_epi16(_mm256_unpacklo_epi16(ahi, bhi), w));
+                acc[3] = _mm256_add_epi32(acc[3], _mm256_madd_epi16(_mm256_unpackhi_epi16(ahi, bhi), w));
+            }
+            
+            for (__m256i& a : acc) {
+                a = _mm256_srai_epi32(a, kResampleShift);
+            }
+            __m256i lo = _mm256_packs_epi32(acc[0], acc[1]);
+            __m256i hi = _mm256_packs_epi32(acc[2], acc[3]);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_packus_epi16(lo, hi));
+        }
+        resample_rows_from(rows, weights, taps, dst, i, bytes);
+    }
+    
+    bool cpu_has_ssse3() {
+    #if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 9)) != 0;
+    #else
+        return __builtin_cpu_supports("ssse3");
+    #endif
+    }
+    
+    bool cpu_has_avx2() {
+    #if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 1);
+        const bool osxsave = (info[2] & (1 << 27)) != 0;
+        if (!osxsave || (_xgetbv(0) & 0x6) != 0x6) return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    #else
+        return __builtin_cpu_supports("avx2");
+    #endif
+    }
+#endif
+
+#ifdef PDFEDITOR_PIXEL_NEON
+    // ===== NEON kernels (sixteen pixels per de-interleaved load) =====
+    
+    void swap_rb24_neon(const uint8_t* src, uint8_t* dst, size_t count) {
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            uint8x16x3_t v = vld3q_u8(src + i * 3);
+            uint8x16_t r = v.val[0];
+            v.val[0] = v.val[2];
+            v.val[2] = r;
+            vst3q_u8(dst + i * 3, v);
+        }
+        swap_rb24_scalar(src + i * 3, dst + i * 3, count - i);
+    }
+    
+    void swap_rb32_neon(const uint8_t* src, uint8_t* dst, size_t count) {
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            uint8x16x4_t v = vld4q_u8(src + i * 4);
+            uint8x16_t r = v.val[0];
+            v.val[0] = v.val[2];
+            v.val[2] = r;
+            vst4q_u8(dst + i * 4, v);
+        }
+        swap_rb32_scalar(src + i * 4, dst + i * 4, count - i);
+    }
+    
+    void add_alpha_neon(const uint8_t* src, uint8_t* dst, size_t count) {
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            uint8x16x3_t v = vld3q_u8(src + i * 3);
+            uint8x16x4_t out = {{ v.val[0], v.val[1], v.val[2], vdupq_n_u8(255) }};
+            vst4q_u8(dst + i * 4, out);
+        }
+        add_alpha_scalar(src + i * 3, dst + i * 4, count - i);
+    }
+    
+    void drop_alpha_neon(const uint8_t* src, uint8_t* dst, size_t count) {
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            uint8x16x4_t v = vld4q_u8(src + i * 4);
+            uint8x16x3_t out = {{ v.val[0], v.val[1], v.val[2] }};
+            vst3q_u8(dst + i * 3, out);
+        }
+        drop_alpha_scalar(src + i * 4, dst + i * 3, count - i);
+    }
+    
+    inline uint8x8_t div255_neon(uint16x8_t x) {
+        uint16x8_t t = vaddq_u16(x, vdupq_n_u16(128));
+        return vshrn_n_u16(vaddq_u16(t, vshrq_n_u16(t, 8)), 8);
+    }
+    
+    void premultiply_neon(uint8_t* p, size_t count) {
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            uint8x16x4_t v = vld4q_u8(p + i * 4);
+            for (int c = 0; c < 3; ++c) {
+                uint8x8_t lo = div255_neon(vmull_u8(vget_low_u8(v.val[c]), vget_low_u8(v.val[3])));
+                uint8x8_t hi = div255_neon(vmull_high_u8(v.val[c], v.val[3]));
+                v.val[c] = vcombine_u8(lo, hi);
+            }
+            vst4q_u8(p + i * 4, v);
+        }
+        premultiply_scalar(p + i * 4, count - i);
+    }
+    
+    void unpremultiply_neon(uint8_t* p, size_t count) {
+        const float32x4_t scale = vdupq_n_f32(255.0f);
+        
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            uint8x16x4_t v = vld4q_u8(p + i * 4);
+            
+            // Alpha widened to four vectors of four lanes
+            uint16x8_t a_lo = vmovl_u8(vget_low_u8(v.val[3]));
+            uint16x8_t a_hi = vmovl_u8(vget_high_u8(v.val[3]));
+            uint32x4_t a[4] = {
+                vmovl_u16(vget_low_u16(a_lo)), vmovl_u16(vget_high_u16(a_lo)),
+                vmovl_u16(vget_low_u16(a_hi)), vmovl_u16(vget_high_u16(a_hi))
+            };
+            
+            for (int c = 0; c < 3; ++c) {
+                uint16x8_t c_lo = vmovl_u8(vget_low_u8(v.val[c]));
+                uint16x8_t c_hi = vmovl_u8(vget_high_u8(v.val[c]));
+                uint32x4_t cw[4] = {
+                    vmovl_u16(vget_low_u16(c_lo)), vmovl_u16(vget_high_u16(c_lo)),
+                    vmovl_u16(vget_low_u16(c_hi)), vmovl_u16(vget_high_u16(c_hi))
+                };
+                
+                uint16x4_t q16[4];
+                for (int k = 0; k < 4; ++k) {
+                    float32x4_t af = vcvtq_f32_u32(a[k]);
+                    float32x4_t num = vaddq_f32(vmulq_f32(vcvtq_f32_u32(cw[k]), scale),
+                                                vcvtq_f32_u32(vshrq_n_u32(a[k], 1)));
+                    float32x4_t q = vminq_f32(vdivq_f32(num, af), scale);
+                    uint32x4_t qi = vcvtq_u32_f32(q);
+                    // Fully transparent pixels have no color
+                    qi = vandq_u32(qi, vtstq_u32(a[k], a[k]));
+                    q16[k] = vmovn_u32(qi);
+                }
+                v.val[c] = vcombine_u8(vmovn_u16(vcombine_u16(q16[0], q16[1])),
+                                       vmovn_u16(vcombine_u16(q16[2], q16[3])));
+            }
+            vst4q_u8(p + i * 4, v);
+        }
+        unpremultiply_scalar(p + i * 4, count - i);
+    }
+    
+    inline uint8x16_t luma16_neon(uint8x16_t r, uint8x16_t g, uint8x16_t b) {
+        uint16x8_t lo = vmull_u8(vget_low_u8(r), vdup_n_u8(77));
+        lo = vmlal_u8(lo, vget_low_u8(g), vdup_n_u8(150));
+        lo = vmlal_u8(lo, vget_low_u8(b), vdup_n_u8(29));
+        uint16x8_t hi = vmull_high_u8(r, vdupq_n_u8(77));
+        hi = vmlal_high_u8(hi, g, vdupq_n_u8(150));
+        hi = vmlal_high_u8(hi, b, vdupq_n_u8(29));
+        return vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8));
+    }
+    
+    void gray_from24_neon(const uint8_t* src, uint8_t* dst, size_t count, bool bgr) {
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            uint8x16x3_t v = vld3q_u8(src + i * 3);
+            vst1q_u8(dst + i, bgr ? luma16_neon(v.val[2], v.val[1], v.val[0])
+                                  : luma16_neon(v.val[0], v.val[1], v.val[2]));
+        }
+        gray_from24_scalar(src + i * 3, dst + i, count - i, bgr);
+    }
+    
+    void gray_from32_neon(const uint8_t* src, uint8_t* dst, size_t count, bool bgr) {
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            uint8x16x4_t v = vld4q_u8(src + i * 4);
+            vst1q_u8(dst + i, bgr ? luma16_neon(v.val[2], v.val[1], v.val[0])
+                                  : luma16_neon(v.val[0], v.val[1], v.val[2]));
+        }
+        gray_from32_scalar(src + i * 4, dst + i, count - i, bgr);
+    }
+    
+    void gray_to24_neon(const uint8_t* src, uint8_t* dst, size_t count) {
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            uint8x16_t g = vld1q_u8(src + i);
+            uint8x16x3_t out = {{ g, g, g }};
+            vst3q_u8(dst + i * 3, out);
+        }
+        gray_to24_scalar(src + i, dst + i * 3, count - i);
+    }
+    
+    void gray_to32_neon(const uint8_t* src, uint8_t* dst, size_t count) {
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            uint8x16_t g = vld1q_u8(src + i);
+            uint8x16x4_t out = {{ g, g, g, vdupq_n_u8(255) }};
+            vst4q_u8(dst + i * 4, out);
+        }
+        gray_to32_scalar(src + i, dst + i * 4, count - i);
+    }
+    
+    void dither_ordered_neon(const uint8_t* gray, uint8_t* bits, size_t count, int x0, int y) {
+        static const uint8_t weights[16] = {128, 64, 32, 16, 8, 4, 2, 1, 128, 64, 32, 16, 8, 4, 2, 1};
+        const uint8x16_t w = vld1q_u8(weights);
+        
+        uint8_t thresholds[16];
+        bayer_row(thresholds, 16, x0, y);
+        const uint8x16_t t = vld1q_u8(thresholds);
+        
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            uint8x16_t black = vcltq_u8(vld1q_u8(gray + i), t);
+            uint8x16_t m = vandq_u8(black, w);
+            bits[i >> 3] = vaddv_u8(vget_low_u8(m));
+            bits[(i >> 3) + 1] = vaddv_u8(vget_high_u8(m));
+        }
+        dither_ordered_scalar(gray + i, bits + (i >> 3), count - i, x0 + static_cast<int>(i), y);
+    }
+    
+    void resample_rows_neon(const uint8_t* const* rows, const int16_t* weights, int taps, uint8_t* dst, size_t bytes) {
+        size_t i = 0;
+        for (; i + 16 <= bytes; i += 16) {
+            int32x4_t acc[4];
+            for (int32x4_t& a : acc) {
+                a = vdupq_n_s32(1 << (kResampleShift - 1));
+            }
+            
+            for (int k = 0; k < taps; ++k) {
+                uint8x16_t v = vld1q_u8(rows[k] + i);
+                int16x8_t lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(v)));
+                int16x8_t hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(v)));
+                acc[0] = vmlal_n_s16(acc[0], vget_low_s16(lo), weights[k]);
+                acc[1] = vmlal_n_s16(acc[1], vget_high_s16(lo), weights[k]);
+                acc[2] = vmlal_n_s16(acc[2], vget_low_s16(hi), weights[k]);
+                acc[3] = vmlal_n_s16(acc[3], vget_high_s16(hi), weights[k]);
+            }
+            
+            int16x8_t lo = vcombine_s16(vqshrn_n_s32(acc[0], kResampleShift), vqshrn_n_s32(acc[1], kResampleShift));
+            int16x8_t hi = vcombine_s16(vqshrn_n_s32(acc[2], kResampleShift), vqshrn_n_s32(acc[3], kResampleShift));
+            vst1q_u8(dst + i, vcombine_u8(vqmovun_s16(lo), vqmovun_s16(hi)));
+        }
+        resample_rows_from(rows, weights, taps, dst, i, bytes);
+    }
+    
+    void resample_row4_neon(const uint8_t* src, uint8_t* dst, size_t count,
+                            const ResampleTaps* taps, const int16_t* weights) {
+        for (size_t x = 0; x < count; ++x, dst += 4) {
+            const uint8_t* p = src + static_cast<size_t>(taps[x].first) * 4;
+            const int16_t* w = weights + taps[x].offset;
+            int32x4_t acc = vdupq_n_s32(1 << (kResampleShift - 1));
+            
+            for (int k = 0; k < taps[x].count; ++k, p += 4) {
+                uint32_t pixel;
+                std::memcpy(&pixel, p, 4);
+                int16x4_t v = vget_low_s16(vreinterpretq_s16_u16(vmovl_u8(vcreate_u8(pixel))));
+                acc = vmlal_n_s16(acc, v, w[k]);
+            }
+            
+            int16x4_t narrow = vqshrn_n_s32(acc, kResampleShift);
+            uint8x8_t out = vqmovun_s16(vcombine_s16(narrow, narrow));
+            vst1_lane_u32(reinterpret_cast<uint32_t*>(dst), vreinterpret_u32_u8(out), 0);
+        }
+    }
+#endif
+    
+    const PixelKernels kScalarKernels = {
+        "scalar",
+        swap_rb24_scalar,
+        swap_rb32_scalar,
+        add_alpha_scalar,
+        drop_alpha_scalar,
+        premultiply_scalar,
+        unpremultiply_scalar,
+        gray_from24_scalar,
+        gray_from32_scalar,
+        gray_to24_scalar,
+        gray_to32_scalar,
+        dither_ordered_scalar,
+        resample_rows_scalar,
+        resample_row4_scalar
+    };
+    
+    PixelKernels select_kernels() {
+        PixelKernels k = kScalarKernels;
+        
+#ifdef PDFEDITOR_PIXEL_X86
+        if (cpu_has_ssse3()) {
+            k.name = "ssse3";
+            k.swap_rb24 = swap_rb24_ssse3;
+            k.swap_rb32 = swap_rb32_ssse3;
+            k.add_alpha = add_alpha_ssse3;
+            k.drop_alpha = drop_alpha_ssse3;
+            k.premultiply = premultiply_ssse3;
+            k.unpremultiply = unpremultiply_ssse3;
+            k.gray_from24 = gray_from24_ssse3;
+            k.gray_from32 = gray_from32_ssse3;
+            k.gray_to24 = gray_to24_ssse3;
+            k.gray_to32 = gray_to32_ssse3;
+            k.dither_ordered = dither_ordered_ssse3;
+            k.resample_rows = resample_rows_ssse3;
+            k.resample_row4 = resample_row4_ssse3;
+            
+            // AVX2 only pays off where whole 32-byte lanes stay independent
+            if (cpu_has_avx2()) {
+                k.name = "avx2";
+                k.swap_rb32 = swap_rb32_avx2;
+                k.premultiply = premultiply_avx2;
+                k.unpremultiply = unpremultiply_avx2;
+                k.gray_from32 = gray_from32_avx2;
+                k.dither_ordered = dither_ordered_avx2;
+                k.resample_rows = resample_rows_avx2;
+            }
+        }
+#elif defined(PDFEDITOR_PIXEL_NEON)
+        k.name = "neon";
+        k.swap_rb24 = swap_rb24_neon;
+        k.swap_rb32 = swap_rb32_neon;
+        k.add_alpha = add_alpha_neon;
+        k.drop_alpha = drop_alpha_neon;
+        k.premultiply = premultiply_neon;
+        k.unpremultiply = unpremultiply_neon;
+        k.gray_from24 = gray_from24_neon;
+        k.gray_from32 = gray_from32_neon;
+        k.gray_to24 = gray_to24_neon;
+        k.gray_to32 = gray_to32_neon;
+        k.dither_ordered = dither_ordered_neon;
+        k.resample_rows = resample_rows_neon;
+        k.resample_row4 = resample_row4_neon;
+#endif
+        
+        return k;
+    }
+}
+
+int format_row_bytes(ImageFormat format, int width) {
+    switch (format) {
+        case ImageFormat::RGB24:
+        case ImageFormat::BGR24:
+            return width * 3;
+        case ImageFormat::RGBA32:
+        case ImageFormat::BGRA32:
+            return width * 4;
+        case ImageFormat::Gray8:
+            return width;
+        case ImageFormat::Mono1:
+            return (width + 7) / 8;
+        default:
+            return 0;
+    }
+}
+
+bool format_has_alpha(ImageFormat format) {
+    return format == ImageFormat::RGBA32 || format == ImageFormat::BGRA32;
+}
+
+const PixelKernels& pixel_kernels() {
+    static const PixelKernels kernels = select_kernels();
+    return kernels;
+}
+
+const PixelKernels& scalar_pixel_kernels() {
+    return kScalarKernels;
+}
+
+void mono_to_gray(const uint8_t* bits, uint8_t* gray, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        gray[i] = (bits[i >> 3] & (0x80 >> (i & 7))) ? 0 : 255;
+    }
+}
+
+void gray_alpha_to32(const uint8_t* src, uint8_t* dst, size_t count) {
+    for (size_t i = 0; i < count; ++i, src += 2, dst += 4) {
+        dst[0] = dst[1] = dst[2] = src[0];
+        dst[3] = src[1];
+    }
+}
+
+ErrorDiffusion::ErrorDiffusion(size_t width)
+    : width_(width)
+    , current_(width + 2, 0)
+    , next_(width + 2, 0) {}
+
+void ErrorDiffusion::dither_row(const uint8_t* gray, uint8_t* bits) {
+    std::memset(bits, 0, (width_ + 7) / 8);
+    std::fill(next_.begin(), next_.end(), 0);
+    
+    // Errors are kept in sixteenths; index 0 and width + 1 absorb the
+    // spill past either edge
+    for (size_t x = 0; x < width_; ++x) {
+        int value = gray[x] + current_[x + 1] / 16;
+        int error;
+        if (value < 128) {
+            bits[x >> 3] |= static_cast<uint8_t>(0x80 >> (x & 7));
+            error = value;
+        } else {
+            error = value - 255;
+        }
+        
+        current_[x + 2] += error * 7;
+        next_[x] += error * 3;
+        next_[x + 1] += error * 5;
+        next_[x + 2] += error * 1;
+    }
+    
+    current_.swap(next_);
+}
+
+RowConverter::RowConverter(
+    ImageFormat from,
+    bool from_premultiplied,
+    ImageFormat to,
+    bool to_premultiplied,
+    size_t width,
+    Dithering dithering
+)
+    : k_(pixel_kernels())
+    , from_(from)
+    , to_(to)
+    , from_premultiplied_(from_premultiplied)
+    , to_premultiplied_(to_premultiplied)
+    , width_(width)
+    , rgba_(width * 4)
+    , gray_(width) {
+    if (to == ImageFormat::Mono1 && dithering == Dithering::ErrorDiffusion) {
+        diffusion_ = std::make_unique<ErrorDiffusion>(width);
+    }
+}
+
+void RowConverter::convert(const uint8_t* src, uint8_t* dst, int y) {
+    const size_t count = width_;
+    uint8_t* rgba = rgba_.data();
+    
+    // Channel order only
+    if (from_premultiplied_ == to_premultiplied_) {
+        if ((from_ == ImageFormat::RGB24 && to_ == ImageFormat::BGR24) ||
+            (from_ == ImageFormat::BGR24 && to_ == ImageFormat::RGB24)) {
+            k_.swap_rb24(src, dst, count);
+            return;
+        }
+        if ((from_ == ImageFormat::RGBA32 && to_ == ImageFormat::BGRA32) ||
+            (from_ == ImageFormat::BGRA32 && to_ == ImageFormat::RGBA32)) {
+            k_.swap_rb32(src, dst, count);
+            return;
+        }
+        if (from_ == to_) {
+            std::memcpy(dst, src, static_cast<size_t>(format_row_bytes(to_, static_cast<int>(count))));
+            return;
+        }
+    }
+    
+    switch (from_) {
+        case ImageFormat::RGB24:
+            k_.add_alpha(src, rgba, count);
+            break;
+        case ImageFormat::BGR24:
+            k_.add_alpha(src, rgba, count);
+            k_.swap_rb32(rgba, rgba, count);
+            break;
+        case ImageFormat::RGBA32:
+            std::memcpy(rgba, src, count * 4);
+            break;
+        case ImageFormat::BGRA32:
+            k_.swap_rb32(src, rgba, count);
+            break;
+        case ImageFormat::Gray8:
+            k_.gray_to32(src, rgba, count);
+            break;
+        case ImageFormat::Mono1:
+            mono_to_gray(src, gray_.data(), count);
+            k_.gray_to32(gray_.data(), rgba, count);
+            break;
+    }
+    if (from_premultiplied_) {
+        k_.unpremultiply(rgba, count);
+    }
+    
+    switch (to_) {
+        case ImageFormat::RGB24:
+            k_.drop_alpha(rgba, dst, count);
+            break;
+        case ImageFormat::BGR24:
+            k_.swap_rb32(rgba, rgba, count);
+            k_.drop_alpha(rgba, dst, count);
+            break;
+        case ImageFormat::RGBA32:
+            std::memcpy(dst, rgba, count * 4);
+            if (to_premultiplied_) k_.premultiply(dst, count);
+            break;
+        case ImageFormat::BGRA32:
+            k_.swap_rb32(rgba, dst, count);
+            if (to_premultiplied_) k_.premultiply(dst, count);
+            break;
+        case ImageFormat::Gray8:
+            k_.gray_from32(rgba, dst, count, false);
+            break;
+        case ImageFormat::Mono1:
+            k_.gray_from32(rgba, gray_.data(), count, false);
+            if (diffusion_) {
+                diffusion_->dither_row(gray_.data(), dst);
+            } else {
+                k_.dither_ordered(gray_.data(), dst, count, 0, y);
+            }
+            break;
+    }
+}
+
+} // namespace detail
+} // namespace pdfeditor
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "pdfeditor/renderer.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace pdfeditor {
+namespace detail {
+
+// Resampling weights are 1.14 fixed point; each output sample's weights
+// sum to 1 << kResampleShift
+constexpr int kResampleShift = 14;
+
+// The source samples behind one output sample of a resampling filter:
+// count samples from first, weighted by weights[offset..offset + count)
+struct ResampleTaps {
+    int first;
+    int count;
+    int offset;
+};
+
+// Row kernels for converting between the ImageFormat layouts. Each one
+// converts count pixels of a single row. In-place use (src == dst) is
+// only allowed where noted.
+//
+// Mono1 rows hold one bit per pixel, most significant bit first, with
+// 1 meaning black (ink) as in PBM and printer rasters.
+struct PixelKernels {
+    const char* name;
+    
+    // Exchange bytes 0 and 2 of each pixel: RGB <-> BGR, RGBA <-> BGRA.
+    // In place allowed.
+    void (*swap_rb24)(const uint8_t* src, uint8_t* dst, size_t count);
+    void (*swap_rb32)(const uint8_t* src, uint8_t* dst, size_t count);
+    
+    // Append an opaque alpha byte to each pixel / drop it again. Dropping
+    // may run in place.
+    void (*add_alpha)(const uint8_t* src, uint8_t* dst, size_t count);
+    void (*drop_alpha)(const uint8_t* src, uint8_t* dst, size_t count);
+    
+    // Scale color by alpha (byte 3) and back, rounding to nearest. In place.
+    void (*premultiply)(uint8_t* pixels, size_t count);
+    void (*unpremultiply)(uint8_t* pixels, size_t count);
+    
+    // Rec. 601 luma of 3- and 4-byte pixels, (77 R + 150 G + 29 B + 128) >> 8.
+    // bgr says the pixels are stored blue first.
+    void (*gray_from24)(const uint8_t* src, uint8_t* dst, size_t count, bool bgr);
+    void (*gray_from32)(const uint8_t* src, uint8_t* dst, size_t count, bool bgr);
+    
+    // Replicate gray into three color bytes, plus opaque alpha for 32
+    void (*gray_to24)(const uint8_t* src, uint8_t* dst, size_t count);
+    void (*gray_to32)(const uint8_t* src, uint8_t* dst, size_t count);
+    
+    // 8x8 Bayer ordered dither of a gray row to Mono1. x0 and y are the
+    // device coordinates of the first pixel, so separately rendered tiles
+    // and bands line up.
+    void (*dither_ordered)(const uint8_t* gray, uint8_t* bits, size_t count, int x0, int y);
+    
+    // Resampling. resample_rows writes the weighted sum of taps source
+    // rows, byte by byte; resample_row4 filters a row of 4-byte pixels
+    // into count output pixels. Results are rounded and clamped to 0-255.
+    void (*resample_rows)(const uint8_t* const* rows, const int16_t* weights, int taps, uint8_t* dst, size_t bytes);
+    void (*resample_row4)(const uint8_t* src, uint8_t* dst, size_t count, const ResampleTaps* taps, const int16_t* weights);
+};
+
+// Bytes in one tightly packed row of the format
+int format_row_bytes(ImageFormat format, int width);
+
+bool format_has_alpha(ImageFormat format);
+
+// Best kernels for this CPU (AVX2, SSSE3, NEON or portable), chosen once
+const PixelKernels& pixel_kernels();
+
+// Portable kernels, the reference the vector ones must match exactly
+const PixelKernels& scalar_pixel_kernels();
+
+// Mono1 bits to gray bytes (black 0, white 255)
+void mono_to_gray(const uint8_t* bits, uint8_t* gray, size_t count);
+
+// Gray + alpha byte pairs to 4-byte pixels
+void gray_alpha_to32(const uint8_t* src, uint8_t* dst, size_t count);
+
+// Floyd-Steinberg error diffusion to Mono1. Inherently sequential, so
+// scalar only; feed rows top to bottom.
+class ErrorDiffusion {
+public:
+    explicit ErrorDiffusion(size_t width);
+    
+    void dither_row(const uint8_t* gray, uint8_t* bits);
+
+private:
+    size_t width_;
+    std::vector<int> current_;
+    std::vector<int> next_;
+};
+
+// Converts rows of one ImageFormat to another through straight RGBA,
+// with direct paths for pure channel-order changes. Alpha is dropped,
+// not composited, when the target has none. Feed rows top to bottom;
+// y positions the ordered dither.
+class RowConverter {
+public:
+    RowConverter(
+        ImageFormat from,
+        bool from_premultiplied,
+        ImageFormat to,
+        bool to_premultiplied,
+        size_t width,
+        Dithering dithering = Dithering::Ordered
+    );
+    
+    void convert(const uint8_t* src, uint8_t* dst, int y);
+
+private:
+    const PixelKernels& k_;
+    ImageFormat from_;
+    ImageFormat to_;
+    bool from_premultiplied_;
+    bool to_premultiplied_;
+    size_t width_;
+    std::vector<uint8_t> rgba_;
+    std::vector<uint8_t> gray_;
+    std::unique_ptr<ErrorDiffusion> diffusion_;
+};
+
+} // namespace detail
+} // namespace pdfeditor
@@ -0,0 +1,911 @@
+// Document::probe: catalog facts read straight from the file structure,
+// without MuPDF. Only the header, the trailer and xref section at
+// startxref, and the few objects they lead to (catalog, page tree root,
+// Info) are read, each through a small window at its offset.
+
+#include "pdfeditor/document.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <thread>
+
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace pdfeditor {
+
+namespace {
+    // Read around each offset; objects a probe needs are small
+    const size_t kWindow = 4096;
+    const size_t kMaxWindow = 1024 * 1024;
+    
+    // Older xref sections followed when an object is not in the newest
+    const size_t kMaxSections = 32;
+    
+    const int kMaxDepth = 32;
+    
+    // A file read only at the offsets asked for
+    class Reader {
+    public:
+        explicit Reader(const std::string& path) : file_(path, std::ios::binary) {
+            if (file_) {
+                file_.seekg(0, std::ios::end);
+                const std::streamoff end = file_.tellg();
+                size_ = end > 0 ? static_cast<uint64_t>(end) : 0;
+            }
+        }
+        
+        bool is_open() const { return static_cast<bool>(file_); }
+        uint64_t size() const { return size_; }
+        
+        std::string read(uint64_t offset, size_t length) {
+            if (offset >= size_) return {};
+            length = static_cast<size_t>(std::min<uint64_t>(length, size_ - offset));
+            
+            std::string bytes(length, '\0');
+            file_.clear();
+            file_.seekg(static_cast<std::streamoff>(offset));
+            file_.read(&bytes[0], static_cast<std::streamsize>(length));
+            bytes.resize(static_cast<size_t>(std::max<std::streamsize>(file_.gcount(), 0)));
+            return bytes;
+        }
+    
+    private:
+        std::ifstream file_;
+        uint64_t size_ = 0;
+    };
+    
+    struct Object {
+        enum class Type { Null, Boolean, Number, Name, String, Array, Dictionary, Reference };
+        
+        Type type = Type::Null;
+        double number = 0;              // Number, or Boolean as 0/1
+        std::string text;               // Name (without the slash) or string bytes
+        int num = 0;                    // Reference
+        int gen = 0;
+        std::vector<std::string> keys;  // Dictionary keys, matching items
+        std::vector<Object> items;      // Array elements or dictionary values
+        
+        const Object* get(const char* key) const {
+            for (size_t i = 0; i < keys.size(); ++i) {
+                if (keys[i] == key) return &items[i];
+            }
+            return nullptr;
+        }
+        
+        bool is(Type t) const { return type == t; }
+    };
+    
+    bool is_space(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\0';
+    }
+    
+    bool is_delimiter(char c) {
+        return is_space(c) || std::strchr("()<>[]{}/%", c) != nullptr;
+    }
+    
+    int hex_value(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+    
+    // PDF syntax over bytes read from the file. Running out of bytes is a
+    // failure like any other; the caller reads a larger window and retries.
+    class Parser {
+    public:
+        explicit Parser(const std::string& data, size_t pos = 0) : data_(data), pos_(std::min(pos, data.size())) {}
+        
+        size_t pos() const { return pos_; }
+        
+        void skip_space() {
+            while (pos_ < data_.size()) {
+                if (is_space(data_[pos_])) {
+                    ++pos_;
+                } else if (data_[pos_] == '%') {
+                    while (pos_ < data_.size() && data_[pos_] != '\r' && data_[pos_] != '\n') ++pos_;
+                } else {
+                    break;
+                }
+            }
+        }
+        
+        bool keyword(const char* word) {
+            skip_space();
+            const size_t length = std::strlen(word);
+            if (data_.compare(pos_, length, word) != 0) return false;
+            if (pos_ + length < data_.size() && !is_delimiter(data_[pos_ + length])) return false;
+            pos_ += length;
+            return true;
+        }
+        
+        bool integer(int64_t& value) {
+            skip_space();
+            size_t end = pos_;
+            if (end < data_.size() && (data_[end] == '+' || data_[end] == '-')) ++end;
+            const size_t digits = end;
+            while (end < data_.size() && data_[end] >= '0' && data_[end] <= '9') ++end;
+            if (end == digits || (end < data_.size() && !is_delimiter(data_[end]))) return false;
+            
+            value = std::strtoll(data_.c_str() + pos_, nullptr, 10);
+            pos_ = end;
+            return true;
+        }
+        
+        // "num gen obj"
+        bool object_header() {
+            int64_t num = 0;
+            int64_t gen = 0;
+            return integer(num) && integer(gen) && keyword("obj");
+        }
+        
+        bool object(Object& out, int depth = 0) {
+            if (depth > kMaxDepth) return false;
+            
+            skip_space();
+            if (pos_ >= data_.size()) return false;
+            
+            const char c = data_[pos_];
+            if (c == '/') {
+                out.type = Object::Type::Name;
+                return name(out.text);
+            }
+            if (c == '(') {
+                out.type = Object::Type::String;
+                return literal_string(out.text);
+            }
+            if (c == '<' && data_.compare(pos_, 2, "<<") == 0) {
+                out.type = Object::Type::Dictionary;
+                pos_ += 2;
+                for (;;) {
+                    skip_space();
+                    if (data_.compare(pos_, 2, ">>") == 0) {
+                        pos_ += 2;
+                        return true;
+                    }
+                    std::string key;
+                    if (pos_ >= data_.size() || data_[pos_] != '/' || !name(key)) return false;
+                    out.keys.push_back(key);
+                    out.items.emplace_back();
+                    if (!object(out.items.back(), depth + 1)) return false;
+                }
+            }
+            if (c == '<') {
+                out.type = Object::Type::String;
+                return hex_string(out.text);
+            }
+            if (c == '[') {
+                out.type = Object::Type::Array;
+                ++pos_;
+                for (;;) {
+                    skip_space();
+                    if (pos_ < data_.size() && data_[pos_] == ']') {
+                        ++pos_;
+                        return true;
+                    }
+                    out.items.emplace_back();
+                    if (!object(out.items.back(), depth + 1)) return false;
+                }
+            }
+            if (keyword("true")) {
+                out.type = Object::Type::Boolean;
+                out.number = 1;
+                return true;
+            }
+            if (keyword("false")) {
+                out.type = Object::Type::Boolean;
+                return true;
+            }
+            if (keyword("null")) {
+                out.type = Object::Type::Null;
+                return true;
+            }
+            return number(out);
+        }
+    
+    private:
+        bool name(std::string& out) {
+            ++pos_;
+            out.clear();
+            while (pos_ < data_.size() && !is_delimiter(data_[pos_])) {
+                if (data_[pos_] == '#' && pos_ + 2 < data_.size() &&
+                    hex_value(data_[pos_ + 1]) >= 0 && hex_value(data_[pos_ + 2]) >= 0) {
+                    out += static_cast<char>(hex_value(data_[pos_ + 1]) * 16 + hex_value(data_[pos_ + 2]));
+                    pos_ += 3;
+                } else {
+                    out += data_[pos_++];
+                }
+            }
+            return true;
+        }
+        
+        bool literal_string(std::string& out) {
+            ++pos_;
+            int nesting = 1;
+            while (pos_ < data_.size()) {
+                char c = data_[pos_++];
+                if (c == '(') {
+                    ++nesting;
+                } else if (c == ')' && --nesting == 0) {
+                    return true;
+                } else if (c == '\\' && pos_ < data_.size()) {
+                    c = data_[pos_++];
+                    switch (c) {
+                    case 'n': out += '\n'; continue;
+                    case 'r': out += '\r'; continue;
+                    case 't': out += '\t'; continue;
+                    case 'b': out += '\b'; continue;
+                    case 'f': out += '\f'; continue;
+                    case '\r':
+                        if (pos_ < data_.size() && data_[pos_] == '\n') ++pos_;
+                        continue;
+                    case '\n':
+                        continue;
+                    default:
+                        break;
+                    }
+                    if (c >= '0' && c <= '7') {
+                        int value = c - '0';
+                        for (int i = 0; i < 2 && pos_ < data_.size() && data_[pos_] >= '0' && data_[pos_] <= '7'; ++i) {
+                            value = value * 8 + (data_[pos_++] - '0');
+                        }
+                        out += static_cast<char>(value);
+                        continue;
+                    }
+                }
+                out += c;
+            }
+            return false;
+        }
+        
+        bool hex_string(std::string& out) {
+            ++pos_;
+            int high = -1;
+            while (pos_ < data_.size()) {
+                const char c = data_[pos_++];
+                if (c == '>') {
+                    if (high >= 0) out += static_cast<char>(high * 16);
+                    return true;
+                }
+                const int value = hex_value(c);
+                if (value < 0) continue;
+                if (high < 0) {
+                    high = value;
+                } else {
+                    out += static_cast<char>(high * 16 + value);
+                    high = -1;
+                }
+            }
+            return false;
+        }
+        
+        // A number, or "num gen R"
+        bool number(Object& out) {
+            const size_t start = pos_;
+            size_t end = pos_;
+            while (end < data_.size()) {
+                const char c = data_[end];
+                if (c != '+' && c != '-' && c != '.' && (c < '0' || c > '9')) break;
+                ++end;
+            }
+            if (end == start) return false;
+            
+            out.type = Object::Type::Number;
+            out.number = std::strtod(data_.substr(start, end - start).c_str(), nullptr);
+            pos_ = end;
+            
+            const bool whole = data_.find('.', start) >= end;
+            if (whole) {
+                int64_t gen = 0;
+                if (integer(gen) && keyword("R")) {
+                    out.type = Object::Type::Reference;
+                    out.num = static_cast<int>(out.number);
+                    out.gen = static_cast<int>(gen);
+                    return true;
+                }
+                pos_ = end;
+            }
+            return true;
+        }
+        
+        const std::string& data_;
+        size_t pos_;
+    };
+    
+    // UTF-16BE with a byte order mark, UTF-8 with one (PDF 2.0), or
+    // PDFDocEncoding, which is Latin-1 for the characters that matter
+    std::string text_string(const std::string& bytes) {
+        std::string out;
+        if (bytes.size() >= 2 && bytes[0] == '\xFE' && bytes[1] == '\xFF') {
+            for (size_t i = 2; i + 1 < bytes.size(); i += 2) {
+                uint32_t code = (static_cast<uint8_t>(bytes[i]) << 8) | static_cast<uint8_t>(bytes[i + 1]);
+                if (code >= 0xD800 && code < 0xDC00 && i + 3 < bytes.size()) {
+                    const uint32_t low = (static_cast<uint8_t>(bytes[i + 2]) << 8) | static_cast<uint8_t>(bytes[i + 3]);
+                    if (low >= 0xDC00 && low < 0xE000) {
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        i += 2;
+                    }
+                }
+                
+                if (code < 0x80) {
+                    out += static_cast<char>(code);
+                } else if (code < 0x800) {
+                    out += static_cast<char>(0xC0 | (code >> 6));
+                    out += static_cast<char>(0x80 | (code & 0x3F));
+                } else if (code < 0x10000) {
+                    out += static_cast<char>(0xE0 | (code >> 12));
+                    out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                    out += static_cast<char>(0x80 | (code & 0x3F));
+                } else {
+                    out += static_cast<char>(0xF0 | (code >> 18));
+                    out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+                    out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                    out += static_cast<char>(0x80 | (code & 0x3F));
+                }
+            }
+            return out;
+        }
+        
+        if (bytes.compare(0, 3, "\xEF\xBB\xBF") == 0) {
+            return bytes.substr(3);
+        }
+        
+        for (char c : bytes) {
+            const uint8_t byte = static_cast<uint8_t>(c);
+            if (byte < 0x80) {
+                out += c;
+            } else {
+                out += static_cast<char>(0xC0 | (byte >> 6));
+                out += static_cast<char>(0x80 | (byte & 0x3F));
+            }
+        }
+        return out;
+    }
+    
+    PDFVersion version_from(const std::string& text) {
+        if (text.size() < 3 || text[1] != '.') return PDFVersion::PDF_1_7;
+        if (text[0] == '2') return PDFVersion::PDF_2_0;
+        if (text[0] == '1' && text[2] >= '0' && text[2] <= '7') {
+            return static_cast<PDFVersion>(text[2] - '0');
+        }
+        return PDFVersion::PDF_1_7;
+    }
+    
+    // The decoded data of a stream; only FlateDecode with PNG predictors
+    // is needed for xref and object streams
+    bool decode_stream(const Object& dict, std::string raw, std::string& out) {
+        const Object* filter = dict.get("Filter");
+        if (filter && filter->is(Object::Type::Array)) {
+            if (filter->items.size() > 1) return false;
+            filter = filter->items.empty() ? nullptr : &filter->items[0];
+        }
+        if (!filter || filter->is(Object::Type::Null)) {
+            out = std::move(raw);
+            return true;
+        }
+        if (!filter->is(Object::Type::Name) || filter->text != "FlateDecode") {
+            return false;
+        }
+        
+#ifdef USE_ZLIB
+        z_stream zs = {};
+        if (inflateInit(&zs) != Z_OK) return false;
+        
+        zs.next_in = reinterpret_cast<Bytef*>(&raw[0]);
+        zs.avail_in = static_cast<uInt>(raw.size());
+        out.clear();
+        
+        char chunk[16384];
+        int rc = Z_OK;
+        while (rc == Z_OK) {
+            zs.next_out = reinterpret_cast<Bytef*>(chunk);
+            zs.avail_out = sizeof(chunk);
+            rc = inflate(&zs, Z_NO_FLUSH);
+            out.append(chunk, sizeof(chunk) - zs.avail_out);
+            if (rc == Z_BUF_ERROR && zs.avail_in == 0) break;     // Truncated, keep what came out
+        }
+        inflateEnd(&zs);
+        if (rc != Z_STREAM_END && rc != Z_BUF_ERROR) return false;
+#else
+        return false;
+#endif
+        
+        const Object* params = dict.get("DecodeParms");
+        if (params && params->is(Object::Type::Array)) {
+            params = params->items.empty() ? nullptr : &params->items[0];
+        }
+        const Object* predictor = params ? params->get("Predictor") : nullptr;
+        if (!predictor || predictor->number < 10) {
+            return true;
+        }
+        
+        // PNG predictors, one filter type byte before each row
+        const Object* columns = params->get("Columns");
+        const size_t width = columns ? static_cast<size_t>(columns->number) : 1;
+        if (width == 0) return false;
+        
+        std::string decoded;
+        std::string previous(width, '\0');
+        for (size_t row = 0; row < out.size(); row += width + 1) {
+            const uint8_t type = static_cast<uint8_t>(out[row]);
+            std::string current = out.substr(row + 1, width);
+            current.resize(width, '\0');
+            for (size_t i = 0; i < width; ++i) {
+                const uint8_t left = i > 0 ? static_cast<uint8_t>(current[i - 1]) : 0;
+                const uint8_t up = static_cast<uint8_t>(previous[i]);
+                const uint8_t corner = i > 0 ? static_cast<uint8_t>(previous[i - 1]) : 0;
+                uint8_t value = static_cast<uint8_t>(current[i]);
+                switch (type) {
+                case 1: value = static_cast<uint8_t>(value + left); break;
+                case 2: value = static_cast<uint8_t>(value + up); break;
+                case 3: value = static_cast<uint8_t>(value + (left + up) / 2); break;
+                case 4: {
+                    const int p = left + up - corner;
+                    const int pa = std::abs(p - left);
+                    const int pb = std::abs(p - up);
+                    const int pc = std::abs(p - corner);
+                    value = static_cast<uint8_t>(value + (pa <= pb && pa <= pc ? left : pb <= pc ? up : corner));
+                    break;
+                }
+                default: break;
+                }
+                current[i] = static_cast<char>(value);
+            }
+            decoded += current;
+            previous = current;
+        }
+        out = std::move(decoded);
+        return true;
+    }
+    
+    // Where an object lives: at an offset (type 1) or inside an object
+    // stream (type 2)
+    struct XrefEntry {
+        int type = 0;
+        uint64_t offset = 0;    // Type 2: the object stream's number
+        int index = 0;          // Type 2: index within that stream
+    };
+    
+    class FileProbe {
+    public:
+        explicit FileProbe(Reader& file) : file_(file) {}
+        
+        // Load the newest xref section and its trailer
+        bool open(std::string& error) {
+            const uint64_t size = file_.size();
+            const uint64_t tail_start = size > 1024 ? size - 1024 : 0;
+            const std::string tail = file_.read(tail_start, 1024);
+            const size_t at = tail.rfind("startxref");
+            if (at == std::string::npos) {
+                error = "No startxref";
+                return false;
+            }
+            
+            Parser parser(tail, at + 9);
+            int64_t offset = 0;
+            if (!parser.integer(offset) || offset <= 0 || static_cast<uint64_t>(offset) >= size) {
+                error = "Invalid startxref";
+                return false;
+            }
+            
+            if (!load_section(static_cast<uint64_t>(offset))) {
+                error = "Unreadable xref section";
+                return false;
+            }
+            return true;
+        }
+        
+        const Object& trailer() const { return sections_.front().trailer; }
+        
+        // Follows a reference, through older sections as needed
+        bool resolve(const Object& obj, Object& out) {
+            if (!obj.is(Object::Type::Reference)) {
+                out = obj;
+                return true;
+            }
+            
+            // A stream Length or object stream may lead back to itself
+            if (nesting_ >= 4) return false;
+            ++nesting_;
+            const bool loaded = load_object(obj.num, out);
+            --nesting_;
+            return loaded;
+        }
+    
+    private:
+        struct Subsection {
+            int first;
+            int count;
+            uint64_t at;        // First entry
+            size_t entry_size;  // 20 by the spec; 19 from some writers
+        };
+        
+        struct Section {
+            std::vector<Subsection> table;          // A classic xref table, read on demand
+            std::map<int, XrefEntry> entries;       // A decoded xref stream
+            Object trailer;
+            uint64_t prev = 0;                      // The section before, if any
+        };
+        
+        // Bytes from offset until parse succeeds, in growing windows
+        template <typename Parse>
+        bool parse_at(uint64_t offset, Parse parse) {
+            for (size_t window = kWindow; ; window *= 16) {
+                const std::string data = file_.read(offset, window);
+                if (data.empty()) return false;
+                
+                Parser parser(data);
+                if (parse(parser, data)) return true;
+                if (data.size() < window || window >= kMaxWindow) return false;
+            }
+        }
+        
+        bool load_section(uint64_t offset) {
+            if (sections_.size() >= kMaxSections) return false;
+            
+            Section section;
+            const bool loaded = parse_at(offset, [&](Parser& parser, const std::string& data) {
+                section = Section();
+                if (parser.keyword("xref")) {
+                    return read_table(parser, data, offset, section);
+                }
+                return read_xref_stream(parser, data, offset, section);
+            });
+            if (!loaded) return false;
+            
+            // A hybrid file lists some objects only in an xref stream that
+            // its table points to
+            const Object* hidden = section.trailer.get("XRefStm");
+            if (!section.table.empty() && hidden && hidden->is(Object::Type::Number)) {
+                const uint64_t at = static_cast<uint64_t>(hidden->number);
+                Section stream;
+                const bool read = parse_at(at, [&](Parser& parser, const std::string& data) {
+                    stream = Section();
+                    return read_xref_stream(parser, data, at, stream);
+                });
+                if (read) {
+                    section.entries = std::move(stream.entries);
+                }
+            }
+            
+            const Object* prev = section.trailer.get("Prev");
+            if (prev && prev->is(Object::Type::Number) && prev->number > 0) {
+                section.prev = static_cast<uint64_t>(prev->number);
+            }
+            sections_.push_back(std::move(section));
+            return true;
+        }
+        
+        bool read_table(Parser& parser, const std::string& data, uint64_t base, Section& section) {
+            size_t pos = parser.pos();
+            std::string window = data;
+            uint64_t window_base = base;
+            
+            for (;;) {
+                Parser p(window, pos);
+                if (p.keyword("trailer")) {
+                    return p.object(section.trailer) && section.trailer.is(Object::Type::Dictionary);
+                }
+                
+                int64_t first = 0;
+                int64_t count = 0;
+                if (!p.integer(first) || !p.integer(count) || first < 0 || count < 0) return false;
+                
+                p.skip_space();
+                Subsection sub{static_cast<int>(first), static_cast<int>(count), window_base + p.pos(), 20};
+                if (count > 0) {
+                    // "oooooooooo ggggg n" and a one or two byte end of line
+                    const size_t eol = p.pos() + 18;
+                    if (eol + 1 >= window.size()) return false;
+                    sub.entry_size = window[eol] == ' ' || (window[eol] == '\r' && window[eol + 1] == '\n') ? 20 : 19;
+                }
+                section.table.push_back(sub);
+                
+                // Skip the entries without reading them
+                const uint64_t next = sub.at + static_cast<uint64_t>(count) * sub.entry_size;
+                if (next + 64 > window_base + window.size()) {
+                    window = file_.read(next, kWindow);
+                    window_base = next;
+                    pos = 0;
+                } else {
+                    pos = static_cast<size_t>(next - window_base);
+                }
+            }
+        }
+        
+        bool read_xref_stream(Parser& parser, const std::string& data, uint64_t base, Section& section) {
+            std::string decoded;
+            if (!read_stream(parser, data, base, section.trailer, decoded)) return false;
+            
+            const Object* w = section.trailer.get("W");
+            if (!w || !w->is(Object::Type::Array) || w->items.size() != 3) return false;
+            size_t widths[3];
+            size_t row = 0;
+            for (int i = 0; i < 3; ++i) {
+                widths[i] = static_cast<size_t>(w->items[i].number);
+                row += widths[i];
+            }
+            if (row == 0) return false;
+            
+            std::vector<int64_t> index;
+            if (const Object* ranges = section.trailer.get("Index")) {
+                for (const Object& item : ranges->items) {
+                    index.push_back(static_cast<int64_t>(item.number));
+                }
+            } else if (const Object* size = section.trailer.get("Size")) {
+                index = {0, static_cast<int64_t>(size->number)};
+            }
+            
+            size_t at = 0;
+            for (size_t r = 0; r + 1 < index.size(); r += 2) {
+                for (int64_t n = 0; n < index[r + 1] && at + row <= decoded.size(); ++n) {
+                    uint64_t fields[3] = {1, 0, 0};     // The type defaults to 1
+                    for (int f = 0; f < 3; ++f) {
+                        if (widths[f] == 0) continue;
+                        fields[f] = 0;
+                        for (size_t b = 0; b < widths[f]; ++b) {
+                            fields[f] = (fields[f] << 8) | static_cast<uint8_t>(decoded[at++]);
+                        }
+                    }
+                    
+                    XrefEntry entry;
+                    entry.type = static_cast<int>(fields[0]);
+                    entry.offset = fields[1];
+                    entry.index = static_cast<int>(fields[2]);
+                    section.entries.emplace(static_cast<int>(index[r] + n), entry);
+                }
+            }
+            return true;
+        }
+        
+        // "num gen obj << dict >> stream ... endstream" at the parser,
+        // decoded. The Length may be indirect.
+        bool read_stream(Parser& parser, const std::string& data, uint64_t base, Object& dict, std::string& out) {
+            if (!parser.object_header() || !parser.object(dict) || !dict.is(Object::Type::Dictionary)) {
+                return false;
+            }
+            if (!parser.keyword("stream")) return false;
+            
+            size_t start = parser.pos();
+            if (start < data.size() && data[start] == '\r') ++start;
+            if (start < data.size() && data[start] == '\n') ++start;
+            
+            Object length;
+            const Object* declared = dict.get("Length");
+            if (!declared || !resolve(*declared, length) || length.number < 0) return false;
+            
+            const size_t size = static_cast<size_t>(length.number);
+            std::string raw = start + size <= data.size()
+                ? data.substr(start, size)
+                : file_.read(base + start, size);
+            if (raw.size() != size) return false;
+            return decode_stream(dict, std::move(raw), out);
+        }
+        
+        bool lookup(int num, XrefEntry& entry) {
+            for (size_t i = 0; i < kMaxSections; ++i) {
+                // Not in the sections read so far: go one further back
+                if (i == sections_.size()) {
+                    if (sections_.empty() || sections_.back().prev == 0 || !load_section(sections_.back().prev)) {
+                        return false;
+                    }
+                }
+                
+                const Section& section = sections_[i];
+                bool listed = false;
+                for (const Subsection& sub : section.table) {
+                    if (num < sub.first || num >= sub.first + sub.count) continue;
+                    
+                    const uint64_t at = sub.at + static_cast<uint64_t>(num - sub.first) * sub.entry_size;
+                    const std::string line = file_.read(at, 18);
+                    if (line.size() < 18) return false;
+                    if (line[17] == 'n') {
+                        entry.type = 1;
+                        entry.offset = std::strtoull(line.substr(0, 10).c_str(), nullptr, 10);
+                        return true;
+                    }
+                    listed = true;
+                    break;
+                }
+                
+                auto found = section.entries.find(num);
+                if (found != section.entries.end()) {
+                    entry = found->second;
+                    return entry.type == 1 || entry.type == 2;
+                }
+                
+                // Freed in the newest section that mentions it
+                if (listed) return false;
+            }
+            return false;
+        }
+        
+        bool load_object(int num, Object& out) {
+            XrefEntry entry;
+            if (!lookup(num, entry)) return false;
+            
+            if (entry.type == 1) {
+                return parse_at(entry.offset, [&](Parser& parser, const std::string&) {
+                    out = Object();
+                    return parser.object_header() && parser.object(out);
+                });
+            }
+            
+            // Inside an object stream: "num offset" pairs, then the objects
+            // from First on
+            XrefEntry stream_entry;
+            if (!lookup(static_cast<int>(entry.offset), stream_entry) || stream_entry.type != 1) return false;
+            
+            Object dict;
+            std::string decoded;
+            const bool read = parse_at(stream_entry.offset, [&](Parser& parser, const std::string& data) {
+                dict = Object();
+                return read_stream(parser, data, stream_entry.offset, dict, decoded);
+            });
+            const Object* count = read ? dict.get("N") : nullptr;
+            const Object* first = read ? dict.get("First") : nullptr;
+            if (!count || !first) return false;
+            
+            Parser header(decoded);
+            for (int i = 0; i < static_cast<int>(count->number); ++i) {
+                int64_t object = 0;
+                int64_t offset = 0;
+                if (!header.integer(object) || !header.integer(offset)) return false;
+                if (object == num) {
+                    Parser body(decoded, static_cast<size_t>(first->number + offset));
+                    out = Object();
+                    return body.object(out);
+                }
+            }
+            return false;
+        }
+        
+        Reader& file_;
+        std::vector<Section> sections_;     // Newest first
+        int nesting_ = 0;
+    };
+}
+
+Result<DocumentInfo> Document::probe(const std::string& path) {
+    DocumentInfo info;
+    
+    Reader file(path);
+    if (!file.is_open()) {
+        return Result<DocumentInfo>(ErrorCode::FileNotFound, "Cannot open " + path);
+    }
+    info.file_size = static_cast<size_t>(file.size());
+    
+    // Header, possibly after some junk, then the linearization dictionary
+    // if the file has one: it must be the first object
+    const std::string head = file.read(0, 1024);
+    const size_t magic = head.find("%PDF-");
+    if (magic == std::string::npos) {
+        return Result<DocumentInfo>(ErrorCode::InvalidPDF, "Not a PDF file");
+    }
+    info.version = version_from(head.substr(magic + 5, 3));
+    
+    {
+        Parser parser(head, magic + 8);
+        Object first;
+        if (parser.object_header() && parser.object(first)) {
+            const Object* length = first.get("L");
+            info.is_linearized = first.get("Linearized") && length &&
+                static_cast<uint64_t>(length->number) == file.size();
+        }
+    }
+    
+    FileProbe probe(file);
+    std::string error;
+    if (!probe.open(error)) {
+        return Result<DocumentInfo>(ErrorCode::InvalidPDF, error);
+    }
+    // A copy: reading older sections may move the loaded ones
+    const Object trailer = probe.trailer();
+    info.is_encrypted = trailer.get("Encrypt") != nullptr;
+    
+    // The page count is on the root of the page tree
+    Object catalog;
+    const Object* root = trailer.get("Root");
+    if (root && probe.resolve(*root, catalog)) {
+        Object pages;
+        Object count;
+        const Object* tree = catalog.get("Pages");
+        if (tree && probe.resolve(*tree, pages)) {
+            const Object* counted = pages.get("Count");
+            if (counted && probe.resolve(*counted, count)) {
+                info.page_count = static_cast<int>(count.number);
+            }
+        }
+        
+        // A later version in the catalog overrides the header
+        const Object* version = catalog.get("Version");
+        if (version && version->is(Object::Type::Name)) {
+            info.version = std::max(info.version, version_from(version->text));
+        }
+    }
+    
+    // Strings in an encrypted file's Info are encrypted too
+    Object fields;
+    const Object* dict = trailer.get("Info");
+    if (!info.is_encrypted && dict && probe.resolve(*dict, fields)) {
+        const std::pair<const char*, std::string*> wanted[] = {
+            { "Title", &info.title },
+            { "Author", &info.author },
+            { "Subject", &info.subject },
+            { "Keywords", &info.keywords },
+            { "Creator", &info.creator },
+            { "Producer", &info.producer },
+            { "CreationDate", &info.creation_date },
+            { "ModDate", &info.modification_date },
+        };
+        for (const auto& [key, field] : wanted) {
+            Object value;
+            const Object* entry = fields.get(key);
+            if (entry && probe.resolve(*entry, value) && value.is(Object::Type::String)) {
+                *field = text_string(value.text);
+            }
+        }
+    }
+    
+    return Result<DocumentInfo>(info);
+}
+
+std::vector<DocumentProbe> Document::probe_all(const std::vector<std::string>& paths, int threads) {
+    std::vector<DocumentProbe> results(paths.size());
+    
+    if (threads <= 0) {
+        threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    threads = static_cast<int>(std::min<size_t>(static_cast<size_t>(threads), paths.size()));
+    
+    // Each probe is a handful of small reads: plain threads pulling the
+    // next path keep the disk queue full
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t i = next++; i < paths.size(); i = next++) {
+            results[i].path = paths[i];
+            results[i].info = probe(paths[i]);
+        }
+    };
+    
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; ++t) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : workers) {
+        t.join();
+    }
+    return results;
+}
+
+std::vector<DocumentProbe> Document::probe_directory(const std::string& directory, int threads) {
+    namespace fs = std::filesystem;
+    
+    std::vector<std::string> paths;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(directory, fs::directory_options::skip_permission_denied, ec), end;
+         !ec && it != end; it.increment(ec)) {
+        if (!it->is_regular_file(ec)) continue;
+        
+        std::string extension = it->path().extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) {
+            return static_cast<char>(std::tolower(c));
+        });
+        if (extension == ".pdf") {
+            paths.push_back(it->path().string());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+    
+    return probe_all(paths, threads);
+}
+
+} // namespace pdfeditor
@@ -1,13 +1,34 @@
 #include "pdfeditor/renderer.h"
 #include "pdfeditor/core.h"
+#include "buffer_pool.h"
+#include "context_manager.h"
+#include "draft_device.h"
+#include "image_writer.h"
+#include "lru_cache.h"
+#include "pixel_convert.h"
+#include "resample.h"
+#include "thumbnail_cache.h"
 #include <cmath>
+#include <cstring>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
 #include <thread>
 #include <mutex>
+#include <list>
 #include <map>
+#include <string>
+#include <unordered_map>
 
 #ifdef USE_MUPDF
 #include <mupdf/fitz.h>
+#include <mupdf/pdf.h>
 #endif
 
 namespace pdfeditor {
@@ -15,11 +36,30 @@ namespace pdfeditor {
 // ImageBuffer implementation
 class ImageBuffer::Impl {
 public:
-    std::vector<uint8_t> data;
+    // Pixel memory is shared between copies of a buffer (a cache entry and
+    // the buffers handed out for it) and detached on first write.
+    std::shared_ptr<uint8_t[]> storage;
+    size_t size = 0;
     int width = 0;
     int height = 0;
     int stride = 0;
     ImageFormat format = ImageFormat::RGB24;
+    bool premultiplied = false;
+    
+    // Allocate uninitialized storage from the pool; the renderer clears
+    // it anyway, and the memory is recycled once the last copy is gone
+    void allocate(size_t bytes) {
+        storage = detail::BufferPool::instance().acquire(bytes);
+        size = bytes;
+    }
+    
+    void detach() {
+        if (storage && storage.use_count() > 1) {
+            std::shared_ptr<uint8_t[]> shared = std::move(storage);
+            allocate(size);
+            std::memcpy(storage.get(), shared.get(), size);
+        }
+    }
 };
 
 ImageBuffer::ImageBuffer() : impl_(std::make_unique<Impl>()) {}
@@ -49,215 +89,2298 @@ int ImageBuffer::bytes_per_pixel() const {
 }
 
 const uint8_t* ImageBuffer::data() const {
-    return impl_->data.data();
+    return impl_->storage.get();
 }
 
 uint8_t* ImageBuffer::data() {
-    return impl_->data.data();
+    impl_->detach();
+    return impl_->storage.get();
 }
 
 size_t ImageBuffer::size() const {
-    return impl_->data.size();
+    return impl_->size;
+}
+
+bool ImageBuffer::is_premultiplied() const {
+    return impl_->premultiplied;
+}
+
+std::unique_ptr<ImageBuffer> ImageBuffer::convert(
+    ImageFormat format,
+    bool premultiplied,
+    Dithering dithering
+) const {
+    const ImageFormat source = impl_->format;
+    const int width = impl_->width;
+    const int height = impl_->height;
+    premultiplied = premultiplied && detail::format_has_alpha(format);
+    
+    auto out = std::make_unique<ImageBuffer>();
+    
+    // Same layout: share the pixels
+    if (format == source && premultiplied == impl_->premultiplied) {
+        *out->impl_ = *impl_;
+        return out;
+    }
+    
+    const int stride = detail::format_row_bytes(format, width);
+    out->impl_->allocate(static_cast<size_t>(stride) * height);
+    out->impl_->width = width;
+    out->impl_->height = height;
+    out->impl_->stride = stride;
+    out->impl_->format = format;
+    out->impl_->premultiplied = premultiplied;
+    
+    detail::RowConverter converter(source, impl_->premultiplied, format, premultiplied,
+                                   static_cast<size_t>(width), dithering);
+    for (int y = 0; y < height; ++y) {
+        converter.convert(impl_->storage.get() + static_cast<size_t>(y) * impl_->stride,
+                          out->impl_->storage.get() + static_cast<size_t>(y) * stride,
+                          y);
+    }
+    
+    return out;
+}
+
+std::unique_ptr<ImageBuffer> ImageBuffer::scaled(
+    int width,
+    int height,
+    ResampleFilter filter
+) const {
+    if (width <= 0 || height <= 0 || impl_->width <= 0 || impl_->height <= 0) {
+        return nullptr;
+    }
+    
+    const ImageFormat format = impl_->format;
+    
+    // Filter 1-bit images as gray and dither the result again
+    if (format == ImageFormat::Mono1) {
+        return convert(ImageFormat::Gray8)->scaled(width, height, filter)->convert(format);
+    }
+    
+    // Filtering straight alpha would bleed the color of transparent pixels
+    if (detail::format_has_alpha(format) && !impl_->premultiplied) {
+        return convert(format, true)->scaled(width, height, filter)->convert(format, false);
+    }
+    
+    auto out = std::make_unique<ImageBuffer>();
+    const int stride = detail::format_row_bytes(format, width);
+    out->impl_->allocate(static_cast<size_t>(stride) * height);
+    out->impl_->width = width;
+    out->impl_->height = height;
+    out->impl_->stride = stride;
+    out->impl_->format = format;
+    out->impl_->premultiplied = impl_->premultiplied;
+    
+    detail::resample(impl_->storage.get(), impl_->width, impl_->height, static_cast<size_t>(impl_->stride),
+                     out->impl_->storage.get(), width, height, static_cast<size_t>(stride),
+                     bytes_per_pixel(), filter);
+    return out;
 }
 
 bool ImageBuffer::save_png(const std::string& path) const {
-    // TODO: Implement PNG saving using stb_image_write or libpng
-    return false;
+    return detail::write_png(*this, path);
 }
 
 bool ImageBuffer::save_jpeg(const std::string& path, int quality) const {
-    // TODO: Implement JPEG saving
-    return false;
+    return detail::write_jpeg(*this, path, quality);
 }
 
 bool ImageBuffer::save_bmp(const std::string& path) const {
-    // TODO: Implement BMP saving
-    return false;
+    return detail::write_bmp(*this, path);
 }
 
-bool ImageBuffer::save_tiff(const std::string& path) const {
-    // TODO: Implement TIFF saving
-    return false;
+bool ImageBuffer::save_tiff(const std::string& path, const TiffOptions& options) const {
+    TiffWriter writer;
+    return writer.open(path, options) && writer.add_page(*this) && writer.close();
 }
 
 std::vector<uint8_t> ImageBuffer::to_vector() const {
-    return impl_->data;
+    const uint8_t* pixels = impl_->storage.get();
+    return std::vector<uint8_t>(pixels, pixels + impl_->size);
 }
 
 // Renderer implementation
-class Renderer::Impl {
-public:
-    Impl() : cache_enabled_(true), cache_size_mb_(100), thread_count_(0) {}
+namespace {
+    // Time spent in each render phase, in nanoseconds
+    struct PhaseTimings {
+        using Clock = std::chrono::steady_clock;
+        
+        std::atomic<uint64_t> interpret{0};
+        std::atomic<uint64_t> rasterize{0};
+        std::atomic<uint64_t> copy{0};
+        std::atomic<uint64_t> encode{0};
+        
+        // Add the time since start to a phase
+        static void add(std::atomic<uint64_t>& phase, Clock::time_point start) {
+            phase += static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        }
+    };
     
-    bool cache_enabled_;
-    size_t cache_size_mb_;
-    int thread_count_;
-    std::mutex cache_mutex_;
-    std::map<void*, std::unique_ptr<ImageBuffer>> cache_;
+    // Everything in RenderOptions that changes the rendered pixels
+    struct RenderCacheKey {
+        uint64_t page;          // Page::id(); addresses are reused
+        uint64_t revision;
+        float dpi;
+        AntiAliasing anti_aliasing;
+        ColorMode color_mode;
+        ImageFormat image_format;
+        bool render_annotations;
+        bool render_forms;
+        bool render_transparent;
+        bool premultiplied_alpha;
+        bool draft;
+        Dithering dithering;
+        uint32_t background;
+        bool use_clip_rect;
+        Rect clip_rect;
+        PageRotation rotation;
+        
+        bool operator==(const RenderCacheKey& other) const {
+            return page == other.page &&
+                   revision == other.revision &&
+                   dpi == other.dpi &&
+                   anti_aliasing == other.anti_aliasing &&
+                   color_mode == other.color_mode &&
+                   image_format == other.image_format &&
+                   render_annotations == other.render_annotations &&
+                   render_forms == other.render_forms &&
+                   render_transparent == other.render_transparent &&
+                   premultiplied_alpha == other.premultiplied_alpha &&
+                   draft == other.draft &&
+                   dithering == other.dithering &&
+                   background == other.background &&
+                   use_clip_rect == other.use_clip_rect &&
+                   clip_rect.x0 == other.clip_rect.x0 &&
+                   clip_rect.y0 == other.clip_rect.y0 &&
+                   clip_rect.x1 == other.clip_rect.x1 &&
+                   clip_rect.y1 == other.clip_rect.y1 &&
+                   rotation == other.rotation;
+        }
+    };
     
-#ifdef USE_MUPDF
-    fz_context* get_context() {
-        // Thread-local context for thread safety
-        static thread_local fz_context* ctx = nullptr;
-        if (!ctx) {
-            ctx = fz_new_context(nullptr, nullptr, FZ_STORE_DEFAULT);
-            if (ctx) {
-                fz_register_document_handlers(ctx);
+    struct RenderCacheKeyHash {
+        size_t operator()(const RenderCacheKey& key) const {
+            size_t h = std::hash<uint64_t>()(key.page);
+            auto mix = [&h](size_t v) {
+                h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+            };
+            mix(std::hash<uint64_t>()(key.revision));
+            mix(std::hash<float>()(key.dpi));
+            mix(static_cast<size_t>(key.anti_aliasing));
+            mix(static_cast<size_t>(key.color_mode));
+            mix(static_cast<size_t>(key.image_format));
+            mix((key.render_annotations ? 1u : 0u) |
+                (key.render_forms ? 2u : 0u) |
+                (key.render_transparent ? 4u : 0u) |
+                (key.use_clip_rect ? 8u : 0u) |
+                (key.premultiplied_alpha ? 16u : 0u) |
+                (key.draft ? 32u : 0u));
+            mix(static_cast<size_t>(key.dithering));
+            mix(key.background);
+            mix(std::hash<float>()(key.clip_rect.x0));
+            mix(std::hash<float>()(key.clip_rect.y0));
+            mix(std::hash<float>()(key.clip_rect.x1));
+            mix(std::hash<float>()(key.clip_rect.y1));
+            mix(static_cast<size_t>(key.rotation));
+            return h;
+        }
+    };
+    
+    // Render and tile caches are indexed by page, for finding a page's
+    // other renders and dropping them all
+    struct RenderCacheKeyPage {
+        uint64_t operator()(const RenderCacheKey& key) const { return key.page; }
+    };
+    
+    uint32_t pack_color(const Color& c) {
+        auto channel = [](float v) {
+            return static_cast<uint32_t>(std::lround(std::clamp(v, 0.0f, 1.0f) * 255.0f));
+        };
+        return (channel(c.r) << 24) | (channel(c.g) << 16) | (channel(c.b) << 8) | channel(c.a);
+    }
+    
+    RenderCacheKey make_cache_key(const Page* page, const RenderOptions& options) {
+        RenderCacheKey key;
+        key.page = page->id();
+        key.revision = options.render_annotations || options.render_forms
+            ? page->revision()
+            : page->content_revision();
+        key.dpi = options.dpi;
+        key.anti_aliasing = options.anti_aliasing;
+        key.color_mode = options.color_mode;
+        key.image_format = options.image_format;
+        key.render_annotations = options.render_annotations;
+        key.render_forms = options.render_forms;
+        key.render_transparent = options.render_transparent;
+        key.premultiplied_alpha = options.premultiplied_alpha;
+        key.draft = options.draft;
+        key.dithering = options.dithering;
+        key.background = options.render_transparent ? 0 : pack_color(options.background_color);
+        key.use_clip_rect = options.use_clip_rect;
+        key.clip_rect = options.use_clip_rect ? options.clip_rect : Rect();
+        key.rotation = options.override_rotation ? options.rotation : PageRotation::None;
+        return key;
+    }
+    
+    // A tile is identified by page, zoom (DPI and the other options) and its
+    // pixel position in the full-page raster at that zoom
+    struct TileCacheKey {
+        RenderCacheKey base;
+        int x;
+        int y;
+        int width;
+        int height;
+        
+        bool operator==(const TileCacheKey& other) const {
+            return base == other.base && x == other.x && y == other.y &&
+                   width == other.width && height == other.height;
+        }
+    };
+    
+    struct TileCacheKeyHash {
+        size_t operator()(const TileCacheKey& key) const {
+            size_t h = RenderCacheKeyHash()(key.base);
+            for (int v : {key.x, key.y, key.width, key.height}) {
+                h ^= std::hash<int>()(v) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
             }
+            return h;
         }
-        return ctx;
+    };
+    
+    struct TileCacheKeyPage {
+        uint64_t operator()(const TileCacheKey& key) const { return key.base.page; }
+    };
+    
+    TileCacheKey make_tile_key(const Page* page, const Renderer::TileInfo& tile, const RenderOptions& options) {
+        RenderOptions page_options = options;
+        page_options.use_clip_rect = false;
+        return TileCacheKey{
+            make_cache_key(page, page_options),
+            tile.pixel_x,
+            tile.pixel_y,
+            tile.tile_width,
+            tile.tile_height
+        };
     }
-#endif
-};
-
-Renderer::Renderer() : impl_(std::make_unique<Impl>()) {}
-Renderer::~Renderer() = default;
+}
 
-Result<std::unique_ptr<ImageBuffer>> Renderer::render_page(
-    Page* page,
-    const RenderOptions& options
-) {
-    if (!page) {
-        return Result<std::unique_ptr<ImageBuffer>>(
-            ErrorCode::InvalidArgument,
-            "Invalid page"
-        );
+#ifdef USE_MUPDF
+namespace {
+    // MuPDF does not expose the size of a display list, so approximate it
+    // from the page's content streams, which it mirrors closely.
+    size_t estimate_display_list_cost(fz_context* ctx, fz_page* page) {
+        size_t cost = 16 * 1024;
+        
+        pdf_page* pdf_pg = pdf_page_from_fz_page(ctx, page);
+        if (!pdf_pg) return cost;
+        
+        pdf_obj* contents = pdf_dict_get(ctx, pdf_pg->obj, PDF_NAME(Contents));
+        if (pdf_is_array(ctx, contents)) {
+            int n = pdf_array_len(ctx, contents);
+            for (int i = 0; i < n; ++i) {
+                pdf_obj* stream = pdf_array_get(ctx, contents, i);
+                cost += 2 * static_cast<size_t>(pdf_dict_get_int(ctx, stream, PDF_NAME(Length)));
+            }
+        } else if (contents) {
+            cost += 2 * static_cast<size_t>(pdf_dict_get_int(ctx, contents, PDF_NAME(Length)));
+        }
+        
+        return cost;
     }
     
-#ifdef USE_MUPDF
-    fz_context* ctx = impl_->get_context();
-    if (!ctx) {
-        return Result<std::unique_ptr<ImageBuffer>>(
-            ErrorCode::RenderError,
-            "Failed to get rendering context"
-        );
+    // A page's display lists, one per layer, drawn in this order. Layers
+    // a render leaves out are null. Every list is made with the page
+    // bounds, so any of them gives the page size.
+    struct PageLists {
+        enum Layer { Content, Annotations, Widgets, LayerCount };
+        
+        fz_display_list* layers[LayerCount] = {};
+        
+        explicit operator bool() const {
+            return layers[Content] || layers[Annotations] || layers[Widgets];
+        }
+    };
+    
+    fz_rect bound_page_lists(fz_context* ctx, const PageLists& lists) {
+        for (fz_display_list* list : lists.layers) {
+            if (list) return fz_bound_display_list(ctx, list);
+        }
+        return fz_empty_rect;
     }
     
-    auto buffer = std::make_unique<ImageBuffer>();
+    void run_page_lists(fz_context* ctx, const PageLists& lists, fz_device* dev,
+                        fz_matrix ctm, fz_rect scissor, fz_cookie* cookie) {
+        for (fz_display_list* list : lists.layers) {
+            if (list) fz_run_display_list(ctx, list, dev, ctm, scissor, cookie);
+        }
+    }
     
-    fz_try(ctx) {
-        fz_page* fz_pg = static_cast<fz_page*>(page->get_handle());
-        if (!fz_pg) {
-            fz_throw(ctx, FZ_ERROR_GENERIC, "Invalid page handle");
+    void drop_page_lists(fz_context* ctx, PageLists& lists) {
+        for (fz_display_list*& list : lists.layers) {
+            fz_drop_display_list(ctx, list);
+            list = nullptr;
         }
+    }
+    
+    // Interpreted pages, kept so that re-rendering a page at another scale
+    // only rasterizes. Each layer is interpreted and kept on its own, so
+    // an annotation edit or toggling annotations leaves the content list
+    // alone. Least recently used pages are dropped once the estimated size
+    // exceeds the budget.
+    class DisplayListCache {
+    public:
+        DisplayListCache(size_t budget, PhaseTimings& timings)
+            : timings_(timings), budget_(budget) {}
         
-        // Calculate transform matrix
-        fz_matrix transform = fz_scale(options.dpi / 72.0f, options.dpi / 72.0f);
+        // Returns new references to the page's display lists for the
+        // layers options draw, interpreting any missing or made before the
+        // page's last edit to that layer under the document's interpret
+        // mutex. Throws MuPDF errors, so call inside fz_try. If cookie is
+        // aborted during interpretation the partial lists are returned but
+        // not cached.
+        PageLists acquire(fz_context* ctx, Page* page, const RenderOptions& options,
+                          fz_cookie* cookie = nullptr) {
+            const bool wanted[PageLists::LayerCount] = {
+                true, options.render_annotations, options.render_forms
+            };
+            const uint64_t revisions[PageLists::LayerCount] = {
+                page->content_revision(), page->revision(), page->revision()
+            };
+            
+            PageLists lists;
+            uint64_t generation;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                auto it = entries_.find(page->id());
+                if (it != entries_.end()) {
+                    lru_.splice(lru_.begin(), lru_, it->second.lru);
+                    for (int layer = 0; layer < PageLists::LayerCount; ++layer) {
+                        const Layer& cached = it->second.layers[layer];
+                        if (wanted[layer] && cached.list && cached.revision == revisions[layer]) {
+                            lists.layers[layer] = fz_keep_display_list(ctx, cached.list);
+                        }
+                    }
+                }
+                generation = generation_;
+            }
+            
+            PageLists fresh;
+            bool missing = false;
+            for (int layer = 0; layer < PageLists::LayerCount; ++layer) {
+                missing = missing || (wanted[layer] && !lists.layers[layer]);
+            }
+            if (!missing) {
+                return lists;
+            }
+            
+            // Released in fz_always: a MuPDF error skips destructors
+            std::recursive_mutex& document = page->interpret_mutex();
+            document.lock();
+            fz_page* fz_pg = static_cast<fz_page*>(page->get_handle());
+            size_t costs[PageLists::LayerCount] = {};
+            
+            fz_var(fresh);
+            
+            fz_try(ctx) {
+                if (!fz_pg) {
+                    fz_throw(ctx, FZ_ERROR_GENERIC, "Invalid page handle");
+                }
+                
+                const auto start = PhaseTimings::Clock::now();
+                for (int layer = 0; layer < PageLists::LayerCount; ++layer) {
+                    if (wanted[layer] && !lists.layers[layer] && !(cookie && cookie->abort)) {
+                        fresh.layers[layer] = interpret(ctx, fz_pg, layer, cookie);
+                    }
+                }
+                PhaseTimings::add(timings_.interpret, start);
+                
+                for (int layer = 0; layer < PageLists::LayerCount; ++layer) {
+                    if (fresh.layers[layer] && !(cookie && cookie->abort)) {
+                        costs[layer] = layer == PageLists::Content
+                            ? estimate_display_list_cost(ctx, fz_pg)
+                            : kOverlayCost;
+                    }
+                }
+            }
+            fz_always(ctx) {
+                fz_drop_page(ctx, fz_pg);
+                document.unlock();
+            }
+            fz_catch(ctx) {
+                drop_page_lists(ctx, lists);
+                drop_page_lists(ctx, fresh);
+                fz_rethrow(ctx);
+            }
+            
+            for (int layer = 0; layer < PageLists::LayerCount; ++layer) {
+                if (fresh.layers[layer]) {
+                    lists.layers[layer] = fresh.layers[layer];
+                }
+            }
+            if (cookie && cookie->abort) {
+                return lists;
+            }
+            
+            std::lock_guard<std::mutex> lock(mutex_);
+            
+            // Don't publish lists that were invalidated while being built
+            if (generation != generation_) {
+                return lists;
+            }
+            
+            auto it = entries_.find(page->id());
+            if (it == entries_.end()) {
+                lru_.push_front(page->id());
+                it = entries_.emplace(page->id(), Entry{{}, lru_.begin()}).first;
+            } else {
+                lru_.splice(lru_.begin(), lru_, it->second.lru);
+            }
+            
+            // A layer another thread interpreted meanwhile is replaced;
+            // both are of the same revision or ours is newer
+            for (int layer = 0; layer < PageLists::LayerCount; ++layer) {
+                if (!fresh.layers[layer]) continue;
+                
+                Layer& cached = it->second.layers[layer];
+                if (cached.list) {
+                    bytes_ -= cached.cost;
+                    fz_drop_display_list(ctx, cached.list);
+                }
+                cached = Layer{fz_keep_display_list(ctx, fresh.layers[layer]), costs[layer], revisions[layer]};
+                bytes_ += costs[layer];
+            }
+            
+            if (it->second.cost() > budget_) {
+                erase_locked(ctx, it);
+            }
+            evict_locked(ctx);
+            
+            return lists;
+        }
         
-        // Get page bounds
-        fz_rect bounds = fz_bound_page(ctx, fz_pg);
-        bounds = fz_transform_rect(bounds, transform);
+        void invalidate(fz_context* ctx, Page* page) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++generation_;
+            
+            auto it = entries_.find(page->id());
+            if (it != entries_.end()) {
+                erase_locked(ctx, it);
+            }
+        }
         
-        // Calculate pixel dimensions
-        int width = static_cast<int>(bounds.x1 - bounds.x0);
-        int height = static_cast<int>(bounds.y1 - bounds.y0);
+        void clear(fz_context* ctx) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++generation_;
+            
+            while (!entries_.empty()) {
+                erase_locked(ctx, entries_.begin());
+            }
+        }
         
-        // Create pixmap
-        fz_colorspace* colorspace = nullptr;
-        int alpha = 0;
+        void set_budget(fz_context* ctx, size_t budget) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            budget_ = budget;
+            evict_locked(ctx);
+        }
         
-        switch (options.color_mode) {
-            case ColorMode::RGB:
-                colorspace = fz_device_rgb(ctx);
-                break;
-            case ColorMode::Grayscale:
-                colorspace = fz_device_gray(ctx);
-                break;
-            case ColorMode::CMYK:
-                colorspace = fz_device_cmyk(ctx);
-                break;
-            default:
-                colorspace = fz_device_rgb(ctx);
+        size_t budget() const {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return budget_;
         }
         
-        if (options.render_transparent) {
-            alpha = 1;
+    private:
+        // Annotation appearance streams are small; a flat guess will do
+        static constexpr size_t kOverlayCost = 16 * 1024;
+        
+        // Same as the matching part of fz_run_page, but cancellable
+        static fz_display_list* interpret(fz_context* ctx, fz_page* page, int layer, fz_cookie* cookie) {
+            fz_display_list* list = fz_new_display_list(ctx, fz_bound_page(ctx, page));
+            fz_device* dev = nullptr;
+            
+            fz_var(dev);
+            
+            fz_try(ctx) {
+                dev = fz_new_list_device(ctx, list);
+                switch (layer) {
+                    case PageLists::Content:
+                        fz_run_page_contents(ctx, page, dev, fz_identity, cookie);
+                        break;
+                    case PageLists::Annotations:
+                        fz_run_page_annots(ctx, page, dev, fz_identity, cookie);
+                        break;
+                    default:
+                        fz_run_page_widgets(ctx, page, dev, fz_identity, cookie);
+                        break;
+                }
+                fz_close_device(ctx, dev);
+            }
+            fz_always(ctx) {
+                fz_drop_device(ctx, dev);
+            }
+            fz_catch(ctx) {
+                fz_drop_display_list(ctx, list);
+                fz_rethrow(ctx);
+            }
+            
+            return list;
         }
         
-        fz_pixmap* pix = fz_new_pixmap_with_bbox(
-            ctx,
-            colorspace,
-            fz_round_rect(bounds),
-            nullptr,
-            alpha
-        );
+        struct Layer {
+            fz_display_list* list = nullptr;
+            size_t cost = 0;
+            uint64_t revision = 0;  // Page revision the list was made at
+        };
         
-        // Clear background
-        if (!options.render_transparent) {
-            fz_clear_pixmap_with_value(
-                ctx,
-                pix,
-                static_cast<int>(options.background_color.r * 255)
-            );
-        } else {
-            fz_clear_pixmap(ctx, pix);
+        struct Entry {
+            Layer layers[PageLists::LayerCount];
+            std::list<uint64_t>::iterator lru;
+            
+            size_t cost() const {
+                size_t total = 0;
+                for (const Layer& layer : layers) total += layer.cost;
+                return total;
+            }
+        };
+        
+        void erase_locked(fz_context* ctx, std::unordered_map<uint64_t, Entry>::iterator it) {
+            bytes_ -= it->second.cost();
+            lru_.erase(it->second.lru);
+            for (Layer& layer : it->second.layers) {
+                fz_drop_display_list(ctx, layer.list);
+            }
+            entries_.erase(it);
         }
         
-        // Create device and render
-        fz_device* dev = fz_new_draw_device(ctx, transform, pix);
-        fz_run_page(ctx, fz_pg, dev, fz_identity, nullptr);
-        fz_close_device(ctx, dev);
-        fz_drop_device(ctx, dev);
+        void evict_locked(fz_context* ctx) {
+            while (bytes_ > budget_ && !lru_.empty()) {
+                erase_locked(ctx, entries_.find(lru_.back()));
+            }
+        }
+        
+        PhaseTimings& timings_;
+        mutable std::mutex mutex_;
+        // By Page::id(): a page of a closed document may leave its address
+        // to a page of the next
+        std::unordered_map<uint64_t, Entry> entries_;
+        std::list<uint64_t> lru_;
+        size_t bytes_ = 0;
+        size_t budget_;
+        uint64_t generation_ = 0;
+    };
+}
+#endif
+
+class Renderer::Impl {
+public:
+    Impl()
+        : cache_enabled_(true)
+        , cache_size_mb_(100)
+        , thread_count_(0)
+        , cache_(cache_size_mb_ * 1024 * 1024)
+        , tile_cache_(64 * 1024 * 1024)
+        , layer_cache_(64 * 1024 * 1024) {
+#ifdef USE_MUPDF
+        display_lists_ = std::make_unique<DisplayListCache>(64 * 1024 * 1024, timings_);
+#endif
+    }
+    
+    ~Impl() {
+#ifdef USE_MUPDF
+        stop_progressive();
+        if (fz_context* ctx = get_context()) {
+            display_lists_->clear(ctx);
+        }
+#endif
+    }
+    
+    std::atomic<bool> cache_enabled_;
+    std::atomic<size_t> cache_size_mb_;
+    int thread_count_;
+    
+    // Rendered pages keyed by page and every option that affects pixels
+    detail::LruCache<RenderCacheKey, ImageBuffer, RenderCacheKeyHash, RenderCacheKeyPage> cache_;
+    
+    // Rendered tiles, budgeted separately so panning around a zoomed page
+    // does not evict whole-page renders
+    detail::LruCache<TileCacheKey, ImageBuffer, TileCacheKeyHash, TileCacheKeyPage> tile_cache_;
+    
+    // Page contents rendered without annotations and widgets, for drawing
+    // a changed annotation layer over without rasterizing the contents
+    detail::LruCache<RenderCacheKey, ImageBuffer, RenderCacheKeyHash, RenderCacheKeyPage> layer_cache_;
+    
+    // Summed over every render, for get_render_timings()
+    PhaseTimings timings_;
+    
+    // Thumbnails that survive reopening the document
+    mutable std::mutex thumbnail_mutex_;
+    detail::ThumbnailDiskCache thumbnail_disk_cache_;
+    
+    // Thumbnails skip annotations and forms, and anti-alias only text,
+    // whose glyphs come from the glyph cache
+    static RenderOptions thumbnail_options(Page* page, int max_width, int max_height, bool maintain_aspect) {
+        float scale_x = max_width / page->width();
+        float scale_y = max_height / page->height();
+        float scale = maintain_aspect ? std::min(scale_x, scale_y) : scale_x;
+        
+        RenderOptions options;
+        options.dpi = 72.0f * scale;
+        options.anti_aliasing = AntiAliasing::Text;
+        options.render_annotations = false;
+        options.render_forms = false;
+        return options;
+    }
+    
+    static std::unique_ptr<ImageBuffer> load_thumbnail(
+        const detail::ThumbnailDiskCache& disk,
+        const detail::ThumbnailDiskCache::Key& key
+    ) {
+        auto buffer = std::make_unique<ImageBuffer>();
+        bool found = disk.load(key, [&buffer](const detail::ThumbnailDiskCache::Header& header) {
+            buffer->impl_->allocate(static_cast<size_t>(header.stride) * header.height);
+            buffer->impl_->width = header.width;
+            buffer->impl_->height = header.height;
+            buffer->impl_->stride = header.stride;
+            buffer->impl_->format = static_cast<ImageFormat>(header.format);
+            return buffer->impl_->storage.get();
+        });
+        return found ? std::move(buffer) : nullptr;
+    }
+    
+    static void store_thumbnail(
+        const detail::ThumbnailDiskCache& disk,
+        const detail::ThumbnailDiskCache::Key& key,
+        const ImageBuffer& buffer
+    ) {
+        disk.store(key, detail::ThumbnailDiskCache::Header{
+            buffer.width(),
+            buffer.height(),
+            buffer.stride(),
+            static_cast<int>(buffer.format())
+        }, buffer.data());
+    }
+    
+    // Copies share pixel storage until one of them is written to
+    static std::unique_ptr<ImageBuffer> copy_buffer(const ImageBuffer& source) {
+        auto copy = std::make_unique<ImageBuffer>();
+        *copy->impl_ = *source.impl_;
+        return copy;
+    }
+    
+    // Up to four neighbouring tiles, top-left, top-right, bottom-left and
+    // bottom-right, joined into one buffer. Tiles missing past the right or
+    // bottom edge are null; the rest share their format.
+    static std::unique_ptr<ImageBuffer> join_tiles(const ImageBuffer* const quad[4]) {
+        const ImageBuffer::Impl& top_left = *quad[0]->impl_;
+        const int left_width = top_left.width;
+        const int top_height = top_left.height;
+        const int width = left_width + (quad[1] ? quad[1]->width() : 0);
+        const int height = top_height + (quad[2] ? quad[2]->height() : 0);
+        const int bpp = quad[0]->bytes_per_pixel();
+        
+        auto out = std::make_unique<ImageBuffer>();
+        const int stride = detail::format_row_bytes(top_left.format, width);
+        out->impl_->allocate(static_cast<size_t>(stride) * height);
+        out->impl_->width = width;
+        out->impl_->height = height;
+        out->impl_->stride = stride;
+        out->impl_->format = top_left.format;
+        out->impl_->premultiplied = top_left.premultiplied;
+        
+        for (int i = 0; i < 4; ++i) {
+            if (!quad[i]) continue;
+            const ImageBuffer::Impl& tile = *quad[i]->impl_;
+            const int x = (i & 1) ? left_width : 0;
+            const int y = (i & 2) ? top_height : 0;
+            for (int row = 0; row < tile.height; ++row) {
+                std::memcpy(out->impl_->storage.get() + static_cast<size_t>(y + row) * stride + static_cast<size_t>(x) * bpp,
+                            tile.storage.get() + static_cast<size_t>(row) * tile.stride,
+                            static_cast<size_t>(tile.width) * bpp);
+            }
+        }
+        return out;
+    }
+    
+    // An RGB24 or RGBA32 tile placed top-left in a size x size buffer of
+    // the background color (transparent for RGBA32)
+    static std::unique_ptr<ImageBuffer> pad_tile(const ImageBuffer& tile, int size, const Color& background) {
+        const ImageBuffer::Impl& source = *tile.impl_;
+        const int bpp = tile.bytes_per_pixel();
+        const size_t stride = static_cast<size_t>(size) * bpp;
         
-        // Copy pixmap data to ImageBuffer
-        buffer->impl_->width = fz_pixmap_width(ctx, pix);
-        buffer->impl_->height = fz_pixmap_height(ctx, pix);
-        buffer->impl_->stride = fz_pixmap_stride(ctx, pix);
+        auto out = std::make_unique<ImageBuffer>();
+        out->impl_->allocate(stride * size);
+        out->impl_->width = size;
+        out->impl_->height = size;
+        out->impl_->stride = static_cast<int>(stride);
+        out->impl_->format = source.format;
+        out->impl_->premultiplied = source.premultiplied;
         
-        // Determine format
-        int n = fz_pixmap_components(ctx, pix);
-        if (alpha) {
-            buffer->impl_->format = (n == 4) ? ImageFormat::RGBA32 : ImageFormat::BGRA32;
+        uint8_t* pixels = out->impl_->storage.get();
+        if (bpp == 4) {
+            std::memset(pixels, 0, stride * size);
         } else {
-            buffer->impl_->format = (n == 3) ? ImageFormat::RGB24 : ImageFormat::BGR24;
+            const uint32_t rgba = pack_color(background);
+            const uint8_t color[3] = {
+                static_cast<uint8_t>(rgba >> 24),
+                static_cast<uint8_t>(rgba >> 16),
+                static_cast<uint8_t>(rgba >> 8)
+            };
+            for (size_t i = 0; i < stride * size; i += 3) {
+                std::memcpy(pixels + i, color, 3);
+            }
         }
         
-        // Copy pixel data
-        size_t data_size = buffer->impl_->stride * buffer->impl_->height;
-        buffer->impl_->data.resize(data_size);
-        std::memcpy(
-            buffer->impl_->data.data(),
-            fz_pixmap_samples(ctx, pix),
-            data_size
-        );
+        for (int row = 0; row < source.height; ++row) {
+            std::memcpy(pixels + row * stride,
+                        source.storage.get() + static_cast<size_t>(row) * source.stride,
+                        static_cast<size_t>(source.width) * bpp);
+        }
+        return out;
+    }
+    
+    // Returns a copy of the cached render, or nullptr on a miss
+    std::unique_ptr<ImageBuffer> find_cached(const RenderCacheKey& key) {
+        if (!cache_enabled_) return nullptr;
+        auto cached = cache_.find(key);
+        return cached ? copy_buffer(*cached) : nullptr;
+    }
+    
+    void store_cached(const RenderCacheKey& key, const ImageBuffer& buffer, uint64_t generation) {
+        if (!cache_enabled_) return;
+        cache_.insert(key, copy_buffer(buffer), buffer.size(), generation);
+    }
+    
+    // The lowest-resolution cached render matching key in everything but
+    // dpi, at between key.dpi and 4x it: close enough to reduce from
+    // without losing detail or spending longer than a fresh render
+    std::shared_ptr<const ImageBuffer> find_larger_cached(const RenderCacheKey& key) {
+        if (!cache_enabled_) return nullptr;
         
-        fz_drop_pixmap(ctx, pix);
+        bool found = false;
+        RenderCacheKey best = key;
+        cache_.for_each_in(key.page, [&](const RenderCacheKey& candidate, const std::shared_ptr<const ImageBuffer>&) {
+            RenderCacheKey same_dpi = candidate;
+            same_dpi.dpi = key.dpi;
+            if (same_dpi == key && candidate.dpi >= key.dpi && candidate.dpi <= key.dpi * 4.0f &&
+                (!found || candidate.dpi < best.dpi)) {
+                best = candidate;
+                found = true;
+            }
+            return true;
+        });
+        return found ? cache_.find(best) : nullptr;
     }
-    fz_catch(ctx) {
-        return Result<std::unique_ptr<ImageBuffer>>(
-            ErrorCode::RenderError,
-            fz_caught_message(ctx)
-        );
+    
+    // Pixel size of a render at dpi_x by dpi_y, rounded like fz_round_rect
+    static void scaled_size(Page* page, const RenderOptions& options, float dpi_x, float dpi_y,
+                            int& width, int& height) {
+        const float sx = dpi_x / 72.0f;
+        const float sy = dpi_y / 72.0f;
+        const int page_width = static_cast<int>(std::ceil(page->width() * sx - 0.001f));
+        const int page_height = static_cast<int>(std::ceil(page->height() * sy - 0.001f));
+        
+        if (!options.use_clip_rect) {
+            width = page_width;
+            height = page_height;
+            return;
+        }
+        
+        const Rect& clip = options.clip_rect;
+        const int x0 = std::max(0, static_cast<int>(std::floor(clip.x0 * sx + 0.001f)));
+        const int y0 = std::max(0, static_cast<int>(std::floor(clip.y0 * sy + 0.001f)));
+        const int x1 = std::min(page_width, static_cast<int>(std::ceil(clip.x1 * sx - 0.001f)));
+        const int y1 = std::min(page_height, static_cast<int>(std::ceil(clip.y1 * sy - 0.001f)));
+        width = std::max(0, x1 - x0);
+        height = std::max(0, y1 - y0);
     }
     
-    return Result<std::unique_ptr<ImageBuffer>>(std::move(buffer));
-#else
-    return Result<std::unique_ptr<ImageBuffer>>(
-        ErrorCode::NotImplemented,
-        "Rendering not implemented for this backend"
-    );
-#endif
-}
-
-bool Renderer::render_page_to_buffer(
-    Page* page,
-    uint8_t* buffer,
-    size_t buffer_size,
-    const RenderOptions& options
-) {
-    auto result = render_page(page, options);
-    if (!result.is_ok()) {
-        return false;
+    // Render at dpi_x by dpi_y into exactly width x height. A size one
+    // resolution produces is rendered directly; otherwise a larger cached
+    // render is reduced, or the page is rendered at the higher of the two
+    // resolutions and resampled. Monochrome output is filtered as gray and
+    // dithered afterwards.
+    Result<std::unique_ptr<ImageBuffer>> render_resized(
+        Renderer& renderer,
+        Page* page,
+        const RenderOptions& options,
+        float dpi_x,
+        float dpi_y,
+        int width,
+        int height
+    ) {
+        using ImageResult = Result<std::unique_ptr<ImageBuffer>>;
+        if (width <= 0 || height <= 0) {
+            return ImageResult(ErrorCode::InvalidArgument, "Invalid size");
+        }
+        
+        RenderOptions source = options;
+        source.dpi = std::max(dpi_x, dpi_y);
+        
+        int direct_width = 0;
+        int direct_height = 0;
+        scaled_size(page, options, source.dpi, source.dpi, direct_width, direct_height);
+        if (direct_width == width && direct_height == height) {
+            return renderer.render_page(page, source);
+        }
+        
+        const bool mono = options.image_format == ImageFormat::Mono1 ||
+                          options.color_mode == ColorMode::Monochrome;
+        if (mono) {
+            source.image_format = ImageFormat::Gray8;
+            source.color_mode = ColorMode::Grayscale;
+        }
+        
+        std::unique_ptr<ImageBuffer> image;
+        if (auto larger = find_larger_cached(make_cache_key(page, source))) {
+            image = larger->scaled(width, height, options.resample_filter);
+        } else {
+            auto rendered = renderer.render_page(page, source);
+            if (!rendered.is_ok()) {
+                return rendered;
+            }
+            image = rendered.value()->scaled(width, height, options.resample_filter);
+        }
+        
+        if (mono) {
+            image = image->convert(ImageFormat::Mono1, false, options.dithering);
+            if (options.image_format != ImageFormat::Mono1) {
+                image = image->convert(options.image_format, options.premultiplied_alpha);
+            }
+        }
+        return ImageResult(std::move(image));
     }
     
-    auto img = result.value();
-    size_t img_size = img->size();
+    int worker_count(size_t jobs) const {
+        int threads = thread_count_;
+        if (threads <= 0) {
+            threads = static_cast<int>(std::thread::hardware_concurrency());
+        }
+        threads = std::max(threads, 1);
+        return static_cast<int>(std::min<size_t>(threads, std::max<size_t>(jobs, 1)));
+    }
     
-    if (img_size > buffer_size) {
-        return false;
+#ifdef USE_MUPDF
+    // Run fn(ctx, i) for every i in [0, count) on up to worker_count()
+    // threads. The calling thread takes part with its own context; the
+    // others use contexts cloned from the library context. fn must only touch
+    // MuPDF objects that are safe to share, such as display lists.
+    template <typename Fn>
+    void parallel_for(fz_context* ctx, size_t count, Fn fn) {
+        std::vector<fz_context*> worker_ctxs;
+        const int threads = worker_count(count);
+        for (int t = 1; t < threads; ++t) {
+            fz_context* worker_ctx = detail::ContextManager::clone();
+            if (!worker_ctx) break;
+            worker_ctxs.push_back(worker_ctx);
+        }
+        
+        std::atomic<size_t> next(0);
+        auto run = [&](fz_context* run_ctx) {
+            for (size_t i = next++; i < count; i = next++) {
+                fn(run_ctx, i);
+            }
+        };
+        
+        std::vector<std::thread> workers;
+        workers.reserve(worker_ctxs.size());
+        for (fz_context* worker_ctx : worker_ctxs) {
+            workers.emplace_back(run, worker_ctx);
+        }
+        
+        run(ctx);
+        
+        for (auto& t : workers) {
+            t.join();
+        }
+        for (fz_context* worker_ctx : worker_ctxs) {
+            fz_drop_context(worker_ctx);
+        }
     }
     
-    std::memcpy(buffer, img->data(), img_size);
+    // One item of run_batch: prepare either resolves it directly into
+    // result or hands a display list over to be rasterized
+    struct BatchItem {
+        size_t index = 0;
+        PageLists list;
+        RenderOptions options;
+        RenderCacheKey key = {};
+        uint64_t content = 0;       // Page::content_fingerprint() as prepared
+        uint64_t generation = 0;
+        Result<std::unique_ptr<ImageBuffer>> result{ErrorCode::RenderError, "Page was not rendered"};
+    };
+    
+    // Shared pipeline of render_pages and render_all_thumbnails. For each
+    // item in order, the calling thread asks proceed(i) whether to go on and
+    // then runs prepare(ctx, item), since a document may only be used by one
+    // thread at a time. Items that prepare returned true for carry a display
+    // list, which finish(ctx, item) rasterizes on up to worker_count()
+    // threads with cloned contexts. At most two items per worker are queued,
+    // so cancelling stops promptly and the results hold every started item,
+    // in order. An item whose identify(i) matches an earlier item's is not
+    // prepared at all and shares that item's buffer; identify returns 0 for
+    // an item that must always be rendered.
+    template <typename Proceed, typename Identify, typename Prepare, typename Finish>
+    std::vector<Result<std::unique_ptr<ImageBuffer>>> run_batch(
+        size_t total,
+        Proceed proceed,
+        Identify identify,
+        Prepare prepare,
+        Finish finish
+    ) {
+        std::vector<Result<std::unique_ptr<ImageBuffer>>> results;
+        
+        fz_context* ctx = detail::ContextManager::clone();
+        if (!ctx) {
+            results.push_back(Result<std::unique_ptr<ImageBuffer>>(
+                ErrorCode::OutOfMemory,
+                "Failed to clone rendering context"
+            ));
+            return results;
+        }
+        
+        results.reserve(total);
+        
+        struct Batch {
+            std::mutex mutex;
+            std::condition_variable work_cv;
+            std::condition_variable done_cv;
+            std::deque<BatchItem> queue;
+            size_t in_flight = 0;
+            bool closed = false;
+        } batch;
+        
+        // Clone every worker context up front; fewer workers is fine if the
+        // allocator runs dry, and none means rasterizing inline.
+        std::vector<fz_context*> worker_ctxs;
+        const int threads = worker_count(total);
+        for (int t = 0; t < threads && threads > 1; ++t) {
+            fz_context* worker_ctx = detail::ContextManager::clone();
+            if (!worker_ctx) break;
+            worker_ctxs.push_back(worker_ctx);
+        }
+        
+        auto worker = [&](fz_context* worker_ctx) {
+            for (;;) {
+                std::unique_lock<std::mutex> lock(batch.mutex);
+                batch.work_cv.wait(lock, [&] {
+                    return batch.closed || !batch.queue.empty();
+                });
+                if (batch.queue.empty()) break;
+                BatchItem item = std::move(batch.queue.front());
+                batch.queue.pop_front();
+                lock.unlock();
+                
+                auto result = finish(worker_ctx, item);
+                drop_page_lists(worker_ctx, item.list);
+                
+                lock.lock();
+                results[item.index] = std::move(result);
+                --batch.in_flight;
+                batch.done_cv.notify_one();
+            }
+        };
+        
+        std::vector<std::thread> workers;
+        workers.reserve(worker_ctxs.size());
+        for (fz_context* worker_ctx : worker_ctxs) {
+            workers.emplace_back(worker, worker_ctx);
+        }
+        
+        const size_t max_in_flight = std::max<size_t>(workers.size(), 1) * 2;
+        
+        // First item seen with each fingerprint, and the (copy, source)
+        // pairs filled in once every item is done
+        std::unordered_map<uint64_t, size_t> firsts;
+        std::vector<std::pair<size_t, size_t>> duplicates;
+        
+        for (size_t i = 0; i < total; ++i) {
+            if (!proceed(i)) break;
+            
+            const uint64_t id = identify(i);
+            if (id != 0) {
+                auto first = firsts.emplace(id, i);
+                if (!first.second) {
+                    duplicates.emplace_back(i, first.first->second);
+                    std::lock_guard<std::mutex> lock(batch.mutex);
+                    results.push_back(Result<std::unique_ptr<ImageBuffer>>(
+                        ErrorCode::RenderError,
+                        "Page was not rendered"
+                    ));
+                    continue;
+                }
+            }
+            
+            BatchItem item;
+            item.index = i;
+            const bool queue = prepare(ctx, item);
+            
+            std::unique_lock<std::mutex> lock(batch.mutex);
+            if (!queue) {
+                results.push_back(std::move(item.result));
+                continue;
+            }
+            
+            if (workers.empty()) {
+                lock.unlock();
+                auto result = finish(ctx, item);
+                drop_page_lists(ctx, item.list);
+                results.push_back(std::move(result));
+                continue;
+            }
+            
+            batch.done_cv.wait(lock, [&] {
+                return batch.in_flight < max_in_flight;
+            });
+            
+            results.push_back(std::move(item.result));
+            batch.queue.push_back(std::move(item));
+            ++batch.in_flight;
+            batch.work_cv.notify_one();
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(batch.mutex);
+            batch.closed = true;
+        }
+        batch.work_cv.notify_all();
+        
+        for (auto& t : workers) {
+            t.join();
+        }
+        
+        // Sharing the storage keeps the batch at one raster per unique page
+        for (const auto& [copy, source] : duplicates) {
+            const auto& original = results[source];
+            if (original.is_ok() && original.value()) {
+                results[copy] = Result<std::unique_ptr<ImageBuffer>>(copy_buffer(*original.value()));
+            } else {
+                results[copy] = Result<std::unique_ptr<ImageBuffer>>(
+                    original.error(),
+                    original.error_message()
+                );
+            }
+        }
+        
+        for (fz_context* worker_ctx : worker_ctxs) {
+            fz_drop_context(worker_ctx);
+        }
+        fz_drop_context(ctx);
+        return results;
+    }
+#endif
+
+#ifdef USE_MUPDF
+    std::unique_ptr<DisplayListCache> display_lists_;
+    
+    // The calling thread's clone of the library context; it shares the
+    // resource store with documents and every other thread
+    static fz_context* get_context() {
+        return detail::ContextManager::thread_context();
+    }
+    
+    // Render a page with the given context
+    Result<std::unique_ptr<ImageBuffer>> render(
+        fz_context* ctx,
+        Page* page,
+        const RenderOptions& options
+    );
+    
+    // Render the content layer, or take it from layer_cache_, and draw
+    // the annotation and widget layers over a copy of it
+    Result<std::unique_ptr<ImageBuffer>> render_layered(
+        fz_context* ctx,
+        Page* page,
+        const PageLists& lists,
+        const RenderOptions& options
+    );
+    
+    // Whether these options' output can be drawn over once finished: true
+    // unless it is converted from what MuPDF draws
+    static bool can_overlay(fz_context* ctx, const RenderOptions& options);
+    
+    // Rasterize an already interpreted page, or only the device pixels in
+    // region if given. Display lists may be replayed from several threads
+    // at once as long as each passes its own context.
+    Result<std::unique_ptr<ImageBuffer>> rasterize(
+        fz_context* ctx,
+        const PageLists& list,
+        const RenderOptions& options,
+        const fz_irect* region = nullptr,
+        fz_cookie* cookie = nullptr
+    );
+    
+    // Bring a cached render of an older revision of the page up to date by
+    // redrawing only the areas damaged since, and cache the result. Null
+    // if there is no such render or a full render would be as cheap.
+    std::unique_ptr<ImageBuffer> redraw_damage(
+        fz_context* ctx,
+        Page* page,
+        const RenderCacheKey& key,
+        const RenderOptions& options
+    );
+    
+    // Device pixels covered by the output: the whole page, narrowed to
+    // options.clip_rect or region when given. Throws if nothing is left.
+    static fz_irect output_bbox(
+        fz_context* ctx,
+        const PageLists& list,
+        const RenderOptions& options,
+        const fz_irect* region
+    );
+    
+    // Device pixels of a tile from calculate_tiles()
+    static fz_irect tile_bbox(
+        fz_context* ctx,
+        const PageLists& list,
+        const RenderOptions& options,
+        const TileInfo& tile
+    );
+    
+    // Draw the part of the list inside bbox (in device pixels) into caller
+    // memory with the given row stride. Throws MuPDF errors.
+    void draw(
+        fz_context* ctx,
+        const PageLists& list,
+        const RenderOptions& options,
+        fz_matrix transform,
+        fz_irect bbox,
+        unsigned char* samples,
+        int stride,
+        fz_cookie* cookie = nullptr
+    );
+    
+    // Like draw(), but over the pixels already there, for options that
+    // can_overlay(). Throws MuPDF errors.
+    void draw_overlay(
+        fz_context* ctx,
+        const PageLists& list,
+        const RenderOptions& options,
+        fz_matrix transform,
+        fz_irect bbox,
+        unsigned char* samples,
+        int stride
+    );
+    
+    // The page's embedded /Thumb image scaled down to width x height, or
+    // null if there is none or it is smaller than that
+    static std::unique_ptr<ImageBuffer> embedded_thumbnail(
+        fz_context* ctx,
+        Page* page,
+        int width,
+        int height
+    );
+    
+    // Interpret only the page contents, skipping annotations and widgets.
+    // Not cached: a thumbnail strip would flush the display list cache.
+    // Throws MuPDF errors.
+    PageLists thumbnail_list(fz_context* ctx, Page* page);
+    
+    // Fingerprint of the file behind doc for the thumbnail disk cache, or
+    // 0 if it has none
+    static uint64_t document_fingerprint(fz_context* ctx, Document* doc);
+    
+    // A render driven by start/continue_progressive_render. The worker
+    // thread interprets the page, publishes a coarse preview, then draws
+    // the full-resolution image in bands; everything it shares with the
+    // caller is guarded by mutex except the rows below rows_done, which
+    // the worker no longer writes.
+    struct Progressive {
+        Page* page = nullptr;
+        RenderOptions options;
+        uint64_t generation = 0;
+        fz_cookie cookie = {};
+        std::thread worker;
+        
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::unique_ptr<ImageBuffer> image;
+        std::unique_ptr<ImageBuffer> preview;
+        int rows_done = 0;
+        int progress = 0;
+        uint64_t updates = 0;
+        bool finished = false;
+        std::string error;
+        
+        void update(int percent) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                progress = percent;
+                ++updates;
+            }
+            changed.notify_all();
+        }
+        
+        void finish(const std::string& message) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                error = message;
+                if (message.empty()) {
+                    progress = 100;
+                }
+                finished = true;
+                ++updates;
+            }
+            changed.notify_all();
+        }
+    };
+    
+    std::unique_ptr<Progressive> progressive_;
+    
+    // Body of the progressive worker thread
+    void run_progressive(Progressive& job);
+    
+    // Abort and wait for the current progressive render, if any
+    void stop_progressive() {
+        if (!progressive_) return;
+        progressive_->cookie.abort = 1;
+        if (progressive_->worker.joinable()) {
+            progressive_->worker.join();
+        }
+        progressive_.reset();
+    }
+    
+    // MuPDF's default of 8 bits (256 levels) where anti-aliasing is on
+    static void apply_anti_aliasing(fz_context* ctx, AntiAliasing aa) {
+        const bool text = aa == AntiAliasing::All || aa == AntiAliasing::Text;
+        const bool graphics = aa == AntiAliasing::All || aa == AntiAliasing::Graphics;
+        fz_set_text_aa_level(ctx, text ? 8 : 0);
+        fz_set_graphics_aa_level(ctx, graphics ? 8 : 0);
+    }
+    
+    static fz_matrix render_transform(const RenderOptions& options) {
+        return fz_scale(options.dpi / 72.0f, options.dpi / 72.0f);
+    }
+    
+    // How draw() produces options.image_format: straight from the draw
+    // device, or via a gray pixmap that the conversion kernels expand or
+    // dither. CMYK renders as RGB since no output format carries it.
+    struct DrawPlan {
+        fz_colorspace* colorspace;
+        int components;     // Bytes per pixel drawn, including alpha
+        bool alpha;
+        bool direct;
+    };
+    
+    static DrawPlan draw_plan(fz_context* ctx, const RenderOptions& options) {
+        const ImageFormat format = options.image_format;
+        const bool has_alpha = detail::format_has_alpha(format);
+        const bool transparent = options.render_transparent && has_alpha;
+        
+        if (format == ImageFormat::Mono1 || options.color_mode == ColorMode::Monochrome) {
+            return { fz_device_gray(ctx), 1, false, false };
+        }
+        if (format == ImageFormat::Gray8) {
+            return { fz_device_gray(ctx), 1, false, true };
+        }
+        if (options.color_mode == ColorMode::Grayscale) {
+            return { fz_device_gray(ctx), transparent ? 2 : 1, transparent, false };
+        }
+        
+        const bool bgr = format == ImageFormat::BGR24 || format == ImageFormat::BGRA32;
+        return { bgr ? fz_device_bgr(ctx) : fz_device_rgb(ctx), has_alpha ? 4 : 3, has_alpha, true };
+    }
+    
+    // Run the lists into memory laid out as plan describes
+    static void replay(
+        fz_context* ctx,
+        const PageLists& list,
+        const RenderOptions& options,
+        const DrawPlan& plan,
+        fz_matrix transform,
+        fz_irect bbox,
+        unsigned char* samples,
+        int stride,
+        fz_cookie* cookie
+    );
+    
+    // Clear to transparent, or fill with the background color
+    static void fill_background(
+        const RenderOptions& options,
+        const DrawPlan& plan,
+        unsigned char* samples,
+        int stride,
+        int width,
+        int height
+    );
+    
+    // Turn drawn rows into options.image_format: unpremultiply direct
+    // alpha output, or expand/dither an indirect gray scratch raster
+    static void finish_pixels(
+        const RenderOptions& options,
+        const DrawPlan& plan,
+        fz_irect bbox,
+        const unsigned char* drawn,
+        int drawn_stride,
+        unsigned char* samples,
+        int stride
+    );
+#endif
+    
+    // Allocate an image of the size and format these options produce
+    static std::unique_ptr<ImageBuffer> new_image(const RenderOptions& options, int width, int height) {
+        auto image = std::make_unique<ImageBuffer>();
+        const int stride = detail::format_row_bytes(options.image_format, width);
+        image->impl_->allocate(static_cast<size_t>(stride) * height);
+        image->impl_->width = width;
+        image->impl_->height = height;
+        image->impl_->stride = stride;
+        image->impl_->format = options.image_format;
+        image->impl_->premultiplied = is_premultiplied(options);
+        return image;
+    }
+    
+    // Whether these options produce premultiplied alpha
+    static bool is_premultiplied(const RenderOptions& options) {
+        return options.render_transparent && options.premultiplied_alpha &&
+               detail::format_has_alpha(options.image_format);
+    }
+};
+
+#ifdef USE_MUPDF
+Result<std::unique_ptr<ImageBuffer>> Renderer::Impl::render(
+    fz_context* ctx,
+    Page* page,
+    const RenderOptions& options
+) {
+    if (!ctx) {
+        return Result<std::unique_ptr<ImageBuffer>>(
+            ErrorCode::RenderError,
+            "Failed to get rendering context"
+        );
+    }
+    
+    PageLists list;
+    
+    fz_try(ctx) {
+        list = display_lists_->acquire(ctx, page, options);
+    }
+    fz_catch(ctx) {
+        return Result<std::unique_ptr<ImageBuffer>>(
+            ErrorCode::RenderError,
+            fz_caught_message(ctx)
+        );
+    }
+    
+    // Keep the layers apart only where there is something over the
+    // contents, and only with a cache to keep them in
+    bool overlay = false;
+    for (int layer : { PageLists::Annotations, PageLists::Widgets }) {
+        overlay = overlay || (list.layers[layer] && !fz_display_list_is_empty(ctx, list.layers[layer]));
+    }
+    
+    auto result = overlay && cache_enabled_ && can_overlay(ctx, options)
+        ? render_layered(ctx, page, list, options)
+        : rasterize(ctx, list, options);
+    drop_page_lists(ctx, list);
+    return result;
+}
+
+Result<std::unique_ptr<ImageBuffer>> Renderer::Impl::render_layered(
+    fz_context* ctx,
+    Page* page,
+    const PageLists& lists,
+    const RenderOptions& options
+) {
+    RenderOptions content_options = options;
+    content_options.render_annotations = false;
+    content_options.render_forms = false;
+    const RenderCacheKey content_key = make_cache_key(page, content_options);
+    
+    std::unique_ptr<ImageBuffer> image;
+    if (auto cached = layer_cache_.find(content_key)) {
+        image = copy_buffer(*cached);
+    } else {
+        PageLists content;
+        content.layers[PageLists::Content] = lists.layers[PageLists::Content];
+        
+        const uint64_t generation = layer_cache_.generation();
+        auto rendered = rasterize(ctx, content, content_options);
+        if (!rendered.is_ok()) {
+            return rendered;
+        }
+        image = std::move(rendered.value());
+        layer_cache_.insert(content_key, copy_buffer(*image), image->size(), generation);
+    }
+    image->impl_->detach();
+    
+    PageLists overlay = lists;
+    overlay.layers[PageLists::Content] = nullptr;
+    
+    fz_try(ctx) {
+        const fz_irect bbox = output_bbox(ctx, lists, options, nullptr);
+        draw_overlay(ctx, overlay, options, render_transform(options), bbox,
+                     image->impl_->storage.get(), image->impl_->stride);
+    }
+    fz_catch(ctx) {
+        return Result<std::unique_ptr<ImageBuffer>>(
+            ErrorCode::RenderError,
+            fz_caught_message(ctx)
+        );
+    }
+    
+    return Result<std::unique_ptr<ImageBuffer>>(std::move(image));
+}
+
+bool Renderer::Impl::can_overlay(fz_context* ctx, const RenderOptions& options) {
+    const DrawPlan plan = draw_plan(ctx, options);
+    return plan.direct && !(plan.alpha && options.render_transparent && !options.premultiplied_alpha);
+}
+
+std::unique_ptr<ImageBuffer> Renderer::Impl::redraw_damage(
+    fz_context* ctx,
+    Page* page,
+    const RenderCacheKey& key,
+    const RenderOptions& options
+) {
+    if (!cache_enabled_ || !ctx) return nullptr;
+    
+    // Error diffusion carries error across the whole raster, so a patch
+    // would not match its surroundings
+    const bool mono = options.image_format == ImageFormat::Mono1 ||
+                      options.color_mode == ColorMode::Monochrome;
+    if (mono && options.dithering == Dithering::ErrorDiffusion) return nullptr;
+    
+    // The newest render of an earlier revision with the same options
+    bool found = false;
+    RenderCacheKey stale = key;
+    cache_.for_each_in(key.page, [&](const RenderCacheKey& candidate, const std::shared_ptr<const ImageBuffer>&) {
+        RenderCacheKey same_revision = candidate;
+        same_revision.revision = key.revision;
+        if (same_revision == key && candidate.revision < key.revision &&
+            (!found || candidate.revision > stale.revision)) {
+            stale = candidate;
+            found = true;
+        }
+        return true;
+    });
+    
+    std::vector<Rect> areas;
+    if (!found || !page->get_damage_since(stale.revision, areas)) return nullptr;
+    
+    std::shared_ptr<const ImageBuffer> cached = cache_.find(stale);
+    if (!cached) return nullptr;
+    
+    const uint64_t generation = cache_.generation();
+    std::unique_ptr<ImageBuffer> image;
+    PageLists list;
+    
+    fz_var(list);
+    
+    fz_try(ctx) {
+        list = display_lists_->acquire(ctx, page, options);
+        const fz_matrix transform = render_transform(options);
+        const fz_irect box = output_bbox(ctx, list, options, nullptr);
+        const int width = box.x1 - box.x0;
+        const int height = box.y1 - box.y0;
+        
+        // Damaged device pixels, grown by a pixel for anti-aliased edges.
+        // Packed 1-bit rows can only be patched in whole bytes.
+        std::vector<fz_irect> rects;
+        int64_t damaged = 0;
+        for (const Rect& area : areas) {
+            fz_irect r = fz_round_rect(fz_transform_rect(fz_make_rect(area.x0, area.y0, area.x1, area.y1), transform));
+            r.x0 -= 1;
+            r.y0 -= 1;
+            r.x1 += 1;
+            r.y1 += 1;
+            r = fz_intersect_irect(r, box);
+            if (fz_is_empty_irect(r)) continue;
+            
+            if (options.image_format == ImageFormat::Mono1) {
+                r.x0 = box.x0 + ((r.x0 - box.x0) & ~7);
+                r.x1 = std::min(box.x1, box.x0 + ((r.x1 - box.x0 + 7) & ~7));
+            }
+            damaged += static_cast<int64_t>(r.x1 - r.x0) * (r.y1 - r.y0);
+            rects.push_back(r);
+        }
+        
+        if (width == cached->width() && height == cached->height() &&
+            damaged <= static_cast<int64_t>(width) * height / 2) {
+            image = copy_buffer(*cached);
+            image->impl_->detach();
+            
+            const int stride = image->impl_->stride;
+            for (const fz_irect& r : rects) {
+                unsigned char* origin = image->impl_->storage.get() +
+                    static_cast<size_t>(r.y0 - box.y0) * stride +
+                    detail::format_row_bytes(options.image_format, r.x0 - box.x0);
+                draw(ctx, list, options, transform, r, origin, stride);
+            }
+        }
+    }
+    fz_always(ctx) {
+        drop_page_lists(ctx, list);
+    }
+    fz_catch(ctx) {
+        return nullptr;
+    }
+    
+    if (image) {
+        store_cached(key, *image, generation);
+        cache_.erase_if_in(stale.page, [&stale](const RenderCacheKey& candidate) {
+            return candidate == stale;
+        });
+    }
+    return image;
+}
+
+fz_irect Renderer::Impl::output_bbox(
+    fz_context* ctx,
+    const PageLists& list,
+    const RenderOptions& options,
+    const fz_irect* region
+) {
+    fz_matrix transform = render_transform(options);
+    fz_irect bbox = fz_round_rect(fz_transform_rect(bound_page_lists(ctx, list), transform));
+    
+    if (region) {
+        bbox = fz_intersect_irect(bbox, *region);
+    } else if (options.use_clip_rect) {
+        fz_rect clip = { options.clip_rect.x0, options.clip_rect.y0,
+                         options.clip_rect.x1, options.clip_rect.y1 };
+        bbox = fz_intersect_irect(bbox, fz_round_rect(fz_transform_rect(clip, transform)));
+    }
+    
+    if (fz_is_empty_irect(bbox)) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "Clip area does not intersect the page");
+    }
+    return bbox;
+}
+
+fz_irect Renderer::Impl::tile_bbox(
+    fz_context* ctx,
+    const PageLists& list,
+    const RenderOptions& options,
+    const TileInfo& tile
+) {
+    fz_matrix transform = render_transform(options);
+    fz_irect page = fz_round_rect(fz_transform_rect(bound_page_lists(ctx, list), transform));
+    
+    fz_irect region;
+    region.x0 = page.x0 + tile.pixel_x;
+    region.y0 = page.y0 + tile.pixel_y;
+    region.x1 = region.x0 + tile.tile_width;
+    region.y1 = region.y0 + tile.tile_height;
+    return region;
+}
+
+Result<std::unique_ptr<ImageBuffer>> Renderer::Impl::rasterize(
+    fz_context* ctx,
+    const PageLists& list,
+    const RenderOptions& options,
+    const fz_irect* region,
+    fz_cookie* cookie
+) {
+    std::unique_ptr<ImageBuffer> buffer;
+    
+    fz_try(ctx) {
+        fz_matrix transform = render_transform(options);
+        fz_irect bbox = output_bbox(ctx, list, options, region);
+        
+        buffer = new_image(options, bbox.x1 - bbox.x0, bbox.y1 - bbox.y0);
+        const int stride = buffer->impl_->stride;
+        
+        draw(ctx, list, options, transform, bbox, buffer->impl_->storage.get(), stride, cookie);
+    }
+    fz_catch(ctx) {
+        return Result<std::unique_ptr<ImageBuffer>>(
+            ErrorCode::RenderError,
+            fz_caught_message(ctx)
+        );
+    }
+    
+    return Result<std::unique_ptr<ImageBuffer>>(std::move(buffer));
+}
+
+void Renderer::Impl::draw(
+    fz_context* ctx,
+    const PageLists& list,
+    const RenderOptions& options,
+    fz_matrix transform,
+    fz_irect bbox,
+    unsigned char* samples,
+    int stride,
+    fz_cookie* cookie
+) {
+    const DrawPlan plan = draw_plan(ctx, options);
+    const int width = bbox.x1 - bbox.x0;
+    const int height = bbox.y1 - bbox.y0;
+    
+    // Indirect plans draw into scratch memory and convert from there
+    std::shared_ptr<uint8_t[]> scratch;
+    unsigned char* target = samples;
+    int target_stride = stride;
+    if (!plan.direct) {
+        target_stride = width * plan.components;
+        scratch = detail::BufferPool::instance().acquire(
+            static_cast<size_t>(target_stride) * height);
+        target = scratch.get();
+    }
+    
+    const auto start = PhaseTimings::Clock::now();
+    fill_background(options, plan, target, target_stride, width, height);
+    replay(ctx, list, options, plan, transform, bbox, target, target_stride, cookie);
+    
+    const auto drawn = PhaseTimings::Clock::now();
+    PhaseTimings::add(timings_.rasterize, start);
+    finish_pixels(options, plan, bbox, target, target_stride, samples, stride);
+    PhaseTimings::add(timings_.copy, drawn);
+}
+
+void Renderer::Impl::draw_overlay(
+    fz_context* ctx,
+    const PageLists& list,
+    const RenderOptions& options,
+    fz_matrix transform,
+    fz_irect bbox,
+    unsigned char* samples,
+    int stride
+) {
+    const auto start = PhaseTimings::Clock::now();
+    replay(ctx, list, options, draw_plan(ctx, options), transform, bbox, samples, stride, nullptr);
+    PhaseTimings::add(timings_.rasterize, start);
+}
+
+void Renderer::Impl::replay(
+    fz_context* ctx,
+    const PageLists& list,
+    const RenderOptions& options,
+    const DrawPlan& plan,
+    fz_matrix transform,
+    fz_irect bbox,
+    unsigned char* samples,
+    int stride,
+    fz_cookie* cookie
+) {
+    const int width = bbox.x1 - bbox.x0;
+    const int height = bbox.y1 - bbox.y0;
+    
+    fz_pixmap* pix = nullptr;
+    fz_device* dev = nullptr;
+    fz_device* draft = nullptr;
+    
+    fz_var(pix);
+    fz_var(dev);
+    fz_var(draft);
+    
+    // Anti-aliasing is a context setting read while drawing; put it back
+    // for whatever renders next on this thread's context
+    const int text_aa = fz_text_aa_level(ctx);
+    const int graphics_aa = fz_graphics_aa_level(ctx);
+    
+    fz_try(ctx) {
+        apply_anti_aliasing(ctx, options.anti_aliasing);
+        
+        // Wrap the destination memory in a pixmap header; MuPDF does not
+        // take ownership of samples it did not allocate.
+        pix = fz_new_pixmap_with_data(
+            ctx,
+            plan.colorspace,
+            width,
+            height,
+            nullptr,
+            plan.alpha ? 1 : 0,
+            stride,
+            samples
+        );
+        
+        // Render with the bbox origin moved to the top-left pixel. The
+        // scissor lets the display list skip everything outside the bbox.
+        fz_matrix ctm = fz_concat(transform, fz_translate(-bbox.x0, -bbox.y0));
+        fz_rect scissor = { 0, 0, static_cast<float>(width), static_cast<float>(height) };
+        dev = fz_new_draw_device(ctx, fz_identity, pix);
+        if (options.draft) {
+            draft = detail::new_draft_device(ctx, dev);
+        }
+        run_page_lists(ctx, list, draft ? draft : dev, ctm, scissor, cookie);
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, draft);
+        fz_drop_device(ctx, dev);
+        fz_drop_pixmap(ctx, pix);
+        fz_set_text_aa_level(ctx, text_aa);
+        fz_set_graphics_aa_level(ctx, graphics_aa);
+    }
+    fz_catch(ctx) {
+        fz_rethrow(ctx);
+    }
+}
+
+void Renderer::Impl::fill_background(
+    const RenderOptions& options,
+    const DrawPlan& plan,
+    unsigned char* samples,
+    int stride,
+    int width,
+    int height
+) {
+    const size_t row_bytes = static_cast<size_t>(width) * plan.components;
+    
+    // Alpha output starts fully transparent (premultiplied zero)
+    if (options.render_transparent && plan.alpha) {
+        for (int y = 0; y < height; ++y) {
+            std::memset(samples + static_cast<size_t>(y) * stride, 0, row_bytes);
+        }
+        return;
+    }
+    
+    const uint32_t color = pack_color(options.background_color);
+    const uint8_t r = static_cast<uint8_t>(color >> 24);
+    const uint8_t g = static_cast<uint8_t>(color >> 16);
+    const uint8_t b = static_cast<uint8_t>(color >> 8);
+    const bool bgr = options.image_format == ImageFormat::BGR24 ||
+                     options.image_format == ImageFormat::BGRA32;
+    
+    uint8_t pixel[4] = { bgr ? b : r, g, bgr ? r : b, 255 };
+    if (plan.components == 1) {
+        detail::scalar_pixel_kernels().gray_from24(pixel, pixel, 1, bgr);
+    }
+    
+    // Fill the first row, then copy it down
+    for (int x = 0; x < width; ++x) {
+        std::memcpy(samples + static_cast<size_t>(x) * plan.components, pixel, plan.components);
+    }
+    for (int y = 1; y < height; ++y) {
+        std::memcpy(samples + static_cast<size_t>(y) * stride, samples, row_bytes);
+    }
+}
+
+void Renderer::Impl::finish_pixels(
+    const RenderOptions& options,
+    const DrawPlan& plan,
+    fz_irect bbox,
+    const unsigned char* drawn,
+    int drawn_stride,
+    unsigned char* samples,
+    int stride
+) {
+    const detail::PixelKernels& k = detail::pixel_kernels();
+    const ImageFormat format = options.image_format;
+    const size_t width = static_cast<size_t>(bbox.x1 - bbox.x0);
+    const int height = bbox.y1 - bbox.y0;
+    
+    // MuPDF draws premultiplied alpha
+    if (plan.direct) {
+        if (plan.alpha && options.render_transparent && !options.premultiplied_alpha) {
+            for (int y = 0; y < height; ++y) {
+                k.unpremultiply(samples + static_cast<size_t>(y) * stride, width);
+            }
+        }
+        return;
+    }
+    
+    const bool mono = format == ImageFormat::Mono1 || options.color_mode == ColorMode::Monochrome;
+    std::vector<uint8_t> bits(mono ? (width + 7) / 8 : 0);
+    std::vector<uint8_t> gray(mono ? width : 0);
+    std::unique_ptr<detail::ErrorDiffusion> diffusion;
+    if (mono && options.dithering == Dithering::ErrorDiffusion) {
+        diffusion = std::make_unique<detail::ErrorDiffusion>(width);
+    }
+    
+    for (int y = 0; y < height; ++y) {
+        const uint8_t* src = drawn + static_cast<size_t>(y) * drawn_stride;
+        uint8_t* dst = samples + static_cast<size_t>(y) * stride;
+        
+        if (mono) {
+            // Ordered dither uses device coordinates so tiles and bands
+            // rendered separately line up
+            uint8_t* out = format == ImageFormat::Mono1 ? dst : bits.data();
+            if (diffusion) {
+                diffusion->dither_row(src, out);
+            } else {
+                k.dither_ordered(src, out, width, bbox.x0, bbox.y0 + y);
+            }
+            if (format == ImageFormat::Mono1) continue;
+            
+            detail::mono_to_gray(bits.data(), gray.data(), width);
+            src = gray.data();
+        }
+        
+        switch (format) {
+            case ImageFormat::Gray8:
+                std::memcpy(dst, src, width);
+                break;
+            case ImageFormat::RGB24:
+            case ImageFormat::BGR24:
+                k.gray_to24(src, dst, width);
+                break;
+            case ImageFormat::RGBA32:
+            case ImageFormat::BGRA32:
+                if (plan.components == 2) {
+                    detail::gray_alpha_to32(src, dst, width);
+                    if (!options.premultiplied_alpha) {
+                        k.unpremultiply(dst, width);
+                    }
+                } else {
+                    k.gray_to32(src, dst, width);
+                }
+                break;
+            case ImageFormat::Mono1:
+                break;
+        }
+    }
+}
+
+std::unique_ptr<ImageBuffer> Renderer::Impl::embedded_thumbnail(
+    fz_context* ctx,
+    Page* page,
+    int width,
+    int height
+) {
+    std::recursive_mutex& document = page->interpret_mutex();
+    document.lock();
+    fz_page* fz_pg = static_cast<fz_page*>(page->get_handle());
+    if (!fz_pg) {
+        document.unlock();
+        return nullptr;
+    }
+    
+    fz_image* image = nullptr;
+    fz_pixmap* pix = nullptr;
+    
+    fz_var(image);
+    fz_var(pix);
+    
+    fz_try(ctx) {
+        pdf_page* pdf_pg = pdf_page_from_fz_page(ctx, fz_pg);
+        pdf_obj* thumb = pdf_pg ? pdf_dict_get(ctx, pdf_pg->obj, PDF_NAME(Thumb)) : nullptr;
+        
+        // Upscaling a small thumbnail looks worse than rendering
+        if (thumb && pdf_is_stream(ctx, thumb)) {
+            image = pdf_load_image(ctx, pdf_pg->doc, thumb);
+            if (image->w >= width && image->h >= height) {
+                pix = fz_get_pixmap_from_image(ctx, image, nullptr, nullptr, nullptr, nullptr);
+                
+                if (fz_pixmap_colorspace(ctx, pix) != fz_device_rgb(ctx) || fz_pixmap_alpha(ctx, pix)) {
+                    fz_pixmap* rgb = fz_convert_pixmap(ctx, pix, fz_device_rgb(ctx), nullptr, nullptr, fz_default_color_params, 0);
+                    fz_drop_pixmap(ctx, pix);
+                    pix = rgb;
+                }
+                
+                if (fz_pixmap_width(ctx, pix) != width || fz_pixmap_height(ctx, pix) != height) {
+                    fz_pixmap* scaled = fz_scale_pixmap(ctx, pix, 0, 0, width, height, nullptr);
+                    fz_drop_pixmap(ctx, pix);
+                    pix = scaled;
+                }
+            }
+        }
+    }
+    fz_always(ctx) {
+        fz_drop_image(ctx, image);
+        fz_drop_page(ctx, fz_pg);
+        document.unlock();
+    }
+    fz_catch(ctx) {
+        // A broken thumbnail just means rendering the page instead
+        fz_drop_pixmap(ctx, pix);
+        pix = nullptr;
+    }
+    
+    if (!pix) return nullptr;
+    
+    auto buffer = std::make_unique<ImageBuffer>();
+    const int w = fz_pixmap_width(ctx, pix);
+    const int h = fz_pixmap_height(ctx, pix);
+    const int row_bytes = w * 3;
+    
+    buffer->impl_->allocate(static_cast<size_t>(row_bytes) * h);
+    buffer->impl_->width = w;
+    buffer->impl_->height = h;
+    buffer->impl_->stride = row_bytes;
+    buffer->impl_->format = ImageFormat::RGB24;
+    
+    const unsigned char* samples = fz_pixmap_samples(ctx, pix);
+    const int stride = fz_pixmap_stride(ctx, pix);
+    for (int y = 0; y < h; ++y) {
+        std::memcpy(buffer->impl_->storage.get() + static_cast<size_t>(y) * row_bytes,
+                    samples + static_cast<size_t>(y) * stride,
+                    row_bytes);
+    }
+    
+    fz_drop_pixmap(ctx, pix);
+    return buffer;
+}
+
+PageLists Renderer::Impl::thumbnail_list(fz_context* ctx, Page* page) {
+    std::recursive_mutex& document = page->interpret_mutex();
+    document.lock();
+    fz_page* fz_pg = static_cast<fz_page*>(page->get_handle());
+    if (!fz_pg) {
+        document.unlock();
+        fz_throw(ctx, FZ_ERROR_GENERIC, "Invalid page handle");
+    }
+    
+    const auto start = PhaseTimings::Clock::now();
+    fz_display_list* list = nullptr;
+    fz_device* dev = nullptr;
+    
+    fz_var(list);
+    fz_var(dev);
+    
+    fz_try(ctx) {
+        list = fz_new_display_list(ctx, fz_bound_page(ctx, fz_pg));
+        dev = fz_new_list_device(ctx, list);
+        fz_run_page_contents(ctx, fz_pg, dev, fz_identity, nullptr);
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+        fz_drop_page(ctx, fz_pg);
+        document.unlock();
+    }
+    fz_catch(ctx) {
+        fz_drop_display_list(ctx, list);
+        fz_rethrow(ctx);
+    }
+    
+    PhaseTimings::add(timings_.interpret, start);
+    PageLists lists;
+    lists.layers[PageLists::Content] = list;
+    return lists;
+}
+
+uint64_t Renderer::Impl::document_fingerprint(fz_context* ctx, Document* doc) {
+    fz_document* fz_doc = static_cast<fz_document*>(doc->get_handle());
+    pdf_document* pdf = fz_doc ? pdf_specifics(ctx, fz_doc) : nullptr;
+    if (!pdf || !pdf->file) return 0;
+    
+    // The file stream is shared: a seek here must not land in the middle
+    // of another thread's interpretation
+    std::lock_guard<std::recursive_mutex> context(doc->interpret_mutex());
+    return detail::ThumbnailDiskCache::fingerprint(
+        static_cast<uint64_t>(pdf->file_size),
+        [ctx, pdf](uint64_t offset, uint8_t* buffer, size_t size) {
+            size_t n = 0;
+            fz_var(n);
+            fz_try(ctx) {
+                fz_seek(ctx, pdf->file, static_cast<int64_t>(offset), SEEK_SET);
+                n = fz_read(ctx, pdf->file, buffer, size);
+            }
+            fz_catch(ctx) {
+                n = 0;
+            }
+            return n;
+        }
+    );
+}
+
+void Renderer::Impl::run_progressive(Progressive& job) {
+    // The preview is drawn at this fraction of the requested DPI
+    const float preview_scale = 0.25f;
+    // The full-resolution pass is split into about this many bands
+    const int band_count = 8;
+    
+    fz_context* ctx = detail::ContextManager::clone();
+    if (!ctx) {
+        job.finish("Failed to create rendering context");
+        return;
+    }
+    
+    const RenderOptions& options = job.options;
+    PageLists list;
+    fz_irect bbox = fz_empty_irect;
+    std::string error;
+    
+    fz_var(list);
+    
+    fz_try(ctx) {
+        list = display_lists_->acquire(ctx, job.page, options, &job.cookie);
+        bbox = output_bbox(ctx, list, options, nullptr);
+    }
+    fz_catch(ctx) {
+        error = fz_caught_message(ctx);
+    }
+    
+    if (error.empty() && job.cookie.abort) {
+        error = "Render cancelled";
+    }
+    
+    unsigned char* samples = nullptr;
+    int stride = 0;
+    
+    if (error.empty()) {
+        const int width = bbox.x1 - bbox.x0;
+        const int height = bbox.y1 - bbox.y0;
+        auto image = new_image(options, width, height);
+        stride = image->impl_->stride;
+        samples = image->impl_->storage.get();
+        
+        {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            job.image = std::move(image);
+        }
+        job.update(10);
+        
+        // Something to show while the real thing is drawn
+        RenderOptions preview_options = options;
+        preview_options.dpi = std::max(options.dpi * preview_scale, 1.0f);
+        auto preview = rasterize(ctx, list, preview_options, nullptr, &job.cookie);
+        if (preview.is_ok()) {
+            {
+                std::lock_guard<std::mutex> lock(job.mutex);
+                job.preview = std::move(preview.value());
+            }
+            job.update(20);
+        }
+    }
+    
+    if (error.empty()) {
+        const fz_matrix transform = render_transform(options);
+        const int height = bbox.y1 - bbox.y0;
+        const int band_height = std::max(16, (height + band_count - 1) / band_count);
+        
+        for (int y = 0; y < height; y += band_height) {
+            if (job.cookie.abort) {
+                error = "Render cancelled";
+                break;
+            }
+            
+            fz_irect band = bbox;
+            band.y0 = bbox.y0 + y;
+            band.y1 = std::min(band.y0 + band_height, bbox.y1);
+            
+            fz_try(ctx) {
+                draw(ctx, list, options, transform, band, samples + static_cast<size_t>(y) * stride, stride, &job.cookie);
+            }
+            fz_catch(ctx) {
+                error = fz_caught_message(ctx);
+            }
+            if (!error.empty()) break;
+            
+            {
+                std::lock_guard<std::mutex> lock(job.mutex);
+                job.rows_done = band.y1 - bbox.y0;
+            }
+            job.update(20 + 80 * (band.y1 - bbox.y0) / height);
+        }
+    }
+    
+    if (error.empty() && job.cookie.abort) {
+        error = "Render cancelled";
+    }
+    
+    // A complete render is as good as one from render_page
+    if (error.empty() && cache_enabled_) {
+        std::lock_guard<std::mutex> lock(job.mutex);
+        store_cached(make_cache_key(job.page, options), *job.image, job.generation);
+    }
+    
+    drop_page_lists(ctx, list);
+    fz_drop_context(ctx);
+    job.finish(error);
+}
+#endif
+
+Renderer::Renderer() : impl_(std::make_unique<Impl>()) {}
+Renderer::~Renderer() = default;
+
+Result<std::unique_ptr<ImageBuffer>> Renderer::render_page(
+    Page* page,
+    const RenderOptions& options
+) {
+    if (!page) {
+        return Result<std::unique_ptr<ImageBuffer>>(
+            ErrorCode::InvalidArgument,
+            "Invalid page"
+        );
+    }
+    
+#ifdef USE_MUPDF
+    RenderCacheKey key = make_cache_key(page, options);
+    if (auto cached = impl_->find_cached(key)) {
+        return Result<std::unique_ptr<ImageBuffer>>(std::move(cached));
+    }
+    if (auto redrawn = impl_->redraw_damage(impl_->get_context(), page, key, options)) {
+        return Result<std::unique_ptr<ImageBuffer>>(std::move(redrawn));
+    }
+    
+    uint64_t generation = impl_->cache_.generation();
+    auto result = impl_->render(impl_->get_context(), page, options);
+    if (result.is_ok()) {
+        impl_->store_cached(key, *result.value(), generation);
+    }
+    return result;
+#else
+    return Result<std::unique_ptr<ImageBuffer>>(
+        ErrorCode::NotImplemented,
+        "Rendering not implemented for this backend"
+    );
+#endif
+}
+
+bool Renderer::render_page_to_buffer(
+    Page* page,
+    uint8_t* buffer,
+    size_t buffer_size,
+    const RenderOptions& options
+) {
+    return render_page_to_buffer(page, buffer, buffer_size, 0, options);
+}
+
+bool Renderer::render_page_to_buffer(
+    Page* page,
+    uint8_t* buffer,
+    size_t buffer_size,
+    int stride,
+    const RenderOptions& options
+) {
+    if (!page || !buffer) {
+        return false;
+    }
+    
+#ifdef USE_MUPDF
+    auto fits = [&](int width, int height) {
+        const int row_bytes = detail::format_row_bytes(options.image_format, width);
+        if (stride == 0) {
+            stride = row_bytes;
+        }
+        return stride >= row_bytes && static_cast<size_t>(stride) * height <= buffer_size;
+    };
+    
+    // A cached render only needs copying into place
+    if (auto cached = impl_->find_cached(make_cache_key(page, options))) {
+        if (!fits(cached->width(), cached->height())) {
+            return false;
+        }
+        const auto start = PhaseTimings::Clock::now();
+        // Read through a const reference: the non-const data() would
+        // detach the shared pixels first
+        const ImageBuffer& image = *cached;
+        const size_t row_bytes = static_cast<size_t>(detail::format_row_bytes(image.format(), image.width()));
+        for (int y = 0; y < image.height(); ++y) {
+            std::memcpy(buffer + static_cast<size_t>(y) * stride,
+                        image.data() + static_cast<size_t>(y) * image.stride(),
+                        row_bytes);
+        }
+        PhaseTimings::add(impl_->timings_.copy, start);
+        return true;
+    }
+    
+    fz_context* ctx = impl_->get_context();
+    if (!ctx) {
+        return false;
+    }
+    
+    PageLists list;
+    bool ok = true;
+    
+    fz_var(list);
+    
+    fz_try(ctx) {
+        list = impl_->display_lists_->acquire(ctx, page, options);
+        
+        fz_irect bbox = Impl::output_bbox(ctx, list, options, nullptr);
+        if (!fits(bbox.x1 - bbox.x0, bbox.y1 - bbox.y0)) {
+            fz_throw(ctx, FZ_ERROR_GENERIC, "Buffer too small");
+        }
+        
+        impl_->draw(ctx, list, options, Impl::render_transform(options), bbox, buffer, stride);
+    }
+    fz_always(ctx) {
+        drop_page_lists(ctx, list);
+    }
+    fz_catch(ctx) {
+        ok = false;
+    }
+    
+    return ok;
+#else
+    return false;
+#endif
+}
+
+bool Renderer::render_page_banded(
+    Page* page,
+    RenderSink& sink,
+    const RenderOptions& options,
+    int band_height,
+    ProgressCallback callback
+) {
+    if (!page || band_height <= 0) {
+        return false;
+    }
+    
+#ifdef USE_MUPDF
+    fz_context* ctx = impl_->get_context();
+    if (!ctx) {
+        return false;
+    }
+    
+    PageLists list;
+    fz_irect bbox = fz_empty_irect;
+    bool ok = true;
+    
+    fz_var(list);
+    
+    fz_try(ctx) {
+        list = impl_->display_lists_->acquire(ctx, page, options);
+        bbox = Impl::output_bbox(ctx, list, options, nullptr);
+    }
+    fz_catch(ctx) {
+        ok = false;
+    }
+    
+    if (ok) {
+        const fz_matrix transform = Impl::render_transform(options);
+        const int width = bbox.x1 - bbox.x0;
+        const int height = bbox.y1 - bbox.y0;
+        const int stride = detail::format_row_bytes(options.image_format, width);
+        
+        // One band of memory, reused from top to bottom
+        auto band = detail::BufferPool::instance().acquire(
+            static_cast<size_t>(stride) * std::min(band_height, height));
+        
+        ok = sink.begin(width, height, options.image_format, Impl::is_premultiplied(options), options.dpi);
+        const bool begun = ok;
+        
+        for (int y = 0; ok && y < height; y += band_height) {
+            fz_irect rows = bbox;
+            rows.y0 = bbox.y0 + y;
+            rows.y1 = std::min(rows.y0 + band_height, bbox.y1);
+            
+            fz_try(ctx) {
+                impl_->draw(ctx, list, options, transform, rows, band.get(), stride);
+            }
+            fz_catch(ctx) {
+                ok = false;
+            }
+            
+            const auto start = PhaseTimings::Clock::now();
+            ok = ok && sink.write_rows(band.get(), stride, y, rows.y1 - rows.y0);
+            PhaseTimings::add(impl_->timings_.encode, start);
+            ok = ok && (!callback || callback(rows.y1 - bbox.y0, height, "Rendering bands"));
+        }
+        
+        if (ok) {
+            const auto start = PhaseTimings::Clock::now();
+            ok = sink.finish();
+            PhaseTimings::add(impl_->timings_.encode, start);
+        } else if (begun) {
+            sink.abort();
+        }
+    }
+    
+    drop_page_lists(ctx, list);
+    return ok;
+#else
+    return false;
+#endif
+}
+
+CallbackSink::CallbackSink(RowsCallback callback) : callback_(std::move(callback)) {}
+
+bool CallbackSink::begin(int, int, ImageFormat, bool, float) {
+    return static_cast<bool>(callback_);
+}
+
+bool CallbackSink::write_rows(const uint8_t* data, int stride, int y, int rows) {
+    return callback_(data, stride, y, rows);
+}
+
+bool CallbackSink::finish() {
     return true;
 }
 
@@ -267,11 +2390,20 @@ Result<std::unique_ptr<ImageBuffer>> Renderer::render_page_scaled(
     float scale_y,
     const RenderOptions& options
 ) {
-    // Calculate DPI based on scale
-    RenderOptions scaled_options = options;
-    scaled_options.dpi *= (scale_x + scale_y) / 2.0f; // Average scale
+    if (!page || scale_x <= 0.0f || scale_y <= 0.0f) {
+        return Result<std::unique_ptr<ImageBuffer>>(
+            ErrorCode::InvalidArgument,
+            "Invalid page or scale"
+        );
+    }
+    
+    const float dpi_x = options.dpi * scale_x;
+    const float dpi_y = options.dpi * scale_y;
     
-    return render_page(page, scaled_options);
+    int width = 0;
+    int height = 0;
+    Impl::scaled_size(page, options, dpi_x, dpi_y, width, height);
+    return impl_->render_resized(*this, page, options, dpi_x, dpi_y, width, height);
 }
 
 Result<std::unique_ptr<ImageBuffer>> Renderer::render_page_to_size(
@@ -287,18 +2419,24 @@ Result<std::unique_ptr<ImageBuffer>> Renderer::render_page_to_size(
         );
     }
     
-    // Calculate required DPI
-    float page_width = page->width();
-    float page_height = page->height();
-    
-    float scale_x = width / page_width;
-    float scale_y = height / page_height;
-    float scale = std::min(scale_x, scale_y);
-    
-    RenderOptions sized_options = options;
-    sized_options.dpi = 72.0f * scale;
+    // Resolution per axis that maps the page, or the clipped area, onto
+    // the requested size
+    float area_width = page->width();
+    float area_height = page->height();
+    if (options.use_clip_rect) {
+        area_width = options.clip_rect.x1 - options.clip_rect.x0;
+        area_height = options.clip_rect.y1 - options.clip_rect.y0;
+    }
+    if (area_width <= 0.0f || area_height <= 0.0f) {
+        return Result<std::unique_ptr<ImageBuffer>>(
+            ErrorCode::InvalidArgument,
+            "Empty page area"
+        );
+    }
     
-    return render_page(page, sized_options);
+    const float dpi_x = 72.0f * width / area_width;
+    const float dpi_y = 72.0f * height / area_height;
+    return impl_->render_resized(*this, page, options, dpi_x, dpi_y, width, height);
 }
 
 std::vector<Result<std::unique_ptr<ImageBuffer>>> Renderer::render_pages(
@@ -309,11 +2447,76 @@ std::vector<Result<std::unique_ptr<ImageBuffer>>> Renderer::render_pages(
 ) {
     std::vector<Result<std::unique_ptr<ImageBuffer>>> results;
     
-    for (size_t i = 0; i < page_indices.size(); ++i) {
+    if (!doc) return results;
+    
+    const size_t total = page_indices.size();
+    
+#ifdef USE_MUPDF
+    if (impl_->get_context()) {
+        auto proceed = [&](size_t i) {
+            return !callback || callback(
+                static_cast<int>(i),
+                static_cast<int>(total),
+                "Rendering page " + std::to_string(page_indices[i])
+            );
+        };
+        
+        auto prepare = [&](fz_context* ctx, Impl::BatchItem& item) {
+            Page* page = doc->get_page(page_indices[item.index]);
+            if (!page) {
+                item.result = Result<std::unique_ptr<ImageBuffer>>(
+                    ErrorCode::InvalidArgument,
+                    "Invalid page index"
+                );
+                return false;
+            }
+            
+            item.options = options;
+            item.key = make_cache_key(page, options);
+            if (auto cached = impl_->find_cached(item.key)) {
+                item.result = Result<std::unique_ptr<ImageBuffer>>(std::move(cached));
+                return false;
+            }
+            
+            item.generation = impl_->cache_.generation();
+            std::string error;
+            fz_try(ctx) {
+                item.list = impl_->display_lists_->acquire(ctx, page, item.options);
+            }
+            fz_catch(ctx) {
+                error = fz_caught_message(ctx);
+            }
+            
+            if (!item.list) {
+                item.result = Result<std::unique_ptr<ImageBuffer>>(ErrorCode::RenderError, error);
+                return false;
+            }
+            return true;
+        };
+        
+        auto finish = [&](fz_context* ctx, Impl::BatchItem& item) {
+            auto result = impl_->rasterize(ctx, item.list, item.options);
+            if (result.is_ok()) {
+                impl_->store_cached(item.key, *result.value(), item.generation);
+            }
+            return result;
+        };
+        
+        // Repeated indices and pages drawing identically render once
+        auto identify = [&](size_t i) -> uint64_t {
+            Page* page = doc->get_page(page_indices[i]);
+            return page ? page->content_fingerprint() : 0;
+        };
+        
+        return impl_->run_batch(total, proceed, identify, prepare, finish);
+    }
+#endif
+    
+    for (size_t i = 0; i < total; ++i) {
         if (callback) {
             bool should_continue = callback(
                 static_cast<int>(i),
-                static_cast<int>(page_indices.size()),
+                static_cast<int>(total),
                 "Rendering page " + std::to_string(page_indices[i])
             );
             
@@ -364,19 +2567,53 @@ Result<std::unique_ptr<ImageBuffer>> Renderer::render_thumbnail(
         );
     }
     
-    float page_width = page->width();
-    float page_height = page->height();
+    RenderOptions options = Impl::thumbnail_options(page, max_width, max_height, maintain_aspect);
     
-    float scale_x = max_width / page_width;
-    float scale_y = max_height / page_height;
+#ifdef USE_MUPDF
+    RenderCacheKey key = make_cache_key(page, options);
+    if (auto cached = impl_->find_cached(key)) {
+        return Result<std::unique_ptr<ImageBuffer>>(std::move(cached));
+    }
+    
+    fz_context* ctx = impl_->get_context();
+    if (!ctx) {
+        return Result<std::unique_ptr<ImageBuffer>>(
+            ErrorCode::RenderError,
+            "Failed to get rendering context"
+        );
+    }
+    
+    int width = 0;
+    int height = 0;
+    calculate_dimensions(page, options.dpi, width, height);
+    if (auto embedded = Impl::embedded_thumbnail(ctx, page, width, height)) {
+        return Result<std::unique_ptr<ImageBuffer>>(std::move(embedded));
+    }
     
-    float scale = maintain_aspect ? std::min(scale_x, scale_y) : scale_x;
+    uint64_t generation = impl_->cache_.generation();
+    PageLists list;
+    std::string error;
+    
+    fz_try(ctx) {
+        list = impl_->thumbnail_list(ctx, page);
+    }
+    fz_catch(ctx) {
+        error = fz_caught_message(ctx);
+    }
     
-    RenderOptions options;
-    options.dpi = 72.0f * scale;
-    options.anti_aliasing = AntiAliasing::All;
+    if (!list) {
+        return Result<std::unique_ptr<ImageBuffer>>(ErrorCode::RenderError, error);
+    }
     
+    auto result = impl_->rasterize(ctx, list, options);
+    drop_page_lists(ctx, list);
+    if (result.is_ok()) {
+        impl_->store_cached(key, *result.value(), generation);
+    }
+    return result;
+#else
     return render_page(page, options);
+#endif
 }
 
 std::vector<Result<std::unique_ptr<ImageBuffer>>> Renderer::render_all_thumbnails(
@@ -389,11 +2626,122 @@ std::vector<Result<std::unique_ptr<ImageBuffer>>> Renderer::render_all_thumbnail
     
     if (!doc) return results;
     
-    for (int i = 0; i < doc->page_count(); ++i) {
+    const int count = doc->page_count();
+    
+#ifdef USE_MUPDF
+    if (impl_->get_context()) {
+        detail::ThumbnailDiskCache disk;
+        {
+            std::lock_guard<std::mutex> lock(impl_->thumbnail_mutex_);
+            disk = impl_->thumbnail_disk_cache_;
+        }
+        
+        uint64_t fingerprint = 0;
+        if (disk.enabled()) {
+            fingerprint = Impl::document_fingerprint(impl_->get_context(), doc);
+        }
+        
+        // The fingerprint covers the file as saved; the page's revision and
+        // content fingerprint tell apart edits made since, and pages that
+        // moved to another index
+        auto disk_key = [&](const Impl::BatchItem& item) {
+            return detail::ThumbnailDiskCache::Key{
+                fingerprint,
+                static_cast<int>(item.index),
+                item.key.revision,
+                item.content,
+                max_width,
+                max_height
+            };
+        };
+        
+        auto proceed = [&](size_t i) {
+            return !callback || callback(
+                static_cast<int>(i),
+                count,
+                "Generating thumbnail " + std::to_string(i + 1)
+            );
+        };
+        
+        // Cheapest source first: memory, disk, the embedded /Thumb, and
+        // only then interpreting the page
+        auto prepare = [&](fz_context* ctx, Impl::BatchItem& item) {
+            Page* page = doc->get_page(static_cast<int>(item.index));
+            if (!page) {
+                item.result = Result<std::unique_ptr<ImageBuffer>>(
+                    ErrorCode::InvalidArgument,
+                    "Invalid page index"
+                );
+                return false;
+            }
+            
+            item.options = Impl::thumbnail_options(page, max_width, max_height, true);
+            item.key = make_cache_key(page, item.options);
+            if (auto cached = impl_->find_cached(item.key)) {
+                item.result = Result<std::unique_ptr<ImageBuffer>>(std::move(cached));
+                return false;
+            }
+            
+            if (fingerprint) {
+                item.content = page->content_fingerprint();
+            }
+            if (item.content) {
+                if (auto stored = Impl::load_thumbnail(disk, disk_key(item))) {
+                    item.result = Result<std::unique_ptr<ImageBuffer>>(std::move(stored));
+                    return false;
+                }
+            }
+            
+            int width = 0;
+            int height = 0;
+            calculate_dimensions(page, item.options.dpi, width, height);
+            if (auto embedded = Impl::embedded_thumbnail(ctx, page, width, height)) {
+                item.result = Result<std::unique_ptr<ImageBuffer>>(std::move(embedded));
+                return false;
+            }
+            
+            item.generation = impl_->cache_.generation();
+            std::string error;
+            fz_try(ctx) {
+                item.list = impl_->thumbnail_list(ctx, page);
+            }
+            fz_catch(ctx) {
+                error = fz_caught_message(ctx);
+            }
+            
+            if (!item.list) {
+                item.result = Result<std::unique_ptr<ImageBuffer>>(ErrorCode::RenderError, error);
+                return false;
+            }
+            return true;
+        };
+        
+        auto finish = [&](fz_context* ctx, Impl::BatchItem& item) {
+            auto result = impl_->rasterize(ctx, item.list, item.options);
+            if (result.is_ok()) {
+                impl_->store_cached(item.key, *result.value(), item.generation);
+                if (item.content) {
+                    Impl::store_thumbnail(disk, disk_key(item), *result.value());
+                }
+            }
+            return result;
+        };
+        
+        // Blank and repeated pages (separators, backgrounds) render once
+        auto identify = [&](size_t i) -> uint64_t {
+            Page* page = doc->get_page(static_cast<int>(i));
+            return page ? page->content_fingerprint() : 0;
+        };
+        
+        return impl_->run_batch(static_cast<size_t>(count), proceed, identify, prepare, finish);
+    }
+#endif
+    
+    for (int i = 0; i < count; ++i) {
         if (callback) {
             bool should_continue = callback(
                 i,
-                doc->page_count(),
+                count,
                 "Generating thumbnail " + std::to_string(i + 1)
             );
             
@@ -402,89 +2750,774 @@ std::vector<Result<std::unique_ptr<ImageBuffer>>> Renderer::render_all_thumbnail
             }
         }
         
-        Page* page = doc->get_page(i);
-        if (page) {
-            results.push_back(render_thumbnail(page, max_width, max_height));
+        Page* page = doc->get_page(i);
+        if (page) {
+            results.push_back(render_thumbnail(page, max_width, max_height));
+        }
+    }
+    
+    return results;
+}
+
+void Renderer::set_thumbnail_cache_dir(const std::string& directory) {
+    std::lock_guard<std::mutex> lock(impl_->thumbnail_mutex_);
+    impl_->thumbnail_disk_cache_.set_directory(directory);
+}
+
+std::string Renderer::get_thumbnail_cache_dir() const {
+    std::lock_guard<std::mutex> lock(impl_->thumbnail_mutex_);
+    return impl_->thumbnail_disk_cache_.directory();
+}
+
+std::vector<Renderer::TileInfo> Renderer::calculate_tiles(
+    Page* page,
+    int tile_width,
+    int tile_height,
+    const RenderOptions& options
+) {
+    std::vector<TileInfo> tiles;
+    
+    if (!page || tile_width <= 0 || tile_height <= 0) return tiles;
+    
+    // The grid is laid over the full-page raster at this DPI, so tiles
+    // line up exactly with what render_page would produce
+    int page_width = 0;
+    int page_height = 0;
+    calculate_dimensions(page, options.dpi, page_width, page_height);
+    
+    const float scale = options.dpi / 72.0f;
+    const int cols = (page_width + tile_width - 1) / tile_width;
+    const int rows = (page_height + tile_height - 1) / tile_height;
+    
+    tiles.reserve(static_cast<size_t>(cols) * rows);
+    
+    for (int row = 0; row < rows; ++row) {
+        for (int col = 0; col < cols; ++col) {
+            TileInfo tile;
+            tile.tile_x = col;
+            tile.tile_y = row;
+            tile.pixel_x = col * tile_width;
+            tile.pixel_y = row * tile_height;
+            tile.tile_width = std::min(tile_width, page_width - tile.pixel_x);
+            tile.tile_height = std::min(tile_height, page_height - tile.pixel_y);
+            
+            tile.page_rect.x0 = tile.pixel_x / scale;
+            tile.page_rect.y0 = tile.pixel_y / scale;
+            tile.page_rect.x1 = (tile.pixel_x + tile.tile_width) / scale;
+            tile.page_rect.y1 = (tile.pixel_y + tile.tile_height) / scale;
+            
+            tiles.push_back(tile);
+        }
+    }
+    
+    return tiles;
+}
+
+Result<std::unique_ptr<ImageBuffer>> Renderer::render_tile(
+    Page* page,
+    const TileInfo& tile,
+    const RenderOptions& options
+) {
+    auto results = render_tiles(page, std::vector<TileInfo>{tile}, options);
+    return std::move(results.front());
+}
+
+std::vector<Result<std::unique_ptr<ImageBuffer>>> Renderer::render_tiles(
+    Page* page,
+    const std::vector<TileInfo>& tiles,
+    const RenderOptions& options
+) {
+    std::vector<Result<std::unique_ptr<ImageBuffer>>> results;
+    results.reserve(tiles.size());
+    
+    if (!page) {
+        for (size_t i = 0; i < tiles.size(); ++i) {
+            results.push_back(Result<std::unique_ptr<ImageBuffer>>(
+                ErrorCode::InvalidArgument,
+                "Invalid page"
+            ));
+        }
+        return results;
+    }
+    
+#ifdef USE_MUPDF
+    // Serve what we can from the tile cache
+    std::vector<size_t> missing;
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        std::shared_ptr<const ImageBuffer> cached;
+        if (impl_->cache_enabled_) {
+            cached = impl_->tile_cache_.find(make_tile_key(page, tiles[i], options));
+        }
+        
+        if (cached) {
+            results.push_back(Result<std::unique_ptr<ImageBuffer>>(Impl::copy_buffer(*cached)));
+        } else {
+            results.push_back(Result<std::unique_ptr<ImageBuffer>>(
+                ErrorCode::RenderError,
+                "Tile was not rendered"
+            ));
+            missing.push_back(i);
+        }
+    }
+    
+    if (missing.empty()) {
+        return results;
+    }
+    
+    fz_context* ctx = impl_->get_context();
+    if (!ctx) {
+        for (size_t i : missing) {
+            results[i] = Result<std::unique_ptr<ImageBuffer>>(
+                ErrorCode::RenderError,
+                "Failed to get rendering context"
+            );
+        }
+        return results;
+    }
+    
+    uint64_t generation = impl_->tile_cache_.generation();
+    PageLists list;
+    std::string error;
+    
+    fz_try(ctx) {
+        list = impl_->display_lists_->acquire(ctx, page, options);
+    }
+    fz_catch(ctx) {
+        error = fz_caught_message(ctx);
+    }
+    
+    if (!list) {
+        for (size_t i : missing) {
+            results[i] = Result<std::unique_ptr<ImageBuffer>>(ErrorCode::RenderError, error);
+        }
+        return results;
+    }
+    
+    // Each tile only rasterizes its own bbox of the shared display list
+    impl_->parallel_for(ctx, missing.size(), [&](fz_context* tile_ctx, size_t n) {
+        const size_t i = missing[n];
+        
+        fz_irect region;
+        bool have_region = true;
+        fz_try(tile_ctx) {
+            region = Impl::tile_bbox(tile_ctx, list, options, tiles[i]);
+        }
+        fz_catch(tile_ctx) {
+            have_region = false;
+        }
+        
+        if (!have_region) {
+            results[i] = Result<std::unique_ptr<ImageBuffer>>(
+                ErrorCode::RenderError,
+                fz_caught_message(tile_ctx)
+            );
+            return;
+        }
+        
+        results[i] = impl_->rasterize(tile_ctx, list, options, &region);
+        
+        if (results[i].is_ok() && impl_->cache_enabled_) {
+            const ImageBuffer& buffer = *results[i].value();
+            impl_->tile_cache_.insert(
+                make_tile_key(page, tiles[i], options),
+                Impl::copy_buffer(buffer),
+                buffer.size(),
+                generation
+            );
+        }
+    });
+    
+    drop_page_lists(ctx, list);
+#else
+    for (auto& result : results) {
+        result = Result<std::unique_ptr<ImageBuffer>>(
+            ErrorCode::NotImplemented,
+            "Rendering not implemented for this backend"
+        );
+    }
+#endif
+    
+    return results;
+}
+
+namespace {
+    // One zoom level of a tile pyramid: the page raster at dpi, or the
+    // finest level's size halved shift times, rounded up
+    struct PyramidLevel {
+        int width;
+        int height;
+        int columns;
+        int rows;
+        float dpi;
+    };
+    
+    std::string pyramid_tile_path(
+        const std::filesystem::path& directory,
+        const TilePyramidOptions& pyramid,
+        int page_index,
+        int level,
+        int column,
+        int row
+    ) {
+        const std::string page = "page_" + std::to_string(page_index + 1);
+        const char* extension = pyramid.format == TilePyramidOptions::Format::JPEG ? ".jpg" : ".png";
+        
+        if (pyramid.layout == TilePyramidOptions::Layout::XYZ) {
+            return (directory / page / std::to_string(level) / std::to_string(column) /
+                    (std::to_string(row) + extension)).string();
+        }
+        return (directory / (page + "_files") / std::to_string(level) /
+                (std::to_string(column) + "_" + std::to_string(row) + extension)).string();
+    }
+    
+    bool write_dzi_descriptor(
+        const std::filesystem::path& directory,
+        const TilePyramidOptions& pyramid,
+        int page_index,
+        int width,
+        int height
+    ) {
+        const std::string name = "page_" + std::to_string(page_index + 1) + ".dzi";
+        std::ofstream file(directory / name, std::ios::binary | std::ios::trunc);
+        file << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+             << "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" TileSize=\"" << pyramid.tile_size
+             << "\" Overlap=\"0\" Format=\""
+             << (pyramid.format == TilePyramidOptions::Format::JPEG ? "jpg" : "png") << "\">\n"
+             << "  <Size Width=\"" << width << "\" Height=\"" << height << "\"/>\n"
+             << "</Image>\n";
+        return static_cast<bool>(file);
+    }
+}
+
+Result<TilePyramidStats> Renderer::export_tile_pyramid(
+    Document* doc,
+    const std::vector<int>& page_indices,
+    const std::string& directory,
+    const TilePyramidOptions& pyramid,
+    const RenderOptions& options,
+    ProgressCallback callback
+) {
+    namespace fs = std::filesystem;
+    using StatsResult = Result<TilePyramidStats>;
+    
+    if (!doc || pyramid.tile_size <= 0 || options.dpi <= 0.0f) {
+        return StatsResult(ErrorCode::InvalidArgument, "Invalid document, tile size or resolution");
+    }
+    
+#ifdef USE_MUPDF
+    fz_context* ctx = impl_->get_context();
+    if (!ctx) {
+        return StatsResult(ErrorCode::RenderError, "Failed to get rendering context");
+    }
+    
+    const bool jpeg = pyramid.format == TilePyramidOptions::Format::JPEG;
+    const bool xyz = pyramid.layout == TilePyramidOptions::Layout::XYZ;
+    const int tile_size = pyramid.tile_size;
+    
+    // Tiles are encoded straight from the render, so render in a layout the
+    // encoders take. Dithered output turns gray when filtered, so it is
+    // rendered at every level.
+    RenderOptions tile_options = options;
+    tile_options.use_clip_rect = false;
+    tile_options.image_format = options.render_transparent && !jpeg ? ImageFormat::RGBA32 : ImageFormat::RGB24;
+    tile_options.premultiplied_alpha = false;
+    const bool derive = options.color_mode != ColorMode::Monochrome;
+    
+    TilePyramidStats stats;
+    std::unordered_map<uint64_t, int> firsts;  // Fingerprint to the first page exported with it
+    std::mutex error_mutex;
+    std::string error;
+    ErrorCode error_code = ErrorCode::IOError;
+    
+    // The first failure is reported: RenderError for a page that cannot
+    // be drawn, IOError for a tile that cannot be written
+    auto fail = [&](ErrorCode code, const std::string& message) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (error.empty()) {
+            error = message;
+            error_code = code;
+        }
+    };
+    
+    for (size_t p = 0; p < page_indices.size(); ++p) {
+        const int page_index = page_indices[p];
+        if (callback && !callback(static_cast<int>(p), static_cast<int>(page_indices.size()),
+                                  "Tiling page " + std::to_string(page_index + 1))) {
+            break;
+        }
+        
+        Page* page = doc->get_page(page_index);
+        if (!page) {
+            return StatsResult(ErrorCode::InvalidArgument, "Invalid page index " + std::to_string(page_index));
+        }
+        
+        // Deep Zoom numbering: level 0 is one pixel, the last the full page
+        int width = 0;
+        int height = 0;
+        calculate_dimensions(page, options.dpi, width, height);
+        if (width <= 0 || height <= 0) {
+            return StatsResult(ErrorCode::RenderError, "Empty page " + std::to_string(page_index + 1));
+        }
+        
+        int max_level = 0;
+        while ((int64_t(1) << max_level) < std::max(width, height)) {
+            ++max_level;
+        }
+        
+        std::vector<PyramidLevel> levels(static_cast<size_t>(max_level) + 1);
+        int first_level = 0;    // XYZ zoom 0: the largest level that fits one tile
+        for (int level = 0; level <= max_level; ++level) {
+            const int shift = max_level - level;
+            PyramidLevel& l = levels[static_cast<size_t>(level)];
+            l.width = static_cast<int>((int64_t(width) + (int64_t(1) << shift) - 1) >> shift);
+            l.height = static_cast<int>((int64_t(height) + (int64_t(1) << shift) - 1) >> shift);
+            l.columns = (l.width + tile_size - 1) / tile_size;
+            l.rows = (l.height + tile_size - 1) / tile_size;
+            l.dpi = options.dpi / static_cast<float>(int64_t(1) << shift);
+            if (l.columns == 1 && l.rows == 1) {
+                first_level = xyz ? level : 0;
+            }
+        }
+        
+        // A page drawing the same as one exported earlier in this call gets
+        // copies of its tiles; the sizes match, since the fingerprint covers
+        // the page boxes and rotation
+        const uint64_t id = page->content_fingerprint();
+        const auto same = id != 0 ? firsts.find(id) : firsts.end();
+        if (same != firsts.end()) {
+            for (int level = max_level; level >= first_level && error.empty(); --level) {
+                const PyramidLevel& l = levels[static_cast<size_t>(level)];
+                const int name = xyz ? level - first_level : level;
+                
+                for (int row = 0; row < l.rows && error.empty(); ++row) {
+                    for (int column = 0; column < l.columns; ++column) {
+                        const std::string path = pyramid_tile_path(directory, pyramid, page_index, name, column, row);
+                        
+                        std::error_code ec;
+                        if (!pyramid.overwrite && fs::exists(path, ec)) {
+                            ++stats.tiles_skipped;
+                            continue;
+                        }
+                        
+                        fs::create_directories(fs::path(path).parent_path(), ec);
+                        const std::string partial = path + ".part";
+                        fs::copy_file(pyramid_tile_path(directory, pyramid, same->second, name, column, row),
+                                      partial, fs::copy_options::overwrite_existing, ec);
+                        if (!ec) {
+                            fs::rename(partial, path, ec);
+                        }
+                        if (ec) {
+                            fs::remove(partial, ec);
+                            fail(ErrorCode::IOError, "Failed to write " + path);
+                            break;
+                        }
+                        ++stats.tiles_copied;
+                    }
+                }
+            }
+        } else {
+            PageLists list;
+            std::string list_error;
+            fz_try(ctx) {
+                list = impl_->display_lists_->acquire(ctx, page, tile_options);
+            }
+            fz_catch(ctx) {
+                list_error = fz_caught_message(ctx);
+            }
+            if (!list) {
+                return StatsResult(ErrorCode::RenderError, list_error);
+            }
+            
+            // The tiles of one level in columns [x0, x1) and rows [y0, y1),
+            // row by row; null where a tile was on disk already, or is not
+            // kept for reducing
+            struct Window {
+                int x0 = 0;
+                int y0 = 0;
+                int columns = 0;
+                std::vector<std::unique_ptr<ImageBuffer>> tiles;
+                
+                ImageBuffer* at(int column, int row) const {
+                    return tiles[static_cast<size_t>(row - y0) * columns + (column - x0)].get();
+                }
+            };
+            
+            // Write the missing tiles of a window of level, reducing those
+            // whose four tiles below are all in finer and rendering the rest
+            // straight from the display list (the tile cache would only
+            // hold on to them). Rendering, reducing and encoding each run in
+            // parallel.
+            auto build = [&](int level, int x0, int y0, int x1, int y1, const Window* finer) {
+                const PyramidLevel& l = levels[static_cast<size_t>(level)];
+                const int name = xyz ? level - first_level : level;
+                x1 = std::min(x1, l.columns);
+                y1 = std::min(y1, l.rows);
+                
+                Window window;
+                window.x0 = x0;
+                window.y0 = y0;
+                window.columns = x1 - x0;
+                window.tiles.resize(static_cast<size_t>(x1 - x0) * (y1 - y0));
+                
+                std::vector<std::string> paths(window.tiles.size());
+                std::vector<size_t> rendered;
+                std::vector<size_t> derived;
+                for (size_t i = 0; i < window.tiles.size(); ++i) {
+                    const int column = x0 + static_cast<int>(i % window.columns);
+                    const int row = y0 + static_cast<int>(i / window.columns);
+                    paths[i] = pyramid_tile_path(directory, pyramid, page_index, name, column, row);
+                    
+                    std::error_code ignored;
+                    if (!pyramid.overwrite && fs::exists(paths[i], ignored)) {
+                        ++stats.tiles_skipped;
+                        continue;
+                    }
+                    
+                    // The tiles below are missing when they were on disk
+                    bool children = derive && finer;
+                    if (children) {
+                        const PyramidLevel& f = levels[static_cast<size_t>(level) + 1];
+                        for (int q = 0; q < 4; ++q) {
+                            const int c = column * 2 + (q & 1);
+                            const int r = row * 2 + (q >> 1);
+                            if (c < f.columns && r < f.rows && !finer->at(c, r)) {
+                                children = false;
+                            }
+                        }
+                    }
+                    (children ? derived : rendered).push_back(i);
+                }
+                
+                RenderOptions level_options = tile_options;
+                level_options.dpi = l.dpi;
+                const float scale = l.dpi / 72.0f;
+                
+                std::vector<size_t> work = rendered;
+                work.insert(work.end(), derived.begin(), derived.end());
+                std::atomic<int> rendered_written(0);
+                std::atomic<int> derived_written(0);
+                
+                impl_->parallel_for(ctx, work.size(), [&](fz_context* tile_ctx, size_t n) {
+                    const size_t i = work[n];
+                    const bool reduce = n >= rendered.size();
+                    const int column = x0 + static_cast<int>(i % window.columns);
+                    const int row = y0 + static_cast<int>(i / window.columns);
+                    const int tile_width = std::min(tile_size, l.width - column * tile_size);
+                    const int tile_height = std::min(tile_size, l.height - row * tile_size);
+                    
+                    std::unique_ptr<ImageBuffer> tile;
+                    if (reduce) {
+                        const PyramidLevel& f = levels[static_cast<size_t>(level) + 1];
+                        const ImageBuffer* quad[4] = {};
+                        for (int q = 0; q < 4; ++q) {
+                            const int c = column * 2 + (q & 1);
+                            const int r = row * 2 + (q >> 1);
+                            if (c < f.columns && r < f.rows) {
+                                quad[q] = finer->at(c, r);
+                            }
+                        }
+                        tile = Impl::join_tiles(quad)->scaled(tile_width, tile_height, ResampleFilter::Box);
+                    } else {
+                        TileInfo info;
+                        info.tile_x = column;
+                        info.tile_y = row;
+                        info.pixel_x = column * tile_size;
+                        info.pixel_y = row * tile_size;
+                        info.tile_width = tile_width;
+                        info.tile_height = tile_height;
+                        info.page_rect = Rect(info.pixel_x / scale, info.pixel_y / scale,
+                                              (info.pixel_x + tile_width) / scale,
+                                              (info.pixel_y + tile_height) / scale);
+                        
+                        fz_irect region;
+                        bool have_region = true;
+                        fz_try(tile_ctx) {
+                            region = Impl::tile_bbox(tile_ctx, list, level_options, info);
+                        }
+                        fz_catch(tile_ctx) {
+                            have_region = false;
+                        }
+                        if (!have_region) {
+                            fail(ErrorCode::RenderError, fz_caught_message(tile_ctx));
+                            return;
+                        }
+                        
+                        auto result = impl_->rasterize(tile_ctx, list, level_options, &region);
+                        if (!result.is_ok()) {
+                            fail(ErrorCode::RenderError, result.error_message());
+                            return;
+                        }
+                        tile = std::move(result.value());
+                    }
+                    if (!tile) {
+                        fail(ErrorCode::RenderError, "Failed to build a tile of page " + std::to_string(page_index + 1));
+                        return;
+                    }
+                    
+                    // Encoded under a temporary name first
+                    const ImageBuffer* out = tile.get();
+                    std::unique_ptr<ImageBuffer> padded;
+                    if (xyz && (out->width() < tile_size || out->height() < tile_size)) {
+                        padded = Impl::pad_tile(*out, tile_size, options.background_color);
+                        out = padded.get();
+                    }
+                    
+                    std::error_code ec;
+                    fs::create_directories(fs::path(paths[i]).parent_path(), ec);
+                    const std::string partial = paths[i] + ".part";
+                    const bool saved = jpeg ? out->save_jpeg(partial, pyramid.jpeg_quality) : out->save_png(partial);
+                    if (saved) {
+                        fs::rename(partial, paths[i], ec);
+                    }
+                    if (!saved || ec) {
+                        fs::remove(partial, ec);
+                        fail(ErrorCode::IOError, "Failed to write " + paths[i]);
+                        return;
+                    }
+                    ++(reduce ? derived_written : rendered_written);
+                    
+                    if (derive) {
+                        window.tiles[i] = std::move(tile);
+                    }
+                });
+                
+                stats.tiles_rendered += rendered_written;
+                stats.tiles_derived += derived_written;
+                return window;
+            };
+            
+            // Depth first through the quadtree, so only the tiles on the
+            // path to the current one and their siblings are alive. The
+            // last kBatchLevels levels of a subtree are built a level at a
+            // time, which gives the workers up to 4^kBatchLevels tiles.
+            static constexpr int kBatchLevels = 2;
+            const int batch_level = std::max(first_level, max_level - kBatchLevels);
+            
+            std::function<Window(int, int, int)> node = [&](int level, int column, int row) {
+                if (level >= batch_level) {
+                    Window finer;
+                    for (int at = max_level; at >= level && error.empty(); --at) {
+                        const int shift = at - level;
+                        Window window = build(at, column << shift, row << shift,
+                                              (column + 1) << shift, (row + 1) << shift,
+                                              at < max_level ? &finer : nullptr);
+                        finer = std::move(window);
+                    }
+                    return finer;
+                }
+                
+                const PyramidLevel& f = levels[static_cast<size_t>(level) + 1];
+                Window children;
+                children.x0 = column * 2;
+                children.y0 = row * 2;
+                children.columns = 2;
+                children.tiles.resize(4);
+                for (int q = 0; q < 4 && error.empty(); ++q) {
+                    const int c = column * 2 + (q & 1);
+                    const int r = row * 2 + (q >> 1);
+                    if (c < f.columns && r < f.rows) {
+                        Window child = node(level + 1, c, r);
+                        if (!child.tiles.empty()) {
+                            children.tiles[static_cast<size_t>(q)] = std::move(child.tiles.front());
+                        }
+                    }
+                }
+                if (!error.empty()) {
+                    return Window();
+                }
+                return build(level, column, row, column + 1, row + 1, &children);
+            };
+            
+            // first_level is a single tile, in either layout
+            node(first_level, 0, 0);
+            drop_page_lists(ctx, list);
+        }
+        
+        if (!error.empty()) {
+            return StatsResult(error_code, error);
+        }
+        
+        // The descriptor goes last: a viewer only finds pages that are done
+        if (!xyz && !write_dzi_descriptor(directory, pyramid, page_index, width, height)) {
+            return StatsResult(ErrorCode::IOError, "Failed to write the descriptor of page " +
+                               std::to_string(page_index + 1));
+        }
+        if (id != 0) {
+            firsts.emplace(id, page_index);
         }
+        ++stats.pages;
     }
     
-    return results;
+    return StatsResult(stats);
+#else
+    (void)directory;
+    (void)callback;
+    return StatsResult(ErrorCode::NotImplemented, "Rendering not implemented for this backend");
+#endif
 }
 
-std::vector<Renderer::TileInfo> Renderer::calculate_tiles(
+bool Renderer::start_progressive_render(
     Page* page,
-    int tile_width,
-    int tile_height,
     const RenderOptions& options
 ) {
-    std::vector<TileInfo> tiles;
+    cancel_progressive_render();
     
-    if (!page) return tiles;
+    if (!page) return false;
     
-    float page_width = page->width();
-    float page_height = page->height();
+#ifdef USE_MUPDF
+    if (!impl_->get_context()) return false;
     
-    int cols = static_cast<int>(std::ceil(page_width / tile_width));
-    int rows = static_cast<int>(std::ceil(page_height / tile_height));
+    auto job = std::make_unique<Impl::Progressive>();
+    job->page = page;
+    job->options = options;
+    job->generation = impl_->cache_.generation();
     
-    for (int row = 0; row < rows; ++row) {
-        for (int col = 0; col < cols; ++col) {
-            TileInfo tile;
-            tile.tile_x = col;
-            tile.tile_y = row;
-            tile.tile_width = tile_width;
-            tile.tile_height = tile_height;
-            
-            tile.page_rect.x0 = col * tile_width;
-            tile.page_rect.y0 = row * tile_height;
-            tile.page_rect.x1 = std::min((col + 1) * tile_width, 
-                                         static_cast<int>(page_width));
-            tile.page_rect.y1 = std::min((row + 1) * tile_height,
-                                         static_cast<int>(page_height));
-            
-            tiles.push_back(tile);
-        }
+    // A cached render needs no work
+    if (auto cached = impl_->find_cached(make_cache_key(page, options))) {
+        job->rows_done = cached->height();
+        job->image = std::move(cached);
+        job->progress = 100;
+        job->finished = true;
+        impl_->progressive_ = std::move(job);
+        return true;
     }
     
-    return tiles;
-}
-
-Result<std::unique_ptr<ImageBuffer>> Renderer::render_tile(
-    Page* page,
-    const TileInfo& tile,
-    const RenderOptions& options
-) {
-    RenderOptions tile_options = options;
-    tile_options.use_clip_rect = true;
-    tile_options.clip_rect = tile.page_rect;
+    Impl* impl = impl_.get();
+    Impl::Progressive* state = job.get();
+    job->worker = std::thread([impl, state] {
+        impl->run_progressive(*state);
+    });
     
-    return render_page(page, tile_options);
-}
-
-bool Renderer::start_progressive_render(
-    Page* page,
-    const RenderOptions& options
-) {
-    // TODO: Implement progressive rendering
+    impl_->progressive_ = std::move(job);
+    return true;
+#else
+    (void)options;
     return false;
+#endif
 }
 
 bool Renderer::continue_progressive_render() {
-    // TODO: Continue progressive render
+#ifdef USE_MUPDF
+    // Wait at most one frame, or until there is something new to show
+    const auto time_slice = std::chrono::milliseconds(16);
+    
+    Impl::Progressive* job = impl_->progressive_.get();
+    if (!job) return false;
+    
+    std::unique_lock<std::mutex> lock(job->mutex);
+    const uint64_t seen = job->updates;
+    job->changed.wait_for(lock, time_slice, [job, seen] {
+        return job->finished || job->updates != seen;
+    });
+    
+    return !job->finished;
+#else
     return false;
+#endif
+}
+
+int Renderer::get_progressive_progress() const {
+#ifdef USE_MUPDF
+    Impl::Progressive* job = impl_->progressive_.get();
+    if (!job) return 0;
+    
+    std::lock_guard<std::mutex> lock(job->mutex);
+    return job->progress;
+#else
+    return 0;
+#endif
 }
 
 Result<std::unique_ptr<ImageBuffer>> Renderer::get_progressive_buffer() {
-    // TODO: Get progressive buffer
-    return Result<std::unique_ptr<ImageBuffer>>(ErrorCode::NotImplemented);
+#ifdef USE_MUPDF
+    Impl::Progressive* job = impl_->progressive_.get();
+    if (!job) {
+        return Result<std::unique_ptr<ImageBuffer>>(
+            ErrorCode::InvalidArgument,
+            "No progressive render started"
+        );
+    }
+    
+    std::lock_guard<std::mutex> lock(job->mutex);
+    
+    if (!job->error.empty()) {
+        return Result<std::unique_ptr<ImageBuffer>>(ErrorCode::RenderError, job->error);
+    }
+    
+    const ImageBuffer* image = job->image.get();
+    const ImageBuffer* preview = job->preview.get();
+    
+    if (image && job->rows_done == image->height()) {
+        return Result<std::unique_ptr<ImageBuffer>>(Impl::copy_buffer(*image));
+    }
+    
+    if (!image || !preview) {
+        return Result<std::unique_ptr<ImageBuffer>>(
+            ErrorCode::RenderError,
+            "Nothing rendered yet"
+        );
+    }
+    
+    // Finished bands at full resolution, the rest scaled up from the preview
+    auto snapshot = std::make_unique<ImageBuffer>();
+    const int width = image->width();
+    const int height = image->height();
+    const int stride = image->stride();
+    const ImageFormat format = image->format();
+    const int n = image->bytes_per_pixel();
+    
+    snapshot->impl_->allocate(static_cast<size_t>(stride) * height);
+    snapshot->impl_->width = width;
+    snapshot->impl_->height = height;
+    snapshot->impl_->stride = stride;
+    snapshot->impl_->format = format;
+    snapshot->impl_->premultiplied = image->is_premultiplied();
+    
+    uint8_t* out = snapshot->impl_->storage.get();
+    std::memcpy(out, image->data(), static_cast<size_t>(stride) * job->rows_done);
+    
+    for (int y = job->rows_done; y < height; ++y) {
+        const int py = std::min(y * preview->height() / height, preview->height() - 1);
+        const uint8_t* src = preview->data() + static_cast<size_t>(py) * preview->stride();
+        uint8_t* dst = out + static_cast<size_t>(y) * stride;
+        if (format == ImageFormat::Mono1) {
+            std::memset(dst, 0, stride);
+            for (int x = 0; x < width; ++x) {
+                const int px = std::min(x * preview->width() / width, preview->width() - 1);
+                if (src[px >> 3] & (0x80 >> (px & 7))) {
+                    dst[x >> 3] |= static_cast<uint8_t>(0x80 >> (x & 7));
+                }
+            }
+            continue;
+        }
+        for (int x = 0; x < width; ++x) {
+            const int px = std::min(x * preview->width() / width, preview->width() - 1);
+            std::memcpy(dst + x * n, src + px * n, n);
+        }
+    }
+    
+    return Result<std::unique_ptr<ImageBuffer>>(std::move(snapshot));
+#else
+    return Result<std::unique_ptr<ImageBuffer>>(
+        ErrorCode::NotImplemented,
+        "Progressive rendering not implemented"
+    );
+#endif
 }
 
 void Renderer::cancel_progressive_render() {
-    // TODO: Cancel progressive render
+#ifdef USE_MUPDF
+    impl_->stop_progressive();
+#endif
 }
 
 void Renderer::set_cache_enabled(bool enabled) {
     impl_->cache_enabled_ = enabled;
+    if (!enabled) {
+        impl_->cache_.clear();
+        impl_->tile_cache_.clear();
+        impl_->layer_cache_.clear();
+    }
 }
 
 bool Renderer::is_cache_enabled() const {
@@ -493,20 +3526,94 @@ bool Renderer::is_cache_enabled() const {
 
 void Renderer::set_cache_size(size_t size_mb) {
     impl_->cache_size_mb_ = size_mb;
+    impl_->cache_.set_budget(size_mb * 1024 * 1024);
 }
 
 size_t Renderer::get_cache_size() const {
     return impl_->cache_size_mb_;
 }
 
+Renderer::CacheStats Renderer::get_cache_stats() const {
+    auto stats = impl_->cache_.stats();
+    
+    CacheStats result;
+    result.hits = stats.hits;
+    result.misses = stats.misses;
+    result.evictions = stats.evictions;
+    result.entries = stats.entries;
+    result.bytes = stats.bytes;
+    return result;
+}
+
+void Renderer::reset_cache_stats() {
+    impl_->cache_.reset_stats();
+}
+
+void Renderer::set_buffer_pool_size(size_t size_mb) {
+    detail::BufferPool::instance().set_budget(size_mb * 1024 * 1024);
+}
+
+size_t Renderer::get_buffer_pool_size() {
+    return detail::BufferPool::instance().budget() / (1024 * 1024);
+}
+
+Renderer::BufferPoolStats Renderer::get_buffer_pool_stats() {
+    auto stats = detail::BufferPool::instance().stats();
+    
+    BufferPoolStats result;
+    result.hits = stats.hits;
+    result.misses = stats.misses;
+    result.idle_buffers = stats.idle_buffers;
+    result.idle_bytes = stats.idle_bytes;
+    result.in_use_bytes = stats.in_use_bytes;
+    return result;
+}
+
+void Renderer::trim_buffer_pool() {
+    detail::BufferPool::instance().trim();
+}
+
+void Renderer::set_tile_cache_size(size_t size_mb) {
+    impl_->tile_cache_.set_budget(size_mb * 1024 * 1024);
+}
+
+size_t Renderer::get_tile_cache_size() const {
+    return impl_->tile_cache_.budget() / (1024 * 1024);
+}
+
+void Renderer::set_display_list_cache_size(size_t size_mb) {
+#ifdef USE_MUPDF
+    impl_->display_lists_->set_budget(impl_->get_context(), size_mb * 1024 * 1024);
+#endif
+}
+
+size_t Renderer::get_display_list_cache_size() const {
+#ifdef USE_MUPDF
+    return impl_->display_lists_->budget() / (1024 * 1024);
+#else
+    return 0;
+#endif
+}
+
 void Renderer::clear_cache() {
-    std::lock_guard<std::mutex> lock(impl_->cache_mutex_);
+#ifdef USE_MUPDF
+    impl_->display_lists_->clear(impl_->get_context());
+#endif
     impl_->cache_.clear();
+    impl_->tile_cache_.clear();
+    impl_->layer_cache_.clear();
 }
 
 void Renderer::invalidate_page(Page* page) {
-    std::lock_guard<std::mutex> lock(impl_->cache_mutex_);
-    impl_->cache_.erase(page->get_handle());
+    if (!page) return;
+#ifdef USE_MUPDF
+    impl_->display_lists_->invalidate(impl_->get_context(), page);
+#endif
+    const uint64_t id = page->id();
+    auto all = [](const auto&) { return true; };
+    impl_->cache_.erase_if_in(id, all);
+    impl_->tile_cache_.erase_if_in(id, all);
+    impl_->layer_cache_.erase_if_in(id, all);
 }
 
 void Renderer::calculate_dimensions(
@@ -520,9 +3627,10 @@ void Renderer::calculate_dimensions(
         return;
     }
     
+    // Round the same way the renderer sizes its pixmaps (fz_round_rect)
     float scale = dpi / 72.0f;
-    width = static_cast<int>(page->width() * scale);
-    height = static_cast<int>(page->height() * scale);
+    width = static_cast<int>(std::ceil(page->width() * scale - 0.001f));
+    height = static_cast<int>(std::ceil(page->height() * scale - 0.001f));
 }
 
 float Renderer::calculate_scale_to_fit(
@@ -588,6 +3696,24 @@ bool Renderer::is_gpu_acceleration_enabled() const {
     return false;
 }
 
+Renderer::RenderTimings Renderer::get_render_timings() const {
+    auto ms = [](const std::atomic<uint64_t>& ns) { return ns.load() / 1e6; };
+    
+    RenderTimings timings;
+    timings.interpret_ms = ms(impl_->timings_.interpret);
+    timings.rasterize_ms = ms(impl_->timings_.rasterize);
+    timings.copy_ms = ms(impl_->timings_.copy);
+    timings.encode_ms = ms(impl_->timings_.encode);
+    return timings;
+}
+
+void Renderer::reset_render_timings() {
+    impl_->timings_.interpret = 0;
+    impl_->timings_.rasterize = 0;
+    impl_->timings_.copy = 0;
+    impl_->timings_.encode = 0;
+}
+
 // RenderJob implementation
 class RenderJob::Impl {
 public:
@@ -596,6 +3722,23 @@ public:
     std::unique_ptr<ImageBuffer> result;
     std::mutex mutex;
     std::condition_variable cv;
+    
+    // Installed by AsyncRenderer: live progress of the shared render, and
+    // detaching this job from it on cancel
+    std::function<float()> progress_source;
+    std::function<void()> on_cancel;
+    
+    bool finish(Status final_status, std::unique_ptr<ImageBuffer> image) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (status == Status::Cancelled) return false;
+        status = final_status;
+        progress = 1.0f;
+        result = std::move(image);
+        progress_source = nullptr;
+        on_cancel = nullptr;
+        cv.notify_all();
+        return true;
+    }
 };
 
 RenderJob::RenderJob() : impl_(std::make_unique<Impl>()) {}
@@ -608,6 +3751,9 @@ RenderJob::Status RenderJob::get_status() const {
 
 float RenderJob::get_progress() const {
     std::lock_guard<std::mutex> lock(impl_->mutex);
+    if (impl_->status == Status::Running && impl_->progress_source) {
+        return impl_->progress_source();
+    }
     return impl_->progress;
 }
 
@@ -635,10 +3781,20 @@ bool RenderJob::wait(int timeout_ms) {
 }
 
 void RenderJob::cancel() {
-    std::lock_guard<std::mutex> lock(impl_->mutex);
-    if (impl_->status == Status::Pending || impl_->status == Status::Running) {
-        impl_->status = Status::Cancelled;
-        impl_->cv.notify_all();
+    std::function<void()> on_cancel;
+    {
+        std::lock_guard<std::mutex> lock(impl_->mutex);
+        if (impl_->status == Status::Pending || impl_->status == Status::Running) {
+            impl_->status = Status::Cancelled;
+            on_cancel = std::move(impl_->on_cancel);
+            impl_->progress_source = nullptr;
+            impl_->cv.notify_all();
+        }
+    }
+    
+    // Called without our lock held; it takes the pool's
+    if (on_cancel) {
+        on_cancel();
     }
 }
 
@@ -660,32 +3816,357 @@ Result<std::unique_ptr<ImageBuffer>> RenderJob::get_result() {
 // AsyncRenderer implementation
 class AsyncRenderer::Impl {
 public:
-    // TODO: Implement async rendering with thread pool
+    // One render, shared by every job queued for the same page and options
+    struct Task {
+        Page* page = nullptr;
+        RenderOptions options;
+        RenderCacheKey key;
+        Priority priority = Priority::Normal;
+        bool running = false;
+        std::vector<std::weak_ptr<RenderJob>> jobs;
+        
+        // 0 queued, 1 interpreting, 2 rasterizing
+        std::atomic<int> phase{0};
+#ifdef USE_MUPDF
+        fz_cookie cookie = {};
+#endif
+        
+        float progress() const {
+            switch (phase.load()) {
+            case 1:
+                return 0.05f;
+            case 2:
+#ifdef USE_MUPDF
+                if (cookie.progress_max > 0 && cookie.progress_max != static_cast<size_t>(-1)) {
+                    float done = static_cast<float>(cookie.progress) / cookie.progress_max;
+                    return 0.1f + 0.9f * std::min(done, 1.0f);
+                }
+#endif
+                return 0.1f;
+            default:
+                return 0.0f;
+            }
+        }
+    };
+    
+    explicit Impl(int thread_count) {
+        if (thread_count <= 0) {
+            thread_count = static_cast<int>(std::thread::hardware_concurrency());
+        }
+        thread_count = std::max(thread_count, 1);
+        
+        for (int i = 0; i < thread_count; ++i) {
+            workers_.emplace_back([this] { worker_loop(); });
+        }
+    }
+    
+    ~Impl() {
+        cancel_all();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        work_available_.notify_all();
+        for (auto& t : workers_) {
+            t.join();
+        }
+    }
+    
+    std::shared_ptr<RenderJob> queue(Page* page, const RenderOptions& options, Priority priority) {
+        auto job = std::make_shared<RenderJob>();
+        
+        if (!page) {
+            job->impl_->finish(RenderJob::Status::Failed, nullptr);
+            return job;
+        }
+        
+        std::lock_guard<std::mutex> lock(mutex_);
+        
+        std::shared_ptr<Task> task;
+        RenderCacheKey key = make_cache_key(page, options);
+        auto it = tasks_.find(key);
+        if (it != tasks_.end()) {
+            task = it->second;
+            // A page becoming visible jumps ahead of its prefetch
+            if (!task->running && priority > task->priority) {
+                auto& from = queues_[static_cast<int>(task->priority)];
+                from.erase(std::find(from.begin(), from.end(), task));
+                task->priority = priority;
+                queues_[static_cast<int>(priority)].push_back(task);
+            }
+        } else {
+            task = std::make_shared<Task>();
+            task->page = page;
+            task->options = options;
+            task->key = key;
+            task->priority = priority;
+            tasks_.emplace(key, task);
+            queues_[static_cast<int>(priority)].push_back(task);
+            work_available_.notify_one();
+        }
+        
+        task->jobs.push_back(job);
+        
+        std::weak_ptr<Task> weak_task = task;
+        std::weak_ptr<RenderJob> weak_job = job;
+        
+        std::lock_guard<std::mutex> job_lock(job->impl_->mutex);
+        if (task->running) {
+            job->impl_->status = RenderJob::Status::Running;
+        }
+        job->impl_->progress_source = [weak_task] {
+            auto t = weak_task.lock();
+            return t ? t->progress() : 0.0f;
+        };
+        job->impl_->on_cancel = [this, weak_task, weak_job] {
+            if (auto t = weak_task.lock()) {
+                detach(t, weak_job);
+            }
+        };
+        
+        return job;
+    }
+    
+    int pending() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return static_cast<int>(tasks_.size());
+    }
+    
+    void cancel_all() {
+        std::vector<std::shared_ptr<RenderJob>> jobs;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto& entry : tasks_) {
+                collect_jobs(*entry.second, jobs);
+                entry.second->jobs.clear();
+                abort(*entry.second);
+            }
+            for (auto& queue : queues_) {
+                queue.clear();
+            }
+            tasks_.clear();
+        }
+        idle_.notify_all();
+        
+        for (auto& job : jobs) {
+            job->cancel();
+        }
+    }
+    
+    void wait_all() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this] { return tasks_.empty() && active_ == 0; });
+    }
+
+private:
+    static void collect_jobs(const Task& task, std::vector<std::shared_ptr<RenderJob>>& out) {
+        for (auto& weak : task.jobs) {
+            if (auto job = weak.lock()) {
+                out.push_back(job);
+            }
+        }
+    }
+    
+    static void abort(Task& task) {
+#ifdef USE_MUPDF
+        task.cookie.abort = 1;
+#else
+        (void)task;
+#endif
+    }
+    
+    // Take a task out of its queue and out of reach of new requests, so a
+    // page queued again after an abort gets a fresh render. Needs mutex_.
+    void forget_locked(const std::shared_ptr<Task>& task) {
+        auto& queue = queues_[static_cast<int>(task->priority)];
+        auto queued = std::find(queue.begin(), queue.end(), task);
+        if (queued != queue.end()) {
+            queue.erase(queued);
+        }
+        
+        auto entry = tasks_.find(task->key);
+        if (entry != tasks_.end() && entry->second == task) {
+            tasks_.erase(entry);
+        }
+    }
+    
+    // A job was cancelled: drop the render if nobody else is waiting for it
+    void detach(const std::shared_ptr<Task>& task, const std::weak_ptr<RenderJob>& job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto& jobs = task->jobs;
+            jobs.erase(std::remove_if(jobs.begin(), jobs.end(), [&job](const std::weak_ptr<RenderJob>& other) {
+                return other.expired() || (!other.owner_before(job) && !job.owner_before(other));
+            }), jobs.end());
+            
+            if (!jobs.empty()) return;
+            
+            abort(*task);
+            forget_locked(task);
+        }
+        idle_.notify_all();
+    }
+    
+    std::shared_ptr<Task> next_task() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        work_available_.wait(lock, [this] {
+            return stopping_ || std::any_of(queues_.begin(), queues_.end(),
+                [](const std::deque<std::shared_ptr<Task>>& queue) { return !queue.empty(); });
+        });
+        
+        for (auto queue = queues_.rbegin(); queue != queues_.rend(); ++queue) {
+            if (!queue->empty()) {
+                auto task = queue->front();
+                queue->pop_front();
+                task->running = true;
+                ++active_;
+                return task;
+            }
+        }
+        return nullptr;
+    }
+    
+    void worker_loop() {
+#ifdef USE_MUPDF
+        fz_context* ctx = detail::ContextManager::clone();
+#endif
+        
+        while (auto task = next_task()) {
+            std::vector<std::shared_ptr<RenderJob>> jobs;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                collect_jobs(*task, jobs);
+            }
+            
+            // Jobs joining from now on are marked running by queue()
+            for (auto& job : jobs) {
+                std::lock_guard<std::mutex> lock(job->impl_->mutex);
+                if (job->impl_->status == RenderJob::Status::Pending) {
+                    job->impl_->status = RenderJob::Status::Running;
+                }
+            }
+            jobs.clear();
+            
+#ifdef USE_MUPDF
+            auto result = render(ctx, *task);
+#else
+            auto result = renderer_.render_page(task->page, task->options);
+#endif
+            
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                collect_jobs(*task, jobs);
+                forget_locked(task);
+                --active_;
+            }
+            idle_.notify_all();
+            
+            for (auto& job : jobs) {
+                if (result.is_ok()) {
+                    job->impl_->finish(RenderJob::Status::Completed, Renderer::Impl::copy_buffer(*result.value()));
+                } else {
+                    job->impl_->finish(RenderJob::Status::Failed, nullptr);
+                }
+            }
+        }
+        
+#ifdef USE_MUPDF
+        if (ctx) {
+            fz_drop_context(ctx);
+        }
+#endif
+    }
+    
+#ifdef USE_MUPDF
+    // Like Renderer::render_page, but cancellable through the task's cookie
+    Result<std::unique_ptr<ImageBuffer>> render(fz_context* ctx, Task& task) {
+        Renderer::Impl& r = *renderer_.impl_;
+        
+        if (auto cached = r.find_cached(task.key)) {
+            return Result<std::unique_ptr<ImageBuffer>>(std::move(cached));
+        }
+        if (!ctx) {
+            return Result<std::unique_ptr<ImageBuffer>>(
+                ErrorCode::RenderError,
+                "Failed to create rendering context"
+            );
+        }
+        
+        uint64_t generation = r.cache_.generation();
+        PageLists list;
+        std::string error;
+        
+        // Interpreting waits for the document; rasterizing display lists
+        // runs fully in parallel
+        task.phase = 1;
+        fz_try(ctx) {
+            list = r.display_lists_->acquire(ctx, task.page, task.options, &task.cookie);
+        }
+        fz_catch(ctx) {
+            error = fz_caught_message(ctx);
+        }
+        
+        if (!list) {
+            return Result<std::unique_ptr<ImageBuffer>>(ErrorCode::RenderError, error);
+        }
+        
+        task.phase = 2;
+        auto result = task.cookie.abort
+            ? Result<std::unique_ptr<ImageBuffer>>(ErrorCode::RenderError, "Render cancelled")
+            : r.rasterize(ctx, list, task.options, nullptr, &task.cookie);
+        drop_page_lists(ctx, list);
+        
+        if (task.cookie.abort) {
+            return Result<std::unique_ptr<ImageBuffer>>(ErrorCode::RenderError, "Render cancelled");
+        }
+        if (result.is_ok()) {
+            r.store_cached(task.key, *result.value(), generation);
+        }
+        return result;
+    }
+#endif
+    
+    // Owns the caches and the base MuPDF context
+    Renderer renderer_;
+    
+    mutable std::mutex mutex_;
+    std::condition_variable work_available_;
+    std::condition_variable idle_;
+    
+    // One FIFO queue per priority, highest last
+    std::array<std::deque<std::shared_ptr<Task>>, 3> queues_;
+    std::unordered_map<RenderCacheKey, std::shared_ptr<Task>, RenderCacheKeyHash> tasks_;
+    int active_ = 0;
+    bool stopping_ = false;
+    
+    std::vector<std::thread> workers_;
 };
 
-AsyncRenderer::AsyncRenderer() : impl_(std::make_unique<Impl>()) {}
+AsyncRenderer::AsyncRenderer(int thread_count) : impl_(std::make_unique<Impl>(thread_count)) {}
 AsyncRenderer::~AsyncRenderer() = default;
 
 std::shared_ptr<RenderJob> AsyncRenderer::queue_render(
     Page* page,
-    const RenderOptions& options
+    const RenderOptions& options,
+    Priority priority
 ) {
-    // TODO: Queue render job in thread pool
-    auto job = std::make_shared<RenderJob>();
-    return job;
+    return impl_->queue(page, options, priority);
 }
 
 std::vector<std::shared_ptr<RenderJob>> AsyncRenderer::queue_batch(
     Document* doc,
     const std::vector<int>& page_indices,
-    const RenderOptions& options
+    const RenderOptions& options,
+    Priority priority
 ) {
     std::vector<std::shared_ptr<RenderJob>> jobs;
     
+    if (!doc) return jobs;
+    
     for (int idx : page_indices) {
         Page* page = doc->get_page(idx);
         if (page) {
-            jobs.push_back(queue_render(page, options));
+            jobs.push_back(queue_render(page, options, priority));
         }
     }
     
@@ -693,16 +4174,15 @@ std::vector<std::shared_ptr<RenderJob>> AsyncRenderer::queue_batch(
 }
 
 int AsyncRenderer::pending_count() const {
-    // TODO: Return number of pending jobs
-    return 0;
+    return impl_->pending();
 }
 
 void AsyncRenderer::cancel_all() {
-    // TODO: Cancel all pending jobs
+    impl_->cancel_all();
 }
 
 void AsyncRenderer::wait_all() {
-    // TODO: Wait for all jobs to complete
+    impl_->wait_all();
 }
 
 } // namespace pdfeditor
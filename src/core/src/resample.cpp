@@ -0,0 +1,194 @@
+#include "resample.h"
+#include "buffer_pool.h"
+#include "pixel_convert.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace pdfeditor {
+namespace detail {
+
+namespace {
+    constexpr double kPi = 3.14159265358979323846;
+    
+    // Filter radius in source pixels at scale 1
+    double filter_support(ResampleFilter filter) {
+        switch (filter) {
+            case ResampleFilter::Box: return 0.5;
+            case ResampleFilter::Bilinear: return 1.0;
+            case ResampleFilter::Lanczos: return 3.0;
+        }
+        return 1.0;
+    }
+    
+    double sinc(double x) {
+        if (x == 0.0) return 1.0;
+        x *= kPi;
+        return std::sin(x) / x;
+    }
+    
+    double filter_weight(ResampleFilter filter, double x) {
+        x = std::fabs(x);
+        switch (filter) {
+            case ResampleFilter::Box:
+                return x <= 0.5 ? 1.0 : 0.0;
+            case ResampleFilter::Bilinear:
+                return x < 1.0 ? 1.0 - x : 0.0;
+            case ResampleFilter::Lanczos:
+                return x < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+        }
+        return 0.0;
+    }
+    
+    // Taps and fixed-point weights of every output sample along one axis
+    struct Contributions {
+        std::vector<ResampleTaps> taps;
+        std::vector<int16_t> weights;
+        int max_taps = 0;
+    };
+    
+    Contributions contributions(int src_size, int dst_size, ResampleFilter filter) {
+        Contributions out;
+        out.taps.resize(static_cast<size_t>(dst_size));
+        
+        const double scale = static_cast<double>(src_size) / dst_size;
+        const double stretch = std::max(scale, 1.0);
+        const double support = filter_support(filter) * stretch;
+        
+        std::vector<double> raw;
+        for (int i = 0; i < dst_size; ++i) {
+            const double center = (i + 0.5) * scale;
+            
+            // Clamp to the image and renormalize, rather than extending edges
+            int first = std::max(0, static_cast<int>(std::floor(center - support)));
+            int last = std::min(src_size - 1, static_cast<int>(std::ceil(center + support)));
+            
+            raw.clear();
+            double total = 0.0;
+            for (int s = first; s <= last; ++s) {
+                double w = filter_weight(filter, (s + 0.5 - center) / stretch);
+                raw.push_back(w);
+                total += w;
+            }
+            
+            // A box narrower than one pixel can fall between samples
+            if (total == 0.0) {
+                first = last = std::clamp(static_cast<int>(center), 0, src_size - 1);
+                raw.assign(1, 1.0);
+                total = 1.0;
+            }
+            
+            // Trim zero taps at both ends
+            size_t begin = 0;
+            size_t end = raw.size();
+            while (begin + 1 < end && raw[begin] == 0.0) ++begin;
+            while (end > begin + 1 && raw[end - 1] == 0.0) --end;
+            
+            ResampleTaps& taps = out.taps[static_cast<size_t>(i)];
+            taps.first = first + static_cast<int>(begin);
+            taps.count = static_cast<int>(end - begin);
+            taps.offset = static_cast<int>(out.weights.size());
+            
+            // Quantize, and put the rounding error on the largest weight
+            // so flat areas come out unchanged
+            int sum = 0;
+            for (size_t k = begin; k < end; ++k) {
+                int16_t w = static_cast<int16_t>(std::lround(raw[k] / total * (1 << kResampleShift)));
+                out.weights.push_back(w);
+                sum += w;
+            }
+            auto largest = std::max_element(out.weights.begin() + taps.offset, out.weights.end());
+            *largest = static_cast<int16_t>(*largest + (1 << kResampleShift) - sum);
+            out.max_taps = std::max(out.max_taps, taps.count);
+        }
+        
+        return out;
+    }
+    
+    template <int Channels>
+    void resample_row(const uint8_t* src, uint8_t* dst, size_t count,
+                      const ResampleTaps* taps, const int16_t* weights) {
+        for (size_t x = 0; x < count; ++x, dst += Channels) {
+            const uint8_t* p = src + static_cast<size_t>(taps[x].first) * Channels;
+            const int16_t* w = weights + taps[x].offset;
+            int32_t acc[Channels];
+            std::fill(acc, acc + Channels, 1 << (kResampleShift - 1));
+            
+            for (int k = 0; k < taps[x].count; ++k, p += Channels) {
+                for (int c = 0; c < Channels; ++c) {
+                    acc[c] += w[k] * p[c];
+                }
+            }
+            for (int c = 0; c < Channels; ++c) {
+                dst[c] = static_cast<uint8_t>(std::clamp(acc[c] >> kResampleShift, 0, 255));
+            }
+        }
+    }
+    
+    void resample_row(const PixelKernels& kernels, int channels, const uint8_t* src, uint8_t* dst,
+                      size_t count, const ResampleTaps* taps, const int16_t* weights) {
+        switch (channels) {
+            case 1: resample_row<1>(src, dst, count, taps, weights); break;
+            case 3: resample_row<3>(src, dst, count, taps, weights); break;
+            case 4: kernels.resample_row4(src, dst, count, taps, weights); break;
+            default: break;
+        }
+    }
+}
+
+void resample(
+    const uint8_t* src, int src_width, int src_height, size_t src_stride,
+    uint8_t* dst, int dst_width, int dst_height, size_t dst_stride,
+    int channels, ResampleFilter filter
+) {
+    if (src_width <= 0 || src_height <= 0 || dst_width <= 0 || dst_height <= 0) {
+        return;
+    }
+    
+    const PixelKernels& kernels = pixel_kernels();
+    const size_t dst_row = static_cast<size_t>(dst_width) * channels;
+    const Contributions rows = contributions(src_height, dst_height, filter);
+    
+    // Horizontal pass into an intermediate of dst_width columns, over the
+    // source rows the vertical pass reads. Skipped when the width is
+    // unchanged.
+    const bool horizontal = src_width != dst_width;
+    int row_begin = 0;
+    int row_end = src_height;
+    std::shared_ptr<uint8_t[]> temp;
+    
+    if (horizontal) {
+        row_begin = src_height;
+        row_end = 0;
+        for (const ResampleTaps& taps : rows.taps) {
+            row_begin = std::min(row_begin, taps.first);
+            row_end = std::max(row_end, taps.first + taps.count);
+        }
+        temp = BufferPool::instance().acquire(dst_row * static_cast<size_t>(row_end - row_begin));
+        
+        const Contributions columns = contributions(src_width, dst_width, filter);
+        for (int y = row_begin; y < row_end; ++y) {
+            resample_row(kernels, channels, src + static_cast<size_t>(y) * src_stride,
+                         temp.get() + static_cast<size_t>(y - row_begin) * dst_row,
+                         static_cast<size_t>(dst_width), columns.taps.data(), columns.weights.data());
+        }
+    }
+    
+    // Vertical pass
+    std::vector<const uint8_t*> sources(static_cast<size_t>(rows.max_taps));
+    for (int y = 0; y < dst_height; ++y) {
+        const ResampleTaps& taps = rows.taps[static_cast<size_t>(y)];
+        for (int k = 0; k < taps.count; ++k) {
+            const int row = taps.first + k;
+            sources[static_cast<size_t>(k)] = horizontal
+                ? temp.get() + static_cast<size_t>(row - row_begin) * dst_row
+                : src + static_cast<size_t>(row) * src_stride;
+        }
+        kernels.resample_rows(sources.data(), rows.weights.data() + taps.offset, taps.count,
+                              dst + static_cast<size_t>(y) * dst_stride, dst_row);
+    }
+}
+
+} // namespace detail
+} // namespace pdfeditor
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "pdfeditor/renderer.h"
+#include <cstdint>
+
+namespace pdfeditor {
+namespace detail {
+
+// Resample an 8-bit image with channels interleaved samples per pixel to
+// dst_width x dst_height, each axis scaled on its own. The filter is
+// widened when shrinking so every source pixel contributes; samples are
+// treated as linear, so alpha must be premultiplied.
+void resample(
+    const uint8_t* src, int src_width, int src_height, size_t src_stride,
+    uint8_t* dst, int dst_width, int dst_height, size_t dst_stride,
+    int channels, ResampleFilter filter
+);
+
+} // namespace detail
+} // namespace pdfeditor
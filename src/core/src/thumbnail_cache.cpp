@@ -0,0 +1,166 @@
+#include "thumbnail_cache.h"
+#include "pixel_convert.h"
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace pdfeditor {
+namespace detail {
+
+namespace {
+    const uint32_t kMagic = 0x48544550;   // "PETH"
+    const uint32_t kVersion = 1;
+    
+    const size_t kSampleSize = 16 * 1024;
+    const int kSampleCount = 8;
+    
+    uint64_t fnv1a(uint64_t hash, const uint8_t* data, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= data[i];
+            hash *= 0x100000001b3ULL;
+        }
+        return hash;
+    }
+    
+    struct FileHeader {
+        uint32_t magic;
+        uint32_t version;
+        int32_t width;
+        int32_t height;
+        int32_t stride;
+        int32_t format;
+    };
+}
+
+uint64_t ThumbnailDiskCache::fingerprint(
+    uint64_t file_size,
+    const std::function<size_t(uint64_t, uint8_t*, size_t)>& read
+) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hash = fnv1a(hash, reinterpret_cast<const uint8_t*>(&file_size), sizeof(file_size));
+    
+    std::vector<uint8_t> block(kSampleSize);
+    const uint64_t last = file_size > kSampleSize ? file_size - kSampleSize : 0;
+    
+    for (int i = 0; i < kSampleCount; ++i) {
+        const uint64_t offset = last * i / (kSampleCount - 1);
+        size_t n = read(offset, block.data(), block.size());
+        hash = fnv1a(hash, block.data(), n);
+        if (last == 0) break;
+    }
+    
+    return hash;
+}
+
+void ThumbnailDiskCache::set_directory(const std::string& directory) {
+    directory_ = directory;
+}
+
+std::string ThumbnailDiskCache::directory() const {
+    return directory_;
+}
+
+bool ThumbnailDiskCache::enabled() const {
+    return !directory_.empty();
+}
+
+std::string ThumbnailDiskCache::path_for(const Key& key) const {
+    char name[128];
+    std::snprintf(name, sizeof(name), "%016llx/%d_%llu_%016llx_%dx%d.thumb",
+                  static_cast<unsigned long long>(key.document),
+                  key.page,
+                  static_cast<unsigned long long>(key.revision),
+                  static_cast<unsigned long long>(key.content),
+                  key.max_width, key.max_height);
+    return (fs::path(directory_) / name).string();
+}
+
+bool ThumbnailDiskCache::load(
+    const Key& key,
+    const std::function<uint8_t*(const Header&)>& allocate
+) const {
+    if (!enabled()) return false;
+    
+    std::ifstream file(path_for(key), std::ios::binary);
+    if (!file) return false;
+    
+    FileHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        return false;
+    }
+    
+    // Nothing is allocated on the word of a damaged or foreign file
+    const bool known_format = header.format >= static_cast<int32_t>(ImageFormat::RGB24) &&
+                              header.format <= static_cast<int32_t>(ImageFormat::Mono1);
+    if (header.magic != kMagic || header.version != kVersion || !known_format ||
+        header.width <= 0 || header.height <= 0 ||
+        header.width > key.max_width || header.height > key.max_height ||
+        header.stride < format_row_bytes(static_cast<ImageFormat>(header.format), header.width)) {
+        return false;
+    }
+    
+    const std::streamsize size = static_cast<std::streamsize>(header.stride) * header.height;
+    if (!file.seekg(0, std::ios::end) ||
+        file.tellg() != static_cast<std::streamoff>(sizeof(header)) + size ||
+        !file.seekg(sizeof(header))) {
+        return false;
+    }
+    
+    uint8_t* pixels = allocate(Header{header.width, header.height, header.stride, header.format});
+    if (!pixels) return false;
+    
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(pixels), size));
+}
+
+bool ThumbnailDiskCache::store(const Key& key, const Header& header, const uint8_t* pixels) const {
+    // load() would turn it away
+    if (!enabled() || header.width > key.max_width || header.height > key.max_height) return false;
+    
+    const fs::path path = path_for(key);
+    std::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+    if (ec) return false;
+    
+    // Random per process plus a counter, so parallel writers in this and
+    // other processes never share a temporary file
+    static const unsigned int salt = std::random_device()();
+    static std::atomic<uint64_t> counter(0);
+    std::ostringstream suffix;
+    suffix << ".tmp" << salt << "." << counter++;
+    const fs::path temp = path.string() + suffix.str();
+    
+    {
+        std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+        if (!file) return false;
+        
+        FileHeader file_header = {
+            kMagic, kVersion,
+            header.width, header.height, header.stride, header.format
+        };
+        file.write(reinterpret_cast<const char*>(&file_header), sizeof(file_header));
+        file.write(reinterpret_cast<const char*>(pixels),
+                   static_cast<std::streamsize>(header.stride) * header.height);
+        
+        if (!file.flush()) {
+            file.close();
+            fs::remove(temp, ec);
+            return false;
+        }
+    }
+    
+    fs::rename(temp, path, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        return false;
+    }
+    return true;
+}
+
+} // namespace detail
+} // namespace pdfeditor
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace pdfeditor {
+namespace detail {
+
+// On-disk store of rendered thumbnails, one file per document, page
+// content and requested size, so reopening a large document fills the thumbnail
+// strip without rendering. Files are written to a temporary name and
+// renamed into place, so concurrent writers and crashes never leave a
+// truncated entry behind. Unreadable or mismatching files count as misses.
+class ThumbnailDiskCache {
+public:
+    struct Key {
+        uint64_t document;   // Fingerprint from fingerprint()
+        int page;
+        uint64_t revision;   // Page::content_revision(), 0 as opened
+        uint64_t content;    // Page::content_fingerprint()
+        int max_width;
+        int max_height;
+    };
+    
+    struct Header {
+        int width;
+        int height;
+        int stride;
+        int format;          // ImageFormat value
+    };
+    
+    // Hash of the file size and a few evenly spaced blocks of the file,
+    // including its head and tail. Cheap even for huge files, and any save
+    // (which rewrites the trailer) changes it. read(offset, buffer, size)
+    // returns the number of bytes read.
+    static uint64_t fingerprint(
+        uint64_t file_size,
+        const std::function<size_t(uint64_t, uint8_t*, size_t)>& read
+    );
+    
+    // An empty directory disables the cache
+    void set_directory(const std::string& directory);
+    std::string directory() const;
+    bool enabled() const;
+    
+    // On a hit, allocate(header) must return a buffer of at least
+    // header.stride * header.height bytes to read the pixels into. The
+    // header is checked first: a known format, a size within the key's
+    // maximum, rows wide enough for it, and exactly that many pixel bytes
+    // in the file.
+    bool load(
+        const Key& key,
+        const std::function<uint8_t*(const Header&)>& allocate
+    ) const;
+    
+    bool store(const Key& key, const Header& header, const uint8_t* pixels) const;
+
+private:
+    std::string path_for(const Key& key) const;
+    
+    std::string directory_;
+};
+
+} // namespace detail
+} // namespace pdfeditor
@@ -251,34 +251,39 @@ void PDFViewer::renderCurrentPage() {
     options.anti_aliasing = pdfeditor::AntiAliasing::All;
     
     auto result = renderer_->render_page(page, options);
-    if (result.is_ok()) {
-        auto buffer = result.value();
-        
-        // Convert to QImage
-        QImage image(
-            buffer->data(),
-            buffer->width(),
-            buffer->height(),
-            buffer->stride(),
-            QImage::Format_RGB888
-        );
-        
-        // Deep copy
-        QImage imageCopy = image.copy();
-        
-        // Update widget
-        if (currentPage_ < pageWidgets_.size()) {
-            pageWidgets_[currentPage_]->setImage(imageCopy);
-        }
-        
-        // Cache the rendered page
-        if (pageCache_.size() >= maxCacheSize_) {
-            // Remove oldest entry
-            auto it = pageCache_.begin();
-            pageCache_.erase(it);
-        }
-        pageCache_[currentPage_] = QPixmap::fromImage(imageCopy);
+    if (result.is_error() || !result.value()) return;
+    
+    // Wrap the rendered pixels without copying. The buffer comes from the
+    // renderer's pool and goes back to it once the last image sharing the
+    // pixels is destroyed. The image is read-only, so the pixels can stay
+    // shared with the renderer's cache.
+    const pdfeditor::ImageBuffer* buffer = result.value().release();
+    QImage image(
+        buffer->data(),
+        buffer->width(),
+        buffer->height(),
+        buffer->stride(),
+        QImage::Format_RGB888,
+        [](void* info) { delete static_cast<const pdfeditor::ImageBuffer*>(info); },
+        const_cast<pdfeditor::ImageBuffer*>(buffer)
+    );
+    if (image.isNull()) {
+        delete buffer;
+        return;
+    }
+    
+    // Update widget
+    if (currentPage_ < pageWidgets_.size()) {
+        pageWidgets_[currentPage_]->setImage(image);
+    }
+    
+    // Cache the rendered page
+    if (pageCache_.size() >= maxCacheSize_) {
+        // Remove oldest entry
+        auto it = pageCache_.begin();
+        pageCache_.erase(it);
     }
+    pageCache_[currentPage_] = QPixmap::fromImage(image);
 }
 
 void PDFViewer::renderVisiblePages() {
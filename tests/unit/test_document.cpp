@@ -1,8 +1,12 @@
 #include <QTest>
 #include <QSignalSpy>
+#include <QTemporaryDir>
 #include "pdfeditor/document.h"
 #include "pdfeditor/core.h"
 #include "../test_helpers.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 
 using namespace pdfeditor;
 using namespace pdfeditor::test;
@@ -72,6 +76,36 @@ private slots:
         // Result depends on whether we have the right password
     }
     
+    void testOpenWithoutCopy() {
+        // Smallest usable PDF; MuPDF rebuilds the missing xref table
+        const std::string pdf =
+            "%PDF-1.4\n"
+            "1 0 obj <</Type/Catalog/Pages 2 0 R>> endobj\n"
+            "2 0 obj <</Type/Pages/Kids[3 0 R]/Count 1>> endobj\n"
+            "3 0 obj <</Type/Page/Parent 2 0 R/MediaBox[0 0 200 100]>> endobj\n"
+            "trailer <</Root 1 0 R>>\n%%EOF\n";
+        
+        auto owned = Document::open_from_memory(std::vector<uint8_t>(pdf.begin(), pdf.end()));
+        ASSERT_RESULT_OK(owned);
+        QCOMPARE(owned.value()->page_count(), 1);
+        QCOMPARE(owned.value()->get_page(0)->width(), 200.0f);
+        
+        // The document holds the last reference to a shared buffer
+        auto buffer = std::make_shared<std::vector<uint8_t>>(pdf.begin(), pdf.end());
+        auto shared = Document::open_from_memory(
+            std::shared_ptr<const uint8_t>(buffer, buffer->data()), buffer->size());
+        buffer.reset();
+        ASSERT_RESULT_OK(shared);
+        QCOMPARE(shared.value()->get_page(0)->height(), 100.0f);
+        
+        // Memory-mapped file
+        const QString path = createTempFile();
+        std::ofstream(path.toStdString(), std::ios::binary) << pdf;
+        auto mapped = Document::open(path.toStdString(), "", FileAccess::Random);
+        ASSERT_RESULT_OK(mapped);
+        QCOMPARE(mapped.value()->page_count(), 1);
+    }
+    
     void testPageCount() {
         auto doc = createTestDocument(5);
         ASSERT_DOCUMENT_VALID(doc.get());
@@ -98,6 +132,40 @@ private slots:
         
         Page* negative = doc->get_page(-1);
         QVERIFY(negative == nullptr);
+        
+        // Ids are never shared, not even with pages of a later document
+        QVERIFY(page0->id() != page2->id());
+        const uint64_t id = page0->id();
+        doc.reset();
+        auto next = createTestDocument(3);
+        ASSERT_DOCUMENT_VALID(next.get());
+        QVERIFY(next->get_page(0)->id() > id);
+    }
+    
+    void testPageCache() {
+        auto doc = createTestDocument(10);
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        doc->set_page_cache_size(3);
+        QCOMPARE(doc->page_cache_size(), size_t(3));
+        
+        std::vector<Page*> pages = doc->get_pages();
+        std::vector<float> widths;
+        for (Page* page : pages) {
+            widths.push_back(page->width());
+        }
+        QVERIFY(doc->loaded_page_count() <= 3);
+        
+        // Dropped pages keep their address and are parsed again on use
+        for (int i = 0; i < 10; ++i) {
+            QCOMPARE(doc->get_page(i), pages[i]);
+            QCOMPARE(pages[i]->index(), i);
+            QCOMPARE(pages[i]->width(), widths[i]);
+        }
+        QVERIFY(doc->loaded_page_count() <= 3);
+        
+        doc->set_page_cache_size(1);
+        QVERIFY(doc->loaded_page_count() <= 1);
     }
     
     void testDocumentInfo() {
@@ -139,6 +207,115 @@ private slots:
         ASSERT_RESULT_OK(result);
     }
     
+    void testSaveToMemory() {
+        auto doc = createTestDocument(2);
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        std::vector<uint8_t> bytes;
+        QVERIFY(doc->save_to_memory(bytes));
+        QVERIFY(bytes.size() > 8);
+        QVERIFY(std::memcmp(bytes.data(), "%PDF-", 5) == 0);
+        
+        auto reopened = Document::open_from_memory(std::move(bytes));
+        ASSERT_RESULT_OK(reopened);
+        QCOMPARE(reopened.value()->page_count(), 2);
+    }
+    
+    void testSaveIncremental() {
+        auto doc = createTestDocument();
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        const QString original = createTempFile();
+        QVERIFY(doc->save(original.toStdString()));
+        
+        auto opened = Document::open(original.toStdString());
+        ASSERT_RESULT_OK(opened);
+        Document* edited = opened.value().get();
+        QVERIFY(edited->rotate_page(0, PageRotation::Clockwise90));
+        
+        // The update goes after the original bytes, which stay as they were
+        const QString updated = createTempFile();
+        QVERIFY(edited->save_incremental(updated.toStdString()));
+        
+        QFile before(original);
+        QFile after(updated);
+        QVERIFY(before.open(QIODevice::ReadOnly));
+        QVERIFY(after.open(QIODevice::ReadOnly));
+        const QByteArray prefix = before.readAll();
+        const QByteArray bytes = after.readAll();
+        QVERIFY(bytes.size() > prefix.size());
+        QVERIFY(bytes.startsWith(prefix));
+        
+        // ...as a new xref section and trailer whose startxref points into
+        // the appended part
+        const QByteArray update = bytes.mid(prefix.size());
+        QVERIFY(update.contains("xref"));
+        QVERIFY(update.contains("trailer"));
+        QVERIFY(update.trimmed().endsWith("%%EOF"));
+        const int startxref = update.lastIndexOf("startxref");
+        QVERIFY(startxref >= 0);
+        const qint64 offset = update.mid(startxref + 9).trimmed().split('\n').first().trimmed().toLongLong();
+        QVERIFY(offset >= prefix.size());
+        
+        auto result = Document::open(updated.toStdString());
+        ASSERT_RESULT_OK(result);
+        QVERIFY(result.value()->get_page(0)->rotation() == PageRotation::Clockwise90);
+        
+        // Once save() has rewritten the opened file, saving incrementally
+        // to it must not append to bytes the document never read
+        QVERIFY(edited->save(original.toStdString()));
+        QVERIFY(edited->rotate_page(0, PageRotation::Clockwise180));
+        QVERIFY(edited->save_incremental(original.toStdString()));
+        auto resaved = Document::open(original.toStdString());
+        ASSERT_RESULT_OK(resaved);
+        QVERIFY(resaved.value()->get_page(0)->rotation() == PageRotation::Clockwise180);
+    }
+    
+    void testProbe() {
+        // Three pages and an Info dictionary, with a real xref table
+        const char* objects[] = {
+            "<</Type/Catalog/Pages 2 0 R>>",
+            "<</Type/Pages/Kids[3 0 R 3 0 R 3 0 R]/Count 3>>",
+            "<</Type/Page/Parent 2 0 R/MediaBox[0 0 200 100]>>",
+            "<</Title(Probe Title)/Author<FEFF00410042>>>",
+        };
+        std::string pdf = "%PDF-1.6\n";
+        std::vector<size_t> offsets;
+        for (size_t i = 0; i < 4; ++i) {
+            offsets.push_back(pdf.size());
+            pdf += std::to_string(i + 1) + " 0 obj\n" + objects[i] + "\nendobj\n";
+        }
+        const size_t xref = pdf.size();
+        pdf += "xref\n0 5\n0000000000 65535 f \n";
+        for (size_t offset : offsets) {
+            char entry[21];
+            std::snprintf(entry, sizeof(entry), "%010zu 00000 n \n", offset);
+            pdf += entry;
+        }
+        pdf += "trailer\n<</Size 5/Root 1 0 R/Info 4 0 R>>\nstartxref\n" + std::to_string(xref) + "\n%%EOF\n";
+        
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const std::string path = dir.filePath("probed.pdf").toStdString();
+        std::ofstream(path, std::ios::binary) << pdf;
+        std::ofstream(dir.filePath("broken.pdf").toStdString(), std::ios::binary) << "not a pdf";
+        
+        auto probed = Document::probe(path);
+        ASSERT_RESULT_OK(probed);
+        QCOMPARE(probed.value().page_count, 3);
+        QVERIFY(probed.value().version == PDFVersion::PDF_1_6);
+        QCOMPARE(QString::fromStdString(probed.value().title), QString("Probe Title"));
+        QCOMPARE(QString::fromStdString(probed.value().author), QString("AB"));
+        QVERIFY(!probed.value().is_encrypted);
+        
+        // Failures are reported per file, in path order
+        auto all = Document::probe_directory(dir.path().toStdString(), 2);
+        QCOMPARE(all.size(), size_t(2));
+        QVERIFY(all[0].info.is_error());
+        QVERIFY(all[1].info.is_ok());
+        QCOMPARE(all[1].info.value().page_count, 3);
+    }
+    
     void testPageDimensions() {
         auto doc = createTestDocument();
         ASSERT_DOCUMENT_VALID(doc.get());
@@ -177,6 +354,59 @@ private slots:
         QCOMPARE(page->rotation(), PageRotation::Clockwise90);
     }
     
+    void testPageGeometry() {
+        // Inherited MediaBox and Rotate, a CropBox, and a UserUnit
+        const std::string pdf =
+            "%PDF-1.6\n"
+            "1 0 obj <</Type/Catalog/Pages 2 0 R>> endobj\n"
+            "2 0 obj <</Type/Pages/Kids[3 0 R 4 0 R]/Count 2/MediaBox[0 0 600 800]/Rotate 90>> endobj\n"
+            "3 0 obj <</Type/Page/Parent 2 0 R/CropBox[50 50 550 750]>> endobj\n"
+            "4 0 obj <</Type/Page/Parent 2 0 R/MediaBox[0 0 200 100]/Rotate 0/UserUnit 2>> endobj\n"
+            "trailer <</Root 1 0 R>>\n%%EOF\n";
+        
+        auto opened = Document::open_from_memory(std::vector<uint8_t>(pdf.begin(), pdf.end()));
+        ASSERT_RESULT_OK(opened);
+        Document* doc = opened.value().get();
+        
+        Page* first = doc->get_page(0);
+        Page* second = doc->get_page(1);
+        QCOMPARE(first->width(), 700.0f);
+        QCOMPARE(first->height(), 500.0f);
+        QVERIFY(first->rotation() == PageRotation::Clockwise90);
+        QCOMPARE(first->get_cropbox().x0, 50.0f);
+        QCOMPARE(second->width(), 400.0f);
+        QCOMPARE(second->height(), 200.0f);
+        
+        // All of it from the page tree, without parsing a page
+        QCOMPARE(doc->loaded_page_count(), size_t(0));
+        
+        QVERIFY(doc->insert_page(0, 300, 200));
+        QCOMPARE(doc->page_count(), 3);
+        QCOMPARE(first->index(), 1);
+        PageGeometry inserted;
+        QVERIFY(doc->get_page_geometry(0, inserted));
+        
+        // The new page takes its Rotate from the tree, as MuPDF draws it
+        QVERIFY(inserted.rotation == PageRotation::Clockwise90);
+        QCOMPARE(inserted.cropbox.width(), 300.0f);
+        QCOMPARE(inserted.width(), 200.0f);
+        QCOMPARE(inserted.height(), 300.0f);
+        
+        const uint64_t revision = second->revision();
+        QVERIFY(doc->rotate_page(2, PageRotation::Clockwise270));
+        QVERIFY(second->rotation() == PageRotation::Clockwise270);
+        QCOMPARE(second->width(), 200.0f);
+        QVERIFY(second->revision() > revision);
+        
+        // A deleted page's Page stays valid, detached
+        QVERIFY(doc->delete_page(1));
+        QCOMPARE(doc->page_count(), 2);
+        QCOMPARE(first->index(), -1);
+        QCOMPARE(second->index(), 1);
+        QCOMPARE(doc->get_page(1), second);
+        QVERIFY(!doc->get_page_geometry(2, inserted));
+    }
+    
     void testExtractPages() {
         auto doc = createTestDocument(10);
         ASSERT_DOCUMENT_VALID(doc.get());
@@ -0,0 +1,1089 @@
+#include <QTest>
+#include "pdfeditor/renderer.h"
+#include "pdfeditor/document.h"
+#include "pdfeditor/core.h"
+#include "../test_helpers.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+using namespace pdfeditor;
+using namespace pdfeditor::test;
+
+class TestRenderer : public QObject, public TestFixture {
+    Q_OBJECT
+    
+    static bool same_pixels(const ImageBuffer& a, const ImageBuffer& b) {
+        if (a.width() != b.width() || a.height() != b.height()) return false;
+        for (int y = 0; y < a.height(); ++y) {
+            if (std::memcmp(a.data() + y * a.stride(), b.data() + y * b.stride(),
+                            static_cast<size_t>(a.width()) * a.bytes_per_pixel()) != 0) return false;
+        }
+        return true;
+    }
+
+private slots:
+    void initTestCase() {
+        QVERIFY(Library::initialize());
+    }
+    
+    void cleanupTestCase() {
+        Library::shutdown();
+    }
+    
+    void init() {
+        setUp();
+    }
+    
+    void cleanup() {
+        tearDown();
+    }
+    
+    void testRenderPage() {
+        auto doc = createTestDocument();
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        Renderer renderer;
+        RenderOptions options;
+        options.dpi = 72.0f;
+        
+        auto result = renderer.render_page(doc->get_page(0), options);
+        ASSERT_RESULT_OK(result);
+        
+        auto& image = result.value();
+        QVERIFY(image->width() > 0);
+        QVERIFY(image->height() > 0);
+        QVERIFY(image->size() >= static_cast<size_t>(image->stride()) * image->height());
+    }
+    
+    void testRenderNullPage() {
+        Renderer renderer;
+        auto result = renderer.render_page(nullptr);
+        ASSERT_RESULT_ERROR(result);
+        QCOMPARE(result.error(), ErrorCode::InvalidArgument);
+    }
+    
+    void testRerenderAtNewScale() {
+        auto doc = createTestDocument();
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        Renderer renderer;
+        renderer.set_display_list_cache_size(16);
+        QCOMPARE(renderer.get_display_list_cache_size(), size_t(16));
+        
+        RenderOptions options;
+        options.dpi = 72.0f;
+        auto small = renderer.render_page(doc->get_page(0), options);
+        ASSERT_RESULT_OK(small);
+        const double interpreted = renderer.get_render_timings().interpret_ms;
+        
+        // Second render replays the cached display list: no interpretation
+        options.dpi = 144.0f;
+        auto large = renderer.render_page(doc->get_page(0), options);
+        ASSERT_RESULT_OK(large);
+        QCOMPARE(renderer.get_render_timings().interpret_ms, interpreted);
+        
+        QVERIFY(std::abs(large.value()->width() - 2 * small.value()->width()) <= 1);
+        QVERIFY(std::abs(large.value()->height() - 2 * small.value()->height()) <= 1);
+    }
+    
+    void testRenderCache() {
+        auto doc = createTestDocument();
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        Renderer renderer;
+        renderer.set_cache_size(32);
+        Page* page = doc->get_page(0);
+        
+        RenderOptions options;
+        options.dpi = 72.0f;
+        
+        auto first = renderer.render_page(page, options);
+        auto second = renderer.render_page(page, options);
+        ASSERT_RESULT_OK(first);
+        ASSERT_RESULT_OK(second);
+        QVERIFY(first.value()->to_vector() == second.value()->to_vector());
+        
+        auto stats = renderer.get_cache_stats();
+        QCOMPARE(stats.misses, uint64_t(1));
+        QCOMPARE(stats.hits, uint64_t(1));
+        QCOMPARE(stats.entries, size_t(1));
+        QVERIFY(stats.bytes >= first.value()->size());
+        
+        // A different DPI is a different entry
+        options.dpi = 96.0f;
+        renderer.render_page(page, options);
+        QCOMPARE(renderer.get_cache_stats().misses, uint64_t(2));
+        
+        renderer.invalidate_page(page);
+        QCOMPARE(renderer.get_cache_stats().entries, size_t(0));
+        
+        // A budget smaller than one page evicts everything
+        renderer.render_page(page, options);
+        renderer.set_cache_size(0);
+        QCOMPARE(renderer.get_cache_stats().entries, size_t(0));
+    }
+    
+    void testRenderToBufferWithStride() {
+        auto doc = createTestDocument();
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        Page* page = doc->get_page(0);
+        RenderOptions options;
+        options.dpi = 50.0f;
+        
+        Renderer renderer;
+        renderer.set_cache_enabled(false);
+        auto reference = renderer.render_page(page, options);
+        ASSERT_RESULT_OK(reference);
+        
+        int width = 0;
+        int height = 0;
+        Renderer::calculate_dimensions(page, options.dpi, width, height);
+        QCOMPARE(width, reference.value()->width());
+        QCOMPARE(height, reference.value()->height());
+        
+        // Padded rows, as in a QImage or a shared-memory frame
+        const int row_bytes = width * 3;
+        const int stride = row_bytes + 13;
+        std::vector<uint8_t> frame(static_cast<size_t>(stride) * height, 0xAB);
+        
+        QVERIFY(renderer.render_page_to_buffer(page, frame.data(), frame.size(), stride, options));
+        
+        const uint8_t* expected = reference.value()->data();
+        for (int y = 0; y < height; ++y) {
+            QVERIFY(std::memcmp(frame.data() + y * stride,
+                                expected + y * reference.value()->stride(),
+                                row_bytes) == 0);
+            // Padding is left untouched
+            QCOMPARE(frame[y * stride + row_bytes], uint8_t(0xAB));
+        }
+        
+        // Too small a buffer or stride is rejected
+        QVERIFY(!renderer.render_page_to_buffer(page, frame.data(), frame.size() / 2, stride, options));
+        QVERIFY(!renderer.render_page_to_buffer(page, frame.data(), frame.size(), row_bytes - 1, options));
+    }
+    
+    void testBufferPool() {
+        auto doc = createTestDocument();
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        Renderer renderer;
+        renderer.set_cache_enabled(false);
+        Renderer::set_buffer_pool_size(64);
+        Renderer::trim_buffer_pool();
+        
+        RenderOptions options;
+        options.dpi = 150.0f;
+        
+        // A released page buffer is handed out again for the next page
+        {
+            auto first = renderer.render_page(doc->get_page(0), options);
+            ASSERT_RESULT_OK(first);
+            QVERIFY(Renderer::get_buffer_pool_stats().in_use_bytes >= first.value()->size());
+        }
+        auto before = Renderer::get_buffer_pool_stats();
+        QVERIFY(before.idle_buffers > 0);
+        
+        auto second = renderer.render_page(doc->get_page(0), options);
+        ASSERT_RESULT_OK(second);
+        QVERIFY(Renderer::get_buffer_pool_stats().hits > before.hits);
+        
+        // Idle memory never exceeds the budget
+        Renderer::set_buffer_pool_size(0);
+        QCOMPARE(Renderer::get_buffer_pool_stats().idle_bytes, size_t(0));
+        second.value().reset();
+        QCOMPARE(Renderer::get_buffer_pool_stats().idle_bytes, size_t(0));
+        
+        Renderer::set_buffer_pool_size(128);
+    }
+    
+    void testRenderTimings() {
+        auto doc = createTestDocument();
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        Renderer renderer;
+        renderer.set_cache_enabled(false);
+        
+        auto result = renderer.render_page(doc->get_page(0));
+        ASSERT_RESULT_OK(result);
+        auto timings = renderer.get_render_timings();
+        QVERIFY(timings.interpret_ms > 0);
+        QVERIFY(timings.rasterize_ms > 0);
+        QCOMPARE(timings.encode_ms, 0.0);
+        
+        // The display list is reused, so only rasterization is repeated
+        renderer.reset_render_timings();
+        QCOMPARE(renderer.get_render_timings().rasterize_ms, 0.0);
+        auto again = renderer.render_page(doc->get_page(0));
+        ASSERT_RESULT_OK(again);
+        timings = renderer.get_render_timings();
+        QCOMPARE(timings.interpret_ms, 0.0);
+        QVERIFY(timings.rasterize_ms > 0);
+        
+        // Sink writes of banded renders count as encoding
+        CallbackSink sink([](const uint8_t*, int, int, int) { return true; });
+        QVERIFY(renderer.render_page_banded(doc->get_page(0), sink));
+        QVERIFY(renderer.get_render_timings().encode_ms > 0);
+    }
+    
+    void testAntiAliasingAndDraft() {
+        auto doc = createTestDocument();
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        Renderer renderer;
+        Page* page = doc->get_page(0);
+        RenderOptions options;
+        options.dpi = 72.0f;
+        
+        auto reference = renderer.render_page(page, options);
+        ASSERT_RESULT_OK(reference);
+        
+        for (AntiAliasing aa : { AntiAliasing::None, AntiAliasing::Text, AntiAliasing::Graphics }) {
+            options.anti_aliasing = aa;
+            auto result = renderer.render_page(page, options);
+            ASSERT_RESULT_OK(result);
+            QCOMPARE(result.value()->width(), reference.value()->width());
+        }
+        
+        // Draft renders are cached apart from full ones
+        options.anti_aliasing = AntiAliasing::All;
+        options.draft = true;
+        auto draft = renderer.render_page(page, options);
+        ASSERT_RESULT_OK(draft);
+        QCOMPARE(draft.value()->width(), reference.value()->width());
+        QCOMPARE(draft.value()->height(), reference.value()->height());
+        QCOMPARE(renderer.get_cache_stats().misses, uint64_t(5));
+        
+        // The thread's anti-aliasing is put back after each render
+        options.draft = false;
+        renderer.set_cache_enabled(false);
+        auto again = renderer.render_page(page, options);
+        ASSERT_RESULT_OK(again);
+        QVERIFY(again.value()->to_vector() == reference.value()->to_vector());
+    }
+    
+    void testScaledRender() {
+        auto doc = createTestDocument();
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        Renderer renderer;
+        Page* page = doc->get_page(0);
+        RenderOptions options;
+        options.dpi = 144.0f;
+        
+        auto large = renderer.render_page(page, options);
+        ASSERT_RESULT_OK(large);
+        
+        // Resampling honours each size and format exactly
+        auto half = large.value()->scaled(100, 37, ResampleFilter::Box);
+        QVERIFY(half);
+        QCOMPARE(half->width(), 100);
+        QCOMPARE(half->height(), 37);
+        QCOMPARE(half->format(), ImageFormat::RGB24);
+        QVERIFY(!large.value()->scaled(0, 10));
+        
+        // Unequal scales give unequal resolutions
+        options.dpi = 72.0f;
+        auto stretched = renderer.render_page_scaled(page, 1.0f, 0.5f, options);
+        ASSERT_RESULT_OK(stretched);
+        int width = 0;
+        int height = 0;
+        int unused = 0;
+        renderer.calculate_dimensions(page, 72.0f, width, unused);
+        renderer.calculate_dimensions(page, 36.0f, unused, height);
+        QCOMPARE(stretched.value()->width(), width);
+        QCOMPARE(stretched.value()->height(), height);
+        
+        // A smaller size is reduced from a cached render rather than
+        // rendered again
+        const uint64_t misses = renderer.get_cache_stats().misses;
+        auto sized = renderer.render_page_to_size(page, width / 2, height / 3, options);
+        ASSERT_RESULT_OK(sized);
+        QCOMPARE(sized.value()->width(), width / 2);
+        QCOMPARE(sized.value()->height(), height / 3);
+        QCOMPARE(renderer.get_cache_stats().misses, misses);
+        
+        options.image_format = ImageFormat::Mono1;
+        auto mono = renderer.render_page_to_size(page, 64, 64, options);
+        ASSERT_RESULT_OK(mono);
+        QCOMPARE(mono.value()->format(), ImageFormat::Mono1);
+        QCOMPARE(mono.value()->width(), 64);
+    }
+    
+    void testDamageRedraw() {
+        auto doc = createTestDocument();
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        Page* page = doc->get_page(0);
+        Renderer renderer;
+        Renderer uncached;
+        uncached.set_cache_enabled(false);
+        RenderOptions options;
+        options.dpi = 72.0f;
+        
+        ASSERT_RESULT_OK(renderer.render_page(page, options));
+        QCOMPARE(renderer.get_cache_stats().entries, size_t(1));
+        
+        // A damaged area is redrawn into the cached render, which replaces it
+        const uint64_t revision = page->revision();
+        page->add_damage(Rect(10, 10, 60, 40));
+        QVERIFY(page->revision() > revision);
+        
+        auto patched = renderer.render_page(page, options);
+        auto full = uncached.render_page(page, options);
+        ASSERT_RESULT_OK(patched);
+        ASSERT_RESULT_OK(full);
+        QVERIFY(same_pixels(*patched.value(), *full.value()));
+        QCOMPARE(renderer.get_cache_stats().entries, size_t(1));
+        
+        // The whole page cannot be patched, so it renders afresh
+        page->add_damage();
+        std::vector<Rect> areas;
+        QVERIFY(!page->get_damage_since(revision, areas));
+        auto redrawn = renderer.render_page(page, options);
+        ASSERT_RESULT_OK(redrawn);
+        QVERIFY(same_pixels(*redrawn.value(), *full.value()));
+        QCOMPARE(renderer.get_cache_stats().entries, size_t(2));
+    }
+    
+    void testDamageRedrawPlacement() {
+        // A square off the centre of a cropped, rotated page. The document
+        // reads the buffer in place, so rewriting its colour is an edit.
+        const std::string content = "0 0 1 rg 30 60 20 20 re f\n";
+        const std::string pdf =
+            "%PDF-1.4\n"
+            "1 0 obj <</Type/Catalog/Pages 2 0 R>> endobj\n"
+            "2 0 obj <</Type/Pages/Kids[3 0 R]/Count 1>> endobj\n"
+            "3 0 obj <</Type/Page/Parent 2 0 R/MediaBox[0 0 200 100]/CropBox[20 10 180 90]"
+            "/Rotate 90/Contents 4 0 R>> endobj\n"
+            "4 0 obj <</Length " + std::to_string(content.size()) + ">> stream\n" + content +
+            "endstream endobj\n"
+            "trailer <</Root 1 0 R>>\n%%EOF\n";
+        auto buffer = std::make_shared<std::vector<uint8_t>>(pdf.begin(), pdf.end());
+        auto opened = Document::open_from_memory(
+            std::shared_ptr<const uint8_t>(buffer, buffer->data()), buffer->size());
+        ASSERT_RESULT_OK(opened);
+        
+        Page* page = opened.value()->get_page(0);
+        Renderer renderer;
+        Renderer uncached;
+        uncached.set_cache_enabled(false);
+        RenderOptions options;
+        options.dpi = 72.0f;
+        
+        auto before = renderer.render_page(page, options);
+        ASSERT_RESULT_OK(before);
+        QCOMPARE(before.value()->width(), 80);
+        QCOMPARE(before.value()->height(), 160);
+        
+        const size_t colour = pdf.find("0 0 1 rg");
+        std::memcpy(buffer->data() + colour, "1 0 0 rg", 8);
+        
+        // Recorded in PDF units, kept in page space
+        const uint64_t revision = page->revision();
+        page->add_damage(Rect(30, 60, 50, 80));
+        std::vector<Rect> areas;
+        QVERIFY(page->get_damage_since(revision, areas));
+        QCOMPARE(areas.size(), size_t(1));
+        QCOMPARE(areas[0].x0, 50.0f);
+        QCOMPARE(areas[0].y0, 10.0f);
+        QCOMPARE(areas[0].x1, 70.0f);
+        QCOMPARE(areas[0].y1, 30.0f);
+        
+        // The patch lands on the square, matching a full render
+        auto patched = renderer.render_page(page, options);
+        auto full = uncached.render_page(page, options);
+        ASSERT_RESULT_OK(patched);
+        ASSERT_RESULT_OK(full);
+        QVERIFY(!same_pixels(*before.value(), *full.value()));
+        QVERIFY(same_pixels(*patched.value(), *full.value()));
+    }
+    
+    void testAnnotationLayer() {
+        auto doc = createTestDocument();
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        Page* page = doc->get_page(0);
+        Renderer renderer;
+        RenderOptions options;
+        options.dpi = 72.0f;
+        options.render_annotations = false;
+        options.render_forms = false;
+        
+        ASSERT_RESULT_OK(renderer.render_page(page, options));
+        
+        // An annotation edit leaves renders of the contents alone
+        const uint64_t content = page->content_revision();
+        page->add_damage(Rect(20, 20, 80, 50), Page::Layer::Annotations);
+        QCOMPARE(page->content_revision(), content);
+        QVERIFY(page->revision() > content);
+        
+        ASSERT_RESULT_OK(renderer.render_page(page, options));
+        QCOMPARE(renderer.get_cache_stats().hits, uint64_t(1));
+        
+        // A content edit does not
+        page->add_damage(Rect(20, 20, 80, 50));
+        QVERIFY(page->content_revision() > content);
+        ASSERT_RESULT_OK(renderer.render_page(page, options));
+        QCOMPARE(renderer.get_cache_stats().hits, uint64_t(1));
+        
+        // With the annotation layer drawn, output matches an uncached render
+        Renderer uncached;
+        uncached.set_cache_enabled(false);
+        options.render_annotations = true;
+        options.render_forms = true;
+        auto layered = renderer.render_page(page, options);
+        auto full = uncached.render_page(page, options);
+        ASSERT_RESULT_OK(layered);
+        ASSERT_RESULT_OK(full);
+        QCOMPARE(layered.value()->size(), full.value()->size());
+        QVERIFY(std::memcmp(layered.value()->data(), full.value()->data(), full.value()->size()) == 0);
+    }
+    
+    void testImageFormats() {
+        auto doc = createTestDocument();
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        Page* page = doc->get_page(0);
+        Renderer renderer;
+        RenderOptions options;
+        options.dpi = 40.0f;
+        
+        auto rgb = renderer.render_page(page, options);
+        ASSERT_RESULT_OK(rgb);
+        const int width = rgb.value()->width();
+        const int height = rgb.value()->height();
+        QCOMPARE(rgb.value()->format(), ImageFormat::RGB24);
+        
+        // BGRA is RGB with red and blue exchanged and opaque alpha
+        options.image_format = ImageFormat::BGRA32;
+        auto bgra = renderer.render_page(page, options);
+        ASSERT_RESULT_OK(bgra);
+        QCOMPARE(bgra.value()->format(), ImageFormat::BGRA32);
+        QCOMPARE(bgra.value()->stride(), width * 4);
+        for (int y = 0; y < height; y += 7) {
+            const uint8_t* a = rgb.value()->data() + y * rgb.value()->stride();
+            const uint8_t* b = bgra.value()->data() + y * bgra.value()->stride();
+            for (int x = 0; x < width; ++x) {
+                QCOMPARE(b[x * 4 + 0], a[x * 3 + 2]);
+                QCOMPARE(b[x * 4 + 1], a[x * 3 + 1]);
+                QCOMPARE(b[x * 4 + 2], a[x * 3 + 0]);
+                QCOMPARE(b[x * 4 + 3], uint8_t(255));
+            }
+        }
+        
+        options.image_format = ImageFormat::Gray8;
+        auto gray = renderer.render_page(page, options);
+        ASSERT_RESULT_OK(gray);
+        QCOMPARE(gray.value()->format(), ImageFormat::Gray8);
+        QCOMPARE(gray.value()->stride(), width);
+        
+        // One bit per pixel, rows padded to whole bytes; a white page
+        // background dithers to all zero bits
+        options.image_format = ImageFormat::Mono1;
+        auto mono = renderer.render_page(page, options);
+        ASSERT_RESULT_OK(mono);
+        QCOMPARE(mono.value()->format(), ImageFormat::Mono1);
+        QCOMPARE(mono.value()->stride(), (width + 7) / 8);
+        QCOMPARE(mono.value()->size(), static_cast<size_t>((width + 7) / 8) * height);
+        QCOMPARE(mono.value()->data()[0], uint8_t(0));
+        
+        // Caller memory gets the same layout
+        std::vector<uint8_t> frame(mono.value()->size());
+        renderer.set_cache_enabled(false);
+        QVERIFY(renderer.render_page_to_buffer(page, frame.data(), frame.size(), options));
+        QVERIFY(frame == mono.value()->to_vector());
+    }
+    
+    void testConvertImage() {
+        auto doc = createTestDocument();
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        Renderer renderer;
+        RenderOptions options;
+        options.dpi = 40.0f;
+        auto rgb = renderer.render_page(doc->get_page(0), options);
+        ASSERT_RESULT_OK(rgb);
+        const ImageBuffer& image = *rgb.value();
+        
+        // Opaque conversions through every color format are lossless
+        for (ImageFormat format : { ImageFormat::BGR24, ImageFormat::RGBA32, ImageFormat::BGRA32 }) {
+            auto converted = image.convert(format, true);
+            QCOMPARE(converted->format(), format);
+            QCOMPARE(converted->is_premultiplied(), format != ImageFormat::BGR24);
+            auto back = converted->convert(ImageFormat::RGB24);
+            QVERIFY(back->to_vector() == image.to_vector());
+        }
+        
+        // Gray stays gray through RGB
+        auto gray = image.convert(ImageFormat::Gray8);
+        QCOMPARE(gray->stride(), image.width());
+        auto gray_again = gray->convert(ImageFormat::BGRA32)->convert(ImageFormat::Gray8);
+        QVERIFY(gray_again->to_vector() == gray->to_vector());
+        
+        auto mono = image.convert(ImageFormat::Mono1, false, Dithering::ErrorDiffusion);
+        QCOMPARE(mono->stride(), (image.width() + 7) / 8);
+        QVERIFY(mono->convert(ImageFormat::Mono1)->data() == mono->data());
+    }
+    
+    void testSaveImages() {
+        auto doc = createTestDocument(2);
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        Renderer renderer;
+        RenderOptions options;
+        options.dpi = 40.0f;
+        auto result = renderer.render_page(doc->get_page(0), options);
+        ASSERT_RESULT_OK(result);
+        const ImageBuffer& image = *result.value();
+        
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        auto path = [&dir](const char* name) {
+            return dir.filePath(name).toStdString();
+        };
+        auto head = [](const std::string& file, int n) {
+            QFile f(QString::fromStdString(file));
+            return f.open(QIODevice::ReadOnly) ? f.read(n) : QByteArray();
+        };
+        
+        QVERIFY(image.save_png(path("page.png")));
+        QCOMPARE(head(path("page.png"), 8), QByteArray("\x89PNG\r\n\x1a\n", 8));
+        
+        QVERIFY(image.save_bmp(path("page.bmp")));
+        QCOMPARE(head(path("page.bmp"), 2), QByteArray("BM"));
+        QCOMPARE(QFileInfo(QString::fromStdString(path("page.bmp"))).size(),
+                 qint64(54 + ((image.width() * 3 + 3) & ~3) * image.height()));
+        
+        TiffOptions tiled;
+        tiled.layout = TiffOptions::Layout::Tiles;
+        QVERIFY(image.save_tiff(path("page.tif")));
+        QVERIFY(image.convert(ImageFormat::Mono1)->save_tiff(path("mono.tif"), tiled));
+        QCOMPARE(head(path("page.tif"), 4), QByteArray("II*\0", 4));
+        
+        // JPEG depends on libjpeg being available at build time
+        if (image.save_jpeg(path("page.jpg"), 80)) {
+            QCOMPARE(head(path("page.jpg"), 2), QByteArray("\xFF\xD8", 2));
+        }
+        
+        // Pages are appended as they are rendered
+        TiffWriter writer;
+        QVERIFY(!writer.close());
+        QVERIFY(writer.open(path("document.tif")));
+        for (int i = 0; i < doc->page_count(); ++i) {
+            auto page = renderer.render_page(doc->get_page(i), options);
+            ASSERT_RESULT_OK(page);
+            QVERIFY(writer.add_page(*page.value(), options.dpi));
+        }
+        QCOMPARE(writer.page_count(), doc->page_count());
+        QVERIFY(writer.close());
+        QVERIFY(QFileInfo(QString::fromStdString(path("document.tif"))).size() >
+                QFileInfo(QString::fromStdString(path("page.tif"))).size());
+    }
+    
+    void testBandedRender() {
+        auto doc = createTestDocument();
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        Page* page = doc->get_page(0);
+        Renderer renderer;
+        RenderOptions options;
+        options.dpi = 60.0f;
+        
+        auto reference = renderer.render_page(page, options);
+        ASSERT_RESULT_OK(reference);
+        const ImageBuffer& image = *reference.value();
+        const size_t row_bytes = static_cast<size_t>(image.width()) * 3;
+        
+        // Bands arrive in order and put together make the whole page
+        std::vector<uint8_t> pixels;
+        int next_row = 0;
+        CallbackSink collect([&](const uint8_t* data, int stride, int y, int rows) {
+            if (y != next_row || rows > 17) return false;
+            for (int r = 0; r < rows; ++r) {
+                pixels.insert(pixels.end(), data + r * stride, data + r * stride + row_bytes);
+            }
+            next_row += rows;
+            return true;
+        });
+        QVERIFY(renderer.render_page_banded(page, collect, options, 17));
+        QCOMPARE(next_row, image.height());
+        for (int y = 0; y < image.height(); ++y) {
+            QVERIFY(std::memcmp(pixels.data() + y * row_bytes, image.data() + y * image.stride(), row_bytes) == 0);
+        }
+        
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const std::string png = dir.filePath("banded.png").toStdString();
+        const std::string tif = dir.filePath("banded.tif").toStdString();
+        
+        PngSink png_sink(png);
+        QVERIFY(renderer.render_page_banded(page, png_sink, options, 17));
+        QVERIFY(QFileInfo(QString::fromStdString(png)).size() > 0);
+        
+        TiffSink tiff_sink(tif);
+        QVERIFY(renderer.render_page_banded(page, tiff_sink, options, 17));
+        QVERIFY(QFileInfo(QString::fromStdString(tif)).size() > 0);
+        
+        // Stopping part way removes the partial file
+        const std::string stopped = dir.filePath("stopped.png").toStdString();
+        PngSink stopped_sink(stopped);
+        auto stop = [](int, int, const std::string&) { return false; };
+        QVERIFY(!renderer.render_page_banded(page, stopped_sink, options, 17, stop));
+        QVERIFY(!QFileInfo::exists(QString::fromStdString(stopped)));
+    }
+    
+    void testTilesMatchFullPage() {
+        auto doc = createTestDocument();
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        Page* page = doc->get_page(0);
+        RenderOptions options;
+        options.dpi = 100.0f;
+        
+        Renderer renderer;
+        renderer.set_thread_count(4);
+        auto full = renderer.render_page(page, options);
+        ASSERT_RESULT_OK(full);
+        
+        auto tiles = renderer.calculate_tiles(page, 128, 96, options);
+        QVERIFY(tiles.size() > 1);
+        
+        auto rendered = renderer.render_tiles(page, tiles, options);
+        QCOMPARE(rendered.size(), tiles.size());
+        
+        // Stitching the tiles back together gives the full page
+        const ImageBuffer& expected = *full.value();
+        for (size_t i = 0; i < tiles.size(); ++i) {
+            ASSERT_RESULT_OK(rendered[i]);
+            const ImageBuffer& tile = *rendered[i].value();
+            QCOMPARE(tile.width(), tiles[i].tile_width);
+            QCOMPARE(tile.height(), tiles[i].tile_height);
+            QVERIFY(tiles[i].pixel_x + tile.width() <= expected.width());
+            QVERIFY(tiles[i].pixel_y + tile.height() <= expected.height());
+            
+            for (int y = 0; y < tile.height(); ++y) {
+                const uint8_t* want = expected.data() +
+                    static_cast<size_t>(tiles[i].pixel_y + y) * expected.stride() +
+                    static_cast<size_t>(tiles[i].pixel_x) * 3;
+                QVERIFY(std::memcmp(tile.data() + static_cast<size_t>(y) * tile.stride(),
+                                    want, static_cast<size_t>(tile.width()) * 3) == 0);
+            }
+        }
+        
+        // A second pass is served from the tile cache
+        auto again = renderer.render_tile(page, tiles.back(), options);
+        ASSERT_RESULT_OK(again);
+        QVERIFY(again.value()->to_vector() == rendered.back().value()->to_vector());
+    }
+    
+    void testTilePyramid() {
+        auto doc = createTestDocument();
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const std::string directory = dir.path().toStdString();
+        
+        Renderer renderer;
+        RenderOptions options;
+        options.dpi = 144.0f;
+        TilePyramidOptions pyramid;
+        
+        int width = 0;
+        int height = 0;
+        Renderer::calculate_dimensions(doc->get_page(0), options.dpi, width, height);
+        int max_level = 0;
+        while ((1 << max_level) < std::max(width, height)) ++max_level;
+        
+        // Only the full-size level is rendered; the rest are reduced from it
+        auto first = renderer.export_tile_pyramid(doc.get(), {0}, directory, pyramid, options);
+        ASSERT_RESULT_OK(first);
+        const int full_tiles = ((width + 255) / 256) * ((height + 255) / 256);
+        QCOMPARE(first.value().pages, 1);
+        QCOMPARE(first.value().tiles_rendered, full_tiles);
+        QVERIFY(first.value().tiles_derived >= max_level);
+        QVERIFY(QFileInfo::exists(dir.filePath("page_1.dzi")));
+        QVERIFY(QFileInfo::exists(dir.filePath("page_1_files/0/0_0.png")));
+        QVERIFY(QFileInfo::exists(dir.filePath(QString("page_1_files/%1/0_0.png").arg(max_level))));
+        
+        // A second run finds every tile in place
+        auto second = renderer.export_tile_pyramid(doc.get(), {0}, directory, pyramid, options);
+        ASSERT_RESULT_OK(second);
+        QCOMPARE(second.value().tiles_rendered + second.value().tiles_derived, 0);
+        QCOMPARE(second.value().tiles_skipped, first.value().tiles_rendered + first.value().tiles_derived);
+        
+        // A lost tile is rendered again on its own
+        QVERIFY(QFile::remove(dir.filePath("page_1_files/0/0_0.png")));
+        auto resumed = renderer.export_tile_pyramid(doc.get(), {0}, directory, pyramid, options);
+        ASSERT_RESULT_OK(resumed);
+        QCOMPARE(resumed.value().tiles_rendered, 1);
+        QVERIFY(QFileInfo::exists(dir.filePath("page_1_files/0/0_0.png")));
+        
+        pyramid.layout = TilePyramidOptions::Layout::XYZ;
+        auto xyz = renderer.export_tile_pyramid(doc.get(), {0}, directory, pyramid, options);
+        ASSERT_RESULT_OK(xyz);
+        QVERIFY(QFileInfo::exists(dir.filePath("page_1/0/0/0.png")));
+    }
+    
+    void testClipRect() {
+        auto doc = createTestDocument();
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        Page* page = doc->get_page(0);
+        RenderOptions options;
+        options.dpi = 72.0f;
+        options.use_clip_rect = true;
+        options.clip_rect = Rect(10, 20, 110, 70);
+        
+        Renderer renderer;
+        auto clipped = renderer.render_page(page, options);
+        ASSERT_RESULT_OK(clipped);
+        QCOMPARE(clipped.value()->width(), 100);
+        QCOMPARE(clipped.value()->height(), 50);
+        
+        // A clip entirely off the page is an error, not an empty image
+        options.clip_rect = Rect(-200, -200, -100, -100);
+        ASSERT_RESULT_ERROR(renderer.render_page(page, options));
+    }
+    
+    void testProgressiveRender() {
+        auto doc = createTestDocument();
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        Page* page = doc->get_page(0);
+        RenderOptions options;
+        options.dpi = 96.0f;
+        
+        Renderer renderer;
+        renderer.set_cache_enabled(false);
+        auto expected = renderer.render_page(page, options);
+        ASSERT_RESULT_OK(expected);
+        
+        QVERIFY(renderer.start_progressive_render(page, options));
+        
+        int slices = 0;
+        while (renderer.continue_progressive_render()) {
+            QVERIFY(++slices < 1000);
+            
+            // Partial snapshots always have the final size
+            auto partial = renderer.get_progressive_buffer();
+            if (partial.is_ok()) {
+                QCOMPARE(partial.value()->width(), expected.value()->width());
+                QCOMPARE(partial.value()->height(), expected.value()->height());
+            }
+        }
+        
+        QCOMPARE(renderer.get_progressive_progress(), 100);
+        auto final_image = renderer.get_progressive_buffer();
+        ASSERT_RESULT_OK(final_image);
+        QVERIFY(final_image.value()->to_vector() == expected.value()->to_vector());
+    }
+    
+    void testProgressiveCancel() {
+        auto doc = createTestDocument();
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        Renderer renderer;
+        QVERIFY(!renderer.start_progressive_render(nullptr));
+        
+        QVERIFY(renderer.start_progressive_render(doc->get_page(0)));
+        renderer.cancel_progressive_render();
+        
+        QVERIFY(!renderer.continue_progressive_render());
+        ASSERT_RESULT_ERROR(renderer.get_progressive_buffer());
+    }
+    
+    void testThumbnails() {
+        auto doc = createTestDocument(5);
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        QTemporaryDir cacheDir;
+        QVERIFY(cacheDir.isValid());
+        
+        Renderer renderer;
+        renderer.set_thread_count(3);
+        renderer.set_thumbnail_cache_dir(cacheDir.path().toStdString());
+        QCOMPARE(renderer.get_thumbnail_cache_dir(), cacheDir.path().toStdString());
+        
+        auto thumbs = renderer.render_all_thumbnails(doc.get(), 64, 64);
+        QCOMPARE(thumbs.size(), size_t(5));
+        for (auto& thumb : thumbs) {
+            ASSERT_RESULT_OK(thumb);
+            QVERIFY(thumb.value()->width() <= 64);
+            QVERIFY(thumb.value()->height() <= 64);
+        }
+        
+        // Same size as the single-page path
+        auto single = renderer.render_thumbnail(doc->get_page(2), 64, 64);
+        ASSERT_RESULT_OK(single);
+        QCOMPARE(single.value()->width(), thumbs[2].value()->width());
+        QCOMPARE(single.value()->height(), thumbs[2].value()->height());
+        
+        // A fresh renderer is served from disk
+        QVERIFY(!QDir(cacheDir.path()).isEmpty());
+        Renderer reopened;
+        reopened.set_thumbnail_cache_dir(cacheDir.path().toStdString());
+        auto cached = reopened.render_all_thumbnails(doc.get(), 64, 64);
+        QCOMPARE(cached.size(), thumbs.size());
+        for (size_t i = 0; i < cached.size(); ++i) {
+            ASSERT_RESULT_OK(cached[i]);
+            QVERIFY(cached[i].value()->to_vector() == thumbs[i].value()->to_vector());
+        }
+        
+        // An entry claiming a size it cannot have is a miss
+        for (const QFileInfo& folder : QDir(cacheDir.path()).entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+            for (const QFileInfo& entry : QDir(folder.filePath()).entryInfoList(QDir::Files)) {
+                QFile file(entry.filePath());
+                QVERIFY(file.open(QIODevice::ReadWrite));
+                const int32_t huge = 1 << 30;
+                QVERIFY(file.seek(8));
+                QCOMPARE(file.write(reinterpret_cast<const char*>(&huge), sizeof(huge)), qint64(sizeof(huge)));
+            }
+        }
+        Renderer damaged;
+        damaged.set_thumbnail_cache_dir(cacheDir.path().toStdString());
+        auto rerendered = damaged.render_all_thumbnails(doc.get(), 64, 64);
+        QCOMPARE(rerendered.size(), thumbs.size());
+        for (size_t i = 0; i < rerendered.size(); ++i) {
+            ASSERT_RESULT_OK(rerendered[i]);
+            QVERIFY(rerendered[i].value()->to_vector() == thumbs[i].value()->to_vector());
+        }
+        
+        // Pages that moved are not served another page's entry
+        QVERIFY(doc->insert_page(0, 300, 200));
+        Renderer edited;
+        edited.set_thumbnail_cache_dir(cacheDir.path().toStdString());
+        auto moved = edited.render_all_thumbnails(doc.get(), 64, 64);
+        QCOMPARE(moved.size(), thumbs.size() + 1);
+        for (size_t i = 0; i < thumbs.size(); ++i) {
+            ASSERT_RESULT_OK(moved[i + 1]);
+            QVERIFY(moved[i + 1].value()->to_vector() == thumbs[i].value()->to_vector());
+        }
+    }
+    
+    void testRenderOnAnotherThread() {
+        auto doc = createTestDocument();
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        Page* page = doc->get_page(0);
+        Renderer renderer;
+        renderer.set_cache_enabled(false);
+        RenderOptions options;
+        options.dpi = 50.0f;
+        
+        auto reference = renderer.render_page(page, options);
+        ASSERT_RESULT_OK(reference);
+        
+        // The page was loaded on this thread; the other thread draws it with
+        // its own context sharing the library's resource store
+        std::vector<uint8_t> pixels;
+        std::thread worker([&] {
+            auto result = renderer.render_page(page, options);
+            if (result.is_ok()) {
+                pixels = result.value()->to_vector();
+            }
+        });
+        worker.join();
+        
+        QVERIFY(!pixels.empty());
+        QVERIFY(pixels == reference.value()->to_vector());
+    }
+    
+    void testAsyncRenderer() {
+        auto doc = createTestDocument(6);
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        RenderOptions options;
+        options.dpi = 36.0f;
+        
+        AsyncRenderer renderer(2);
+        auto prefetch = renderer.queue_batch(doc.get(), {2, 3, 4, 5}, options,
+                                             AsyncRenderer::Priority::Prefetch);
+        auto visible = renderer.queue_render(doc->get_page(0), options,
+                                             AsyncRenderer::Priority::Visible);
+        
+        // Same page and options share the render
+        auto first = renderer.queue_render(doc->get_page(1), options);
+        auto second = renderer.queue_render(doc->get_page(1), options);
+        
+        QVERIFY(visible->wait(10000));
+        QCOMPARE(visible->get_status(), RenderJob::Status::Completed);
+        QCOMPARE(visible->get_progress(), 1.0f);
+        
+        auto a = first->get_result();
+        auto b = second->get_result();
+        ASSERT_RESULT_OK(a);
+        ASSERT_RESULT_OK(b);
+        QVERIFY(a.value()->to_vector() == b.value()->to_vector());
+        
+        renderer.wait_all();
+        QCOMPARE(renderer.pending_count(), 0);
+        for (auto& job : prefetch) {
+            QCOMPARE(job->get_status(), RenderJob::Status::Completed);
+        }
+    }
+    
+    void testFingerprintDuringAsyncRender() {
+        auto doc = createTestDocument(6);
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        std::vector<Page*> pages = doc->get_pages();
+        std::vector<uint64_t> expected;
+        for (Page* page : pages) {
+            expected.push_back(page->content_fingerprint());
+        }
+        
+        RenderOptions options;
+        options.dpi = 36.0f;
+        
+        AsyncRenderer renderer(2);
+        auto jobs = renderer.queue_batch(doc.get(), {0, 1, 2, 3, 4, 5}, options);
+        
+        // Each damage forces a fresh hash, read from the document while
+        // the workers interpret its pages
+        bool stable = true;
+        std::thread hasher([&] {
+            for (int round = 0; round < 20; ++round) {
+                for (size_t i = 0; i < pages.size(); ++i) {
+                    pages[i]->add_damage(Page::Layer::Annotations);
+                    stable = stable && pages[i]->content_fingerprint() == expected[i];
+                }
+            }
+        });
+        hasher.join();
+        renderer.wait_all();
+        
+        QVERIFY(stable);
+        for (auto& job : jobs) {
+            QCOMPARE(job->get_status(), RenderJob::Status::Completed);
+            ASSERT_RESULT_OK(job->get_result());
+        }
+    }
+    
+    void testAsyncCancel() {
+        auto doc = createTestDocument(8);
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        RenderOptions options;
+        options.dpi = 72.0f;
+        
+        AsyncRenderer renderer(1);
+        
+        // Cancelling one of two shared jobs leaves the other running
+        auto kept = renderer.queue_render(doc->get_page(0), options);
+        auto dropped = renderer.queue_render(doc->get_page(0), options);
+        dropped->cancel();
+        QCOMPARE(dropped->get_status(), RenderJob::Status::Cancelled);
+        ASSERT_RESULT_ERROR(dropped->get_result());
+        ASSERT_RESULT_OK(kept->get_result());
+        
+        auto jobs = renderer.queue_batch(doc.get(), {1, 2, 3, 4, 5, 6, 7}, options);
+        renderer.cancel_all();
+        renderer.wait_all();
+        QCOMPARE(renderer.pending_count(), 0);
+        
+        for (auto& job : jobs) {
+            QVERIFY(job->wait(0));
+            QVERIFY(job->get_status() == RenderJob::Status::Cancelled ||
+                    job->get_status() == RenderJob::Status::Completed);
+        }
+    }
+    
+    void testThreadCount() {
+        Renderer renderer;
+        QVERIFY(renderer.get_thread_count() > 0);
+        
+        renderer.set_thread_count(3);
+        QCOMPARE(renderer.get_thread_count(), 3);
+    }
+    
+    void testParallelBatchMatchesSerial() {
+        auto doc = createTestDocument(8);
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        RenderOptions options;
+        options.dpi = 36.0f;
+        std::vector<int> indices = {7, 0, 3, 5, 1};
+        
+        Renderer serial;
+        serial.set_thread_count(1);
+        auto expected = serial.render_pages(doc.get(), indices, options);
+        
+        Renderer parallel;
+        parallel.set_thread_count(4);
+        auto actual = parallel.render_pages(doc.get(), indices, options);
+        
+        QCOMPARE(actual.size(), indices.size());
+        QCOMPARE(actual.size(), expected.size());
+        
+        for (size_t i = 0; i < actual.size(); ++i) {
+            ASSERT_RESULT_OK(actual[i]);
+            ASSERT_RESULT_OK(expected[i]);
+            QCOMPARE(actual[i].value()->width(), expected[i].value()->width());
+            QCOMPARE(actual[i].value()->height(), expected[i].value()->height());
+            QVERIFY(actual[i].value()->to_vector() == expected[i].value()->to_vector());
+        }
+    }
+    
+    void testDuplicatePagesRenderOnce() {
+        auto doc = createTestDocument(3);
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        Page* page = doc->get_page(2);
+        const uint64_t fingerprint = page->content_fingerprint();
+        QCOMPARE(page->content_fingerprint(), fingerprint);
+        
+        Renderer renderer;
+        renderer.set_thread_count(2);
+        RenderOptions options;
+        options.dpi = 36.0f;
+        
+        auto results = renderer.render_pages(doc.get(), {2, 0, 2}, options);
+        QCOMPARE(results.size(), size_t(3));
+        for (auto& result : results) {
+            ASSERT_RESULT_OK(result);
+        }
+        QVERIFY(results[2].value()->to_vector() == results[0].value()->to_vector());
+        
+        // A repeat shares the first render's pixels rather than its own
+        if (fingerprint != 0) {
+            const ImageBuffer& first = *results[0].value();
+            const ImageBuffer& repeat = *results[2].value();
+            QCOMPARE(repeat.data(), first.data());
+        }
+    }
+    
+    void testBatchCancel() {
+        auto doc = createTestDocument(10);
+        ASSERT_DOCUMENT_VALID(doc.get());
+        
+        Renderer renderer;
+        renderer.set_thread_count(4);
+        
+        RenderOptions options;
+        options.dpi = 36.0f;
+        
+        int calls = 0;
+        auto results = renderer.render_all_pages(doc.get(), options,
+            [&calls](int current, int, const std::string&) {
+                ++calls;
+                return current < 3;
+            });
+        
+        // Pages 0-2 were accepted, page 3 was refused
+        QCOMPARE(calls, 4);
+        QCOMPARE(results.size(), size_t(3));
+        for (auto& result : results) {
+            ASSERT_RESULT_OK(result);
+        }
+    }
+};
+
+QTEST_MAIN(TestRenderer)
+#include "test_renderer.moc"